@@ -6,7 +6,7 @@ import com.example.llamacppdemo.appContext
 import com.stephen.commonhelper.utils.debugLog
 import com.stephen.commonhelper.utils.errorLog
 import com.stephen.commonhelper.utils.infoLog
-import com.stephen.llamacppbridge.GgufFileReader
+import com.stephen.llamacppbridge.GgufModelIndex
 import com.stephen.llamacppbridge.LlamaCppBridge
 import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
@@ -19,6 +19,7 @@ import kotlin.coroutines.cancellation.CancellationException
 import kotlin.time.measureTime
 
 object LLManager {
+    private const val MODEL_INDEX_FILE = "models.idx"
     private val instance = LlamaCppBridge()
     private var modelInitJob: Job? = null
     private var responseGenerationJob: Job? = null
@@ -65,7 +66,7 @@ object LLManager {
                     var response = ""
                     val duration =
                         measureTime {
-                            instance.getResponseAsFlow(query).collect { piece ->
+                            instance.getResponseAsBatchedFlow(query).collect { piece ->
                                 response += piece
                                 withContext(Dispatchers.Main) {
                                     onPartialResponseGenerated(response)
@@ -103,8 +104,10 @@ object LLManager {
                         inputStream?.copyTo(outputStream)
                     }
                 }
-                val ggufFileReader = GgufFileReader()
-                ggufFileReader.load(File(appContext.filesDir, fileName).absolutePath)
+                // 复制完成后立即写入模型索引，之后列出模型时不再读取文件
+                GgufModelIndex(File(appContext.filesDir, MODEL_INDEX_FILE).absolutePath).use { index ->
+                    index.scan(listOf(File(appContext.filesDir, fileName).absolutePath))
+                }
                 withContext(Dispatchers.Main) {
                     onComplete(fileName)
                 }
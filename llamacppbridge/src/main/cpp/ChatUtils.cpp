@@ -0,0 +1,13 @@
+#include "ChatUtils.h"
+
+// applies the chat template to `messages[0, n)`, growing `buffer` when the output does not fit
+int
+applyChatTemplate(const char *tmpl, const llama_chat_message *messages, size_t n, bool addAssistant,
+                  std::vector<char> &buffer) {
+    int len = llama_chat_apply_template(tmpl, messages, n, addAssistant, buffer.data(), buffer.size());
+    if (len > (int) buffer.size()) {
+        buffer.resize(len);
+        len = llama_chat_apply_template(tmpl, messages, n, addAssistant, buffer.data(), buffer.size());
+    }
+    return len;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "llama.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief 将聊天模板应用到 `messages[0, n)`，输出不足以放入 `buffer` 时自动扩容。
+ *
+ * @param tmpl 聊天模板字符串。
+ * @param messages 消息数组。
+ * @param n 参与渲染的消息数量。
+ * @param addAssistant 是否在末尾追加助手回复的起始标记。
+ * @param buffer 输出缓冲区。
+ * @return int 渲染结果的长度，失败时返回负数。
+ */
+int applyChatTemplate(const char *tmpl, const llama_chat_message *messages, size_t n, bool addAssistant,
+                      std::vector<char> &buffer);
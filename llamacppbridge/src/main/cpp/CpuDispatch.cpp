@@ -0,0 +1,157 @@
+#include "CpuDispatch.h"
+#include "LLMLog.h"
+#include "ggml-backend.h"
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <cstring>
+#include <sys/auxv.h>
+
+// older NDK headers do not define every capability bit
+#ifndef HWCAP_ATOMICS
+#define HWCAP_ATOMICS (1 << 8)
+#endif
+#ifndef HWCAP_FPHP
+#define HWCAP_FPHP (1 << 9)
+#endif
+#ifndef HWCAP_ASIMDHP
+#define HWCAP_ASIMDHP (1 << 10)
+#endif
+#ifndef HWCAP_ASIMDRDM
+#define HWCAP_ASIMDRDM (1 << 12)
+#endif
+#ifndef HWCAP_ASIMDDP
+#define HWCAP_ASIMDDP (1 << 20)
+#endif
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1 << 22)
+#endif
+#ifndef HWCAP_ILRCPC
+#define HWCAP_ILRCPC (1 << 26)
+#endif
+#ifndef HWCAP_FLAGM
+#define HWCAP_FLAGM (1 << 27)
+#endif
+#ifndef HWCAP2_I8MM
+#define HWCAP2_I8MM (1 << 13)
+#endif
+
+namespace {
+
+// -march=armv8.2-a / armv8.4-a allow the compiler to use every feature that is mandatory at that
+// level, so a variant also requires the mandatory features it can actually emit code for:
+// LSE atomics and RDM (v8.1) for both levels, LDAPUR and flag manipulation (v8.4) for v8.4.
+// Optional extensions (AES/SHA crypto, DCPOP, ...) are not compiled in and are not required.
+constexpr uint64_t ARMV8_2 = HWCAP_ASIMD | HWCAP_ATOMICS | HWCAP_ASIMDRDM;
+constexpr uint64_t ARMV8_4 = ARMV8_2 | HWCAP_ILRCPC | HWCAP_FLAGM;
+// the extensions in the variant names: +fp16, +dotprod, +sve, +i8mm
+constexpr uint64_t FP16    = HWCAP_FPHP | HWCAP_ASIMDHP;
+constexpr uint64_t DOTPROD = HWCAP_ASIMDDP;
+constexpr uint64_t SVE     = HWCAP_SVE;
+constexpr uint64_t I8MM    = HWCAP2_I8MM;
+
+// CPU 后端变体，按优先级从高到低排列，与 CMakeLists.txt 中的 build_cpu_variant_arm64 一一对应
+struct CpuVariant {
+    const char *name;
+    uint64_t    hwcap;
+    uint64_t    hwcap2;
+};
+
+constexpr CpuVariant CPU_VARIANTS[] = {
+        {"v8_4_fp16_dotprod_i8mm_sve", ARMV8_4 | FP16 | DOTPROD | SVE, I8MM},
+        {"v8_4_fp16_dotprod_sve",      ARMV8_4 | FP16 | DOTPROD | SVE, 0},
+        {"v8_4_fp16_dotprod_i8mm",     ARMV8_4 | FP16 | DOTPROD,       I8MM},
+        {"v8_4_fp16_dotprod",          ARMV8_4 | FP16 | DOTPROD,       0},
+        {"v8_2_fp16_dotprod",          ARMV8_2 | FP16 | DOTPROD,       0},
+        {"v8_2_fp16",                  ARMV8_2 | FP16,                 0},
+        {"v8",                         0,                              0},
+};
+
+bool
+isSupported(const CpuVariant &variant, uint64_t hwcap, uint64_t hwcap2) {
+    return (hwcap & variant.hwcap) == variant.hwcap && (hwcap2 & variant.hwcap2) == variant.hwcap2;
+}
+
+} // namespace
+
+bool
+isCpuVariantSupported(const char *variant, uint64_t hwcap, uint64_t hwcap2) {
+    for (const CpuVariant &candidate: CPU_VARIANTS) {
+        if (strcmp(candidate.name, variant) == 0) {
+            return isSupported(candidate, hwcap, hwcap2);
+        }
+    }
+    return false;
+}
+
+#endif
+
+#if defined(GGML_BACKEND_DL) && defined(__aarch64__)
+
+namespace {
+
+const char *_cpuVariant = nullptr;
+
+void
+loadBestCpuVariant() {
+    const uint64_t hwcap  = getauxval(AT_HWCAP);
+    const uint64_t hwcap2 = getauxval(AT_HWCAP2);
+    LOGi("AT_HWCAP = 0x%llx, AT_HWCAP2 = 0x%llx", (unsigned long long) hwcap, (unsigned long long) hwcap2);
+    for (const CpuVariant &variant: CPU_VARIANTS) {
+        if (!isSupported(variant, hwcap, hwcap2)) {
+            continue;
+        }
+        // the bare file name is resolved by the dynamic linker in the app's native library directory
+        std::string library = std::string("libggml-cpu-") + variant.name + ".so";
+        if (ggml_backend_load(library.c_str()) != nullptr) {
+            LOGi("loaded CPU backend %s", library.c_str());
+            _cpuVariant = variant.name;
+            return;
+        }
+        LOGe("failed to load CPU backend %s, trying the next variant", library.c_str());
+    }
+    throw std::runtime_error("no CPU backend variant could be loaded");
+}
+
+// the backends ggml_backend_load_all() looks for, without "cpu": it would register a second CPU backend
+// next to the variant chosen above, possibly a different one than getCpuBackendVariant() reports
+constexpr const char *OTHER_BACKENDS[] = {"blas", "cann", "cuda", "hip", "metal", "rpc", "sycl", "vulkan", "opencl",
+                                          "hexagon", "musa"};
+
+void
+loadOtherBackends() {
+    for (const char *name: OTHER_BACKENDS) {
+        if (ggml_backend_load_best(name, true, nullptr) != nullptr) {
+            LOGi("loaded %s backend", name);
+        }
+    }
+}
+
+} // namespace
+
+#endif
+
+void
+loadCpuBackend() {
+    static std::once_flag loaded;
+    std::call_once(loaded, []() {
+#if defined(GGML_BACKEND_DL) && defined(__aarch64__)
+        loadBestCpuVariant();
+        loadOtherBackends();
+#else
+        ggml_backend_load_all();
+#endif
+    });
+}
+
+const char *
+getCpuBackendVariant() {
+#if defined(GGML_BACKEND_DL) && defined(__aarch64__)
+    return _cpuVariant != nullptr ? _cpuVariant : "";
+#else
+    return "static";
+#endif
+}
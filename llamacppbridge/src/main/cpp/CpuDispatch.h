@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief 加载 ggml 的 CPU 后端，多次调用只加载一次。
+ *
+ * arm64 的 Android 构建（定义了 GGML_BACKEND_DL）中，ggml-cpu 的量化与向量内核按指令集级别编译为
+ * 多个 `libggml-cpu-<variant>.so`，这里通过 getauxval(AT_HWCAP / AT_HWCAP2) 检测 CPU 特性，
+ * 加载设备支持的最高级别变体；其他构建中 CPU 后端已静态链接，只加载其余的动态后端。
+ *
+ * @throws std::runtime_error 没有可以加载的 CPU 后端变体时抛出。
+ */
+void loadCpuBackend();
+
+/**
+ * @brief 获取已加载的 CPU 后端变体名称（例如 "v8_2_fp16_dotprod"），CPU 后端为静态链接时返回 "static"。
+ */
+const char *getCpuBackendVariant();
+
+#if defined(__aarch64__) && defined(__linux__)
+/**
+ * @brief 判断 getauxval(AT_HWCAP / AT_HWCAP2) 返回的 CPU 特性是否满足 CPU 后端变体 `variant` 编译时启用的扩展。
+ *
+ * `loadCpuBackend` 按同一张表选择变体，宿主机的 dispatch_test 也用它跳过当前 CPU 无法运行的变体。
+ *
+ * @return 变体名称未知时返回 false。
+ */
+bool isCpuVariantSupported(const char *variant, uint64_t hwcap, uint64_t hwcap2);
+#endif
@@ -0,0 +1,131 @@
+#include "EmbeddingContext.h"
+#include "LLMLog.h"
+#include "common.h"
+#include <algorithm>
+#include <stdexcept>
+
+EmbeddingContext::EmbeddingContext(llama_model *model, const EmbeddingParams &params, ThreadPlacement &threads)
+    : _model(model) {
+    if (params.nBatch <= 0 || params.nSeqMax <= 0) {
+        throw std::runtime_error("EmbeddingContext: nBatch and nSeqMax must be positive");
+    }
+    if (params.poolingType == LLAMA_POOLING_TYPE_NONE || params.poolingType == LLAMA_POOLING_TYPE_RANK) {
+        throw std::runtime_error("EmbeddingContext: the pooling type must produce one vector per text");
+    }
+    llama_context_params ctx_params = llama_context_default_params();
+    // pooling needs every sequence inside a single ubatch
+    ctx_params.n_ctx = params.nBatch;
+    ctx_params.n_batch = params.nBatch;
+    ctx_params.n_ubatch = params.nBatch;
+    ctx_params.n_seq_max = params.nSeqMax;
+    // the packed sequences share the cells instead of getting n_ctx / n_seq_max each
+    ctx_params.kv_unified = true;
+    ctx_params.embeddings = true;
+    ctx_params.pooling_type = (enum llama_pooling_type) params.poolingType;
+    ctx_params.n_threads = threads.nThreads();
+    ctx_params.n_threads_batch = threads.nThreadsBatch();
+    ctx_params.no_perf = true;
+    _ctx = llama_init_from_model(model, ctx_params);
+    if (!_ctx) {
+        throw std::runtime_error("llama_init_from_model() returned null for the embedding context");
+    }
+    // the destructor does not run for a partly constructed object
+    try {
+        const enum llama_pooling_type pooling = llama_pooling_type(_ctx);
+        if (pooling == LLAMA_POOLING_TYPE_NONE || pooling == LLAMA_POOLING_TYPE_RANK) {
+            throw std::runtime_error("EmbeddingContext: the model does not define a pooling type, set one explicitly");
+        }
+        threads.attach(_ctx);
+
+        _nEmbd = llama_model_n_embd(model);
+        _nBatch = (int) llama_n_batch(_ctx);
+        _nSeqMax = (int) llama_n_seq_max(_ctx);
+        _useEncode = llama_model_has_encoder(model) && !llama_model_has_decoder(model);
+        _batch = llama_batch_init(_nBatch, 0, 1);
+        _tokens.resize(std::min(_nBatch, 512));
+        _rows.reserve(_nSeqMax);
+    } catch (...) {
+        llama_batch_free(_batch);
+        llama_free(_ctx);
+        throw;
+    }
+    LOGi("embedding context: %d dims, pooling %d, %d tokens x %d sequences per batch", _nEmbd,
+         (int) llama_pooling_type(_ctx), _nBatch, _nSeqMax);
+}
+
+void
+EmbeddingContext::embed(const std::vector<std::string> &texts, bool normalize, float *out) {
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    _rows.clear();
+    _batch.n_tokens = 0;
+    for (size_t i = 0; i < texts.size(); i++) {
+        const std::string &text = texts[i];
+        int32_t nTokens = llama_tokenize(vocab, text.data(), (int32_t) text.size(), _tokens.data(),
+                                         (int32_t) _tokens.size(), true, false);
+        if (nTokens < 0) {
+            _tokens.resize(-nTokens);
+            nTokens = llama_tokenize(vocab, text.data(), (int32_t) text.size(), _tokens.data(),
+                                     (int32_t) _tokens.size(), true, false);
+        }
+        if (nTokens <= 0) {
+            // nothing to pool, e.g. an empty text with a vocabulary that adds no BOS
+            std::fill(out + i * _nEmbd, out + (i + 1) * _nEmbd, 0.0f);
+            continue;
+        }
+        if (nTokens > _nBatch) {
+            LOGi("embedding input %zu truncated from %d to %d tokens", i, nTokens, _nBatch);
+            nTokens = _nBatch;
+        }
+        if ((int) _rows.size() == _nSeqMax || _batch.n_tokens + nTokens > _nBatch) {
+            _flush(normalize, out);
+        }
+        const auto seqId = (llama_seq_id) _rows.size();
+        // each text is its own sequence, starting at position 0
+        for (int32_t j = 0; j < nTokens; j++) {
+            const int32_t n = _batch.n_tokens++;
+            _batch.token[n] = _tokens[j];
+            _batch.pos[n] = j;
+            _batch.n_seq_id[n] = 1;
+            _batch.seq_id[n][0] = seqId;
+            _batch.logits[n] = true;
+        }
+        _rows.push_back(i);
+    }
+    if (!_rows.empty()) {
+        _flush(normalize, out);
+    }
+}
+
+void
+EmbeddingContext::_flush(bool normalize, float *out) {
+    // the sequences of the previous batch must not be attended to
+    llama_memory_t memory = llama_get_memory(_ctx);
+    if (memory) {
+        llama_memory_clear(memory, true);
+    }
+    const int32_t result = _useEncode ? llama_encode(_ctx, _batch) : llama_decode(_ctx, _batch);
+    _batch.n_tokens = 0;
+    if (result != 0) {
+        _rows.clear();
+        throw std::runtime_error(_useEncode ? "llama_encode() failed" : "llama_decode() failed");
+    }
+    for (size_t s = 0; s < _rows.size(); s++) {
+        const float *embedding = llama_get_embeddings_seq(_ctx, (llama_seq_id) s);
+        if (!embedding) {
+            _rows.clear();
+            throw std::runtime_error("llama_get_embeddings_seq() returned null");
+        }
+        float *row = out + _rows[s] * _nEmbd;
+        if (normalize) {
+            common_embd_normalize(embedding, row, _nEmbd, 2);
+        } else {
+            std::copy(embedding, embedding + _nEmbd, row);
+        }
+    }
+    _rows.clear();
+}
+
+EmbeddingContext::~EmbeddingContext() {
+    llama_batch_free(_batch);
+    llama_free(_ctx);
+}
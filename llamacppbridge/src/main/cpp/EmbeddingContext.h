@@ -0,0 +1,77 @@
+#pragma once
+#include "ThreadPlacement.h"
+#include "llama.h"
+#include <string>
+#include <vector>
+
+/**
+ * @struct EmbeddingParams
+ * @brief 嵌入上下文的参数。
+ */
+struct EmbeddingParams {
+    /// 池化方式，取值见 llama_pooling_type，LLAMA_POOLING_TYPE_UNSPECIFIED 表示使用模型元数据中的设置；
+    /// 必须产生每条文本一个向量（MEAN、CLS 或 LAST）
+    int poolingType = LLAMA_POOLING_TYPE_UNSPECIFIED;
+    /// 一次 llama_decode 处理的最大 token 数，也是单条文本的最大长度（更长的文本被截断）
+    int nBatch = 2048;
+    /// 一次 llama_decode 打包的最大文本数
+    int nSeqMax = 64;
+};
+
+/**
+ * @class EmbeddingContext
+ * @brief 在已加载的模型上创建 `embeddings = true` 的独立上下文，批量计算文本嵌入。
+ *
+ * 多条短文本作为不同的序列打包进同一个 llama_batch，一次 llama_decode（编码器模型为 llama_encode）
+ * 得到每个序列池化后的向量，避免逐条解码的调用开销。与生成用的上下文共享模型权重和线程池，互不影响 KV 缓存。
+ */
+class EmbeddingContext {
+    const llama_model *_model;
+    llama_context *_ctx = nullptr;
+    /// 复用的多序列批处理结构
+    llama_batch _batch{};
+    /// 当前文本的 token，按出现过的最长文本复用
+    std::vector<llama_token> _tokens;
+    /// `_batch` 中每个序列对应的输出行（输入文本的下标）
+    std::vector<size_t> _rows;
+    int _nEmbd = 0;
+    int _nBatch = 0;
+    int _nSeqMax = 0;
+    /// 编码器模型（如 BERT）使用 llama_encode，解码器模型使用 llama_decode
+    bool _useEncode = false;
+
+    /**
+     * @brief 计算 `_batch` 中各序列的嵌入，按 `_rows` 写入 `out` 的对应行，然后清空批处理结构。
+     */
+    void _flush(bool normalize, float *out);
+
+public:
+    /**
+     * @brief 在 `model` 上创建嵌入上下文。
+     *
+     * @param threads 生成上下文使用的线程设置，嵌入上下文使用相同的线程数和线程池。
+     * @throws std::runtime_error 参数无效、池化方式不产生逐条文本的向量或创建上下文失败时抛出。
+     */
+    EmbeddingContext(llama_model *model, const EmbeddingParams &params, ThreadPlacement &threads);
+
+    EmbeddingContext(const EmbeddingContext &) = delete;
+    EmbeddingContext &operator=(const EmbeddingContext &) = delete;
+
+    /**
+     * @brief 嵌入向量的维度。
+     */
+    int size() const { return _nEmbd; }
+
+    /**
+     * @brief 计算多条文本的嵌入。
+     *
+     * @param texts 输入文本（UTF-8）。
+     * @param normalize 是否对每个向量做 L2 归一化（用于余弦相似度）。
+     * @param out 输出缓冲区，至少 texts.size() * size() 个 float，第 i 行是第 i 条文本的向量
+     *            （没有任何 token 的文本为全零向量）。
+     * @throws std::runtime_error 编码失败时抛出。
+     */
+    void embed(const std::vector<std::string> &texts, bool normalize, float *out);
+
+    ~EmbeddingContext();
+};
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// 64 位 FNV-1a 的初始值
+constexpr uint64_t FNV1A_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+
+/**
+ * @brief 把 `size` 个字节累加到 64 位 FNV-1a 哈希 `hash` 中。
+ *
+ * 结果与平台无关（std::hash 在 32 位的 armeabi-v7a 上只有 32 位），可用作缓存键或写入文件。
+ */
+inline uint64_t
+fnv1a(uint64_t hash, const void *data, size_t size) {
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
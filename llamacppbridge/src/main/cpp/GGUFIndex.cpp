@@ -0,0 +1,161 @@
+#include "GGUFIndex.h"
+#include "GGUFMetadata.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+// bump when the line format changes, older index files are then discarded
+constexpr const char *INDEX_HEADER = "gguf-index 1";
+
+// fields are tab-separated, so paths and names containing tabs or newlines are never stored
+bool
+isStorable(const std::string &value) {
+    return value.find_first_of("\t\n") == std::string::npos;
+}
+
+bool
+parseLine(const std::string &line, GGUFIndexEntry &entry) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        const size_t end = line.find('\t', start);
+        fields.push_back(line.substr(start, end - start));
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    if (fields.size() != 8) {
+        return false;
+    }
+    entry.path = fields[0];
+    entry.mtimeNs = strtoll(fields[1].c_str(), nullptr, 10);
+    entry.fileSize = strtoll(fields[2].c_str(), nullptr, 10);
+    entry.architecture = fields[3];
+    entry.contextLength = strtoll(fields[4].c_str(), nullptr, 10);
+    entry.quantType = fields[5];
+    entry.parameterCount = strtoull(fields[6].c_str(), nullptr, 10);
+    entry.chatTemplateHash = strtoull(fields[7].c_str(), nullptr, 16);
+    return !entry.path.empty();
+}
+
+} // namespace
+
+GGUFIndex::GGUFIndex(std::string indexPath) : _indexPath(std::move(indexPath)) {
+    _load();
+}
+
+void
+GGUFIndex::_load() {
+    std::ifstream file(_indexPath);
+    std::string line;
+    // a missing index or one written by another version is rebuilt from the model files
+    if (!std::getline(file, line) || line != INDEX_HEADER) {
+        return;
+    }
+    while (std::getline(file, line)) {
+        GGUFIndexEntry entry;
+        if (parseLine(line, entry)) {
+            _entries[entry.path] = std::move(entry);
+        }
+    }
+}
+
+GGUFIndexEntry
+GGUFIndex::lookup(const std::string &path) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    struct stat st {};
+    if (stat(path.c_str(), &st) != 0) {
+        const int error = errno;
+        _dirty |= _entries.erase(path) > 0;
+        throw std::system_error(error, std::generic_category(), "failed to stat " + path);
+    }
+    const int64_t mtimeNs = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    auto it = _entries.find(path);
+    if (it != _entries.end() && it->second.mtimeNs == mtimeNs && it->second.fileSize == (int64_t) st.st_size) {
+        return it->second;
+    }
+
+    std::unique_ptr<GGUFMetadata> metadata;
+    try {
+        metadata = GGUFMetadata::open(path.c_str());
+    } catch (...) {
+        _dirty |= _entries.erase(path) > 0;
+        throw;
+    }
+    GGUFIndexEntry entry;
+    entry.path = path;
+    entry.mtimeNs = metadata->mtimeNs();
+    entry.fileSize = (int64_t) metadata->fileSize();
+    entry.architecture = metadata->getString("general.architecture").value_or("");
+    if (!entry.architecture.empty()) {
+        entry.contextLength = metadata->getInt(entry.architecture + ".context_length").value_or(-1);
+    }
+    entry.quantType = metadata->quantType();
+    entry.parameterCount = metadata->parameterCount();
+    entry.chatTemplateHash = metadata->getStringHash("tokenizer.chat_template").value_or(0);
+    if (isStorable(entry.path) && isStorable(entry.architecture) && isStorable(entry.quantType)) {
+        _entries[path] = entry;
+        _dirty = true;
+    }
+    return entry;
+}
+
+std::vector<GGUFIndexEntry>
+GGUFIndex::entries() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<GGUFIndexEntry> entries;
+    entries.reserve(_entries.size());
+    for (const auto &[path, entry]: _entries) {
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const GGUFIndexEntry &a, const GGUFIndexEntry &b) { return a.path < b.path; });
+    return entries;
+}
+
+void
+GGUFIndex::remove(const std::string &path) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _dirty |= _entries.erase(path) > 0;
+}
+
+void
+GGUFIndex::save() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_dirty) {
+        return;
+    }
+    const std::string tmpPath = _indexPath + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "we");
+    if (file == nullptr) {
+        throw std::system_error(errno, std::generic_category(), "failed to create " + tmpPath);
+    }
+    fprintf(file, "%s\n", INDEX_HEADER);
+    for (const auto &[path, entry]: _entries) {
+        fprintf(file, "%s\t%" PRId64 "\t%" PRId64 "\t%s\t%" PRId64 "\t%s\t%" PRIu64 "\t%016" PRIx64 "\n",
+                entry.path.c_str(), entry.mtimeNs, entry.fileSize, entry.architecture.c_str(), entry.contextLength,
+                entry.quantType.c_str(), entry.parameterCount, entry.chatTemplateHash);
+    }
+    const bool failed = ferror(file) != 0;
+    if (fclose(file) != 0 || failed) {
+        const int error = errno;
+        unlink(tmpPath.c_str());
+        throw std::system_error(error, std::generic_category(), "failed to write " + tmpPath);
+    }
+    if (rename(tmpPath.c_str(), _indexPath.c_str()) != 0) {
+        const int error = errno;
+        unlink(tmpPath.c_str());
+        throw std::system_error(error, std::generic_category(), "failed to replace " + _indexPath);
+    }
+    _dirty = false;
+}
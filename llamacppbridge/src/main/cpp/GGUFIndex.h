@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @struct GGUFIndexEntry
+ * @brief 模型索引中一个 GGUF 文件的摘要。
+ */
+struct GGUFIndexEntry {
+    /// 文件路径
+    std::string path;
+    /// 文件的修改时间（纳秒），与文件大小一起判断索引是否过期
+    int64_t mtimeNs = 0;
+    /// 文件大小（字节）
+    int64_t fileSize = 0;
+    /// 模型架构（general.architecture）
+    std::string architecture;
+    /// 训练时的上下文长度，未知时为 -1
+    int64_t contextLength = -1;
+    /// 量化类型名称，参见 GGUFMetadata::quantType
+    std::string quantType;
+    /// 参数量
+    uint64_t parameterCount = 0;
+    /// 聊天模板的 64 位 FNV-1a 哈希，没有聊天模板时为 0
+    uint64_t chatTemplateHash = 0;
+};
+
+/**
+ * @class GGUFIndex
+ * @brief 持久化在磁盘上的 GGUF 模型索引。
+ *
+ * 以文本文件保存每个模型的 GGUFIndexEntry，查询时只 stat 文件：修改时间和大小未变化时直接返回索引中的摘要，
+ * 否则用 GGUFMetadata 重新解析文件头。这样模型列表只需在模型文件第一次出现或被替换时读取一次文件头。
+ */
+class GGUFIndex {
+    /// 索引文件路径
+    std::string _indexPath;
+    /// 按模型路径索引的摘要
+    std::unordered_map<std::string, GGUFIndexEntry> _entries;
+    /// 内容是否有尚未写回索引文件的修改
+    bool _dirty = false;
+    std::mutex _mutex;
+
+    void _load();
+
+public:
+    /**
+     * @brief 读取索引文件，文件不存在或格式不兼容时从空索引开始。
+     */
+    explicit GGUFIndex(std::string indexPath);
+
+    /**
+     * @brief 获取模型文件的摘要，索引过期或没有记录时解析文件头并更新索引。
+     *
+     * @throws std::system_error 文件无法访问时抛出（同时从索引中移除该文件）。
+     * @throws std::runtime_error 文件不是有效的 GGUF 文件时抛出。
+     */
+    GGUFIndexEntry lookup(const std::string &path);
+
+    /**
+     * @brief 返回索引中记录的所有摘要（按路径排序），不访问任何模型文件。
+     */
+    std::vector<GGUFIndexEntry> entries();
+
+    /**
+     * @brief 从索引中移除一个模型文件。
+     */
+    void remove(const std::string &path);
+
+    /**
+     * @brief 若索引有修改，先写入临时文件再原子地替换索引文件。
+     *
+     * @throws std::system_error 写入失败时抛出。
+     */
+    void save();
+};
@@ -0,0 +1,425 @@
+#include "GGUFMetadata.h"
+#include "Fnv1a.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+
+constexpr uint32_t GGUF_MAGIC = 0x46554747; // "GGUF"
+// the first mapping covers the fixed header and, for most models, every key but the tokenizer arrays
+constexpr size_t INITIAL_MAP_SIZE = 1024 * 1024;
+// ggml tensors have at most GGML_MAX_DIMS dimensions
+constexpr uint32_t MAX_DIMS = 4;
+
+size_t
+scalarSize(GGUFMetadata::Type type) {
+    switch (type) {
+        case GGUFMetadata::TYPE_UINT8:
+        case GGUFMetadata::TYPE_INT8:
+        case GGUFMetadata::TYPE_BOOL:
+            return 1;
+        case GGUFMetadata::TYPE_UINT16:
+        case GGUFMetadata::TYPE_INT16:
+            return 2;
+        case GGUFMetadata::TYPE_UINT32:
+        case GGUFMetadata::TYPE_INT32:
+        case GGUFMetadata::TYPE_FLOAT32:
+            return 4;
+        case GGUFMetadata::TYPE_UINT64:
+        case GGUFMetadata::TYPE_INT64:
+        case GGUFMetadata::TYPE_FLOAT64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// llama_ftype -> name, as printed by llama_model_ftype_name()
+const char *
+fileTypeName(int64_t fileType) {
+    switch (fileType) {
+        case 0: return "F32";
+        case 1: return "F16";
+        case 2: return "Q4_0";
+        case 3: return "Q4_1";
+        case 7: return "Q8_0";
+        case 8: return "Q5_0";
+        case 9: return "Q5_1";
+        case 10: return "Q2_K";
+        case 11: return "Q3_K_S";
+        case 12: return "Q3_K_M";
+        case 13: return "Q3_K_L";
+        case 14: return "Q4_K_S";
+        case 15: return "Q4_K_M";
+        case 16: return "Q5_K_S";
+        case 17: return "Q5_K_M";
+        case 18: return "Q6_K";
+        case 19: return "IQ2_XXS";
+        case 20: return "IQ2_XS";
+        case 21: return "Q2_K_S";
+        case 22: return "IQ3_XS";
+        case 23: return "IQ3_XXS";
+        case 24: return "IQ1_S";
+        case 25: return "IQ4_NL";
+        case 26: return "IQ3_S";
+        case 27: return "IQ3_M";
+        case 28: return "IQ2_S";
+        case 29: return "IQ2_M";
+        case 30: return "IQ4_XS";
+        case 31: return "IQ1_M";
+        case 32: return "BF16";
+        case 36: return "TQ1_0";
+        case 37: return "TQ2_0";
+        case 38: return "MXFP4_MOE";
+        default: return nullptr;
+    }
+}
+
+// ggml_type -> name, as returned by ggml_type_name()
+const char *
+tensorTypeName(int64_t tensorType) {
+    switch (tensorType) {
+        case 0: return "f32";
+        case 1: return "f16";
+        case 2: return "q4_0";
+        case 3: return "q4_1";
+        case 6: return "q5_0";
+        case 7: return "q5_1";
+        case 8: return "q8_0";
+        case 9: return "q8_1";
+        case 10: return "q2_K";
+        case 11: return "q3_K";
+        case 12: return "q4_K";
+        case 13: return "q5_K";
+        case 14: return "q6_K";
+        case 15: return "q8_K";
+        case 16: return "iq2_xxs";
+        case 17: return "iq2_xs";
+        case 18: return "iq3_xxs";
+        case 19: return "iq1_s";
+        case 20: return "iq4_nl";
+        case 21: return "iq3_s";
+        case 22: return "iq2_s";
+        case 23: return "iq4_xs";
+        case 24: return "i8";
+        case 25: return "i16";
+        case 26: return "i32";
+        case 27: return "i64";
+        case 28: return "f64";
+        case 29: return "iq1_m";
+        case 30: return "bf16";
+        case 34: return "tq1_0";
+        case 35: return "tq2_0";
+        case 39: return "mxfp4";
+        default: return nullptr;
+    }
+}
+
+} // namespace
+
+std::unique_ptr<GGUFMetadata>
+GGUFMetadata::open(const char *path) {
+    std::unique_ptr<GGUFMetadata> metadata(new GGUFMetadata());
+    metadata->_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (metadata->_fd < 0) {
+        throw std::system_error(errno, std::generic_category(), std::string("failed to open ") + path);
+    }
+    struct stat st {};
+    if (fstat(metadata->_fd, &st) != 0) {
+        throw std::system_error(errno, std::generic_category(), std::string("failed to stat ") + path);
+    }
+    metadata->_fileSize = (uint64_t) st.st_size;
+    metadata->_mtimeNs = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    uint64_t offset = 0;
+    if (metadata->_read<uint32_t>(offset) != GGUF_MAGIC) {
+        throw std::runtime_error(std::string("not a GGUF file: ") + path);
+    }
+    // version 1 used 32-bit counts and is rejected by llama.cpp as well
+    const uint32_t version = metadata->_read<uint32_t>(offset);
+    if (version < 2 || version > 3) {
+        throw std::runtime_error("unsupported GGUF version " + std::to_string(version));
+    }
+    metadata->_nTensors = metadata->_read<uint64_t>(offset);
+    metadata->_nKv = metadata->_read<uint64_t>(offset);
+    metadata->_kvNextOffset = offset;
+    return metadata;
+}
+
+GGUFMetadata::~GGUFMetadata() {
+    if (_mapped != nullptr) {
+        munmap(const_cast<uint8_t *>(_mapped), _mappedSize);
+    }
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+const uint8_t *
+GGUFMetadata::_at(uint64_t offset, uint64_t size) {
+    if (offset > _fileSize || size > _fileSize - offset) {
+        throw std::runtime_error("truncated GGUF file");
+    }
+    const uint64_t end = offset + size;
+    if (end > _mappedSize) {
+        // grow geometrically so that walking a large tokenizer array remaps only a few times
+        uint64_t newSize = std::max<uint64_t>({end, (uint64_t) _mappedSize * 2, INITIAL_MAP_SIZE});
+        newSize = std::min(newSize, _fileSize);
+        if (newSize > std::numeric_limits<size_t>::max()) {
+            throw std::runtime_error("GGUF header too large to map");
+        }
+        void *mapped = mmap(nullptr, (size_t) newSize, PROT_READ, MAP_SHARED, _fd, 0);
+        if (mapped == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "failed to map the GGUF header");
+        }
+        if (_mapped != nullptr) {
+            munmap(const_cast<uint8_t *>(_mapped), _mappedSize);
+        }
+        _mapped = static_cast<const uint8_t *>(mapped);
+        _mappedSize = (size_t) newSize;
+    }
+    return _mapped + offset;
+}
+
+template<typename T>
+T
+GGUFMetadata::_read(uint64_t &offset) {
+    T value;
+    memcpy(&value, _at(offset, sizeof(T)), sizeof(T));
+    offset += sizeof(T);
+    return value;
+}
+
+void
+GGUFMetadata::_skipValue(Type type, uint64_t &offset) {
+    if (type == TYPE_STRING) {
+        const auto length = _read<uint64_t>(offset);
+        _at(offset, length);
+        offset += length;
+        return;
+    }
+    if (type == TYPE_ARRAY) {
+        const auto elementType = (Type) _read<uint32_t>(offset);
+        const auto count = _read<uint64_t>(offset);
+        if (elementType == TYPE_STRING) {
+            for (uint64_t i = 0; i < count; i++) {
+                _skipValue(TYPE_STRING, offset);
+            }
+            return;
+        }
+        const size_t elementSize = scalarSize(elementType);
+        if (elementSize == 0) {
+            throw std::runtime_error("unsupported GGUF array element type " + std::to_string(elementType));
+        }
+        if (count > _fileSize / elementSize) {
+            throw std::runtime_error("truncated GGUF file");
+        }
+        // only the bounds are checked, the elements themselves are never touched
+        _at(offset, count * elementSize);
+        offset += count * elementSize;
+        return;
+    }
+    const size_t size = scalarSize(type);
+    if (size == 0) {
+        throw std::runtime_error("unsupported GGUF value type " + std::to_string(type));
+    }
+    _at(offset, size);
+    offset += size;
+}
+
+const GGUFMetadata::KvEntry *
+GGUFMetadata::_scanNextKv() {
+    if (_kvsScanned) {
+        return nullptr;
+    }
+    if (_kvs.size() == _nKv) {
+        _tensorInfoStart = _kvNextOffset;
+        _kvsScanned = true;
+        return nullptr;
+    }
+    if (_kvs.empty()) {
+        _kvs.reserve((size_t) std::min<uint64_t>(_nKv, 4096));
+    }
+    uint64_t offset = _kvNextOffset;
+    KvEntry entry{};
+    entry.keyLength = _read<uint64_t>(offset);
+    entry.keyOffset = offset;
+    _at(offset, entry.keyLength);
+    offset += entry.keyLength;
+    entry.type = (Type) _read<uint32_t>(offset);
+    entry.valueOffset = offset;
+    _skipValue(entry.type, offset);
+    _kvNextOffset = offset;
+    _kvs.push_back(entry);
+    return &_kvs.back();
+}
+
+void
+GGUFMetadata::_scanKvs() {
+    while (_scanNextKv() != nullptr) {
+    }
+}
+
+void
+GGUFMetadata::_scanTensors() {
+    if (_tensorsScanned) {
+        return;
+    }
+    _scanKvs();
+    std::unordered_map<uint32_t, uint64_t> elementsPerType;
+    uint64_t offset = _tensorInfoStart;
+    for (uint64_t i = 0; i < _nTensors; i++) {
+        // name, n_dims, dims[n_dims], type, data offset
+        _skipValue(TYPE_STRING, offset);
+        const auto nDims = _read<uint32_t>(offset);
+        if (nDims > MAX_DIMS) {
+            throw std::runtime_error("invalid number of tensor dimensions " + std::to_string(nDims));
+        }
+        uint64_t elements = 1;
+        for (uint32_t d = 0; d < nDims; d++) {
+            elements *= _read<uint64_t>(offset);
+        }
+        const auto type = _read<uint32_t>(offset);
+        offset += sizeof(uint64_t);
+        _parameterCount += elements;
+        elementsPerType[type] += elements;
+    }
+    uint64_t maxElements = 0;
+    for (const auto &[type, elements]: elementsPerType) {
+        if (elements > maxElements) {
+            maxElements = elements;
+            _dominantTensorType = type;
+        }
+    }
+    _tensorsScanned = true;
+}
+
+const GGUFMetadata::KvEntry *
+GGUFMetadata::_find(std::string_view key) {
+    auto matches = [&](const KvEntry &entry) {
+        return entry.keyLength == key.size() &&
+               memcmp(_at(entry.keyOffset, entry.keyLength), key.data(), key.size()) == 0;
+    };
+    for (const KvEntry &entry: _kvs) {
+        if (matches(entry)) {
+            return &entry;
+        }
+    }
+    // the tokenizer arrays after the key are only walked if a later lookup needs them
+    while (const KvEntry *entry = _scanNextKv()) {
+        if (matches(*entry)) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+std::optional<GGUFMetadata::Type>
+GGUFMetadata::getType(std::string_view key) {
+    const KvEntry *entry = _find(key);
+    if (entry == nullptr) {
+        return std::nullopt;
+    }
+    return entry->type;
+}
+
+std::optional<int64_t>
+GGUFMetadata::getInt(std::string_view key) {
+    const KvEntry *entry = _find(key);
+    if (entry == nullptr) {
+        return std::nullopt;
+    }
+    uint64_t offset = entry->valueOffset;
+    switch (entry->type) {
+        case TYPE_UINT8: return _read<uint8_t>(offset);
+        case TYPE_INT8: return _read<int8_t>(offset);
+        case TYPE_UINT16: return _read<uint16_t>(offset);
+        case TYPE_INT16: return _read<int16_t>(offset);
+        case TYPE_UINT32: return _read<uint32_t>(offset);
+        case TYPE_INT32: return _read<int32_t>(offset);
+        case TYPE_INT64: return _read<int64_t>(offset);
+        case TYPE_BOOL: return _read<uint8_t>(offset) != 0;
+        case TYPE_UINT64: {
+            const auto value = _read<uint64_t>(offset);
+            if (value > (uint64_t) std::numeric_limits<int64_t>::max()) {
+                return std::nullopt;
+            }
+            return (int64_t) value;
+        }
+        default:
+            return std::nullopt;
+    }
+}
+
+std::optional<double>
+GGUFMetadata::getFloat(std::string_view key) {
+    const KvEntry *entry = _find(key);
+    if (entry == nullptr) {
+        return std::nullopt;
+    }
+    uint64_t offset = entry->valueOffset;
+    switch (entry->type) {
+        case TYPE_FLOAT32: return _read<float>(offset);
+        case TYPE_FLOAT64: return _read<double>(offset);
+        case TYPE_UINT64: return (double) _read<uint64_t>(offset);
+        default: {
+            const std::optional<int64_t> value = getInt(key);
+            if (!value) {
+                return std::nullopt;
+            }
+            return (double) *value;
+        }
+    }
+}
+
+std::optional<std::string>
+GGUFMetadata::getString(std::string_view key) {
+    const KvEntry *entry = _find(key);
+    if (entry == nullptr || entry->type != TYPE_STRING) {
+        return std::nullopt;
+    }
+    uint64_t offset = entry->valueOffset;
+    const auto length = _read<uint64_t>(offset);
+    const auto *data = reinterpret_cast<const char *>(_at(offset, length));
+    return std::string(data, (size_t) length);
+}
+
+std::optional<uint64_t>
+GGUFMetadata::getStringHash(std::string_view key) {
+    const KvEntry *entry = _find(key);
+    if (entry == nullptr || entry->type != TYPE_STRING) {
+        return std::nullopt;
+    }
+    uint64_t offset = entry->valueOffset;
+    const auto length = _read<uint64_t>(offset);
+    return fnv1a(FNV1A_OFFSET_BASIS, _at(offset, length), (size_t) length);
+}
+
+uint64_t
+GGUFMetadata::parameterCount() {
+    _scanTensors();
+    return _parameterCount;
+}
+
+std::string
+GGUFMetadata::quantType() {
+    if (const std::optional<int64_t> fileType = getInt("general.file_type")) {
+        // bit 10 is LLAMA_FTYPE_GUESSED, set when the type was not recorded by the quantizer
+        if (const char *name = fileTypeName(*fileType & ~1024)) {
+            return name;
+        }
+    }
+    _scanTensors();
+    const char *name = tensorTypeName(_dominantTensorType);
+    return name != nullptr ? name : "";
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @class GGUFMetadata
+ * @brief 只读取 GGUF 文件头部的轻量级元数据读取器。
+ *
+ * 文件以 mmap 方式按需映射：打开时只映射文件开头的一小段并校验魔数和版本，
+ * 解析超出映射范围时再扩大映射，因此映射范围只覆盖实际解析到的头部，不会触及张量数据。
+ * 键值对在第一次查询时才扫描一遍并记录每个值的偏移，值本身在读取时才解码；
+ * 张量信息只在需要参数量或量化类型时才扫描。
+ * 与 gguf_init_from_file 不同，不会把词表等数组复制到内存中，也不依赖 ggml。
+ */
+class GGUFMetadata {
+public:
+    /// GGUF 值类型（与 gguf_type 一致）
+    enum Type : uint32_t {
+        TYPE_UINT8 = 0,
+        TYPE_INT8 = 1,
+        TYPE_UINT16 = 2,
+        TYPE_INT16 = 3,
+        TYPE_UINT32 = 4,
+        TYPE_INT32 = 5,
+        TYPE_FLOAT32 = 6,
+        TYPE_BOOL = 7,
+        TYPE_STRING = 8,
+        TYPE_ARRAY = 9,
+        TYPE_UINT64 = 10,
+        TYPE_INT64 = 11,
+        TYPE_FLOAT64 = 12,
+    };
+
+    /**
+     * @brief 打开 GGUF 文件并校验文件头。
+     *
+     * @throws std::system_error 文件无法打开或映射时抛出。
+     * @throws std::runtime_error 文件不是受支持的 GGUF 文件时抛出。
+     */
+    static std::unique_ptr<GGUFMetadata> open(const char *path);
+
+    ~GGUFMetadata();
+
+    GGUFMetadata(const GGUFMetadata &) = delete;
+    GGUFMetadata &operator=(const GGUFMetadata &) = delete;
+
+    /// 文件大小（字节）
+    uint64_t fileSize() const { return _fileSize; }
+
+    /// 文件的修改时间（纳秒）
+    int64_t mtimeNs() const { return _mtimeNs; }
+
+    /// 当前映射的字节数，即已解析到的头部范围
+    size_t mappedSize() const { return _mappedSize; }
+
+    /// 键值对数量
+    uint64_t keyCount() const { return _nKv; }
+
+    /// 张量数量
+    uint64_t tensorCount() const { return _nTensors; }
+
+    /**
+     * @brief 查找键对应值的类型，找不到时返回空。
+     */
+    std::optional<Type> getType(std::string_view key);
+
+    /**
+     * @brief 读取整数值，接受任意整数类型和布尔值。
+     *
+     * @return 键不存在、不是整数或超出 int64 范围时返回空。
+     */
+    std::optional<int64_t> getInt(std::string_view key);
+
+    /**
+     * @brief 读取浮点值，接受任意数值类型。
+     */
+    std::optional<double> getFloat(std::string_view key);
+
+    /**
+     * @brief 读取字符串值。
+     */
+    std::optional<std::string> getString(std::string_view key);
+
+    /**
+     * @brief 读取字符串值的 64 位 FNV-1a 哈希，不复制字符串内容。
+     */
+    std::optional<uint64_t> getStringHash(std::string_view key);
+
+    /**
+     * @brief 模型参数量，即所有张量的元素个数之和。
+     */
+    uint64_t parameterCount();
+
+    /**
+     * @brief 量化类型名称：优先使用 general.file_type（例如 "Q4_K_M"），
+     * 否则使用元素最多的张量类型（例如 "q4_K"），都无法识别时返回空字符串。
+     */
+    std::string quantType();
+
+private:
+    /// 一个键值对在文件中的位置
+    struct KvEntry {
+        /// 键字符串内容的偏移
+        uint64_t keyOffset;
+        /// 键的长度
+        uint64_t keyLength;
+        /// 值的类型
+        Type type;
+        /// 值的偏移
+        uint64_t valueOffset;
+    };
+
+    int _fd = -1;
+    uint64_t _fileSize = 0;
+    int64_t _mtimeNs = 0;
+    const uint8_t *_mapped = nullptr;
+    size_t _mappedSize = 0;
+
+    uint64_t _nTensors = 0;
+    uint64_t _nKv = 0;
+    /// 下一个尚未扫描的键值对的偏移，扫描从这里继续
+    uint64_t _kvNextOffset = 0;
+    /// 键值对扫描完成后，第一个张量信息的偏移
+    uint64_t _tensorInfoStart = 0;
+    /// 已扫描的键值对，按文件顺序；查询只扫描到匹配的键为止，之后的查询从上次停下的位置继续
+    std::vector<KvEntry> _kvs;
+    bool _kvsScanned = false;
+
+    /// 张量信息扫描结果
+    bool _tensorsScanned = false;
+    uint64_t _parameterCount = 0;
+    /// 元素最多的 ggml 张量类型，没有张量时为 -1
+    int64_t _dominantTensorType = -1;
+
+    GGUFMetadata() = default;
+
+    /**
+     * @brief 确保 [offset, offset + size) 已被映射，返回指向 offset 的指针。
+     * 映射范围可能扩大，之前返回的指针随之失效。
+     *
+     * @throws std::runtime_error 范围超出文件末尾时抛出。
+     */
+    const uint8_t *_at(uint64_t offset, uint64_t size);
+
+    template<typename T>
+    T _read(uint64_t &offset);
+
+    /// 跳过一个 `type` 类型的值
+    void _skipValue(Type type, uint64_t &offset);
+
+    /**
+     * @brief 扫描下一个键值对并加入 `_kvs`，全部扫描完时返回 nullptr。
+     */
+    const KvEntry *_scanNextKv();
+
+    void _scanKvs();
+
+    void _scanTensors();
+
+    const KvEntry *_find(std::string_view key);
+};
@@ -1,92 +1,298 @@
-#include "gguf.h"
+#include "GGUFIndex.h"
+#include "GGUFMetadata.h"
 #include <jni.h>
 #include <string>
+#include <system_error>
+
+namespace {
+
+/**
+ * @brief 把 C++ 异常转换为 Java 异常：文件不存在时抛出 FileNotFoundException，其余情况抛出 IOException。
+ */
+void
+throwIOException(JNIEnv *env, const std::exception &e) {
+    const auto *systemError = dynamic_cast<const std::system_error *>(&e);
+    if (systemError != nullptr && systemError->code() == std::errc::no_such_file_or_directory) {
+        env->ThrowNew(env->FindClass("java/io/FileNotFoundException"), e.what());
+    } else {
+        env->ThrowNew(env->FindClass("java/io/IOException"), e.what());
+    }
+}
+
+/**
+ * @brief 把 Java 字符串复制为 std::string。
+ */
+std::string
+toString(JNIEnv *env, jstring value) {
+    const char *chars = env->GetStringUTFChars(value, nullptr);
+    std::string result(chars);
+    env->ReleaseStringUTFChars(value, chars);
+    return result;
+}
+
+/**
+ * @brief 把可选的整数装箱为 java.lang.Long，没有值时返回 null。
+ */
+jobject
+toLong(JNIEnv *env, const std::optional<int64_t> &value) {
+    if (!value) {
+        return nullptr;
+    }
+    jclass longClass = env->FindClass("java/lang/Long");
+    jmethodID valueOf = env->GetStaticMethodID(longClass, "valueOf", "(J)Ljava/lang/Long;");
+    return env->CallStaticObjectMethod(longClass, valueOf, (jlong) *value);
+}
+
+/**
+ * @brief 用索引中的摘要构造 com.stephen.llamacppbridge.GgufModelInfo 对象。
+ */
+jobject
+toModelInfo(JNIEnv *env, const GGUFIndexEntry &entry) {
+    jclass infoClass = env->FindClass("com/stephen/llamacppbridge/GgufModelInfo");
+    jmethodID constructor = env->GetMethodID(
+            infoClass, "<init>",
+            "(Ljava/lang/String;JJLjava/lang/String;Ljava/lang/Long;Ljava/lang/String;JJ)V");
+    jobject contextLength =
+            toLong(env, entry.contextLength >= 0 ? std::optional<int64_t>(entry.contextLength) : std::nullopt);
+    return env->NewObject(infoClass, constructor, env->NewStringUTF(entry.path.c_str()), (jlong) entry.mtimeNs,
+                          (jlong) entry.fileSize, env->NewStringUTF(entry.architecture.c_str()), contextLength,
+                          env->NewStringUTF(entry.quantType.c_str()), (jlong) entry.parameterCount,
+                          (jlong) entry.chatTemplateHash);
+}
+
+} // namespace
 
 /**
- * @brief 获取 GGUF 上下文的本地句柄。
+ * @brief 打开 GGUF 文件并返回元数据读取器的本地句柄。
  *
- * 该函数通过 Java Native Interface (JNI) 从 Java 层调用，用于根据给定的模型文件路径
- * 初始化 GGUF 上下文，并返回其本地句柄。
+ * 只映射并校验文件头，键值对在第一次查询时才被解析。句柄需要通过 `close` 释放。
  *
  * @param env JNI 环境指针，用于与 Java 虚拟机交互。
  * @param thiz 调用该本地方法的 Java 对象引用。
  * @param modelPath 包含 GGUF 模型文件路径的 Java 字符串对象。
- * @return 指向初始化后的 GGUF 上下文的 jlong 类型句柄，若初始化失败可能为 nullptr 对应的 jlong 值。
+ * @return 指向 GGUFMetadata 的 jlong 类型句柄；失败时抛出 FileNotFoundException 或 IOException 并返回 0。
  */
 extern "C" JNIEXPORT jlong JNICALL
-Java_com_stephen_llamacppbridge_GgufFileReader_getGGUFContextNativeHandle(JNIEnv *env, jobject thiz,
-                                                                          jstring modelPath) {
-    jboolean isCopy = true;
-    const char *modelPathCStr = env->GetStringUTFChars(modelPath, &isCopy);
-    // 初始化 GGUF 上下文所需的参数，不分配额外内存，上下文指针初始化为 nullptr
-    gguf_init_params initParams = {.no_alloc = true, .ctx = nullptr};
-    // 根据模型文件路径和初始化参数创建 GGUF 上下文
-    gguf_context *ggufContext = gguf_init_from_file(modelPathCStr, initParams);
-    env->ReleaseStringUTFChars(modelPath, modelPathCStr);
-    return reinterpret_cast<jlong>(ggufContext);
+Java_com_stephen_llamacppbridge_GgufFileReader_open(JNIEnv *env, jobject thiz, jstring modelPath) {
+    try {
+        return reinterpret_cast<jlong>(GGUFMetadata::open(toString(env, modelPath).c_str()).release());
+    } catch (const std::exception &e) {
+        throwIOException(env, e);
+        return 0;
+    }
+}
+
+/**
+ * @brief 释放元数据读取器，解除文件映射并关闭文件。
+ *
+ * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_GgufFileReader_close(JNIEnv *env, jobject thiz, jlong nativeHandle) {
+    delete reinterpret_cast<GGUFMetadata *>(nativeHandle);
 }
 
 /**
  * @brief 获取 GGUF 模型的上下文大小。
  *
- * 该函数通过 JNI 从 Java 层调用，根据给定的 GGUF 上下文本地句柄，
- * 查找并返回模型的上下文大小。
+ * 该函数通过 JNI 从 Java 层调用，根据给定的本地句柄查找 `<architecture>.context_length`，
+ * 接受以任意整数类型存储的值。
  *
  * @param env JNI 环境指针，用于与 Java 虚拟机交互。
  * @param thiz 调用该本地方法的 Java 对象引用。
- * @param nativeHandle 指向 GGUF 上下文的本地句柄。
+ * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
  * @return 模型的上下文大小，若查找失败则返回 -1。
  */
 extern "C" JNIEXPORT jlong JNICALL
 Java_com_stephen_llamacppbridge_GgufFileReader_getContextSize(JNIEnv *env, jobject thiz,
                                                               jlong nativeHandle) {
-    // 将 jlong 类型的本地句柄转换为 gguf_context 指针
-    gguf_context *ggufContext = reinterpret_cast<gguf_context *>(nativeHandle);
-    // 查找模型架构信息对应的键 ID
-    int64_t architectureKeyId = gguf_find_key(ggufContext, "general.architecture");
-    // 若未找到架构信息键 ID，返回 -1
-    if (architectureKeyId == -1)
+    auto *metadata = reinterpret_cast<GGUFMetadata *>(nativeHandle);
+    try {
+        const std::optional<std::string> architecture = metadata->getString("general.architecture");
+        if (!architecture) {
+            return -1;
+        }
+        return metadata->getInt(*architecture + ".context_length").value_or(-1);
+    } catch (const std::exception &e) {
+        throwIOException(env, e);
         return -1;
-    // 获取模型架构信息
-    std::string architecture = gguf_get_val_str(ggufContext, architectureKeyId);
-    // 构建上下文长度信息对应的键名
-    std::string contextLengthKey = architecture + ".context_length";
-    // 查找上下文长度信息对应的键 ID
-    int64_t contextLengthKeyId = gguf_find_key(ggufContext, contextLengthKey.c_str());
-    // 若未找到上下文长度信息键 ID，返回 -1
-    if (contextLengthKeyId == -1)
-        return -1;
-    uint32_t contextLength = gguf_get_val_u32(ggufContext, contextLengthKeyId);
-    return contextLength;
+    }
 }
 
 /**
  * @brief 获取 GGUF 模型的聊天模板。
  *
- * 该函数通过 JNI 从 Java 层调用，根据给定的 GGUF 上下文本地句柄，
- * 查找并返回模型的聊天模板。
- *
  * @param env JNI 环境指针，用于与 Java 虚拟机交互。
  * @param thiz 调用该本地方法的 Java 对象引用。
- * @param nativeHandle 指向 GGUF 上下文的本地句柄。
+ * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
  * @return 包含聊天模板的 Java 字符串对象，若未找到则返回空字符串对应的 Java 字符串。
  */
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_stephen_llamacppbridge_GgufFileReader_getChatTemplate(JNIEnv *env, jobject thiz,
                                                                jlong nativeHandle) {
-    // 将 jlong 类型的本地句柄转换为 gguf_context 指针
-    gguf_context *ggufContext = reinterpret_cast<gguf_context *>(nativeHandle);
-    // 查找聊天模板信息对应的键 ID
-    int64_t chatTemplateKeyId = gguf_find_key(ggufContext, "tokenizer.chat_template");
-    // 存储聊天模板的字符串
-    std::string chatTemplate;
-    // 若未找到聊天模板信息键 ID，将聊天模板设为空字符串
-    if (chatTemplateKeyId == -1) {
-        chatTemplate = "";
-    } else {
-        // 若找到聊天模板信息键 ID，获取聊天模板信息
-        chatTemplate = gguf_get_val_str(ggufContext, chatTemplateKeyId);
+    auto *metadata = reinterpret_cast<GGUFMetadata *>(nativeHandle);
+    try {
+        return env->NewStringUTF(metadata->getString("tokenizer.chat_template").value_or("").c_str());
+    } catch (const std::exception &e) {
+        throwIOException(env, e);
+        return nullptr;
     }
-    // 将 C++ 字符串转换为 Java 字符串并返回
-    return env->NewStringUTF(chatTemplate.c_str());
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 读取字符串类型的元数据。
+ *
+ * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
+ * @param key 元数据的键，例如 "general.name"。
+ * @return 对应的字符串，键不存在或不是字符串时返回 null。
+ */
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_stephen_llamacppbridge_GgufFileReader_getString(JNIEnv *env, jobject thiz, jlong nativeHandle,
+                                                         jstring key) {
+    auto *metadata = reinterpret_cast<GGUFMetadata *>(nativeHandle);
+    try {
+        const std::optional<std::string> value = metadata->getString(toString(env, key));
+        return value ? env->NewStringUTF(value->c_str()) : nullptr;
+    } catch (const std::exception &e) {
+        throwIOException(env, e);
+        return nullptr;
+    }
+}
+
+/**
+ * @brief 读取整数类型的元数据，接受任意整数类型和布尔值。
+ *
+ * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
+ * @param key 元数据的键，例如 "llama.block_count"。
+ * @return 装箱后的 java.lang.Long，键不存在或不是整数时返回 null。
+ */
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_stephen_llamacppbridge_GgufFileReader_getLong(JNIEnv *env, jobject thiz, jlong nativeHandle,
+                                                       jstring key) {
+    auto *metadata = reinterpret_cast<GGUFMetadata *>(nativeHandle);
+    try {
+        return toLong(env, metadata->getInt(toString(env, key)));
+    } catch (const std::exception &e) {
+        throwIOException(env, e);
+        return nullptr;
+    }
+}
+
+/**
+ * @brief 获取模型的参数量，需要扫描全部张量信息。
+ *
+ * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_stephen_llamacppbridge_GgufFileReader_getParameterCount(JNIEnv *env, jobject thiz,
+                                                                 jlong nativeHandle) {
+    auto *metadata = reinterpret_cast<GGUFMetadata *>(nativeHandle);
+    try {
+        return (jlong) metadata->parameterCount();
+    } catch (const std::exception &e) {
+        throwIOException(env, e);
+        return 0;
+    }
+}
+
+/**
+ * @brief 获取模型的量化类型名称，例如 "Q4_K_M"。
+ *
+ * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
+ */
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_stephen_llamacppbridge_GgufFileReader_getQuantType(JNIEnv *env, jobject thiz,
+                                                            jlong nativeHandle) {
+    auto *metadata = reinterpret_cast<GGUFMetadata *>(nativeHandle);
+    try {
+        return env->NewStringUTF(metadata->quantType().c_str());
+    } catch (const std::exception &e) {
+        throwIOException(env, e);
+        return nullptr;
+    }
+}
+
+/**
+ * @brief 读取（或新建）磁盘上的模型索引，返回其本地句柄。句柄需要通过 `close` 释放。
+ *
+ * @param indexPath 索引文件的路径。
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_stephen_llamacppbridge_GgufModelIndex_open(JNIEnv *env, jobject thiz, jstring indexPath) {
+    return reinterpret_cast<jlong>(new GGUFIndex(toString(env, indexPath)));
+}
+
+/**
+ * @brief 获取模型文件的摘要，文件未变化时直接使用索引中的记录。
+ *
+ * @param nativeHandle 指向 GGUFIndex 的本地句柄。
+ * @param modelPath 模型文件的路径。
+ * @return GgufModelInfo 对象；文件不存在时抛出 FileNotFoundException，不是有效的 GGUF 文件时抛出 IOException。
+ */
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_stephen_llamacppbridge_GgufModelIndex_lookup(JNIEnv *env, jobject thiz, jlong nativeHandle,
+                                                      jstring modelPath) {
+    auto *index = reinterpret_cast<GGUFIndex *>(nativeHandle);
+    try {
+        return toModelInfo(env, index->lookup(toString(env, modelPath)));
+    } catch (const std::exception &e) {
+        throwIOException(env, e);
+        return nullptr;
+    }
+}
+
+/**
+ * @brief 返回索引中记录的所有摘要，不访问任何模型文件。
+ *
+ * @param nativeHandle 指向 GGUFIndex 的本地句柄。
+ * @return GgufModelInfo 数组，按路径排序。
+ */
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_stephen_llamacppbridge_GgufModelIndex_getEntries(JNIEnv *env, jobject thiz, jlong nativeHandle) {
+    auto *index = reinterpret_cast<GGUFIndex *>(nativeHandle);
+    const std::vector<GGUFIndexEntry> entries = index->entries();
+    jclass infoClass = env->FindClass("com/stephen/llamacppbridge/GgufModelInfo");
+    jobjectArray result = env->NewObjectArray((jsize) entries.size(), infoClass, nullptr);
+    for (size_t i = 0; i < entries.size(); i++) {
+        jobject info = toModelInfo(env, entries[i]);
+        env->SetObjectArrayElement(result, (jsize) i, info);
+        env->DeleteLocalRef(info);
+    }
+    return result;
+}
+
+/**
+ * @brief 从索引中移除一个模型文件。
+ *
+ * @param nativeHandle 指向 GGUFIndex 的本地句柄。
+ * @param modelPath 模型文件的路径。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_GgufModelIndex_remove(JNIEnv *env, jobject thiz, jlong nativeHandle,
+                                                      jstring modelPath) {
+    reinterpret_cast<GGUFIndex *>(nativeHandle)->remove(toString(env, modelPath));
+}
+
+/**
+ * @brief 把索引的修改写回磁盘。
+ *
+ * @param nativeHandle 指向 GGUFIndex 的本地句柄。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_GgufModelIndex_save(JNIEnv *env, jobject thiz, jlong nativeHandle) {
+    try {
+        reinterpret_cast<GGUFIndex *>(nativeHandle)->save();
+    } catch (const std::exception &e) {
+        throwIOException(env, e);
+    }
+}
+
+/**
+ * @brief 释放模型索引（不会写回修改，需要先调用 `save`）。
+ *
+ * @param nativeHandle 指向 GGUFIndex 的本地句柄。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_GgufModelIndex_close(JNIEnv *env, jobject thiz, jlong nativeHandle) {
+    delete reinterpret_cast<GGUFIndex *>(nativeHandle);
+}
@@ -0,0 +1,56 @@
+#include "GrammarCache.h"
+#include "LLMLog.h"
+#include "json-schema-to-grammar.h"
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+GrammarCache::GrammarCache(size_t capacity) : _capacity(capacity) {}
+
+llama_sampler *
+GrammarCache::create(const llama_vocab *vocab, const char *text, bool jsonSchema) {
+    size_t hash = std::hash<std::string>()(text) ^ (size_t) jsonSchema;
+    for (size_t i = 0; i < _entries.size(); i++) {
+        if (_entries[i].hash == hash && _entries[i].jsonSchema == jsonSchema && _entries[i].text == text) {
+            // move the entry to the back, the front is evicted first
+            Entry entry = std::move(_entries[i]);
+            _entries.erase(_entries.begin() + (long) i);
+            _entries.push_back(std::move(entry));
+            return llama_sampler_clone(_entries.back().prototype);
+        }
+    }
+
+    std::string grammar;
+    if (jsonSchema) {
+        try {
+            grammar = json_schema_to_grammar(nlohmann::ordered_json::parse(text));
+        } catch (std::exception &error) {
+            throw std::runtime_error(std::string("invalid JSON schema: ") + error.what());
+        }
+    } else {
+        grammar = text;
+    }
+    llama_sampler *prototype = llama_sampler_init_grammar(vocab, grammar.c_str(), "root");
+    if (!prototype) {
+        throw std::runtime_error("failed to parse the grammar");
+    }
+    LOGi("compiled grammar (%zu bytes of GBNF), %zu grammars cached", grammar.size(), _entries.size() + 1);
+
+    if (_entries.size() == _capacity) {
+        llama_sampler_free(_entries.front().prototype);
+        _entries.erase(_entries.begin());
+    }
+    _entries.push_back({hash, jsonSchema, text, prototype});
+    return llama_sampler_clone(prototype);
+}
+
+void
+GrammarCache::clear() {
+    for (Entry &entry: _entries) {
+        llama_sampler_free(entry.prototype);
+    }
+    _entries.clear();
+}
+
+GrammarCache::~GrammarCache() {
+    clear();
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "llama.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * @class GrammarCache
+ * @brief 按内容哈希缓存已编译的语法采样器。
+ *
+ * JSON schema 转换为 GBNF 以及 GBNF 的解析只在第一次遇到某个语法时执行，之后通过 llama_sampler_clone
+ * 复制已解析的语法，重复的结构化输出请求不再重新解析。缓存按最近使用顺序淘汰。
+ */
+class GrammarCache {
+    struct Entry {
+        /// 语法文本与类型的哈希，用于快速比较
+        size_t hash;
+        /// 是否为 JSON schema
+        bool jsonSchema;
+        /// 原始语法文本（GBNF 或 JSON schema），哈希相同时用于确认
+        std::string text;
+        /// 未使用过的语法采样器，只作为复制的原型
+        llama_sampler *prototype;
+    };
+
+    /// 缓存项，最近使用的排在末尾
+    std::vector<Entry> _entries;
+    /// 最多缓存的语法数量
+    size_t _capacity;
+
+public:
+    explicit GrammarCache(size_t capacity = 16);
+
+    /**
+     * @brief 创建一个处于初始状态的语法采样器，命中缓存时直接复制已编译的原型。
+     *
+     * @param vocab 模型词表。
+     * @param text GBNF 语法或 JSON schema。
+     * @param jsonSchema `text` 是否为 JSON schema。
+     * @return llama_sampler* 新的语法采样器，由调用方通过 llama_sampler_free 释放。
+     * @throws std::runtime_error JSON schema 或语法无效时抛出。
+     */
+    llama_sampler *create(const llama_vocab *vocab, const char *text, bool jsonSchema);
+
+    /**
+     * @brief 释放所有缓存的语法（例如更换模型之后）。
+     */
+    void clear();
+
+    ~GrammarCache();
+};
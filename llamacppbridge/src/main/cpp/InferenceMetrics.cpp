@@ -0,0 +1,46 @@
+#include "InferenceMetrics.h"
+#include <algorithm>
+#include <cstdio>
+
+void
+InferenceMetrics::setDecodeLatencies(std::vector<int64_t> latenciesUs) {
+    if (latenciesUs.empty()) {
+        decodeP50Ms = decodeP95Ms = decodeP99Ms = 0.0;
+        return;
+    }
+    std::sort(latenciesUs.begin(), latenciesUs.end());
+    // nearest-rank percentile
+    auto percentile = [&](double p) {
+        size_t rank = (size_t) (p * (double) latenciesUs.size() + 0.5);
+        rank = std::min(std::max<size_t>(rank, 1), latenciesUs.size());
+        return (double) latenciesUs[rank - 1] / 1000.0;
+    };
+    decodeP50Ms = percentile(0.50);
+    decodeP95Ms = percentile(0.95);
+    decodeP99Ms = percentile(0.99);
+}
+
+namespace {
+
+std::string
+jsonSize(const std::optional<size_t> &size) {
+    return size ? std::to_string(*size) : "null";
+}
+
+} // namespace
+
+std::string
+InferenceMetrics::toJson() const {
+    char json[1024];
+    snprintf(json, sizeof(json),
+             "{\"load_ms\": %.3f, \"warmup_ms\": %.3f, \"tokenize_ms\": %.3f, "
+             "\"prefill_tokens\": %d, \"prefill_ms\": %.3f, \"ttft_ms\": %.3f, "
+             "\"decode_tokens\": %d, \"decode_steps\": %d, \"decode_ms\": %.3f, "
+             "\"decode_p50_ms\": %.3f, \"decode_p95_ms\": %.3f, \"decode_p99_ms\": %.3f, "
+             "\"sample_ms\": %.3f, \"detokenize_ms\": %.3f, "
+             "\"kv_cache_used\": %d, \"kv_cache_size\": %d, \"kv_cache_bytes\": %s, \"compute_buffer_bytes\": %s}",
+             loadMs, warmupMs, tokenizeMs, prefillTokens, prefillMs, ttftMs, decodeTokens, decodeSteps, decodeMs,
+             decodeP50Ms, decodeP95Ms, decodeP99Ms, sampleMs, detokenizeMs, kvCacheUsed, kvCacheSize,
+             jsonSize(kvCacheBytes).c_str(), jsonSize(computeBufferBytes).c_str());
+    return json;
+}
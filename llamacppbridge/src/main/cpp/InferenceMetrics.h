@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @struct InferenceMetrics
+ * @brief 模型加载和最近一次生成的分阶段性能指标，时间单位均为毫秒。
+ */
+struct InferenceMetrics {
+    /// 模型加载（包括创建上下文）耗时
+    double loadMs = 0.0;
+    /// 预热耗时，未预热时为 0
+    double warmupMs = 0.0;
+    /// 渲染聊天模板与分词耗时
+    double tokenizeMs = 0.0;
+    /// 预填充的 token 数（不包括复用 KV 缓存的前缀）
+    int prefillTokens = 0;
+    /// 预填充耗时
+    double prefillMs = 0.0;
+    /// 首 token 时间：从 startCompletion 开始到采样得到第一个 token
+    double ttftMs = 0.0;
+    /// 生成的 token 数
+    int decodeTokens = 0;
+    /// 解码步数（投机解码时一步可以生成多个 token）
+    int decodeSteps = 0;
+    /// 所有解码步中 llama_decode 的总耗时
+    double decodeMs = 0.0;
+    /// 单步解码延迟的 50 百分位
+    double decodeP50Ms = 0.0;
+    /// 单步解码延迟的 95 百分位
+    double decodeP95Ms = 0.0;
+    /// 单步解码延迟的 99 百分位
+    double decodeP99Ms = 0.0;
+    /// 采样（包括语法约束）耗时
+    double sampleMs = 0.0;
+    /// token 转换为文本以及 UTF-8 校验耗时
+    double detokenizeMs = 0.0;
+    /// KV 缓存中已使用的 token 数
+    int kvCacheUsed = 0;
+    /// KV 缓存容量（上下文大小）
+    int kvCacheSize = 0;
+    /// KV 缓存占用的内存（字节），取决于上下文大小和 KV 缓存的数据类型；未知时为空
+    std::optional<size_t> kvCacheBytes;
+    /// 上下文的计算缓冲区大小（字节），由 llama.cpp 在创建上下文时预留，是推理期间的峰值；未知时为空
+    std::optional<size_t> computeBufferBytes;
+
+    /**
+     * @brief 根据每一步的解码延迟（微秒）计算百分位。
+     */
+    void setDecodeLatencies(std::vector<int64_t> latenciesUs);
+
+    /**
+     * @brief 以 JSON 对象的形式输出所有指标，键名为 snake_case，未知的大小输出为 null。
+     */
+    std::string toJson() const;
+};
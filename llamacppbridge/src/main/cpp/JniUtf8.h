@@ -0,0 +1,47 @@
+#pragma once
+#include <jni.h>
+#include <string>
+
+/**
+ * @brief 把 Java 字符串转换为标准 UTF-8，结果与 Kotlin 的 String.toByteArray() 逐字节相同。
+ *
+ * GetStringUTFChars 返回的是 Modified UTF-8：补充平面字符（emoji 等）被编码为两个 3 字节的代理项，
+ * U+0000 被编码为 0xC0 0x80，分词结果会与 LlamaTokenizer（传入 toByteArray() 的字节）不一致。
+ * 这里直接读取 UTF-16 代码单元并编码，不成对的代理项与 Java 一样替换为 '?'。
+ */
+inline std::string
+toUtf8(JNIEnv *env, jstring string) {
+    const jsize length = env->GetStringLength(string);
+    std::u16string units(length, u'\0');
+    env->GetStringRegion(string, 0, length, reinterpret_cast<jchar *>(units.data()));
+
+    std::string out;
+    out.reserve(units.size() * 3);
+    for (size_t i = 0; i < units.size(); i++) {
+        char32_t c = units[i];
+        if (c >= 0xD800 && c <= 0xDFFF) {
+            if (c <= 0xDBFF && i + 1 < units.size() && units[i + 1] >= 0xDC00 && units[i + 1] <= 0xDFFF) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (units[++i] - 0xDC00);
+            } else {
+                out.push_back('?');
+                continue;
+            }
+        }
+        if (c < 0x80) {
+            out.push_back((char) c);
+        } else if (c < 0x800) {
+            out.push_back((char) (0xC0 | (c >> 6)));
+            out.push_back((char) (0x80 | (c & 0x3F)));
+        } else if (c < 0x10000) {
+            out.push_back((char) (0xE0 | (c >> 12)));
+            out.push_back((char) (0x80 | ((c >> 6) & 0x3F)));
+            out.push_back((char) (0x80 | (c & 0x3F)));
+        } else {
+            out.push_back((char) (0xF0 | (c >> 18)));
+            out.push_back((char) (0x80 | ((c >> 12) & 0x3F)));
+            out.push_back((char) (0x80 | ((c >> 6) & 0x3F)));
+            out.push_back((char) (0x80 | (c & 0x3F)));
+        }
+    }
+    return out;
+}
@@ -0,0 +1,425 @@
+#include "LLMEngine.h"
+#include "ChatUtils.h"
+#include "CpuDispatch.h"
+#include "LLMLog.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+void
+freeMessages(std::vector<llama_chat_message> &messages) {
+    for (llama_chat_message &message: messages) {
+        free(const_cast<char *>(message.role));
+        free(const_cast<char *>(message.content));
+    }
+    messages.clear();
+}
+
+} // namespace
+
+void
+LLMEngine::loadModel(const char *modelPath, long contextSize, int nThreads, bool useMmap, bool useMlock, int nSeqMax,
+                     int nBatch, int nUbatch) {
+    if (nSeqMax <= 0) {
+        nSeqMax = 1;
+    }
+    if (nBatch <= 0) {
+        nBatch = 512;
+    }
+    nBatch = (int) std::min<long>(nBatch, contextSize);
+    if (nUbatch <= 0) {
+        nUbatch = 512;
+    }
+    nUbatch = std::min(nUbatch, nBatch);
+    // every generating session adds one token to each step's batch
+    if (nSeqMax > nBatch) {
+        LOGi("nSeqMax = %d exceeds nBatch = %d, clamping", nSeqMax, nBatch);
+        nSeqMax = nBatch;
+    }
+    LOGi("loading engine model with"
+         "\n\tmodel_path = %s"
+         "\n\tcontextSize = %li"
+         "\n\tnThreads = %d"
+         "\n\tuseMmap = %d"
+         "\n\tuseMlock = %d"
+         "\n\tnSeqMax = %d"
+         "\n\tnBatch = %d"
+         "\n\tnUbatch = %d",
+         modelPath, contextSize, nThreads, useMmap, useMlock, nSeqMax, nBatch, nUbatch);
+
+    // load the CPU backend variant for this device and the other dynamic backends
+    loadCpuBackend();
+
+    // create an instance of llama_model
+    llama_model_params model_params = llama_model_default_params();
+    model_params.use_mmap = useMmap;
+    model_params.use_mlock = useMlock;
+    _model = llama_model_load_from_file(modelPath, model_params);
+    if (!_model) {
+        LOGe("failed to load model from %s", modelPath);
+        throw std::runtime_error("loadModel() failed");
+    }
+
+    // create an instance of llama_context shared by all sessions,
+    // every session decodes into its own sequence of the KV cache
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = contextSize;
+    ctx_params.n_batch = nBatch;
+    ctx_params.n_ubatch = nUbatch;
+    ctx_params.n_seq_max = nSeqMax;
+    ctx_params.n_threads = nThreads;
+    ctx_params.no_perf = true; // disable performance metrics
+    _ctx = llama_init_from_model(_model, ctx_params);
+    if (!_ctx) {
+        LOGe("llama_init_from_model() returned null");
+        throw std::runtime_error("llama_init_from_model() returned null");
+    }
+    _nCtxSeq = (int) (llama_n_ctx(_ctx) / (uint32_t) nSeqMax);
+    _batch = llama_batch_init(nBatch, 0, 1);
+    _sessions.resize(nSeqMax);
+    _scheduler = std::thread(&LLMEngine::_schedulerLoop, this);
+}
+
+int
+LLMEngine::createSession(const SamplerParams &samplerParams, const char *chatTemplate) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto slot = std::find(_sessions.begin(), _sessions.end(), nullptr);
+    if (slot == _sessions.end()) {
+        throw std::runtime_error("all sessions are in use");
+    }
+    auto session = std::make_shared<LLMSession>();
+    session->seqId = (llama_seq_id) (slot - _sessions.begin());
+
+    // create an instance of llama_sampler for the session
+    session->sampler = createSamplerChain(samplerParams);
+
+    if (chatTemplate == nullptr) {
+        session->chatTemplate = llama_model_chat_template(_model, nullptr);
+    } else {
+        session->chatTemplate = strdup(chatTemplate);
+        session->ownsChatTemplate = true;
+    }
+    session->formattedMessages = std::vector<char>(_nCtxSeq);
+    *slot = session;
+    LOGi("created session %d", session->seqId);
+    return session->seqId;
+}
+
+void
+LLMEngine::destroySession(int sessionId) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::shared_ptr<LLMSession> session = _getSession(sessionId);
+    session->closeRequested = true;
+    session->stream.finish();
+    _work.notify_one();
+    // the sequence is released by the scheduler thread, which owns all calls into the context
+    _idle.wait(lock, [&] { return _sessions[sessionId] != session; });
+}
+
+void
+LLMEngine::addChatMessage(int sessionId, const char *message, const char *role) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::shared_ptr<LLMSession> session = _getSession(sessionId);
+    if (session->state != LLMSession::IDLE) {
+        throw std::runtime_error("addChatMessage() called while the session is generating");
+    }
+    session->messages.push_back({strdup(role), strdup(message)});
+}
+
+void
+LLMEngine::startCompletion(int sessionId, const char *query) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::shared_ptr<LLMSession> session = _getSession(sessionId);
+    if (session->state != LLMSession::IDLE) {
+        throw std::runtime_error("startCompletion() called while the session is generating");
+    }
+    session->messages.push_back({strdup("user"), strdup(query)});
+
+    // apply the chat-template and keep only the part that the model has not seen yet
+    int newLen = applyChatTemplate(session->chatTemplate, session->messages.data(), session->messages.size(), true,
+                                   session->formattedMessages);
+    if (newLen < 0) {
+        free(const_cast<char *>(session->messages.back().role));
+        free(const_cast<char *>(session->messages.back().content));
+        session->messages.pop_back();
+        throw std::runtime_error("llama_chat_apply_template() in LLMEngine::startCompletion() failed");
+    }
+    std::string prompt(session->formattedMessages.begin() + session->prevLen,
+                       session->formattedMessages.begin() + newLen);
+    std::vector<llama_token> tokens =
+            common_tokenize(llama_model_get_vocab(_model), prompt, session->nPast == 0, true);
+    if (tokens.empty() || session->nPast + (int) tokens.size() >= _nCtxSeq) {
+        free(const_cast<char *>(session->messages.back().role));
+        free(const_cast<char *>(session->messages.back().content));
+        session->messages.pop_back();
+        throw std::runtime_error(tokens.empty() ? "empty prompt" : "context size reached");
+    }
+
+    session->promptTokens = std::move(tokens);
+    session->promptPos = 0;
+    session->promptStartPos = session->nPast;
+    session->response.clear();
+    session->utf8Stream.reset();
+    session->pendingText.clear();
+    session->responseGenerationTime = 0;
+    session->responseNumTokens = 0;
+    session->stopRequested = false;
+    session->stream.reset();
+    session->state = LLMSession::PREFILL;
+    _work.notify_one();
+}
+
+long
+LLMEngine::drain(int sessionId, char *dst, size_t capacity, int maxPieces) {
+    std::shared_ptr<LLMSession> session;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        session = _getSession(sessionId);
+    }
+    // the reference keeps the buffer alive even if the session is destroyed while we are blocked
+    return session->stream.drain(dst, capacity, maxPieces);
+}
+
+void
+LLMEngine::stopCompletion(int sessionId) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::shared_ptr<LLMSession> session = _getSession(sessionId);
+    if (session->state == LLMSession::IDLE) {
+        return;
+    }
+    session->stopRequested = true;
+    _work.notify_one();
+    _idle.wait(lock, [&] { return session->state == LLMSession::IDLE; });
+}
+
+float
+LLMEngine::getResponseGenerationSpeed(int sessionId) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::shared_ptr<LLMSession> session = _getSession(sessionId);
+    return session->responseGenerationTime > 0
+           ? (float) session->responseNumTokens / (session->responseGenerationTime / 1e6)
+           : 0.0f;
+}
+
+int
+LLMEngine::getContextSizeUsed(int sessionId) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _getSession(sessionId)->nPast;
+}
+
+std::shared_ptr<LLMSession>
+LLMEngine::_getSession(int sessionId) {
+    if (sessionId < 0 || sessionId >= (int) _sessions.size() || !_sessions[sessionId] ||
+        _sessions[sessionId]->closeRequested) {
+        throw std::runtime_error("invalid session handle");
+    }
+    return _sessions[sessionId];
+}
+
+void
+LLMEngine::_finishCompletion(LLMSession &session, const std::string &error) {
+    llama_memory_t memory = llama_get_memory(_ctx);
+    if (session.state == LLMSession::PREFILL) {
+        // the prompt never completed, forget the query and whatever part of it reached the KV cache
+        llama_memory_seq_rm(memory, session.seqId, session.promptStartPos, -1);
+        session.nPast = session.promptStartPos;
+        free(const_cast<char *>(session.messages.back().role));
+        free(const_cast<char *>(session.messages.back().content));
+        session.messages.pop_back();
+    } else if (session.state == LLMSession::GENERATING) {
+        session.messages.push_back({strdup("assistant"), strdup(session.response.c_str())});
+        int len = applyChatTemplate(session.chatTemplate, session.messages.data(), session.messages.size(), false,
+                                    session.formattedMessages);
+        if (len >= 0) {
+            session.prevLen = len;
+        }
+    }
+    session.promptTokens.clear();
+    session.state = LLMSession::IDLE;
+    session.stream.finish(error);
+    _idle.notify_all();
+}
+
+void
+LLMEngine::_handleRequests() {
+    for (std::shared_ptr<LLMSession> &session: _sessions) {
+        if (!session) {
+            continue;
+        }
+        if (session->closeRequested) {
+            if (session->state != LLMSession::IDLE) {
+                _finishCompletion(*session);
+            }
+            llama_memory_seq_rm(llama_get_memory(_ctx), session->seqId, -1, -1);
+            freeMessages(session->messages);
+            llama_sampler_free(session->sampler);
+            if (session->ownsChatTemplate) {
+                free(const_cast<char *>(session->chatTemplate));
+            }
+            LOGi("destroyed session %d", session->seqId);
+            session.reset();
+            _idle.notify_all();
+        } else if (session->stopRequested) {
+            session->stopRequested = false;
+            if (session->state != LLMSession::IDLE) {
+                _finishCompletion(*session);
+            }
+        }
+    }
+}
+
+void
+LLMEngine::_acceptToken(LLMSession &session, llama_token token) {
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    if (llama_vocab_is_eog(vocab, token)) {
+        _finishCompletion(session);
+        return;
+    }
+    session.currToken = token;
+    session.responseNumTokens += 1;
+    session.responseGenerationTime = ggml_time_us() - session.generationStart;
+    int32_t nBytes = llama_token_to_piece(vocab, token, session.pieceBytes.data(), (int32_t) session.pieceBytes.size(),
+                                          0, true);
+    if (nBytes < 0) {
+        session.pieceBytes.resize(-nBytes);
+        session.pieceText.resize(Utf8Stream::maxOutputSize(session.pieceBytes.size()));
+        nBytes = llama_token_to_piece(vocab, token, session.pieceBytes.data(), (int32_t) session.pieceBytes.size(), 0,
+                                      true);
+    }
+    // complete characters are pushed right away, only the bytes of an unfinished one are held back
+    const size_t length =
+            session.utf8Stream.append(session.pieceBytes.data(), (size_t) std::max(nBytes, 0), session.pieceText.data());
+    if (length > 0) {
+        session.response.append(session.pieceText.data(), length);
+        session.pendingText.append(session.pieceText.data(), length);
+        _flushPendingText(session);
+    }
+}
+
+bool
+LLMEngine::_flushPendingText(LLMSession &session) {
+    // `_mutex` is held, so only push what fits without waiting for the reader
+    if (session.pendingText.empty() || !session.stream.canPush(session.pendingText.size())) {
+        return session.pendingText.empty();
+    }
+    session.stream.push(session.pendingText.data(), session.pendingText.size());
+    session.pendingText.clear();
+    return true;
+}
+
+void
+LLMEngine::_schedulerLoop() {
+    // (session, index of its logits in the batch or -1, number of prompt tokens added)
+    struct BatchEntry {
+        LLMSession *session;
+        int32_t outputIndex;
+        int nPromptTokens;
+    };
+    std::vector<BatchEntry> entries;
+    entries.reserve(_sessions.size());
+    const int nBatch = (int) llama_n_batch(_ctx);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _work.wait(lock, [&] {
+            return _shutdown || std::any_of(_sessions.begin(), _sessions.end(), [](const auto &session) {
+                return session && (session->state != LLMSession::IDLE || session->closeRequested);
+            });
+        });
+        if (_shutdown) {
+            break;
+        }
+        _handleRequests();
+
+        // one token for every generating session first, so that long prompts never stall running responses
+        common_batch_clear(_batch);
+        entries.clear();
+        for (std::shared_ptr<LLMSession> &session: _sessions) {
+            if (!session || session->state != LLMSession::GENERATING || !_flushPendingText(*session)) {
+                continue;
+            }
+            if (session->nPast >= _nCtxSeq) {
+                _finishCompletion(*session, "context size reached");
+                continue;
+            }
+            common_batch_add(_batch, session->currToken, session->nPast, {session->seqId}, true);
+            entries.push_back({session.get(), _batch.n_tokens - 1, 0});
+        }
+        // the rest of the batch is shared by the pending prompts, starting with a different session every step
+        for (size_t i = 0; i < _sessions.size() && _batch.n_tokens < nBatch; i++) {
+            LLMSession *session = _sessions[(_prefillCursor + i) % _sessions.size()].get();
+            if (!session || session->state != LLMSession::PREFILL) {
+                continue;
+            }
+            int nTokens = (int) std::min<size_t>(nBatch - _batch.n_tokens,
+                                                 session->promptTokens.size() - session->promptPos);
+            for (int j = 0; j < nTokens; j++) {
+                bool last = session->promptPos + j + 1 == session->promptTokens.size();
+                common_batch_add(_batch, session->promptTokens[session->promptPos + j], session->nPast + j,
+                                 {session->seqId}, last);
+            }
+            bool complete = session->promptPos + nTokens == session->promptTokens.size();
+            entries.push_back({session, complete ? _batch.n_tokens - 1 : -1, nTokens});
+        }
+        _prefillCursor = (_prefillCursor + 1) % _sessions.size();
+        if (_batch.n_tokens == 0) {
+            // every active session waits for its reader to drain the stream buffer
+            _work.wait_for(lock, std::chrono::milliseconds(5));
+            continue;
+        }
+
+        lock.unlock();
+        int32_t result = llama_decode(_ctx, _batch);
+        lock.lock();
+
+        for (const BatchEntry &entry: entries) {
+            LLMSession &session = *entry.session;
+            if (result != 0) {
+                // drop whatever this step wrote for the session before reporting the failure
+                llama_memory_seq_rm(llama_get_memory(_ctx), session.seqId, session.nPast, -1);
+                _finishCompletion(session, "llama_decode() failed");
+                continue;
+            }
+            if (entry.nPromptTokens > 0) {
+                session.nPast += entry.nPromptTokens;
+                session.promptPos += entry.nPromptTokens;
+                if (entry.outputIndex < 0) {
+                    continue;
+                }
+                session.state = LLMSession::GENERATING;
+                session.generationStart = ggml_time_us();
+            } else {
+                session.nPast += 1;
+            }
+            _acceptToken(session, llama_sampler_sample(session.sampler, _ctx, entry.outputIndex));
+        }
+    }
+}
+
+LLMEngine::~LLMEngine() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _shutdown = true;
+    }
+    _work.notify_one();
+    if (_scheduler.joinable()) {
+        _scheduler.join();
+    }
+    for (std::shared_ptr<LLMSession> &session: _sessions) {
+        if (!session) {
+            continue;
+        }
+        session->stream.finish();
+        freeMessages(session->messages);
+        llama_sampler_free(session->sampler);
+        if (session->ownsChatTemplate) {
+            free(const_cast<char *>(session->chatTemplate));
+        }
+    }
+    _sessions.clear();
+    llama_batch_free(_batch);
+    llama_free(_ctx);
+    llama_model_free(_model);
+}
@@ -0,0 +1,223 @@
+#pragma once
+#include "llama.h"
+#include "SamplerChain.h"
+#include "TokenStreamBuffer.h"
+#include "Utf8Stream.h"
+#include "common.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @struct LLMSession
+ * @brief LLMEngine 中的一个对话会话，占用上下文中的一个序列（llama_seq_id）。
+ */
+struct LLMSession {
+    /// 会话状态
+    enum State {
+        /// 空闲，等待下一次 startCompletion
+        IDLE,
+        /// 提示词尚未全部写入 KV 缓存
+        PREFILL,
+        /// 正在逐 token 生成响应
+        GENERATING,
+    };
+
+    /// 会话占用的序列编号，同时作为会话句柄
+    llama_seq_id seqId = 0;
+    /// 会话自己的采样器
+    llama_sampler *sampler = nullptr;
+    /// 聊天模板字符串（strdup 得到的副本，或模型内置模板）
+    const char *chatTemplate = nullptr;
+    /// `chatTemplate` 是否由 strdup 分配
+    bool ownsChatTemplate = false;
+    /// 会话中用户和助手的消息列表
+    std::vector<llama_chat_message> messages;
+    /// 应用聊天模板后的格式化消息
+    std::vector<char> formattedMessages;
+    /// 上一次格式化消息的长度
+    int prevLen = 0;
+
+    /// 当前状态
+    State state = IDLE;
+    /// 本轮需要预填充的提示词 token
+    std::vector<llama_token> promptTokens;
+    /// `promptTokens` 中下一个要写入 KV 缓存的位置
+    size_t promptPos = 0;
+    /// 本轮预填充开始时序列中已有的 token 数
+    llama_pos promptStartPos = 0;
+    /// 序列中已写入 KV 缓存的 token 数，即下一个 token 的位置
+    llama_pos nPast = 0;
+    /// 最近采样得到、尚未写入 KV 缓存的 token
+    llama_token currToken = LLAMA_TOKEN_NULL;
+
+    /// 当前查询的完整响应内容
+    std::string response;
+    /// 把词块切分为完整的 UTF-8 字符，只保留末尾未完成的字节
+    Utf8Stream utf8Stream;
+    /// llama_token_to_piece 的输出缓冲区，只在遇到更长的词块时扩大
+    std::vector<char> pieceBytes = std::vector<char>(64);
+    /// utf8Stream 的输出缓冲区
+    std::vector<char> pieceText = std::vector<char>(Utf8Stream::maxOutputSize(64));
+    /// 调度线程写入、调用方批量读取的词块缓冲区
+    TokenStreamBuffer stream;
+    /// 词块缓冲区暂时放不下的响应文本，写入之前调度线程不再为会话解码
+    std::string pendingText;
+    /// 调用方请求停止本轮生成（由调度线程处理）
+    bool stopRequested = false;
+    /// 调用方请求关闭会话（由调度线程处理）
+    bool closeRequested = false;
+
+    /// 本轮响应生成所花费的时间（微秒），从首个 token 开始计算
+    int64_t responseGenerationTime = 0;
+    /// 本轮生成的 token 总数
+    long responseNumTokens = 0;
+    /// 本轮预填充完成的时间戳（微秒）
+    int64_t generationStart = 0;
+};
+
+/**
+ * @class LLMEngine
+ * @brief 在一个模型和一个上下文上承载多个会话的推理引擎。
+ *
+ * 每个会话对应上下文中的一个序列，由调度线程在每一步把所有会话待预填充的提示词分块与待解码的 token
+ * 合并到同一个 llama_batch 中执行（continuous batching），因此多个并发对话只需要一份模型权重。
+ * 所有对上下文的调用（llama_decode、KV 缓存操作）只在调度线程中进行，公开方法只修改会话状态并唤醒调度线程。
+ */
+class LLMEngine {
+    /// llama 模型指针
+    llama_model *_model = nullptr;
+    /// 所有会话共享的 llama 上下文
+    llama_context *_ctx = nullptr;
+    /// 每一步的批处理结构，容量为 n_batch
+    llama_batch _batch{};
+    /// 每个会话（序列）可以使用的上下文长度
+    int _nCtxSeq = 0;
+
+    /// 按序列编号索引的会话，未使用的序列为 nullptr（读取方在阻塞读取期间持有引用）
+    std::vector<std::shared_ptr<LLMSession>> _sessions;
+    /// 下一步优先预填充的序列编号，轮流分配预填充预算
+    size_t _prefillCursor = 0;
+    /// 保护 `_sessions` 及其状态的互斥锁（llama_decode 执行期间不持有）
+    std::mutex _mutex;
+    /// 有新的工作或请求时唤醒调度线程
+    std::condition_variable _work;
+    /// 调度线程处理完停止或关闭请求后唤醒等待的调用方
+    std::condition_variable _idle;
+    /// 调度线程
+    std::thread _scheduler;
+    /// 请求调度线程退出的标志
+    bool _shutdown = false;
+
+    /**
+     * @brief 调度线程的主循环：处理停止/关闭请求，组装批次、解码并为每个会话采样。
+     */
+    void _schedulerLoop();
+
+    /**
+     * @brief 处理所有会话的停止和关闭请求，需持有 `_mutex`。
+     */
+    void _handleRequests();
+
+    /**
+     * @brief 结束会话的本轮生成：保存助手消息（或撤销未完成预填充的查询），关闭词块缓冲区，需持有 `_mutex`。
+     *
+     * @param error 错误信息，为空表示正常结束。
+     */
+    void _finishCompletion(LLMSession &session, const std::string &error = "");
+
+    /**
+     * @brief 采样得到会话的下一个 token 后更新响应并写入词块缓冲区，遇到 EOG 时结束本轮生成，需持有 `_mutex`。
+     */
+    void _acceptToken(LLMSession &session, llama_token token);
+
+    /**
+     * @brief 在不阻塞的前提下把会话的 `pendingText` 写入词块缓冲区，需持有 `_mutex`。
+     *
+     * @return `pendingText` 已全部写入时返回 true。
+     */
+    bool _flushPendingText(LLMSession &session);
+
+    /**
+     * @brief 根据会话句柄查找会话，需持有 `_mutex`。
+     *
+     * @throws std::runtime_error 句柄无效或会话已关闭时抛出。
+     */
+    std::shared_ptr<LLMSession> _getSession(int sessionId);
+
+public:
+    /**
+     * @brief 加载模型并创建所有会话共享的上下文，启动调度线程。
+     *
+     * @param modelPath 模型文件的路径。
+     * @param contextSize 上下文大小，由所有会话平分。
+     * @param nThreads 推理时使用的线程数量。
+     * @param useMmap 是否使用内存映射加载模型。
+     * @param useMlock 是否使用内存锁定。
+     * @param nSeqMax 最多同时存在的会话数量，大于 nBatch 时取 nBatch（生成中的会话每一步各占批次中的一个 token）。
+     * @param nBatch 每一步提交给 llama_decode 的最大 token 数，小于等于 0 时使用默认值。
+     * @param nUbatch 计算图一次处理的最大 token 数，小于等于 0 时使用默认值。
+     */
+    void loadModel(const char *modelPath, long contextSize, int nThreads, bool useMmap, bool useMlock, int nSeqMax,
+                   int nBatch = 0, int nUbatch = 0);
+
+    /**
+     * @brief 创建一个会话。
+     *
+     * @param samplerParams 会话的采样参数。
+     * @param chatTemplate 聊天模板字符串，为 nullptr 时使用模型内置模板。
+     * @return int 会话句柄。
+     * @throws std::runtime_error 会话数量已达上限时抛出。
+     */
+    int createSession(const SamplerParams &samplerParams, const char *chatTemplate);
+
+    /**
+     * @brief 关闭会话，释放其序列在 KV 缓存中的内容；正在进行的生成会先被停止。
+     */
+    void destroySession(int sessionId);
+
+    /**
+     * @brief 向会话的聊天消息列表中添加一条消息。
+     *
+     * @throws std::runtime_error 会话正在生成时抛出。
+     */
+    void addChatMessage(int sessionId, const char *message, const char *role);
+
+    /**
+     * @brief 向会话添加用户查询并开始生成，生成的词块写入会话的缓冲区。
+     *
+     * @throws std::runtime_error 会话正在生成时抛出。
+     */
+    void startCompletion(int sessionId, const char *query);
+
+    /**
+     * @brief 从会话的缓冲区中批量读取已生成的词块，没有可读数据时阻塞。
+     *
+     * @return long 写入的字节数，生成结束后返回 -1。
+     * @throws std::runtime_error 生成出错（例如会话的上下文已满）时抛出。
+     */
+    long drain(int sessionId, char *dst, size_t capacity, int maxPieces);
+
+    /**
+     * @brief 停止会话的本轮生成，等待调度线程完成收尾工作后返回。
+     */
+    void stopCompletion(int sessionId);
+
+    /**
+     * @brief 获取会话最近一次响应的生成速度（token/秒）。
+     */
+    float getResponseGenerationSpeed(int sessionId);
+
+    /**
+     * @brief 获取会话已使用的上下文大小。
+     */
+    int getContextSizeUsed(int sessionId);
+
+    /**
+     * @brief 析构函数，停止调度线程并释放所有会话、上下文和模型。
+     */
+    ~LLMEngine();
+};
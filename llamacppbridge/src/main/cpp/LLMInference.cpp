@@ -1,15 +1,193 @@
 #include "LLMInference.h"
-#include <android/log.h>
+#include "ChatUtils.h"
+#include "CpuDispatch.h"
+#include "Fnv1a.h"
+#include "LLMLog.h"
+#include "LlamaLog.h"
+#include "ModelPrefetch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#define TAG "[SmolLMAndroid-Cpp]"
-#define LOGi(...) __android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__)
-#define LOGe(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
+namespace {
+
+// 会话快照文件格式：
+// SessionHeader | 消息（每条为 u32 角色长度、角色、u32 内容长度、内容，整体补齐到 4 字节）
+//               | token 历史（nTokens 个 llama_token）| 消息起始位置（nMessages 个 llama_pos，-1 表示未知）
+//               | 序列 0 的状态数据（stateSize 字节）
+constexpr uint32_t SESSION_MAGIC   = 0x5345534c; // "LSES"
+constexpr uint32_t SESSION_VERSION = 3;
+
+struct SessionHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t modelFingerprint;
+    uint32_t contextSize;
+    int32_t  prevLen;
+    int32_t  responseStartPos;
+    uint32_t nRenderedMessages;
+    uint32_t nMessages;
+    uint32_t nTokens;
+    uint64_t messagesSize;
+    uint64_t stateSize;
+};
+
+// renders `messages[from, to)` as they would appear after an already rendered `messages[0, from)`:
+// the window `messages[from - 1, to)` is rendered and the rendering of the anchor `messages[from - 1]` stripped
+bool
+renderMessagesDelta(const char *tmpl, const llama_chat_message *messages, size_t from, size_t to, bool addAssistant,
+                    std::vector<char> &buffer, std::string &delta) {
+    int anchorLen = applyChatTemplate(tmpl, messages + from - 1, 1, false, buffer);
+    if (anchorLen < 0) {
+        return false;
+    }
+    std::string anchor(buffer.data(), anchorLen);
+    int len = applyChatTemplate(tmpl, messages + from - 1, to - from + 1, addAssistant, buffer);
+    if (len < anchorLen || memcmp(buffer.data(), anchor.data(), anchorLen) != 0) {
+        return false;
+    }
+    delta.assign(buffer.data() + anchorLen, len - anchorLen);
+    return true;
+}
+
+// checks on a sample conversation that rendering message deltas gives the same text as rendering
+// the full history, i.e. the template has no cross-message logic beyond the first message
+bool
+supportsIncrementalRendering(const char *tmpl) {
+    const llama_chat_message conversation[] = {
+            {"system", "You are a helpful assistant."},
+            {"user", "Hello!"},
+            {"assistant", "Hi, how can I help you?"},
+            {"user", "Tell me a joke."},
+            {"assistant", "Why did the robot go on vacation? To recharge."},
+            {"user", "Another one."},
+    };
+    const size_t n = sizeof(conversation) / sizeof(conversation[0]);
+    std::vector<char> buffer(1024);
+    std::string delta;
+    for (size_t from = 1; from < n; from++) {
+        int prefixLen = applyChatTemplate(tmpl, conversation, from, false, buffer);
+        if (prefixLen < 0) {
+            return false;
+        }
+        std::string prefix(buffer.data(), prefixLen);
+        for (size_t to = from + 1; to <= n; to++) {
+            for (bool addAssistant: {false, true}) {
+                if (!renderMessagesDelta(tmpl, conversation, from, to, addAssistant, buffer, delta)) {
+                    return false;
+                }
+                int fullLen = applyChatTemplate(tmpl, conversation, to, addAssistant, buffer);
+                if (fullLen != (int) (prefix.size() + delta.size()) ||
+                    memcmp(buffer.data(), prefix.data(), prefix.size()) != 0 ||
+                    memcmp(buffer.data() + prefix.size(), delta.data(), delta.size()) != 0) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// fingerprint of the loaded model, cheap enough to compute on every load
+// (hashing the weights of a multi-GB model is not)
+uint64_t
+modelFingerprint(const llama_model *model) {
+    char desc[256];
+    int32_t descLen = llama_model_desc(model, desc, sizeof(desc));
+    uint64_t values[] = {
+            llama_model_n_params(model),
+            llama_model_size(model),
+            (uint64_t) llama_model_n_embd(model),
+            (uint64_t) llama_model_n_layer(model),
+            (uint64_t) llama_vocab_n_tokens(llama_model_get_vocab(model)),
+    };
+    uint64_t hash = FNV1A_OFFSET_BASIS;
+    hash = fnv1a(hash, desc, std::max(descLen, 0));
+    hash = fnv1a(hash, values, sizeof(values));
+    return hash;
+}
+
+void
+appendString(std::vector<char> &blob, const char *str) {
+    uint32_t len = (uint32_t) strlen(str);
+    blob.insert(blob.end(), (const char *) &len, (const char *) &len + sizeof(len));
+    blob.insert(blob.end(), str, str + len);
+}
+
+bool
+readString(const char *&cursor, const char *end, std::string &out) {
+    uint32_t len;
+    if (end - cursor < (long) sizeof(len)) {
+        return false;
+    }
+    memcpy(&len, cursor, sizeof(len));
+    cursor += sizeof(len);
+    if (end - cursor < (long) len) {
+        return false;
+    }
+    out.assign(cursor, len);
+    cursor += len;
+    return true;
+}
+
+bool
+isSupportedKvCacheType(int type) {
+    return type == GGML_TYPE_F16 || type == GGML_TYPE_Q8_0 || type == GGML_TYPE_Q4_0;
+}
+
+// log of the softmax denominator, so that logits[i] - logPartition(...) is the log probability of token i
+float
+logPartition(const float *logits, int nVocab) {
+    const float maxLogit = *std::max_element(logits, logits + nVocab);
+    float sum = 0.0f;
+    for (int i = 0; i < nVocab; i++) {
+        sum += expf(logits[i] - maxLogit);
+    }
+    return maxLogit + logf(sum);
+}
+
+struct SamplerDeleter {
+    void operator()(llama_sampler *sampler) const { llama_sampler_free(sampler); }
+};
+
+} // namespace
 
 void
 LLMInference::loadModel(const char *model_path, float minP, float temperature, bool storeChats, long contextSize,
-                        const char *chatTemplate, int nThreads, bool useMmap, bool useMlock) {
+                        const char *chatTemplate, const ThreadParams &threadParams, bool useMmap, bool useMlock,
+                        int nBatch,
+                        int nUbatch, int typeK, int typeV, int flashAttn, int maxCandidates,
+                        llama_progress_callback progressCallback, void *progressUserData) {
+    // 逻辑批大小不超过上下文大小，物理批大小不超过逻辑批大小
+    if (nBatch <= 0) {
+        nBatch = 512;
+    }
+    nBatch = (int) std::min<long>(nBatch, contextSize);
+    if (nUbatch <= 0) {
+        nUbatch = 512;
+    }
+    nUbatch = std::min(nUbatch, nBatch);
+    if (!isSupportedKvCacheType(typeK) || !isSupportedKvCacheType(typeV)) {
+        throw std::runtime_error("unsupported KV cache type");
+    }
+    if (flashAttn < LLAMA_FLASH_ATTN_TYPE_AUTO || flashAttn > LLAMA_FLASH_ATTN_TYPE_ENABLED) {
+        throw std::runtime_error("invalid flash attention type");
+    }
+    if (typeV != GGML_TYPE_F16 && flashAttn == LLAMA_FLASH_ATTN_TYPE_DISABLED) {
+        // llama.cpp only reads a quantized V cache through the flash attention kernel
+        throw std::runtime_error("a quantized V cache requires flash attention");
+    }
+    if (maxCandidates < 0) {
+        throw std::runtime_error("invalid number of candidates");
+    }
+    _threads.configure(threadParams);
     LOGi("loading model with"
          "\n\tmodel_path = %s"
          "\n\tminP = %f"
@@ -17,45 +195,95 @@ LLMInference::loadModel(const char *model_path, float minP, float temperature, b
          "\n\tstoreChats = %d"
          "\n\tcontextSize = %li"
          "\n\tchatTemplate = %s"
-         "\n\tnThreads = %d"
+         "\n\tthreads = %s"
          "\n\tuseMmap = %d"
-         "\n\tuseMlock = %d",
-         model_path, minP, temperature, storeChats, contextSize, chatTemplate, nThreads, useMmap, useMlock);
+         "\n\tuseMlock = %d"
+         "\n\tnBatch = %d"
+         "\n\tnUbatch = %d"
+         "\n\ttypeK = %s"
+         "\n\ttypeV = %s"
+         "\n\tflashAttn = %d"
+         "\n\tmaxCandidates = %d",
+         model_path, minP, temperature, storeChats, contextSize, chatTemplate, _threads.describe().c_str(), useMmap,
+         useMlock, nBatch, nUbatch, ggml_type_name((ggml_type) typeK), ggml_type_name((ggml_type) typeV), flashAttn,
+         maxCandidates);
 
-    // load dynamic backends
-    ggml_backend_load_all();
+    int64_t loadStart = ggml_time_us();
+    installLlamaLogHook();
+    // load the CPU backend variant for this device and the other dynamic backends
+    loadCpuBackend();
 
     // create an instance of llama_model
     llama_model_params model_params = llama_model_default_params();
     model_params.use_mmap = useMmap;
     model_params.use_mlock = useMlock;
+    if (progressCallback != nullptr) {
+        model_params.progress_callback = progressCallback;
+        model_params.progress_callback_user_data = progressUserData;
+    }
     _model = llama_model_load_from_file(model_path, model_params);
     if (!_model) {
         LOGe("failed to load model from %s", model_path);
         throw std::runtime_error("loadModel() failed");
     }
+    _tokenizer = std::make_unique<Tokenizer>(_model);
 
     // create an instance of llama_context
     llama_context_params ctx_params = llama_context_default_params();
     ctx_params.n_ctx = contextSize;
-    ctx_params.n_batch = contextSize;
-    ctx_params.n_threads = nThreads;
+    ctx_params.n_batch = nBatch;
+    ctx_params.n_ubatch = nUbatch;
+    ctx_params.n_threads = _threads.nThreads();
+    ctx_params.n_threads_batch = _threads.nThreadsBatch();
+    ctx_params.type_k = (ggml_type) typeK;
+    ctx_params.type_v = (ggml_type) typeV;
+    ctx_params.flash_attn_type = (llama_flash_attn_type) flashAttn;
     ctx_params.no_perf = true; // disable performance metrics
+    if (maxCandidates > 0) {
+        // sequence 0 holds the chat, the candidates fork from it and share its cells instead of
+        // getting n_ctx / n_seq_max cells each
+        ctx_params.n_seq_max = maxCandidates + 1;
+        ctx_params.kv_unified = true;
+    }
+    takeComputeBufferSize();
+    takeKvCacheSize();
     _ctx = llama_init_from_model(_model, ctx_params);
     if (!_ctx) {
         LOGe("llama_new_context_with_model() returned null)");
         throw std::runtime_error("llama_new_context_with_model() returned null");
     }
+    _threads.attach(_ctx);
+    // lets cancel() and the deadline stop a llama_decode() between graph nodes
+    llama_set_abort_callback(_ctx, _abortCallback, this);
+    _metrics = InferenceMetrics();
+    _metrics.computeBufferBytes = takeComputeBufferSize();
+    _metrics.kvCacheBytes = takeKvCacheSize();
 
     // create an instance of llama_sampler
-    llama_sampler_chain_params sampler_params = llama_sampler_chain_default_params();
-    sampler_params.no_perf = true; // disable performance metrics
-    _sampler = llama_sampler_chain_init(sampler_params);
-    llama_sampler_chain_add(_sampler, llama_sampler_init_temp(temperature));
-    llama_sampler_chain_add(_sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+    _samplerParams = SamplerParams();
+    _samplerParams.minP = minP;
+    _samplerParams.temperature = temperature;
+    _sampler = createSamplerChain(_samplerParams);
+    _maxCandidates = maxCandidates;
+    llama_batch_free(_candidateBatch);
+    _candidateBatch = maxCandidates > 0 ? llama_batch_init(maxCandidates, 0, 1) : llama_batch{};
 
     _formattedMessages = std::vector<char>(llama_n_ctx(_ctx));
     _messages.clear();
+    _messageArena.clear();
+    // the buffers of the decode loop are sized once, so that generating a token does not allocate
+    _tokenHistory.reserve(llama_n_ctx(_ctx));
+    _decodeLatencies.reserve(llama_n_ctx(_ctx));
+    _candidates.reserve(llama_vocab_n_tokens(llama_model_get_vocab(_model)));
+    _response.reserve(16 * 1024);
+    _pieceBytes.resize(256);
+    _pieceText.resize(Utf8Stream::maxOutputSize(_pieceBytes.size()) + 1);
+    _tokenHistory.clear();
+    _messageStartPos.clear();
+    _ngramCacheContext.clear();
+    _ngramCacheTokens = 0;
+    _modelFingerprint = modelFingerprint(_model);
+    _modelPath = model_path;
 
     if (chatTemplate == nullptr) {
         _chatTemplate = llama_model_chat_template(_model, nullptr);
@@ -63,11 +291,67 @@ LLMInference::loadModel(const char *model_path, float minP, float temperature, b
         _chatTemplate = strdup(chatTemplate);
     }
     this->_storeChats = storeChats;
+    _prevLen = 0;
+    _renderedMessages = 0;
+    _incrementalTemplate = supportsIncrementalRendering(_chatTemplate);
+    LOGi("incremental chat template rendering: %d", _incrementalTemplate);
+    _metrics.loadMs = (double) (ggml_time_us() - loadStart) / 1000.0;
+}
+
+void
+LLMInference::warmup(bool prefetch) {
+    int64_t start = ggml_time_us();
+    if (prefetch) {
+        size_t prefetched = prefetchMappedFile(_modelPath.c_str());
+        LOGi("prefetched %zu MB of the model in %lld ms", prefetched >> 20,
+             (long long) (ggml_time_us() - start) / 1000);
+    }
+
+    // a dummy decode allocates the compute buffers and starts the worker threads
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    std::vector<llama_token> tokens;
+    if (llama_vocab_bos(vocab) != LLAMA_TOKEN_NULL) {
+        tokens.push_back(llama_vocab_bos(vocab));
+    }
+    if (llama_vocab_eos(vocab) != LLAMA_TOKEN_NULL) {
+        tokens.push_back(llama_vocab_eos(vocab));
+    }
+    if (tokens.empty()) {
+        tokens.push_back(0);
+    }
+    llama_set_warmup(_ctx, true);
+    int result = llama_decode(_ctx, llama_batch_get_one(tokens.data(), (int32_t) tokens.size()));
+    llama_set_warmup(_ctx, false);
+    llama_memory_clear(llama_get_memory(_ctx), true);
+    llama_synchronize(_ctx);
+    if (result < 0) {
+        throw std::runtime_error("llama_decode() failed");
+    }
+    _metrics.warmupMs = (double) (ggml_time_us() - start) / 1000.0;
+    LOGi("warm-up took %.0f ms", _metrics.warmupMs);
+}
+
+InferenceMetrics
+LLMInference::getMetrics() const {
+    InferenceMetrics metrics = _metrics;
+    metrics.decodeTokens = (int) _responseNumTokens;
+    metrics.decodeSteps = (int) _decodeLatencies.size();
+    int64_t decodeTime = 0;
+    for (int64_t latency: _decodeLatencies) {
+        decodeTime += latency;
+    }
+    metrics.decodeMs = (double) decodeTime / 1000.0;
+    metrics.setDecodeLatencies(_decodeLatencies);
+    metrics.sampleMs = (double) _sampleTime / 1000.0;
+    metrics.detokenizeMs = (double) _detokenizeTime / 1000.0;
+    metrics.kvCacheUsed = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
+    metrics.kvCacheSize = (int) llama_n_ctx(_ctx);
+    return metrics;
 }
 
 void
 LLMInference::addChatMessage(const char *message, const char *role) {
-    _messages.push_back({strdup(role), strdup(message)});
+    _messages.push_back({_messageArena.copy(role), _messageArena.copy(message)});
 }
 
 float
@@ -75,148 +359,1387 @@ LLMInference::getResponseGenerationTime() const {
     return (float) _responseNumTokens / (_responseGenerationTime / 1e6);
 }
 
+void
+LLMInference::setSamplerParams(const SamplerParams &params) {
+    llama_sampler *sampler = createSamplerChain(params);
+    llama_sampler_free(_sampler);
+    _sampler = sampler;
+    _samplerParams = params;
+}
+
+void
+LLMInference::setGrammar(const char *grammar, bool isJsonSchema) {
+    llama_sampler *sampler = nullptr;
+    if (grammar != nullptr && grammar[0] != '\0') {
+        sampler = _grammarCache.create(llama_model_get_vocab(_model), grammar, isJsonSchema);
+    }
+    if (_grammarSampler) {
+        llama_sampler_free(_grammarSampler);
+    }
+    _grammarSampler = sampler;
+}
+
+void
+LLMInference::setContextOverflowPolicy(int policy, int nKeep) {
+    if (policy < CONTEXT_OVERFLOW_FAIL || policy > CONTEXT_OVERFLOW_RESTART) {
+        throw std::runtime_error("unknown context overflow policy");
+    }
+    _overflowPolicy = policy;
+    _nKeep = nKeep;
+}
+
 int
 LLMInference::getContextSizeUsed() const {
     return _nCtxUsed;
 }
 
+int
+LLMInference::getPromptTokenCount() const {
+    return (int) _promptTokens.size();
+}
+
+float
+LLMInference::getPrefillProgress() const {
+    int total = _prefillTokensTotal.load();
+    return total > 0 ? (float) _prefillTokensDone.load() / (float) total : 0.0f;
+}
+
+float
+LLMInference::getPrefillSpeed() const {
+    int64_t prefillTime = _prefillTime.load();
+    return prefillTime > 0 ? (float) _prefillTokensDone.load() / (prefillTime / 1e6) : 0.0f;
+}
+
 void
-LLMInference::startCompletion(const char *query) {
+LLMInference::cancel() {
+    _cancelRequested = true;
+}
+
+int
+LLMInference::getStopReason() const {
+    return _stopReason.load();
+}
+
+bool
+LLMInference::_abortCallback(void *data) {
+    return static_cast<LLMInference *>(data)->_checkAbort();
+}
+
+bool
+LLMInference::_checkAbort() {
+    // called by the ggml threads between graph nodes, keep it to two relaxed loads and a clock read
+    if (_cancelRequested.load(std::memory_order_relaxed)) {
+        _stopReason = STOP_CANCELLED;
+        return true;
+    }
+    const int64_t deadline = _deadlineUs.load(std::memory_order_relaxed);
+    if (deadline > 0 && ggml_time_us() >= deadline) {
+        _stopReason = STOP_DEADLINE;
+        return true;
+    }
+    return false;
+}
+
+void
+LLMInference::loadDraftModel(const char *modelPath) {
+    LOGi("loading draft model from %s", modelPath);
+    if (_draftModel) {
+        llama_free(_draftCtx);
+        llama_model_free(_draftModel);
+        llama_sampler_free(_draftSampler);
+        _draftModel = nullptr;
+        _draftCtx = nullptr;
+        _draftSampler = nullptr;
+        _draftHistory.clear();
+    }
+
+    // create an instance of llama_model for the draft model
+    llama_model_params model_params = llama_model_default_params();
+    llama_model *draftModel = llama_model_load_from_file(modelPath, model_params);
+    if (!draftModel) {
+        LOGe("failed to load draft model from %s", modelPath);
+        throw std::runtime_error("loadDraftModel() failed");
+    }
+
+    // the drafts are verified token by token, so both models have to map ids to the same text
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    const llama_vocab *draftVocab = llama_model_get_vocab(draftModel);
+    if (llama_vocab_type(vocab) != llama_vocab_type(draftVocab) ||
+        llama_vocab_bos(vocab) != llama_vocab_bos(draftVocab) ||
+        llama_vocab_eos(vocab) != llama_vocab_eos(draftVocab) ||
+        std::abs(llama_vocab_n_tokens(vocab) - llama_vocab_n_tokens(draftVocab)) > 128) {
+        llama_model_free(draftModel);
+        throw std::runtime_error("loadDraftModel(): the vocabulary of the draft model does not match the model");
+    }
+
+    // create an instance of llama_context for the draft model
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = llama_n_ctx(_ctx);
+    ctx_params.n_batch = llama_n_batch(_ctx);
+    ctx_params.n_ubatch = llama_n_ubatch(_ctx);
+    ctx_params.n_threads = llama_n_threads(_ctx);
+    ctx_params.n_threads_batch = llama_n_threads_batch(_ctx);
+    ctx_params.no_perf = true; // disable performance metrics
+    llama_context *draftCtx = llama_init_from_model(draftModel, ctx_params);
+    if (!draftCtx) {
+        llama_model_free(draftModel);
+        throw std::runtime_error("llama_init_from_model() returned null for the draft model");
+    }
+    _threads.attach(draftCtx);
+    llama_set_abort_callback(draftCtx, _abortCallback, this);
+
+    // create an instance of llama_sampler for drafting
+    SamplerParams draftSamplerParams;
+    draftSamplerParams.greedy = true;
+    _draftSampler = createSamplerChain(draftSamplerParams);
+    _draftModel = draftModel;
+    _draftCtx = draftCtx;
+}
+
+void
+LLMInference::setSpeculativeDecoding(int mode, int nDraft) {
+    if (mode < SPECULATIVE_NONE || mode > SPECULATIVE_NGRAM) {
+        throw std::runtime_error("unknown speculative decoding mode");
+    }
+    if (mode != SPECULATIVE_NONE) {
+        if (nDraft <= 0) {
+            throw std::runtime_error("nDraft has to be positive");
+        }
+        if (mode == SPECULATIVE_DRAFT_MODEL && !_draftModel) {
+            throw std::runtime_error("no draft model loaded, call loadDraftModel() first");
+        }
+        // rejected drafts are removed from the KV cache, which recurrent memory cannot do
+        if (llama_model_is_recurrent(_model) || llama_model_is_hybrid(_model)) {
+            throw std::runtime_error("speculative decoding is not supported for recurrent models");
+        }
+        nDraft = std::min(nDraft, (int) llama_n_batch(_ctx) - 1);
+    }
+    if (nDraft != _nDraft || mode == SPECULATIVE_NONE) {
+        llama_batch_free(_speculativeBatch);
+        _speculativeBatch = {};
+        if (mode != SPECULATIVE_NONE) {
+            _speculativeBatch = llama_batch_init(nDraft + 1, 0, 1);
+        }
+    }
+    _speculativeMode = mode;
+    _nDraft = mode == SPECULATIVE_NONE ? 0 : nDraft;
+    _nDrafted = 0;
+    _nDraftAccepted = 0;
+}
+
+float
+LLMInference::getDraftAcceptanceRate() const {
+    return _nDrafted > 0 ? (float) _nDraftAccepted / (float) _nDrafted : 0.0f;
+}
+
+int
+LLMInference::loadLoraAdapter(const char *path) {
+    for (size_t i = 0; i < _loraAdapters.size(); i++) {
+        if (_loraAdapters[i].second == path) {
+            return (int) i;
+        }
+    }
+    int64_t start = ggml_time_us();
+    llama_adapter_lora *adapter = llama_adapter_lora_init(_model, path);
+    if (!adapter) {
+        LOGe("failed to load LoRA adapter from %s", path);
+        throw std::runtime_error("loadLoraAdapter() failed");
+    }
+    _loraAdapters.emplace_back(adapter, path);
+    _loraScales.push_back(0.0f);
+    LOGi("loaded LoRA adapter %s in %.2f ms", path, (double) (ggml_time_us() - start) / 1000.0);
+    return (int) _loraAdapters.size() - 1;
+}
+
+void
+LLMInference::setLoraAdapter(int id, float scale) {
+    if (id < 0 || id >= (int) _loraAdapters.size()) {
+        throw std::runtime_error("setLoraAdapter(): invalid adapter id");
+    }
+    if (_loraScales[id] == scale) {
+        return;
+    }
+    llama_adapter_lora *adapter = _loraAdapters[id].first;
+    // only the small adapter tensors are attached to (or detached from) the context, the base weights stay as they are
+    int32_t result = scale == 0.0f ? llama_rm_adapter_lora(_ctx, adapter) : llama_set_adapter_lora(_ctx, adapter, scale);
+    if (result != 0 && scale != 0.0f) {
+        throw std::runtime_error("llama_set_adapter_lora() failed");
+    }
+    _loraScales[id] = scale;
+    _clearKvCache();
+}
+
+void
+LLMInference::clearLoraAdapters() {
+    if (std::all_of(_loraScales.begin(), _loraScales.end(), [](float scale) { return scale == 0.0f; })) {
+        return;
+    }
+    llama_clear_adapter_lora(_ctx);
+    std::fill(_loraScales.begin(), _loraScales.end(), 0.0f);
+    _clearKvCache();
+}
+
+void
+LLMInference::initEmbeddings(const EmbeddingParams &params) {
+    _embeddings.reset();
+    _embeddings = std::make_unique<EmbeddingContext>(_model, params, _threads);
+}
+
+int
+LLMInference::getEmbeddingSize() const {
+    return llama_model_n_embd(_model);
+}
+
+void
+LLMInference::embed(const std::vector<std::string> &texts, bool normalize, float *out) {
+    if (!_embeddings) {
+        throw std::runtime_error("embed(): initEmbeddings() has not been called");
+    }
+    _embeddings->embed(texts, normalize, out);
+}
+
+Tokenizer &
+LLMInference::getTokenizer() {
+    if (!_tokenizer) {
+        throw std::runtime_error("getTokenizer(): the model is not loaded");
+    }
+    return *_tokenizer;
+}
+
+void
+LLMInference::_clearKvCache() {
+    llama_memory_seq_rm(llama_get_memory(_ctx), 0, -1, -1);
+    _tokenHistory.clear();
+    _messageStartPos.clear();
+    _prevLen = 0;
+    _renderedMessages = 0;
+    _nCtxUsed = 0;
+}
+
+void
+LLMInference::startCompletion(const char *query, const GenerationLimits &limits) {
+    _cancelRequested = false;
+    _stopReason = STOP_NONE;
+    _maxTokens = std::max(limits.maxTokens, 0);
     if (!_storeChats) {
         _prevLen = 0;
-        _formattedMessages.clear();
-        _formattedMessages = std::vector<char>(llama_n_ctx(_ctx));
+        _renderedMessages = 0;
     }
+    _completionStart = ggml_time_us();
+    _deadlineUs = limits.timeoutMs > 0 ? _completionStart + (int64_t) limits.timeoutMs * 1000 : 0;
+    _firstTokenPending = true;
+    _metrics.tokenizeMs = _metrics.prefillMs = _metrics.ttftMs = 0.0;
+    _metrics.prefillTokens = 0;
+    _decodeLatencies.clear();
+    _sampleTime = 0;
+    _detokenizeTime = 0;
     _responseGenerationTime = 0;
     _responseNumTokens = 0;
+    _acceptedTokens.clear();
+    _acceptedTokensPos = 0;
+    if (_grammarSampler) {
+        // every response is matched against the grammar from its root rule
+        llama_sampler_reset(_grammarSampler);
+    }
     addChatMessage(query, "user");
-    // apply the chat-template
-    int newLen = llama_chat_apply_template(_chatTemplate, _messages.data(), _messages.size(), true,
-                                           _formattedMessages.data(), _formattedMessages.size());
-    if (newLen > (int) _formattedMessages.size()) {
-        // resize the output buffer `_formattedMessages`
-        // and re-apply the chat template
-        _formattedMessages.resize(newLen);
-        newLen = llama_chat_apply_template(_chatTemplate, _messages.data(), _messages.size(), true,
-                                           _formattedMessages.data(), _formattedMessages.size());
+    // apply the chat-template to the messages that have not been seen by the model yet
+    std::string prompt = _renderNewMessages(true);
+    _promptTokens = common_tokenize(llama_model_get_vocab(_model), prompt, true, true);
+    if (!_storeChats) {
+        // the full prompt is rendered for every query, decode only what differs from the KV cache
+        _reuseCachedPrefix();
     }
+    _metrics.tokenizeMs = (double) (ggml_time_us() - _completionStart) / 1000.0;
+
+    // the batch only points at the prompt tokens, later at `_currToken`
+    _batch = llama_batch_get_one(_promptTokens.data(), (int32_t) _promptTokens.size());
+    _utf8Stream.reset();
+
+    // the prompt is decoded in n_batch sized chunks by the first call to completionLoop()
+    _prefillPending = true;
+    _prefillCancelled = false;
+    _prefillTokensDone = 0;
+    _prefillTokensTotal = (int) _promptTokens.size();
+    _prefillTime = 0;
+}
+
+std::string
+LLMInference::_renderNewMessages(bool addAssistant) {
+    std::string delta;
+    if (_incrementalTemplate && _renderedMessages > 0 &&
+        renderMessagesDelta(_chatTemplate, _messages.data(), _renderedMessages, _messages.size(), addAssistant,
+                            _formattedMessages, delta)) {
+        return delta;
+    }
+    int newLen = applyChatTemplate(_chatTemplate, _messages.data(), _messages.size(), addAssistant,
+                                   _formattedMessages);
     if (newLen < 0) {
-        throw std::runtime_error("llama_chat_apply_template() in LLMInference::startCompletion() failed");
+        throw std::runtime_error("llama_chat_apply_template() in LLMInference::_renderNewMessages() failed");
     }
-    std::string prompt(_formattedMessages.begin() + _prevLen, _formattedMessages.begin() + newLen);
-    _promptTokens = common_tokenize(llama_model_get_vocab(_model), prompt, true, true);
+    return std::string(_formattedMessages.begin() + _prevLen, _formattedMessages.begin() + newLen);
+}
+
+void
+LLMInference::_reuseCachedPrefix() {
+    size_t nCommon = 0;
+    size_t nMax = std::min(_tokenHistory.size(), _promptTokens.size());
+    while (nCommon < nMax && _tokenHistory[nCommon] == _promptTokens[nCommon]) {
+        nCommon++;
+    }
+    // at least one token has to be decoded to obtain the logits for sampling
+    if (nCommon == _promptTokens.size() && nCommon > 0) {
+        nCommon--;
+    }
+    llama_memory_t memory = llama_get_memory(_ctx);
+    if (!llama_memory_seq_rm(memory, 0, (llama_pos) nCommon, -1)) {
+        // recurrent memory cannot drop a partial sequence, start from an empty cache instead
+        llama_memory_seq_rm(memory, 0, -1, -1);
+        nCommon = 0;
+    }
+    _tokenHistory.resize(nCommon);
+    _promptTokens.erase(_promptTokens.begin(), _promptTokens.begin() + (long) nCommon);
+}
+
+void
+LLMInference::_removeLastChatMessage() {
+    llama_chat_message &message = _messages.back();
+    // in reverse order of allocation, so that both strings are given back to the arena
+    _messageArena.release(message.content);
+    _messageArena.release(message.role);
+    _messages.pop_back();
+    if (_messageStartPos.size() > _messages.size()) {
+        _messageStartPos.pop_back();
+    }
+}
+
+void
+LLMInference::_dropMessages(size_t first, size_t count) {
+    for (size_t i = first; i < first + count; i++) {
+        _messageArena.release(_messages[i].role);
+        _messageArena.release(_messages[i].content);
+    }
+    _messages.erase(_messages.begin() + (long) first, _messages.begin() + (long) (first + count));
+    if (_messageArena.wastedBytes() > _messageArena.usedBytes() / 2) {
+        _compactMessages();
+    }
+    if (_messageStartPos.size() > first) {
+        size_t nPositions = std::min(count, _messageStartPos.size() - first);
+        _messageStartPos.erase(_messageStartPos.begin() + (long) first,
+                               _messageStartPos.begin() + (long) (first + nPositions));
+    }
+    if (_renderedMessages > first) {
+        _renderedMessages -= std::min(count, _renderedMessages - first);
+        // the rendered prefix changed, re-render it once to keep `_prevLen` in sync
+        _prevLen = _renderedMessages == 0 ? 0 : applyChatTemplate(_chatTemplate, _messages.data(), _renderedMessages,
+                                                                   false, _formattedMessages);
+        if (_prevLen < 0) {
+            throw std::runtime_error("llama_chat_apply_template() in LLMInference::_dropMessages() failed");
+        }
+    }
+}
+
+void
+LLMInference::_compactMessages() {
+    MessageArena arena;
+    for (llama_chat_message &message: _messages) {
+        message.role = arena.copy(message.role);
+        message.content = arena.copy(message.content);
+    }
+    _messageArena = std::move(arena);
+}
+
+void
+LLMInference::_makeContextSpace(int nTokens) {
+    const int contextSize = (int) llama_n_ctx(_ctx);
+    _nCtxUsed = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
+    if (_nCtxUsed + nTokens <= contextSize) {
+        return;
+    }
+    switch (_overflowPolicy) {
+    case CONTEXT_OVERFLOW_SHIFT:
+        if (llama_memory_can_shift(llama_get_memory(_ctx))) {
+            while (_nCtxUsed + nTokens > contextSize) {
+                if (!_shiftContext()) {
+                    throw std::runtime_error("context size reached");
+                }
+            }
+            return;
+        }
+        // the memory of this model cannot shift positions, start over instead
+        _restartContext(nTokens);
+        return;
+    case CONTEXT_OVERFLOW_RESTART:
+        _restartContext(nTokens);
+        return;
+    default:
+        throw std::runtime_error("context size reached");
+    }
+}
 
-    // create a llama_batch containing a single sequence
-    // see llama_batch_init for more details
-    _batch = new llama_batch();
-    _batch->token = _promptTokens.data();
-    _batch->n_tokens = _promptTokens.size();
+int
+LLMInference::_keepTokenCount() {
+    if (_nKeep >= 0) {
+        return std::min(_nKeep, (int) _tokenHistory.size());
+    }
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    int nBos = llama_vocab_get_add_bos(vocab) ? 1 : 0;
+    if (_messages.empty() || strcmp(_messages[0].role, "system") != 0) {
+        return std::min(nBos, (int) _tokenHistory.size());
+    }
+    // the system prompt is the common prefix of its own rendering and the tokens in the KV cache
+    int len = applyChatTemplate(_chatTemplate, _messages.data(), 1, false, _formattedMessages);
+    if (len < 0) {
+        return std::min(nBos, (int) _tokenHistory.size());
+    }
+    std::vector<llama_token> systemTokens =
+            common_tokenize(vocab, std::string(_formattedMessages.data(), len), true, true);
+    size_t nKeep = 0;
+    while (nKeep < systemTokens.size() && nKeep < _tokenHistory.size() &&
+           systemTokens[nKeep] == _tokenHistory[nKeep]) {
+        nKeep++;
+    }
+    return (int) nKeep;
 }
 
-// taken from:
-// https://github.com/ggerganov/llama.cpp/blob/master/examples/llama.android/llama/src/main/cpp/llama-android.cpp#L38
 bool
-LLMInference::_isValidUtf8(const char *response) {
-    if (!response) {
-        return true;
+LLMInference::_shiftContext() {
+    const int nPast = _nCtxUsed;
+    const int nKeep = _keepTokenCount();
+    const int nDiscard = (nPast - nKeep) / 2;
+    if (nDiscard <= 0) {
+        return false;
+    }
+    const int discardEnd = nKeep + nDiscard;
+    llama_memory_t memory = llama_get_memory(_ctx);
+    llama_memory_seq_rm(memory, 0, nKeep, discardEnd);
+    llama_memory_seq_add(memory, 0, discardEnd, nPast, -nDiscard);
+    _tokenHistory.erase(_tokenHistory.begin() + nKeep, _tokenHistory.begin() + discardEnd);
+
+    // drop the leading messages (after the system prompt) that now lie entirely in the discarded range,
+    // a message ends where the next message with a later start position begins
+    const size_t first = (!_messages.empty() && strcmp(_messages[0].role, "system") == 0) ? 1 : 0;
+    size_t count = 0;
+    for (size_t i = first; i < _messageStartPos.size() && i + 1 < _messages.size(); i++) {
+        llama_pos end = _responseStartPos > _messageStartPos[i] ? _responseStartPos : nPast;
+        for (size_t j = i + 1; j < _messageStartPos.size(); j++) {
+            if (_messageStartPos[j] > _messageStartPos[i]) {
+                end = _messageStartPos[j];
+                break;
+            }
+        }
+        if (_messageStartPos[i] < nKeep || end > discardEnd) {
+            break;
+        }
+        count++;
+    }
+    if (count > 0) {
+        _dropMessages(first, count);
+    }
+
+    auto shiftPos = [&](llama_pos pos) {
+        return pos >= discardEnd ? pos - nDiscard : std::min(pos, (llama_pos) nKeep);
+    };
+    for (llama_pos &pos: _messageStartPos) {
+        pos = shiftPos(pos);
+    }
+    _responseStartPos = shiftPos(_responseStartPos);
+    _nCtxUsed = nPast - nDiscard;
+    LOGi("context shift: kept %d tokens, discarded %d tokens and %zu messages", nKeep, nDiscard, count);
+    return true;
+}
+
+void
+LLMInference::_restartContext(int nTokens) {
+    const int contextSize = (int) llama_n_ctx(_ctx);
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    const bool inPrefill = _prefillPending;
+    // while generating, the part of the response that is already in the KV cache is carried over
+    std::vector<llama_token> responseTokens;
+    if (!inPrefill) {
+        size_t responseStart = std::min((size_t) _responseStartPos, _tokenHistory.size());
+        responseTokens.assign(_tokenHistory.begin() + (long) responseStart, _tokenHistory.end());
+    }
+
+    // drop the oldest turns (keeping the system prompt and the current query)
+    // until the history fits into half of the context
+    const size_t first = (!_messages.empty() && strcmp(_messages[0].role, "system") == 0) ? 1 : 0;
+    std::vector<llama_token> tokens;
+    size_t nDropped = 0;
+    while (true) {
+        int len = applyChatTemplate(_chatTemplate, _messages.data(), _messages.size(), true, _formattedMessages);
+        if (len < 0) {
+            throw std::runtime_error("llama_chat_apply_template() in LLMInference::_restartContext() failed");
+        }
+        tokens = common_tokenize(vocab, std::string(_formattedMessages.data(), len), true, true);
+        int total = (int) (tokens.size() + responseTokens.size()) + (inPrefill ? 0 : nTokens);
+        if (total <= contextSize / 2) {
+            break;
+        }
+        if (first + 1 >= _messages.size()) {
+            if (total <= contextSize) {
+                break;
+            }
+            throw std::runtime_error("context size reached");
+        }
+        _dropMessages(first, 1);
+        nDropped++;
     }
-    const unsigned char *bytes = (const unsigned char *) response;
-    int num;
-    while (*bytes != 0x00) {
-        if ((*bytes & 0x80) == 0x00) {
-            // U+0000 to U+007F
-            num = 1;
-        } else if ((*bytes & 0xE0) == 0xC0) {
-            // U+0080 to U+07FF
-            num = 2;
-        } else if ((*bytes & 0xF0) == 0xE0) {
-            // U+0800 to U+FFFF
-            num = 3;
-        } else if ((*bytes & 0xF8) == 0xF0) {
-            // U+10000 to U+10FFFF
-            num = 4;
+
+    llama_memory_seq_rm(llama_get_memory(_ctx), 0, -1, -1);
+    _tokenHistory.clear();
+    _messageStartPos.clear();
+    LOGi("context restart: dropped %zu messages, re-prefilling %zu tokens", nDropped,
+         tokens.size() + responseTokens.size());
+    if (inPrefill) {
+        // the pending prefill now covers the whole remaining history
+        _promptTokens = std::move(tokens);
+        _batch = llama_batch_get_one(_promptTokens.data(), (int32_t) _promptTokens.size());
+        _prefillTokensTotal = (int) _promptTokens.size();
+    } else {
+        const llama_pos responseStart = (llama_pos) tokens.size();
+        tokens.insert(tokens.end(), responseTokens.begin(), responseTokens.end());
+        _promptTokens = std::move(tokens);
+        _prefillTokensTotal = (int) _promptTokens.size();
+        if (!_prefill()) {
+            throw std::runtime_error("context restart cancelled");
+        }
+        _responseStartPos = responseStart;
+    }
+    _nCtxUsed = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
+}
+
+bool
+LLMInference::_prefill() {
+    const int nBatch = (int) llama_n_batch(_ctx);
+    const int nTotal = (int) _promptTokens.size();
+    const llama_pos startPos = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
+    auto start = ggml_time_us();
+    for (int i = 0; i < nTotal; i += nBatch) {
+        int nTokens = std::min(nBatch, nTotal - i);
+        // llama_decode() returns 2 when the abort callback stopped it inside the chunk
+        int result = _checkAbort() ? 2 : llama_decode(_ctx, llama_batch_get_one(_promptTokens.data() + i, nTokens));
+        if (result != 0 && result != 2) {
+            // 1 means no KV slot was found, the prompt is dropped as a whole like a cancelled one
+            llama_memory_seq_rm(llama_get_memory(_ctx), 0, startPos, -1);
+            throw std::runtime_error("llama_decode() failed: " + std::to_string(result));
+        }
+        if (result == 2) {
+            // drop the chunks (and ubatches) that were already decoded for this prompt
+            llama_memory_seq_rm(llama_get_memory(_ctx), 0, startPos, -1);
+            _prefillCancelled = true;
+            return false;
+        }
+        _prefillTokensDone = i + nTokens;
+        _prefillTime = ggml_time_us() - start;
+    }
+    _metrics.prefillTokens += nTotal;
+    _metrics.prefillMs += (double) (ggml_time_us() - start) / 1000.0;
+    _tokenHistory.insert(_tokenHistory.end(), _promptTokens.begin(), _promptTokens.end());
+    // the messages rendered into this prompt start where the prompt starts
+    for (size_t i = _messageStartPos.size(); i < _messages.size(); i++) {
+        _messageStartPos.push_back(startPos);
+    }
+    _responseStartPos = startPos + nTotal;
+    return true;
+}
+
+llama_token
+LLMInference::_sampleToken(int32_t idx) {
+    int64_t start = ggml_time_us();
+
+    // the same steps as llama_sampler_sample(), which allocates the candidate array on every call
+    const float *logits = llama_get_logits_ith(_ctx, idx);
+    const int nVocab = llama_vocab_n_tokens(llama_model_get_vocab(_model));
+    _candidates.resize(nVocab);
+    for (llama_token id = 0; id < nVocab; id++) {
+        _candidates[id] = {id, logits[id], 0.0f};
+    }
+    llama_token_data_array candidates = {_candidates.data(), _candidates.size(), -1, false};
+    llama_sampler_apply(_sampler, &candidates);
+    llama_token token = candidates.data[candidates.selected].id;
+    if (!_grammarSampler) {
+        llama_sampler_accept(_sampler, token);
+        _sampleTime += ggml_time_us() - start;
+        return token;
+    }
+
+    // check only the sampled token against the grammar
+    llama_token_data single = {token, 1.0f, 0.0f};
+    llama_token_data_array singleArray = {&single, 1, -1, false};
+    llama_sampler_apply(_grammarSampler, &singleArray);
+    if (std::isinf(single.logit) && single.logit < 0) {
+        // the token is rejected, mask the whole vocabulary with the grammar and sample again
+        for (llama_token id = 0; id < nVocab; id++) {
+            _candidates[id] = {id, logits[id], 0.0f};
+        }
+        candidates = {_candidates.data(), _candidates.size(), -1, false};
+        llama_sampler_apply(_grammarSampler, &candidates);
+        llama_sampler_apply(_sampler, &candidates);
+        token = candidates.data[candidates.selected].id;
+    }
+    llama_sampler_accept(_grammarSampler, token);
+    llama_sampler_accept(_sampler, token);
+    _sampleTime += ggml_time_us() - start;
+    return token;
+}
+
+bool
+LLMInference::_speculativeDecode() {
+    int64_t start = ggml_time_us();
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    const llama_pos pos = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
+    // the drafts are limited by the space that is left in the context
+    const int nDraft = std::min(_nDraft, (int) llama_n_ctx(_ctx) - pos - 1);
+
+    // `_currToken` is decoded as the first token of the batch, the drafters see it as part of the history
+    _tokenHistory.push_back(_currToken);
+    _draftTokens.clear();
+    _draftTokens.push_back(_currToken);
+    if (nDraft > 0) {
+        if (_speculativeMode == SPECULATIVE_DRAFT_MODEL) {
+            _draftWithModel(nDraft);
         } else {
+            _draftWithNgrams(nDraft);
+        }
+    }
+
+    common_batch_clear(_speculativeBatch);
+    for (size_t i = 0; i < _draftTokens.size(); i++) {
+        common_batch_add(_speculativeBatch, _draftTokens[i], pos + (llama_pos) i, {0}, true);
+    }
+    int result = llama_decode(_ctx, _speculativeBatch);
+    if (result != 0) {
+        _tokenHistory.pop_back();
+        if (result == 2) {
             return false;
         }
+        llama_memory_seq_rm(llama_get_memory(_ctx), 0, pos, -1);
+        throw std::runtime_error("llama_decode() failed: " + std::to_string(result));
+    }
+    // the step latency covers drafting and verification, sampling is measured separately
+    _decodeLatencies.push_back(ggml_time_us() - start);
 
-        bytes += 1;
-        for (int i = 1; i < num; ++i) {
-            if ((*bytes & 0xC0) != 0x80) {
-                return false;
-            }
-            bytes += 1;
+    // the sample at position i is the token that follows `_draftTokens[i]`,
+    // the draft is accepted as long as it agrees with what the model samples
+    const size_t nDrafted = _draftTokens.size() - 1;
+    _acceptedTokens.clear();
+    _acceptedTokensPos = 0;
+    _acceptedStartPos = pos + 1;
+    for (size_t i = 0; i <= nDrafted; i++) {
+        llama_token token = _sampleToken((int32_t) i);
+        _acceptedTokens.push_back(token);
+        if (i == nDrafted || token != _draftTokens[i + 1] || llama_vocab_is_eog(vocab, token)) {
+            break;
         }
     }
+    // all accepted tokens except the last one are in the KV cache now, the rejected drafts are dropped
+    const size_t nAccepted = _acceptedTokens.size() - 1;
+    llama_memory_seq_rm(llama_get_memory(_ctx), 0, _acceptedStartPos + (llama_pos) nAccepted, -1);
+    _tokenHistory.insert(_tokenHistory.end(), _acceptedTokens.begin(), _acceptedTokens.end() - 1);
+    _nDrafted += (long) nDrafted;
+    _nDraftAccepted += (long) nAccepted;
     return true;
 }
 
-std::string
-LLMInference::completionLoop() {
-    // check if the length of the inputs to the model
-    // have exceeded the context size of the model
-    uint32_t contextSize = llama_n_ctx(_ctx);
-    _nCtxUsed = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
-    if (_nCtxUsed + _batch->n_tokens > contextSize) {
-        throw std::runtime_error("context size reached");
+void
+LLMInference::_draftWithModel(int nDraft) {
+    // keep the common prefix of the draft KV cache, at least the last token is decoded again for its logits
+    size_t nCommon = 0;
+    size_t nMax = std::min(_draftHistory.size(), _tokenHistory.size() - 1);
+    while (nCommon < nMax && _draftHistory[nCommon] == _tokenHistory[nCommon]) {
+        nCommon++;
+    }
+    llama_memory_t memory = llama_get_memory(_draftCtx);
+    if (!llama_memory_seq_rm(memory, 0, (llama_pos) nCommon, -1)) {
+        llama_memory_seq_rm(memory, 0, -1, -1);
+        nCommon = 0;
+    }
+    _draftHistory.resize(nCommon);
+
+    const int nBatch = (int) llama_n_batch(_draftCtx);
+    for (size_t i = nCommon; i < _tokenHistory.size(); i += nBatch) {
+        int nTokens = (int) std::min<size_t>(nBatch, _tokenHistory.size() - i);
+        if (llama_decode(_draftCtx, llama_batch_get_one(_tokenHistory.data() + i, nTokens)) != 0) {
+            // a failing (or aborted) draft model only disables drafting for this step
+            LOGe("llama_decode() failed for the draft model");
+            llama_memory_seq_rm(memory, 0, -1, -1);
+            _draftHistory.clear();
+            return;
+        }
+        _draftHistory.insert(_draftHistory.end(), _tokenHistory.begin() + (long) i,
+                             _tokenHistory.begin() + (long) (i + nTokens));
+    }
+
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    const int nVocab = llama_vocab_n_tokens(vocab);
+    for (int i = 0; i < nDraft; i++) {
+        llama_token token = llama_sampler_sample(_draftSampler, _draftCtx, -1);
+        if (token >= nVocab || llama_vocab_is_eog(vocab, token)) {
+            break;
+        }
+        _draftTokens.push_back(token);
+        if (i + 1 == nDraft || llama_decode(_draftCtx, llama_batch_get_one(&_draftTokens.back(), 1)) != 0) {
+            break;
+        }
+        _draftHistory.push_back(token);
+    }
+}
+
+void
+LLMInference::_draftWithNgrams(int nDraft) {
+    if (_ngramCacheTokens > _tokenHistory.size()) {
+        // the history was shifted or replaced, rebuild the cache from what is left
+        _ngramCacheContext.clear();
+        _ngramCacheTokens = 0;
+    }
+    int nNew = (int) (_tokenHistory.size() - _ngramCacheTokens);
+    if (nNew > 0) {
+        common_ngram_cache_update(_ngramCacheContext, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, _tokenHistory, nNew, false);
+        _ngramCacheTokens = _tokenHistory.size();
     }
+    common_ngram_cache_draft(_tokenHistory, _draftTokens, nDraft, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX,
+                             _ngramCacheContext, _ngramCacheDynamic, _ngramCacheStatic);
+}
 
+void
+LLMInference::_discardAcceptedTokens() {
+    if (_acceptedTokensPos >= _acceptedTokens.size()) {
+        return;
+    }
+    // `_currToken` is the last token that was returned, it and the tokens after it leave the KV cache
+    const llama_pos pos = _acceptedStartPos + (llama_pos) _acceptedTokensPos - 1;
+    llama_memory_seq_rm(llama_get_memory(_ctx), 0, pos, -1);
+    _tokenHistory.resize(std::min(_tokenHistory.size(), (size_t) pos));
+    _acceptedTokens.clear();
+    _acceptedTokensPos = 0;
+}
+
+bool
+LLMInference::completionStep(std::string_view &piece) {
+    piece = {};
+    if (_maxTokens > 0 && _responseNumTokens >= _maxTokens) {
+        _stopReason = STOP_MAX_TOKENS;
+        return false;
+    }
+    if (_checkAbort()) {
+        return false;
+    }
     auto start = ggml_time_us();
-    // run the model
-    if (llama_decode(_ctx, *_batch) < 0) {
-        throw std::runtime_error("llama_decode() failed");
+    bool sampled = false;
+    if (_acceptedTokensPos < _acceptedTokens.size()) {
+        // the tokens accepted by the last verification are returned one per call without running the model
+        _currToken = _acceptedTokens[_acceptedTokensPos++];
+        sampled = true;
+    } else {
+        // check if the length of the inputs to the model
+        // have exceeded the context size of the model
+        _makeContextSpace(_batch.n_tokens);
+
+        // run the model
+        if (_prefillPending) {
+            _prefillPending = false;
+            if (!_prefill()) {
+                return false;
+            }
+        } else if (_speculativeMode != SPECULATIVE_NONE) {
+            if (!_speculativeDecode()) {
+                return false;
+            }
+            _currToken = _acceptedTokens[_acceptedTokensPos++];
+            sampled = true;
+        } else {
+            auto decodeStart = ggml_time_us();
+            const llama_pos pos = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
+            int result = llama_decode(_ctx, _batch);
+            if (result != 0 && result != 2) {
+                // nothing may stay in the KV cache past the history, or later steps decode at the wrong positions
+                llama_memory_seq_rm(llama_get_memory(_ctx), 0, pos, -1);
+                throw std::runtime_error("llama_decode() failed: " + std::to_string(result));
+            }
+            if (result == 2) {
+                // aborted, llama.cpp has already removed the token from the KV cache
+                return false;
+            }
+            _decodeLatencies.push_back(ggml_time_us() - decodeStart);
+            _tokenHistory.push_back(_currToken);
+        }
     }
 
     // sample a token and check if it is an EOG (end of generation token)
     // convert the integer token to its corresponding word-piece
-    _currToken = llama_sampler_sample(_sampler, _ctx, -1);
-    if (llama_vocab_is_eog(llama_model_get_vocab(_model), _currToken)) {
-        addChatMessage(strdup(_response.data()), "assistant");
-        _response.clear();
-        return "[EOG]";
+    if (!sampled) {
+        _currToken = _sampleToken(-1);
+    }
+    if (_firstTokenPending) {
+        _firstTokenPending = false;
+        _metrics.ttftMs = (double) (ggml_time_us() - _completionStart) / 1000.0;
+    }
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    if (llama_vocab_is_eog(vocab, _currToken)) {
+        // the response is stored (or discarded) by stopCompletion()
+        _stopReason = STOP_EOG;
+        return false;
+    }
+    auto detokenizeStart = ggml_time_us();
+    int32_t nBytes = llama_token_to_piece(vocab, _currToken, _pieceBytes.data(), (int32_t) _pieceBytes.size(), 0,
+                                          true);
+    if (nBytes < 0) {
+        // longer than every piece seen so far, the buffers only ever grow here
+        _pieceBytes.resize(-nBytes);
+        _pieceText.resize(Utf8Stream::maxOutputSize(_pieceBytes.size()) + 1);
+        nBytes = llama_token_to_piece(vocab, _currToken, _pieceBytes.data(), (int32_t) _pieceBytes.size(), 0, true);
     }
-    std::string piece = common_token_to_piece(_ctx, _currToken, true);
     auto end = ggml_time_us();
     _responseGenerationTime += (end - start);
     _responseNumTokens += 1;
-    _cacheResponseTokens += piece;
 
     // re-init the batch with the newly predicted token
     // key, value pairs of all previous tokens have been cached
     // in the KV cache
-    _batch->token = &_currToken;
-    _batch->n_tokens = 1;
+    _batch = llama_batch_get_one(&_currToken, 1);
 
-    if (_isValidUtf8(_cacheResponseTokens.c_str())) {
-        _response += _cacheResponseTokens;
-        std::string valid_utf8_piece = _cacheResponseTokens;
-        _cacheResponseTokens.clear();
-        return valid_utf8_piece;
-    }
+    // only the new bytes are checked, an incomplete character is held back until its last byte arrives
+    const size_t length = _utf8Stream.append(_pieceBytes.data(), (size_t) std::max(nBytes, 0), _pieceText.data());
+    _pieceText[length] = '\0';
+    _response.append(_pieceText.data(), length);
+    piece = std::string_view(_pieceText.data(), length);
+    _detokenizeTime += ggml_time_us() - detokenizeStart;
+    return true;
+}
 
-    return "";
+std::string
+LLMInference::completionLoop() {
+    std::string_view piece;
+    if (!completionStep(piece)) {
+        return "[EOG]";
+    }
+    return std::string(piece);
 }
 
 void
 LLMInference::stopCompletion() {
+    // the limits only apply to this completion, not to later decodes such as a context restart
+    _deadlineUs = 0;
+    _cancelRequested = false;
+    _discardAcceptedTokens();
+    if (_prefillCancelled) {
+        // the prompt never reached the model, forget the query that was added by startCompletion()
+        _removeLastChatMessage();
+        _prefillCancelled = false;
+        _response.clear();
+        return;
+    }
     if (_storeChats) {
         addChatMessage(_response.c_str(), "assistant");
+        if (_messageStartPos.size() + 1 == _messages.size()) {
+            _messageStartPos.push_back(_responseStartPos);
+        }
+    } else {
+        // stateless chats keep only their fixed preamble (e.g. the system prompt) between queries,
+        // whose tokens stay in the KV cache and are matched again by the next query
+        _removeLastChatMessage();
     }
     _response.clear();
-    _prevLen = llama_chat_apply_template(_chatTemplate, _messages.data(), _messages.size(), false, nullptr, 0);
-    if (_prevLen < 0) {
-        throw std::runtime_error("llama_chat_apply_template() in LLMInference::stopCompletion() failed");
+    // only the messages of this turn are rendered to advance `_prevLen`
+    _prevLen += (int) _renderNewMessages(false).size();
+    _renderedMessages = _messages.size();
+}
+
+llama_token
+LLMInference::_sampleWith(llama_sampler *sampler, const float *logits) {
+    const int nVocab = llama_vocab_n_tokens(llama_model_get_vocab(_model));
+    _candidates.resize(nVocab);
+    for (llama_token id = 0; id < nVocab; id++) {
+        _candidates[id] = {id, logits[id], 0.0f};
     }
+    llama_token_data_array candidates = {_candidates.data(), _candidates.size(), -1, false};
+    llama_sampler_apply(sampler, &candidates);
+    const llama_token token = candidates.data[candidates.selected].id;
+    llama_sampler_accept(sampler, token);
+    return token;
+}
+
+int
+LLMInference::_decodeCandidates(const std::vector<CandidateSequence> &sequences, llama_pos pos) {
+    common_batch_clear(_candidateBatch);
+    for (const CandidateSequence &sequence: sequences) {
+        if (!sequence.finished) {
+            common_batch_add(_candidateBatch, sequence.tokens.back(), pos, {sequence.seqId}, true);
+        }
+    }
+    if (_checkAbort()) {
+        return 2;
+    }
+    const int64_t start = ggml_time_us();
+    const int result = llama_decode(_ctx, _candidateBatch);
+    if (result < 0) {
+        throw std::runtime_error("llama_decode() failed");
+    }
+    _decodeLatencies.push_back(ggml_time_us() - start);
+    return result;
+}
+
+void
+LLMInference::_sampleCandidates(std::vector<CandidateSequence> &sequences, const float *promptLogits,
+                                llama_pos promptEnd, int maxTokens) {
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    const int nVocab = llama_vocab_n_tokens(vocab);
+    // a clone of `_sampler` would also clone its RNG state and sample the same continuation every time
+    std::vector<std::unique_ptr<llama_sampler, SamplerDeleter>> samplers;
+    for (size_t i = 0; i < sequences.size(); i++) {
+        SamplerParams params = _samplerParams;
+        if (params.seed != LLAMA_DEFAULT_SEED) {
+            params.seed += (uint32_t) i;
+        }
+        samplers.emplace_back(createSamplerChain(params));
+    }
+
+    for (int step = 0; step < maxTokens; step++) {
+        int32_t outputIndex = 0;
+        int nActive = 0;
+        for (size_t i = 0; i < sequences.size(); i++) {
+            CandidateSequence &sequence = sequences[i];
+            if (sequence.finished) {
+                continue;
+            }
+            // every candidate starts from the logits of the prompt, later each one has its own output
+            const float *logits = step == 0 ? promptLogits : llama_get_logits_ith(_ctx, outputIndex++);
+            const int64_t sampleStart = ggml_time_us();
+            const llama_token token = _sampleWith(samplers[i].get(), logits);
+            sequence.logProb += logits[token] - logPartition(logits, nVocab);
+            _sampleTime += ggml_time_us() - sampleStart;
+            if (llama_vocab_is_eog(vocab, token)) {
+                sequence.finished = true;
+                continue;
+            }
+            sequence.tokens.push_back(token);
+            _responseNumTokens++;
+            nActive++;
+        }
+        if (nActive == 0 || step + 1 == maxTokens) {
+            return;
+        }
+        if (_decodeCandidates(sequences, promptEnd + step) != 0) {
+            return;
+        }
+    }
+}
+
+void
+LLMInference::_beamSearchCandidates(std::vector<CandidateSequence> &sequences, const float *promptLogits,
+                                    llama_pos promptEnd, int maxTokens) {
+    // (index of the beam, token, log probability of the extended beam)
+    struct Expansion {
+        size_t beam;
+        llama_token token;
+        float logProb;
+    };
+    const llama_vocab *vocab = llama_model_get_vocab(_model);
+    const int nVocab = llama_vocab_n_tokens(vocab);
+    const size_t width = sequences.size();
+    std::vector<llama_seq_id> freeSeqs;
+    for (size_t i = 1; i < width; i++) {
+        freeSeqs.push_back(sequences[i].seqId);
+    }
+    // all beams are identical before the first token, so the search starts from a single one
+    std::vector<CandidateSequence> beams(1);
+    beams[0].seqId = sequences[0].seqId;
+    std::vector<CandidateSequence> results;
+    std::vector<Expansion> expansions;
+    std::vector<char> keepsSeq;
+
+    for (int step = 0; step < maxTokens && !beams.empty(); step++) {
+        const size_t nKeep = width - results.size();
+        const int64_t sampleStart = ggml_time_us();
+        expansions.clear();
+        for (size_t b = 0; b < beams.size(); b++) {
+            const float *logits = step == 0 ? promptLogits : llama_get_logits_ith(_ctx, (int32_t) b);
+            const float logZ = logPartition(logits, nVocab);
+            _candidates.resize(nVocab);
+            for (llama_token id = 0; id < nVocab; id++) {
+                _candidates[id] = {id, logits[id], 0.0f};
+            }
+            // no beam can contribute more than nKeep of the surviving expansions
+            const size_t nTop = std::min(nKeep, (size_t) nVocab);
+            std::partial_sort(_candidates.begin(), _candidates.begin() + (long) nTop, _candidates.end(),
+                              [](const llama_token_data &a, const llama_token_data &b) { return a.logit > b.logit; });
+            for (size_t k = 0; k < nTop; k++) {
+                expansions.push_back({b, _candidates[k].id, beams[b].logProb + _candidates[k].logit - logZ});
+            }
+        }
+        const size_t nSelected = std::min(nKeep, expansions.size());
+        std::partial_sort(expansions.begin(), expansions.begin() + (long) nSelected, expansions.end(),
+                          [](const Expansion &a, const Expansion &b) { return a.logProb > b.logProb; });
+        expansions.resize(nSelected);
+
+        // the sequence of a beam without surviving children can be reused by the children of another beam
+        keepsSeq.assign(beams.size(), 0);
+        for (const Expansion &expansion: expansions) {
+            if (!llama_vocab_is_eog(vocab, expansion.token)) {
+                keepsSeq[expansion.beam] = 1;
+            }
+        }
+        for (size_t b = 0; b < beams.size(); b++) {
+            if (!keepsSeq[b]) {
+                freeSeqs.push_back(beams[b].seqId);
+            }
+        }
+        std::vector<CandidateSequence> children;
+        children.reserve(expansions.size());
+        std::fill(keepsSeq.begin(), keepsSeq.end(), 0);
+        llama_memory_t memory = llama_get_memory(_ctx);
+        for (const Expansion &expansion: expansions) {
+            const CandidateSequence &parent = beams[expansion.beam];
+            CandidateSequence child;
+            child.tokens.reserve(step + 1);
+            child.tokens = parent.tokens;
+            child.logProb = expansion.logProb;
+            if (llama_vocab_is_eog(vocab, expansion.token)) {
+                child.finished = true;
+                results.push_back(std::move(child));
+                continue;
+            }
+            child.tokens.push_back(expansion.token);
+            if (!keepsSeq[expansion.beam]) {
+                // the first child continues in the sequence of its parent
+                keepsSeq[expansion.beam] = 1;
+                child.seqId = parent.seqId;
+            } else {
+                // the parent sequences are not touched before the next decode, so they can still be copied
+                child.seqId = freeSeqs.back();
+                freeSeqs.pop_back();
+                llama_memory_seq_rm(memory, child.seqId, -1, -1);
+                llama_memory_seq_cp(memory, parent.seqId, child.seqId, -1, -1);
+            }
+            children.push_back(std::move(child));
+        }
+        beams = std::move(children);
+        _responseNumTokens += (long) beams.size();
+        _sampleTime += ggml_time_us() - sampleStart;
+        if (beams.empty() || step + 1 == maxTokens || _decodeCandidates(beams, promptEnd + step) != 0) {
+            break;
+        }
+    }
+    // the beams that are still running are returned as they are
+    for (CandidateSequence &beam: beams) {
+        results.push_back(std::move(beam));
+    }
+    sequences = std::move(results);
+}
+
+std::vector<GenerationCandidate>
+LLMInference::generateCandidates(const char *query, int nCandidates, bool beamSearch, const GenerationLimits &limits) {
+    if (nCandidates < 1 || nCandidates > _maxCandidates) {
+        throw std::runtime_error("generateCandidates(): nCandidates must be between 1 and maxCandidates");
+    }
+    // the query is rendered, tokenized and prefilled into sequence 0 exactly like a completion
+    GenerationLimits promptLimits;
+    promptLimits.timeoutMs = limits.timeoutMs;
+    startCompletion(query, promptLimits);
+    _makeContextSpace(_batch.n_tokens);
+    _prefillPending = false;
+    llama_memory_t memory = llama_get_memory(_ctx);
+    const llama_pos promptStart = llama_memory_seq_pos_max(memory, 0) + 1;
+    std::vector<GenerationCandidate> candidates;
+    if (_prefill()) {
+        const llama_pos promptEnd = llama_memory_seq_pos_max(memory, 0) + 1;
+        int maxTokens = (int) llama_n_ctx(_ctx) - promptEnd;
+        if (limits.maxTokens > 0) {
+            maxTokens = std::min(maxTokens, limits.maxTokens);
+        }
+        const int64_t start = ggml_time_us();
+        _metrics.ttftMs = (double) (start - _completionStart) / 1000.0;
+
+        // the candidates share the cells of the prompt with sequence 0
+        std::vector<CandidateSequence> sequences(nCandidates);
+        for (int i = 0; i < nCandidates; i++) {
+            sequences[i].seqId = i + 1;
+            sequences[i].tokens.reserve(maxTokens);
+            llama_memory_seq_rm(memory, i + 1, -1, -1);
+            llama_memory_seq_cp(memory, 0, i + 1, -1, -1);
+        }
+        const float *promptLogits = llama_get_logits_ith(_ctx, -1);
+        if (maxTokens > 0) {
+            if (beamSearch) {
+                _beamSearchCandidates(sequences, promptLogits, promptEnd, maxTokens);
+            } else {
+                _sampleCandidates(sequences, promptLogits, promptEnd, maxTokens);
+            }
+        }
+        _responseGenerationTime = ggml_time_us() - start;
+        for (int i = 0; i < nCandidates; i++) {
+            llama_memory_seq_rm(memory, i + 1, -1, -1);
+        }
+        if (_stopReason == STOP_NONE) {
+            const bool allFinished = std::all_of(sequences.begin(), sequences.end(),
+                                                 [](const CandidateSequence &sequence) { return sequence.finished; });
+            const bool limitReached = std::any_of(sequences.begin(), sequences.end(), [&](const auto &sequence) {
+                return !sequence.finished && (int) sequence.tokens.size() == limits.maxTokens;
+            });
+            _stopReason = allFinished ? STOP_EOG : limitReached ? STOP_MAX_TOKENS : STOP_NONE;
+        }
+
+        Utf8Stream utf8Stream;
+        for (const CandidateSequence &sequence: sequences) {
+            // an incomplete character at the end of a truncated candidate is dropped
+            const std::string bytes =
+                    _tokenizer->detokenize(sequence.tokens.data(), sequence.tokens.size(), false, true);
+            GenerationCandidate candidate;
+            candidate.text.resize(Utf8Stream::maxOutputSize(bytes.size()));
+            candidate.text.resize(utf8Stream.append(bytes.data(), bytes.size(), candidate.text.data()));
+            utf8Stream.reset();
+            candidate.logProb = sequence.logProb;
+            candidate.nTokens = (int) sequence.tokens.size();
+            candidate.finished = sequence.finished;
+            candidates.push_back(std::move(candidate));
+        }
+        // longer candidates are not penalized for their length
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [](const GenerationCandidate &a, const GenerationCandidate &b) {
+                             return a.logProb / (float) std::max(a.nTokens, 1) >
+                                    b.logProb / (float) std::max(b.nTokens, 1);
+                         });
+    }
+
+    // neither the query nor the candidates become part of the chat
+    _deadlineUs = 0;
+    _cancelRequested = false;
+    if (!_prefillCancelled && _storeChats) {
+        llama_memory_seq_rm(memory, 0, promptStart, -1);
+        _tokenHistory.resize(std::min(_tokenHistory.size(), (size_t) promptStart));
+        if (promptStart == 0) {
+            // the context was restarted for this prompt, the next query renders the whole chat again
+            _prevLen = 0;
+            _renderedMessages = 0;
+        }
+    }
+    _removeLastChatMessage();
+    if (!_prefillCancelled && !_storeChats) {
+        _prevLen += (int) _renderNewMessages(false).size();
+        _renderedMessages = _messages.size();
+    }
+    _prefillCancelled = false;
+    _nCtxUsed = llama_memory_seq_pos_max(memory, 0) + 1;
+    return candidates;
+}
+
+void
+LLMInference::startStream(const char *query, const GenerationLimits &limits) {
+    if (_streamThread.joinable()) {
+        stopStream();
+    }
+    startCompletion(query, limits);
+    _streamBuffer.reset();
+    _streamStopRequested = false;
+    _streamThread = std::thread([this]() {
+        try {
+            std::string_view piece;
+            while (!_streamStopRequested.load(std::memory_order_relaxed)) {
+                if (!completionStep(piece)) {
+                    break;
+                }
+                // 不完整的 UTF-8 片段（空字符串）不写入缓冲区，读取方不会被无意义地唤醒
+                if (!piece.empty() && !_streamBuffer.push(piece.data(), piece.size())) {
+                    break;
+                }
+            }
+            _streamBuffer.finish();
+        } catch (std::runtime_error &error) {
+            _streamBuffer.finish(error.what());
+        }
+    });
+}
+
+long
+LLMInference::drainStream(char *dst, size_t capacity, int maxPieces) {
+    return _streamBuffer.drain(dst, capacity, maxPieces);
+}
+
+void
+LLMInference::stopStream() {
+    _streamStopRequested = true;
+    // interrupt the llama_decode() that is running, even in the middle of a long prefill chunk
+    _cancelRequested = true;
+    _streamBuffer.finish();
+    if (_streamThread.joinable()) {
+        _streamThread.join();
+    }
+    stopCompletion();
+}
+
+void
+LLMInference::saveSession(const char *path) {
+    std::vector<char> messagesBlob;
+    for (const llama_chat_message &message: _messages) {
+        appendString(messagesBlob, message.role);
+        appendString(messagesBlob, message.content);
+    }
+    // keep the token history 4-byte aligned inside the file
+    messagesBlob.resize((messagesBlob.size() + 3) & ~(size_t) 3, 0);
+
+    std::vector<llama_pos> positions(_messages.size(), -1);
+    std::copy(_messageStartPos.begin(), _messageStartPos.end(), positions.begin());
+
+    std::vector<uint8_t> state(llama_state_seq_get_size(_ctx, 0));
+    if (llama_state_seq_get_data(_ctx, state.data(), state.size(), 0) != state.size()) {
+        throw std::runtime_error("llama_state_seq_get_data() failed");
+    }
+
+    SessionHeader header{};
+    header.magic = SESSION_MAGIC;
+    header.version = SESSION_VERSION;
+    header.modelFingerprint = _modelFingerprint;
+    header.contextSize = llama_n_ctx(_ctx);
+    header.prevLen = _prevLen;
+    header.responseStartPos = _responseStartPos;
+    header.nRenderedMessages = (uint32_t) _renderedMessages;
+    header.nMessages = (uint32_t) _messages.size();
+    header.nTokens = (uint32_t) _tokenHistory.size();
+    header.messagesSize = messagesBlob.size();
+    header.stateSize = state.size();
+
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("saveSession() could not open " + tmpPath);
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(messagesBlob.data(), 1, messagesBlob.size(), file) == messagesBlob.size() &&
+              fwrite(_tokenHistory.data(), sizeof(llama_token), _tokenHistory.size(), file) == _tokenHistory.size() &&
+              fwrite(positions.data(), sizeof(llama_pos), positions.size(), file) == positions.size() &&
+              fwrite(state.data(), 1, state.size(), file) == state.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmpPath.c_str(), path) != 0) {
+        unlink(tmpPath.c_str());
+        throw std::runtime_error("saveSession() failed to write " + std::string(path));
+    }
+    LOGi("saved session to %s (%u messages, %u tokens, %zu state bytes)", path, header.nMessages, header.nTokens,
+         state.size());
+}
+
+bool
+LLMInference::loadSession(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SessionHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t fileSize = (size_t) st.st_size;
+    void *data = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    madvise(data, fileSize, MADV_SEQUENTIAL);
+
+    auto fail = [&](const char *reason) {
+        LOGe("loadSession(%s): %s", path, reason);
+        munmap(data, fileSize);
+        return false;
+    };
+
+    SessionHeader header{};
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != SESSION_MAGIC || header.version != SESSION_VERSION) {
+        return fail("not a session file");
+    }
+    if (header.modelFingerprint != _modelFingerprint) {
+        return fail("saved with a different model");
+    }
+    if (header.contextSize != llama_n_ctx(_ctx)) {
+        return fail("saved with a different context size");
+    }
+    if (header.nRenderedMessages > header.nMessages) {
+        return fail("corrupted header");
+    }
+    // saveSession pads the messages so that the token history stays aligned for the casts below
+    if (header.messagesSize % sizeof(llama_token) != 0) {
+        return fail("misaligned token history");
+    }
+    if (header.nTokens > llama_n_ctx(_ctx)) {
+        return fail("token history longer than the context");
+    }
+    if (sizeof(header) + header.messagesSize + (uint64_t) header.nTokens * sizeof(llama_token) +
+                (uint64_t) header.nMessages * sizeof(llama_pos) + header.stateSize !=
+        fileSize) {
+        return fail("truncated or corrupted file");
+    }
+
+    const char *messagesBegin = static_cast<const char *>(data) + sizeof(header);
+    const char *messagesEnd = messagesBegin + header.messagesSize;
+    const auto *tokens = reinterpret_cast<const llama_token *>(messagesEnd);
+    const auto *positions = reinterpret_cast<const llama_pos *>(tokens + header.nTokens);
+    const auto *state = reinterpret_cast<const uint8_t *>(positions + header.nMessages);
+
+    // parse the messages before touching any state, so a bad file leaves the session intact
+    std::vector<std::pair<std::string, std::string>> messages(header.nMessages);
+    const char *cursor = messagesBegin;
+    for (auto &[role, content]: messages) {
+        if (!readString(cursor, messagesEnd, role) || !readString(cursor, messagesEnd, content)) {
+            return fail("corrupted messages");
+        }
+    }
+
+    // the KV cells of sequence 0 are restored straight from the mapped file
+    llama_memory_seq_rm(llama_get_memory(_ctx), 0, -1, -1);
+    if (llama_state_seq_set_data(_ctx, state, header.stateSize, 0) != header.stateSize) {
+        // the old KV cells are gone, reset the whole conversation so the templating state matches the empty cache
+        _clearKvCache();
+        _messages.clear();
+        _messageArena.clear();
+        _ngramCacheContext.clear();
+        _ngramCacheTokens = 0;
+        return fail("llama_state_seq_set_data() failed");
+    }
+
+    _messages.clear();
+    _messageArena.clear();
+    for (const auto &[role, content]: messages) {
+        addChatMessage(content.c_str(), role.c_str());
+    }
+    _tokenHistory.assign(tokens, tokens + header.nTokens);
+    _ngramCacheContext.clear();
+    _ngramCacheTokens = 0;
+    _messageStartPos.clear();
+    for (uint32_t i = 0; i < header.nMessages && positions[i] >= 0; i++) {
+        _messageStartPos.push_back(positions[i]);
+    }
+    _responseStartPos = header.responseStartPos;
+    _prevLen = header.prevLen;
+    _renderedMessages = header.nRenderedMessages;
+    _nCtxUsed = llama_memory_seq_pos_max(llama_get_memory(_ctx), 0) + 1;
+    munmap(data, fileSize);
+    LOGi("restored session from %s (%u messages, %u tokens)", path, header.nMessages, header.nTokens);
+    return true;
 }
 
 LLMInference::~LLMInference() {
-    // free memory held by the message text in messages
-    // (as we had used strdup() to create a malloc'ed copy)
-    for (llama_chat_message &message: _messages) {
-        free(const_cast<char *>(message.role));
-        free(const_cast<char *>(message.content));
+    if (_streamThread.joinable()) {
+        _streamStopRequested = true;
+        // fires the abort callback, close() does not wait for a long prefill or decode to finish
+        _cancelRequested = true;
+        _streamBuffer.finish();
+        _streamThread.join();
+    }
+    // the grammars hold pointers into the vocabulary of the model
+    if (_grammarSampler) {
+        llama_sampler_free(_grammarSampler);
     }
+    _grammarCache.clear();
+    _embeddings.reset();
+    _tokenizer.reset();
     llama_free(_ctx);
     llama_model_free(_model);
-    delete _batch;
     llama_sampler_free(_sampler);
+    llama_batch_free(_speculativeBatch);
+    llama_batch_free(_candidateBatch);
+    if (_draftModel) {
+        llama_free(_draftCtx);
+        llama_model_free(_draftModel);
+        llama_sampler_free(_draftSampler);
+    }
 }
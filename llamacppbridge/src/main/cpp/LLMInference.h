@@ -1,10 +1,90 @@
 #pragma once
 #include "llama.h"
-#include <jni.h>
+#include "EmbeddingContext.h"
+#include "GrammarCache.h"
+#include "InferenceMetrics.h"
+#include "MessageArena.h"
+#include "SamplerChain.h"
+#include "ThreadPlacement.h"
+#include "TokenStreamBuffer.h"
+#include "Tokenizer.h"
+#include "Utf8Stream.h"
 #include "common.h"
+#include "ngram-cache.h"
+#include <atomic>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
+/**
+ * @brief 上下文窗口写满时的处理策略。
+ */
+enum ContextOverflowPolicy {
+    /// 抛出 "context size reached" 异常（默认）
+    CONTEXT_OVERFLOW_FAIL = 0,
+    /// 保留前 nKeep 个 token（默认为系统提示词），丢弃其余部分中最旧的一半，并平移 KV 缓存中剩余 token 的位置
+    CONTEXT_OVERFLOW_SHIFT = 1,
+    /// 丢弃最早的对话轮次，直到剩余历史不超过上下文的一半，然后清空 KV 缓存并重新预填充
+    CONTEXT_OVERFLOW_RESTART = 2,
+};
+
+/**
+ * @brief 投机解码（speculative decoding）的草稿来源。
+ */
+enum SpeculativeMode {
+    /// 不使用投机解码，每次 llama_decode 只生成一个 token（默认）
+    SPECULATIVE_NONE = 0,
+    /// 由与主模型共享词表的小型草稿模型贪心生成草稿
+    SPECULATIVE_DRAFT_MODEL = 1,
+    /// 在提示词和已生成内容中查找 n-gram 续写作为草稿，不需要额外的模型
+    SPECULATIVE_NGRAM = 2,
+};
+
+/**
+ * @brief 最近一次生成结束的原因。
+ */
+enum StopReason {
+    /// 生成尚未结束（或还没有开始过生成）
+    STOP_NONE = 0,
+    /// 模型生成了结束 token（EOG）
+    STOP_EOG = 1,
+    /// 被 cancel() 取消（包括停止流式生成）
+    STOP_CANCELLED = 2,
+    /// 达到 GenerationLimits::maxTokens
+    STOP_MAX_TOKENS = 3,
+    /// 超过 GenerationLimits::timeoutMs
+    STOP_DEADLINE = 4,
+};
+
+/**
+ * @struct GenerationLimits
+ * @brief 单次生成的上限，在 startCompletion / startStream 时指定，只对这一轮生成有效。
+ */
+struct GenerationLimits {
+    /// 最多返回的 token 数，小于等于 0 表示不限制
+    int maxTokens = 0;
+    /// 从 startCompletion 开始计时的截止时间（毫秒），包括预填充；小于等于 0 表示不限制
+    long timeoutMs = 0;
+};
+
+/**
+ * @struct GenerationCandidate
+ * @brief generateCandidates 生成的一条候选续写。
+ */
+struct GenerationCandidate {
+    /// 候选文本，末尾不完整的 UTF-8 字符被丢弃
+    std::string text;
+    /// 候选中每个 token 在模型原始分布（未经采样器处理的 logits）下的对数概率之和
+    float logProb = 0.0f;
+    /// 候选的 token 数（不含结束 token）
+    int nTokens = 0;
+    /// 是否以结束 token（EOG）结束，否则因达到 token 上限、上下文写满或取消而截断
+    bool finished = false;
+};
+
 /**
  * @class LLMInference
  * @brief 该类用于管理大语言模型（LLM）的推理过程，包括模型加载、聊天消息处理、推理循环等功能。
@@ -12,19 +92,29 @@
 class LLMInference {
     // llama.cpp 特定类型的成员变量
     /// llama 上下文指针，用于管理模型的运行时状态
-    llama_context *_ctx;
+    llama_context *_ctx = nullptr;
     /// llama 模型指针，指向加载的大语言模型
-    llama_model *_model;
+    llama_model *_model = nullptr;
     /// llama 采样器指针，用于从模型输出中采样生成下一个 token
-    llama_sampler *_sampler;
+    llama_sampler *_sampler = nullptr;
+    /// 约束输出格式的语法采样器，未设置语法时为 nullptr
+    llama_sampler *_grammarSampler = nullptr;
+    /// 已编译语法的缓存，相同的语法或 JSON schema 不会重复解析
+    GrammarCache _grammarCache;
+    /// 解码和预填充的线程数，以及固定在指定核心上的 ggml 线程池（主模型和草稿模型共用）
+    ThreadPlacement _threads;
+    /// 采样的候选 token 数组，按词表大小复用（llama_sampler_sample 每次调用都会重新分配）
+    std::vector<llama_token_data> _candidates;
     /// 当前采样得到的 llama token
-    llama_token _currToken;
-    /// llama 批处理结构，用于批量处理输入 token
-    llama_batch *_batch;
+    llama_token _currToken = LLAMA_TOKEN_NULL;
+    /// llama 批处理结构，只引用 `_promptTokens` 或 `_currToken`，不分配内存
+    llama_batch _batch{};
 
     // 存储聊天中用户/助手消息的容器
     /// 存储聊天过程中用户和助手的消息列表
     std::vector<llama_chat_message> _messages;
+    /// `_messages` 中角色和内容字符串的存储
+    MessageArena _messageArena;
     // 存储将聊天模板应用到 `_messages` 中所有消息后生成的字符串
     /// 存储应用聊天模板后的格式化消息
     std::vector<char> _formattedMessages;
@@ -33,17 +123,108 @@ class LLMInference {
     std::vector<llama_token> _promptTokens;
     /// 上一次格式化消息的长度
     int _prevLen = 0;
+    /// `_prevLen` 覆盖的消息数量，即已经渲染并送入模型的 `_messages` 前缀长度
+    size_t _renderedMessages = 0;
+    /// 聊天模板是否逐条消息拼接（由 loadModel 探测），是则每轮只渲染新增的消息
+    bool _incrementalTemplate = false;
+    /// 已写入 KV 缓存（序列 0）的全部 token，按位置顺序排列
+    std::vector<llama_token> _tokenHistory;
+    /// 模型指纹，由模型描述和结构参数计算得到，用于校验会话快照
+    uint64_t _modelFingerprint = 0;
+    /// 模型文件的路径，预热时用于查找模型文件的内存映射
+    std::string _modelPath;
+    /// 已写入 KV 缓存的每条消息在序列 0 中的起始位置（同一轮一起预填充的消息共享起始位置）
+    std::vector<llama_pos> _messageStartPos;
+    /// 当前（或最近一次）响应在序列 0 中的起始位置
+    llama_pos _responseStartPos = 0;
+
+    // 上下文溢出处理
+    /// 上下文窗口写满时的处理策略，取值见 ContextOverflowPolicy
+    int _overflowPolicy = CONTEXT_OVERFLOW_FAIL;
+    /// CONTEXT_OVERFLOW_SHIFT 策略下始终保留的前缀 token 数，小于 0 表示保留系统提示词
+    int _nKeep = -1;
     /// 聊天模板字符串指针
-    const char *_chatTemplate;
+    const char *_chatTemplate = nullptr;
+
+    // 投机解码
+    /// 草稿来源，取值见 SpeculativeMode
+    int _speculativeMode = SPECULATIVE_NONE;
+    /// 每次验证时最多提交的草稿 token 数
+    int _nDraft = 0;
+    /// 验证用的批处理结构，一次容纳当前 token 和全部草稿 token，每个位置都输出 logits
+    llama_batch _speculativeBatch{};
+    /// 当前 token 及其后的草稿 token（第一个元素始终为 `_currToken`）
+    std::vector<llama_token> _draftTokens;
+    /// 最近一次验证被接受的 token，由之后的 completionLoop 逐个返回；除最后一个外都已写入 KV 缓存
+    std::vector<llama_token> _acceptedTokens;
+    /// `_acceptedTokens` 中下一个要返回的位置
+    size_t _acceptedTokensPos = 0;
+    /// `_acceptedTokens` 中第一个 token 在序列 0 中的位置
+    llama_pos _acceptedStartPos = 0;
+    /// 草稿模型指针，未加载时为 nullptr
+    llama_model *_draftModel = nullptr;
+    /// 草稿模型的上下文
+    llama_context *_draftCtx = nullptr;
+    /// 草稿模型使用的贪心采样器
+    llama_sampler *_draftSampler = nullptr;
+    /// 已写入草稿模型 KV 缓存（序列 0）的 token
+    std::vector<llama_token> _draftHistory;
+    /// 由 `_tokenHistory` 构建的 n-gram 缓存
+    common_ngram_cache _ngramCacheContext;
+    /// 跨会话积累的 n-gram 缓存（目前为空，供 common_ngram_cache_draft 使用）
+    common_ngram_cache _ngramCacheDynamic;
+    /// 预先统计的静态 n-gram 缓存（目前为空，供 common_ngram_cache_draft 使用）
+    common_ngram_cache _ngramCacheStatic;
+    /// 已加入 `_ngramCacheContext` 的 `_tokenHistory` 前缀长度
+    size_t _ngramCacheTokens = 0;
+    /// 累计提交验证的草稿 token 数
+    long _nDrafted = 0;
+    /// 累计被接受的草稿 token 数
+    long _nDraftAccepted = 0;
+
+    // 多候选生成
+    /// generateCandidates 最多生成的候选数量，候选占用序列 1～`_maxCandidates`
+    int _maxCandidates = 0;
+    /// 每个候选一个 token 的批处理结构，`_maxCandidates` 大于 0 时由 loadModel 分配
+    llama_batch _candidateBatch{};
+    /// 当前的采样参数，generateCandidates 据此为每个候选创建独立的采样器链
+    SamplerParams _samplerParams;
+
+    /// 一条正在生成的候选续写
+    struct CandidateSequence {
+        /// 占用的序列编号
+        llama_seq_id seqId = 0;
+        /// 已生成的 token（不含结束 token）
+        std::vector<llama_token> tokens;
+        /// `tokens` 的对数概率之和
+        float logProb = 0.0f;
+        /// 是否已生成结束 token
+        bool finished = false;
+    };
+
+    // LoRA 适配器
+    /// 已加载的适配器及其路径，下标即适配器 id；适配器与 `_model` 一起释放
+    std::vector<std::pair<llama_adapter_lora *, std::string>> _loraAdapters;
+    /// 每个适配器当前应用到 `_ctx` 的缩放系数，0 表示未应用
+    std::vector<float> _loraScales;
+
+    /// 共享 `_model` 的嵌入上下文，initEmbeddings 之前为空
+    std::unique_ptr<EmbeddingContext> _embeddings;
+    /// 使用 `_model` 词表的分词器，由 loadModel 创建
+    std::unique_ptr<Tokenizer> _tokenizer;
 
     // 存储给定查询的完整响应
     /// 存储当前查询的完整响应内容
     std::string _response;
-    /// 缓存响应的 token 片段
-    std::string _cacheResponseTokens;
+    /// 当前 token 转换得到的字节，按出现过的最长词块复用
+    std::vector<char> _pieceBytes;
+    /// 本次 completionStep 输出的完整 UTF-8 字符（以 '\0' 结尾）
+    std::vector<char> _pieceText;
+    /// 跨 token 拼接被拆分的多字节字符
+    Utf8Stream _utf8Stream;
     // 是否在 `_messages` 中缓存先前的消息
     /// 是否存储聊天历史消息的标志
-    bool _storeChats;
+    bool _storeChats = false;
 
     // 响应生成指标
     /// 记录响应生成所花费的总时间（微秒）
@@ -51,17 +232,195 @@ class LLMInference {
     /// 记录生成的 token 总数
     long _responseNumTokens = 0;
 
+    // 分阶段性能指标（见 getMetrics）
+    /// 加载、预热、首 token 时间等按阶段记录的指标
+    InferenceMetrics _metrics;
+    /// 本轮 startCompletion 开始的时间戳（微秒）
+    int64_t _completionStart = 0;
+    /// 本轮是否还没有采样出第一个 token
+    bool _firstTokenPending = false;
+    /// 本轮每个解码步的延迟（微秒）
+    std::vector<int64_t> _decodeLatencies;
+    /// 本轮采样所花费的时间（微秒）
+    int64_t _sampleTime = 0;
+    /// 本轮 token 转换为文本所花费的时间（微秒）
+    int64_t _detokenizeTime = 0;
+
     // 对话过程中消耗的上下文窗口长度
     /// 记录对话过程中已使用的上下文大小
     int _nCtxUsed = 0;
 
+    // 分块预填充
+    /// 是否有尚未预填充的提示词（startCompletion 之后第一次 completionLoop 时执行预填充）
+    bool _prefillPending = false;
+    /// 本轮预填充是否已被取消
+    bool _prefillCancelled = false;
+    /// 本轮预填充已处理的 token 数量
+    std::atomic<int> _prefillTokensDone{0};
+    /// 本轮预填充需要处理的 token 总数
+    std::atomic<int> _prefillTokensTotal{0};
+    /// 本轮预填充所花费的时间（微秒）
+    std::atomic<int64_t> _prefillTime{0};
+
+    /**
+     * @brief 将 `_promptTokens` 按 n_batch 分块送入 llama_decode，每个分块之后更新进度。
+     *
+     * @return bool 预填充完成返回 true，被取消或超时（包括在分块中途被 abort 回调中止）返回 false，
+     *         此时已从 KV 缓存中移除本轮写入的内容。
+     */
+    bool _prefill();
+
+    // 取消与生成上限
+    /// 请求取消本轮生成的标志，由 abort 回调在 llama_decode 的计算图节点之间检查
+    std::atomic<bool> _cancelRequested{false};
+    /// 本轮生成的截止时间（ggml_time_us），0 表示不限制
+    std::atomic<int64_t> _deadlineUs{0};
+    /// 本轮生成最多返回的 token 数，0 表示不限制
+    int _maxTokens = 0;
+    /// 最近一次生成结束的原因，取值见 StopReason
+    std::atomic<int> _stopReason{STOP_NONE};
+
+    /**
+     * @brief 设置给 `_ctx` 和 `_draftCtx` 的 abort 回调，取消或超过截止时间时让 llama_decode 在当前计算图中途返回。
+     */
+    static bool _abortCallback(void *data);
+
+    /**
+     * @brief 检查是否应该停止本轮生成，需要停止时记录原因（取消优先于超时）。
+     */
+    bool _checkAbort();
+
+    // 流式生成模式
+    /// 在原生线程上循环执行 completionLoop 的生成线程
+    std::thread _streamThread;
+    /// 生成线程写入、调用方批量读取的词块缓冲区
+    TokenStreamBuffer _streamBuffer;
+    /// 请求生成线程提前停止的标志
+    std::atomic<bool> _streamStopRequested{false};
+
+    /**
+     * @brief 渲染 `_messages` 中 `_renderedMessages` 之后新增的消息对应的文本片段。
+     *
+     * 聊天模板支持增量渲染时，只渲染以最后一条已渲染消息为锚点的小窗口并去掉锚点部分，
+     * 每轮开销与历史长度无关；否则退回到渲染全部消息并截取 `_prevLen` 之后的部分。
+     *
+     * @param addAssistant 是否在末尾追加助手回复的起始标记。
+     * @return std::string 新增消息渲染后的文本。
+     */
+    std::string _renderNewMessages(bool addAssistant);
+
+    /**
+     * @brief 将 `_promptTokens` 与 KV 缓存（序列 0）中已有的 token 比较，保留最长公共前缀，
+     * 只移除分叉之后的部分，并把 `_promptTokens` 缩减为需要重新预填充的后缀。
+     */
+    void _reuseCachedPrefix();
+
+    /**
+     * @brief 移除 `_messages` 中的最后一条消息并释放其内存。
+     */
+    void _removeLastChatMessage();
+
+    /**
+     * @brief 把存活的消息复制到新的 MessageArena 中，回收被丢弃的消息占用的空间。
+     */
+    void _compactMessages();
+
+    /**
+     * @brief 从 `_messages` 中移除 `[first, first + count)` 范围内的消息，并同步 `_renderedMessages` 与 `_prevLen`。
+     */
+    void _dropMessages(size_t first, size_t count);
+
+    /**
+     * @brief 确保 KV 缓存中还能写入 `nTokens` 个 token，空间不足时按 `_overflowPolicy` 处理。
+     *
+     * @throws std::runtime_error 策略为 CONTEXT_OVERFLOW_FAIL 或无法腾出足够空间时抛出。
+     */
+    void _makeContextSpace(int nTokens);
+
+    /**
+     * @brief 计算 CONTEXT_OVERFLOW_SHIFT 策略下需要保留的前缀 token 数。
+     */
+    int _keepTokenCount();
+
+    /**
+     * @brief 丢弃保留前缀之后最旧的一半 token，平移剩余 token 的位置，并移除完全落在丢弃区间内的消息。
+     *
+     * @return bool 没有可以丢弃的 token 时返回 false。
+     */
+    bool _shiftContext();
+
+    /**
+     * @brief 从第 `idx` 个输出位置的 logits 中采样下一个 token，并让采样器（以及语法）接受该 token。
+     *
+     * 设置了语法时先不带语法采样，只检查采样结果是否符合语法；不符合时才对整个词表应用语法后重新采样，
+     * 大多数 token 因此不必对完整词表逐个匹配语法。
+     */
+    llama_token _sampleToken(int32_t idx);
+
+    /**
+     * @brief 为 `_currToken` 生成草稿，在一次 llama_decode 中验证，并把被接受的 token 放入 `_acceptedTokens`。
+     *
+     * 每个位置都用 `_sampler` 采样，与草稿一致则接受并继续，第一个不一致（或全部接受后多出的一个）
+     * 采样结果作为新的当前 token，因此输出分布与逐个解码相同。未被接受的草稿从 KV 缓存中移除。
+     *
+     * @return bool 验证被 abort 回调中止时返回 false。
+     */
+    bool _speculativeDecode();
+
     /**
-     * @brief 检查输入的字符串是否为有效的 UTF-8 编码。
+     * @brief 用草稿模型在 `_draftTokens` 之后贪心生成最多 `nDraft` 个草稿 token。
      *
-     * @param response 待检查的字符串。
-     * @return bool 若为有效 UTF-8 编码返回 true，否则返回 false。
+     * 草稿模型的 KV 缓存与 `_tokenHistory` 比较，只补充解码分叉之后的部分。
+     */
+    void _draftWithModel(int nDraft);
+
+    /**
+     * @brief 用 `_tokenHistory` 中的 n-gram 在 `_draftTokens` 之后生成最多 `nDraft` 个草稿 token。
+     */
+    void _draftWithNgrams(int nDraft);
+
+    /**
+     * @brief 停止生成时，移除已写入 KV 缓存但尚未返回给调用方的被接受 token。
      */
-    bool _isValidUtf8(const char *response);
+    void _discardAcceptedTokens();
+
+    /**
+     * @brief 用 `sampler` 从 `logits` 中采样一个 token，并让采样器接受该 token。
+     */
+    llama_token _sampleWith(llama_sampler *sampler, const float *logits);
+
+    /**
+     * @brief 把每个未结束候选的最后一个 token 放进同一个批次解码，第 i 个未结束候选的 logits 位于输出位置 i。
+     *
+     * @param pos 这些 token 在各自序列中的位置（所有候选长度相同）。
+     * @return int llama_decode 的返回值：0 成功，1 KV 缓存没有空闲单元，2 被 abort 回调中止。
+     */
+    int _decodeCandidates(const std::vector<CandidateSequence> &sequences, llama_pos pos);
+
+    /**
+     * @brief 每个候选使用独立的采样器链，从提示词的 logits 开始独立采样。
+     */
+    void _sampleCandidates(std::vector<CandidateSequence> &sequences, const float *promptLogits, llama_pos promptEnd,
+                           int maxTokens);
+
+    /**
+     * @brief 集束搜索：每一步从所有路径的扩展中按累计对数概率保留最好的若干条，分叉的路径通过 llama_memory_seq_cp
+     * 复制 KV 缓存。以结束 token 结束的路径直接成为结果，不再占用集束宽度。
+     *
+     * @param sequences 输入时为可用的序列（编号有效即可），输出为全部结果。
+     */
+    void _beamSearchCandidates(std::vector<CandidateSequence> &sequences, const float *promptLogits,
+                               llama_pos promptEnd, int maxTokens);
+
+    /**
+     * @brief 丢弃最早的对话轮次后清空 KV 缓存，重新预填充剩余历史（以及已生成的部分响应）。
+     */
+    void _restartContext(int nTokens);
+
+    /**
+     * @brief 清空 KV 缓存和对应的 token 历史，下一次 startCompletion 重新渲染并预填充全部消息。
+     */
+    void _clearKvCache();
 
 public:
     /**
@@ -73,13 +432,37 @@ public:
      * @param storeChats 是否存储聊天记录。
      * @param contextSize 模型的上下文大小。
      * @param chatTemplate 聊天模板字符串。
-     * @param nThreads 推理时使用的线程数量。
+     * @param threadParams 解码和预填充的线程数以及 CPU 放置策略。
      * @param useMmap 是否使用内存映射加载模型。
      * @param useMlock 是否使用内存锁定。
+     * @param nBatch 预填充时每次提交给 llama_decode 的最大 token 数（逻辑批大小），小于等于 0 时使用默认值。
+     * @param nUbatch 计算图一次处理的最大 token 数（物理批大小），决定计算缓冲区大小，小于等于 0 时使用默认值。
+     * @param typeK KV 缓存中 K 的数据类型（ggml_type），支持 GGML_TYPE_F16、GGML_TYPE_Q8_0 和 GGML_TYPE_Q4_0。
+     * @param typeV KV 缓存中 V 的数据类型，取值同 `typeK`，量化的 V 缓存需要 flash attention。
+     * @param flashAttn flash attention 开关，取值见 llama_flash_attn_type（-1 表示由 llama.cpp 自动决定）。
+     * @param maxCandidates generateCandidates 最多生成的候选数量，0 表示不使用。大于 0 时上下文为每个候选多分配一个序列，
+     *                      并使用所有序列共享的统一 KV 缓存，因此序列 0 仍然可以使用全部上下文。
+     * @param progressCallback 模型加载进度回调（0～1），在调用线程上执行，返回 false 时中止加载，可以为 nullptr。
+     * @param progressUserData 传给 `progressCallback` 的用户数据。
+     * @throws std::runtime_error 加载失败、KV 缓存参数或线程参数无效时抛出。
      */
     void loadModel(const char *modelPath, float minP, float temperature, bool storeChats,
                    long contextSize,
-                   const char *chatTemplate, int nThreads, bool useMmap, bool useMlock);
+                   const char *chatTemplate, const ThreadParams &threadParams, bool useMmap, bool useMlock,
+                   int nBatch = 0, int nUbatch = 0, int typeK = GGML_TYPE_F16, int typeV = GGML_TYPE_F16,
+                   int flashAttn = LLAMA_FLASH_ATTN_TYPE_AUTO, int maxCandidates = 0,
+                   llama_progress_callback progressCallback = nullptr, void *progressUserData = nullptr);
+
+    /**
+     * @brief 预热刚加载的模型，让第一个用户 token 不再承担冷启动的 I/O 和内存分配开销。
+     *
+     * 先把 mmap 映射的模型文件预读进页缓存（见 prefetchMappedFile），再执行一次只包含 BOS/EOS 的解码，
+     * 触发计算缓冲区分配和线程创建，最后清空 KV 缓存。必须在 loadModel 之后、添加任何消息之前调用。
+     *
+     * @param prefetch 是否预读模型文件。
+     * @throws std::runtime_error 预热解码失败时抛出。
+     */
+    void warmup(bool prefetch = true);
 
     /**
      * @brief 向聊天消息列表中添加一条消息。
@@ -105,15 +488,192 @@ public:
      */
     int getContextSizeUsed() const;
 
+    /**
+     * @brief 获取最近一次 startCompletion 生成的提示词 token 数量（即本轮需要预填充的 token 数）。
+     *
+     * @return int 提示词 token 数量。
+     */
+    int getPromptTokenCount() const;
+
+    /**
+     * @brief 获取当前（或最近一次）预填充的进度，可在其他线程中调用。
+     *
+     * @return float 已处理的提示词 token 比例，范围为 [0, 1]。
+     */
+    float getPrefillProgress() const;
+
+    /**
+     * @brief 获取最近一次预填充的速度。
+     *
+     * @return float 预填充速度，单位为 token/秒。
+     */
+    float getPrefillSpeed() const;
+
+    /**
+     * @brief 请求取消当前的预填充，可在其他线程中调用，在下一个分块开始之前生效。
+     *
+     * 被取消后 completionLoop 返回 "[EOG]"，stopCompletion 会撤销本轮的用户消息。
+     * 等同于 cancel()。
+     */
+    void cancelPrefill() { cancel(); }
+
+    /**
+     * @brief 请求取消本轮生成，可在其他线程中调用。
+     *
+     * 正在执行的 llama_decode（预填充的分块或一次解码）通过 abort 回调在计算图中途返回，
+     * 之后 completionStep 返回 false。预填充阶段被取消时 stopCompletion 会撤销本轮的用户消息，
+     * 解码阶段被取消时已生成的部分响应照常保存。
+     */
+    void cancel();
+
+    /**
+     * @brief 获取最近一次生成结束的原因，取值见 StopReason。可在其他线程中调用。
+     */
+    int getStopReason() const;
+
+    /**
+     * @brief 获取模型加载和最近一次生成的分阶段性能指标。
+     *
+     * 应在生成结束（或 stopCompletion）之后调用，生成进行中调用时结果可能不一致。
+     */
+    InferenceMetrics getMetrics() const;
+
+    /**
+     * @brief 替换采样器链，loadModel 创建的采样器只包含 min-p、温度和随机采样。
+     *
+     * 不能在生成进行中调用。
+     *
+     * @param params 采样参数。
+     */
+    void setSamplerParams(const SamplerParams &params);
+
+    /**
+     * @brief 设置约束之后每次生成的语法，每次 startCompletion 都从语法的起始状态开始。
+     *
+     * 不能在生成进行中调用。编译后的语法按内容缓存，重复使用同一个语法或 JSON schema 时不会重新解析。
+     *
+     * @param grammar GBNF 语法（根规则为 root）或 JSON schema，为 nullptr 或空字符串时取消约束。
+     * @param isJsonSchema `grammar` 是否为 JSON schema。
+     * @throws std::runtime_error 语法或 JSON schema 无效时抛出，此时之前的语法保持不变。
+     */
+    void setGrammar(const char *grammar, bool isJsonSchema);
+
+    /**
+     * @brief 设置上下文窗口写满时的处理策略。
+     *
+     * @param policy 处理策略，取值见 ContextOverflowPolicy。
+     * @param nKeep CONTEXT_OVERFLOW_SHIFT 策略下始终保留的前缀 token 数，小于 0 表示保留系统提示词。
+     */
+    void setContextOverflowPolicy(int policy, int nKeep);
+
+    /**
+     * @brief 加载与主模型共享词表的草稿模型，用于 SPECULATIVE_DRAFT_MODEL 模式。
+     *
+     * 草稿模型的上下文使用与主模型相同的上下文大小、批大小和线程数。
+     *
+     * @param modelPath 草稿模型文件的路径。
+     * @throws std::runtime_error 加载失败或词表与主模型不兼容时抛出。
+     */
+    void loadDraftModel(const char *modelPath);
+
+    /**
+     * @brief 设置投机解码模式。
+     *
+     * @param mode 草稿来源，取值见 SpeculativeMode。
+     * @param nDraft 每次验证时最多提交的草稿 token 数（建议 4～8）。
+     * @throws std::runtime_error 模式无效、草稿模型未加载或模型的记忆不支持回滚部分序列时抛出。
+     */
+    void setSpeculativeDecoding(int mode, int nDraft);
+
+    /**
+     * @brief 获取草稿 token 的接受率。
+     *
+     * @return float 被接受的草稿 token 数与提交验证的草稿 token 数之比，没有草稿时返回 0。
+     */
+    float getDraftAcceptanceRate() const;
+
+    /**
+     * @brief 加载 LoRA 适配器，加载后不会立即应用。
+     *
+     * 适配器必须基于当前模型训练，只加载一次，之后通过 setLoraAdapter 在不同任务之间切换，
+     * 不需要重新加载模型权重。同一路径重复加载时返回已有的 id。
+     *
+     * @param path 适配器 GGUF 文件的路径。
+     * @return int 适配器 id。
+     * @throws std::runtime_error 文件无效或与模型不兼容时抛出。
+     */
+    int loadLoraAdapter(const char *path);
+
+    /**
+     * @brief 设置适配器在之后的生成中使用的缩放系数，`scale` 为 0 时卸下适配器。不能在生成进行中调用。
+     *
+     * 应用的适配器或系数发生变化时，KV 缓存中的内容是用旧的权重计算的，会被清空，
+     * 下一次生成重新预填充全部聊天历史。
+     *
+     * @param id loadLoraAdapter 返回的 id。
+     * @param scale 缩放系数，通常为 1。
+     * @throws std::runtime_error id 无效或应用失败时抛出。
+     */
+    void setLoraAdapter(int id, float scale);
+
+    /**
+     * @brief 卸下所有适配器，回到基础模型。已加载的适配器保留，可以再次应用。
+     */
+    void clearLoraAdapters();
+
+    /**
+     * @brief 在已加载的模型上创建（或按新参数重新创建）嵌入上下文，之后可以调用 embed。
+     *
+     * 嵌入上下文与生成用的上下文共享模型权重，但有独立的 KV 缓存，两者互不影响；LoRA 适配器只作用于生成。
+     *
+     * @param params 池化方式和批大小。
+     * @throws std::runtime_error 参数无效或模型不支持所选的池化方式时抛出。
+     */
+    void initEmbeddings(const EmbeddingParams &params);
+
+    /**
+     * @brief 嵌入向量的维度（模型的 n_embd）。
+     */
+    int getEmbeddingSize() const;
+
+    /**
+     * @brief 计算多条文本的嵌入，多条文本被打包进同一次 llama_decode。不能与生成同时进行。
+     *
+     * @param texts 输入文本。
+     * @param normalize 是否对每个向量做 L2 归一化。
+     * @param out 输出缓冲区，至少 texts.size() * getEmbeddingSize() 个 float，按文本顺序逐行写入。
+     * @throws std::runtime_error 未调用 initEmbeddings 或编码失败时抛出。
+     */
+    void embed(const std::vector<std::string> &texts, bool normalize, float *out);
+
+    /**
+     * @brief 使用已加载模型词表的分词器，用于在生成之前估算上下文预算，可以与生成同时使用。
+     *
+     * @throws std::runtime_error 模型未加载时抛出。
+     */
+    Tokenizer &getTokenizer();
+
     /**
      * @brief 开始完成任务，处理用户输入并准备推理。
      *
      * @param query 用户输入的查询内容。
+     * @param limits 本轮生成的 token 数和时间上限，默认不限制。
      */
-    void startCompletion(const char *query);
+    void startCompletion(const char *query, const GenerationLimits &limits = {});
 
     /**
-     * @brief 完成任务的循环函数，进行模型推理和响应生成。
+     * @brief 生成一个 token：必要时预填充或解码，采样并转换为文本。
+     *
+     * 稳定状态下不分配内存：批处理结构、候选数组和文本缓冲区都被复用，UTF-8 只检查新产生的字节。
+     *
+     * @param piece 输出本次得到的完整 UTF-8 字符（多字节字符未完成时为空），以 '\0' 结尾，
+     *              在下一次调用之前有效。
+     * @return bool 生成结束时返回 false，结束的原因见 getStopReason()。
+     */
+    bool completionStep(std::string_view &piece);
+
+    /**
+     * @brief 完成任务的循环函数，进行模型推理和响应生成（completionStep 返回副本的版本）。
      *
      * @return std::string 生成的有效 UTF-8 词块，若无效则返回空字符串，若生成结束则返回 "[EOG]"。
      */
@@ -124,6 +684,72 @@ public:
      */
     void stopCompletion();
 
+    /**
+     * @brief 为同一个查询一次生成多条候选续写（如输入联想的多个建议），提示词只预填充一次。
+     *
+     * 查询像 startCompletion 一样渲染并预填充到序列 0，再用 llama_memory_seq_cp 分叉到序列 1～nCandidates
+     * （统一 KV 缓存中分叉只共享单元，不复制数据），之后每一步把所有候选的 token 放进同一个批次，只调用一次
+     * llama_decode。采样模式下每个候选使用按当前采样参数新建的采样器链（指定种子时依次加 1）；
+     * 集束搜索模式下按累计对数概率保留最好的 nCandidates 条路径。
+     * 查询和候选都不会写入聊天历史。不应用语法约束和投机解码，不能与其他生成同时进行，可以通过 cancel() 取消。
+     *
+     * @param query 用户查询。
+     * @param nCandidates 候选数量，1～loadModel 的 maxCandidates。
+     * @param beamSearch 是否使用集束搜索，否则各候选独立采样。
+     * @param limits 每个候选最多生成 `limits.maxTokens` 个 token（小于等于 0 时只受上下文大小限制），
+     *               `limits.timeoutMs` 限制整次调用。
+     * @return std::vector<GenerationCandidate> 按平均每个 token 的对数概率从高到低排序的候选，被取消或超时时为已生成的部分。
+     * @throws std::runtime_error 候选数量无效、上下文写满或解码失败时抛出。
+     */
+    std::vector<GenerationCandidate> generateCandidates(const char *query, int nCandidates, bool beamSearch,
+                                                        const GenerationLimits &limits = {});
+
+    /**
+     * @brief 以流式模式开始生成：处理用户输入后，在原生线程上持续生成词块并写入环形缓冲区。
+     *
+     * 预填充也在原生线程上进行，调用方不会阻塞在 llama_decode 中。
+     *
+     * @param query 用户输入的查询内容。
+     * @param limits 本轮生成的 token 数和时间上限，默认不限制。
+     */
+    void startStream(const char *query, const GenerationLimits &limits = {});
+
+    /**
+     * @brief 从流式缓冲区中批量读取已生成的词块，没有可读数据时阻塞。
+     *
+     * @param dst 目标缓冲区（例如 Java 层的 direct ByteBuffer）。
+     * @param capacity 目标缓冲区容量（字节）。
+     * @param maxPieces 最多读取的词块数量，小于等于 0 表示读取全部可用数据。
+     * @return long 写入的字节数（均为完整的 UTF-8 序列），生成结束后返回 -1。
+     */
+    long drainStream(char *dst, size_t capacity, int maxPieces);
+
+    /**
+     * @brief 停止流式生成：取消正在执行的 llama_decode，等待生成线程退出并完成收尾工作（等同于 stopCompletion）。
+     */
+    void stopStream();
+
+    /**
+     * @brief 将当前会话保存到文件，包括 KV 缓存（序列 0）、聊天消息、`_prevLen` 以及 token 历史。
+     *
+     * 不能在生成进行中调用。文件先写入临时文件再重命名，保证不会留下不完整的快照。
+     *
+     * @param path 会话快照文件路径。
+     * @throws std::runtime_error 写入失败时抛出。
+     */
+    void saveSession(const char *path);
+
+    /**
+     * @brief 从文件恢复会话，文件以内存映射方式读取，KV 缓存直接从映射区域载入。
+     *
+     * 快照必须由同一模型、相同上下文大小保存，否则不会修改当前会话。文件校验通过后若 KV 缓存载入失败，
+     * 原有的 KV 缓存已被清除，此时对话会被完整重置（消息、token 历史与增量模板状态全部清空）。
+     *
+     * @param path 会话快照文件路径。
+     * @return bool 恢复成功返回 true；文件不存在、格式无效、与当前模型/上下文不匹配或载入失败时返回 false。
+     */
+    bool loadSession(const char *path);
+
     /**
      * @brief 析构函数，释放类实例占用的资源。
      */
@@ -0,0 +1,24 @@
+#pragma once
+
+// 日志宏：Android 上输出到 logcat，宿主机（Linux）构建时输出到 stderr
+#define TAG "[SmolLMAndroid-Cpp]"
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#define LOGi(...) __android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__)
+#define LOGe(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
+#else
+#include <cstdio>
+#define LOGi(...)                                                                                                      \
+    do {                                                                                                               \
+        fprintf(stderr, "%s I ", TAG);                                                                                 \
+        fprintf(stderr, __VA_ARGS__);                                                                                  \
+        fputc('\n', stderr);                                                                                           \
+    } while (0)
+#define LOGe(...)                                                                                                      \
+    do {                                                                                                               \
+        fprintf(stderr, "%s E ", TAG);                                                                                 \
+        fprintf(stderr, __VA_ARGS__);                                                                                  \
+        fputc('\n', stderr);                                                                                           \
+    } while (0)
+#endif
@@ -0,0 +1,80 @@
+#include "LlamaLog.h"
+#include "LLMLog.h"
+#include "llama.h"
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <optional>
+
+namespace {
+
+// llama.cpp does not expose the KV cache or compute buffer allocations (llama_state_get_size is the size of the
+// serialized state, the scheduler's buffers are private), so they are read from the log messages it prints while
+// creating the context. Both patterns depend on the exact wording of these llama.cpp messages:
+//   llama-context.cpp  "llama_context:        CPU compute buffer size =    30.02 MiB"
+//   llama-kv-cache.cpp "llama_kv_cache: size =  256.00 MiB (  4096 cells,  32 layers,  1/1 seqs), K (f16): ..."
+// A message that no longer matches leaves the size unknown instead of reporting 0.
+struct SizePattern {
+    // the message must contain this, e.g. the name of the llama.cpp function or class that prints it
+    const char *tag;
+    // located after `tag`, the sscanf format is applied from here and reads the size in MiB
+    const char *anchor;
+    const char *format;
+};
+
+constexpr SizePattern COMPUTE_BUFFER_PATTERN = {"compute buffer", "compute buffer size =", "compute buffer size = %f MiB"};
+// also matches the older "llama_kv_cache_unified: size =" and both caches of the SWA variant
+constexpr SizePattern KV_CACHE_PATTERN = {"kv_cache", ": size =", ": size = %f MiB"};
+
+// llama_init_from_model reports the compute buffer of each backend on the thread that creates the context
+thread_local std::optional<size_t> _computeBufferSize;
+// the KV cache constructor reports its size the same way
+thread_local std::optional<size_t> _kvCacheSize;
+
+void
+addMatchedSize(const char *text, const SizePattern &pattern, std::optional<size_t> &size) {
+    const char *tag = strstr(text, pattern.tag);
+    const char *anchor = tag != nullptr ? strstr(tag, pattern.anchor) : nullptr;
+    float mib = 0.0f;
+    if (anchor != nullptr && sscanf(anchor, pattern.format, &mib) == 1) {
+        size = size.value_or(0) + (size_t) (mib * 1024.0f * 1024.0f);
+    }
+}
+
+void
+onLlamaLog(ggml_log_level level, const char *text, void * /*userData*/) {
+    addMatchedSize(text, COMPUTE_BUFFER_PATTERN, _computeBufferSize);
+    addMatchedSize(text, KV_CACHE_PATTERN, _kvCacheSize);
+#ifdef __ANDROID__
+    if (level == GGML_LOG_LEVEL_ERROR || level == GGML_LOG_LEVEL_WARN) {
+        LOGe("%s", text);
+    } else if (level == GGML_LOG_LEVEL_INFO) {
+        LOGi("%s", text);
+    }
+#else
+    (void) level;
+    fputs(text, stderr);
+#endif
+}
+
+} // namespace
+
+void
+installLlamaLogHook() {
+    static std::once_flag installed;
+    std::call_once(installed, []() { llama_log_set(onLlamaLog, nullptr); });
+}
+
+std::optional<size_t>
+takeComputeBufferSize() {
+    std::optional<size_t> size = _computeBufferSize;
+    _computeBufferSize.reset();
+    return size;
+}
+
+std::optional<size_t>
+takeKvCacheSize() {
+    std::optional<size_t> size = _kvCacheSize;
+    _kvCacheSize.reset();
+    return size;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <optional>
+
+/**
+ * @brief 安装 llama.cpp / ggml 的日志回调，多次调用只安装一次。
+ *
+ * Android 上 llama.cpp 默认写入 stderr 的日志会被丢弃，回调把它们转发到 logcat（宿主机构建仍写入 stderr），
+ * 同时记录创建上下文时报告的计算缓冲区和 KV 缓存大小，见 takeComputeBufferSize 和 takeKvCacheSize。
+ */
+void installLlamaLogHook();
+
+/**
+ * @brief 返回当前线程自上一次调用以来 llama.cpp 报告的计算缓冲区大小之和（字节），并将其清零。
+ *
+ * 在 llama_init_from_model 之前调用一次清零，之后再调用即可得到该上下文所有后端的计算缓冲区大小。
+ * llama.cpp 没有提供查询接口，大小取自其日志消息；没有匹配到任何消息（例如上游改变了措辞）时返回 std::nullopt。
+ */
+std::optional<size_t> takeComputeBufferSize();
+
+/**
+ * @brief 返回当前线程自上一次调用以来 llama.cpp 报告的 KV 缓存大小之和（字节），并将其清零。
+ *
+ * 使用方式同 takeComputeBufferSize，滑动窗口注意力模型的两个 KV 缓存会合计在一起。
+ */
+std::optional<size_t> takeKvCacheSize();
@@ -0,0 +1,66 @@
+#include "MessageArena.h"
+#include <algorithm>
+#include <cstring>
+
+MessageArena::MessageArena(size_t chunkSize) : _chunkSize(chunkSize) {}
+
+const char *
+MessageArena::copy(const char *text) {
+    return copy(text, strlen(text));
+}
+
+const char *
+MessageArena::copy(const char *text, size_t length) {
+    const size_t size = length + 1;
+    // move on to the next chunk (reused after clear(), or a new one) when the current one is full
+    while (_current < _chunks.size() && _chunks[_current].capacity - _chunks[_current].used < size) {
+        if (_current + 1 == _chunks.size()) {
+            break;
+        }
+        _current++;
+    }
+    if (_chunks.empty() || _chunks[_current].capacity - _chunks[_current].used < size) {
+        const size_t capacity = std::max(_chunkSize, size);
+        _chunks.push_back({std::unique_ptr<char[]>(new char[capacity]), capacity, 0});
+        _current = _chunks.size() - 1;
+    }
+    Chunk &chunk = _chunks[_current];
+    char *dst = chunk.data.get() + chunk.used;
+    memcpy(dst, text, length);
+    dst[length] = '\0';
+    chunk.used += size;
+    return dst;
+}
+
+void
+MessageArena::release(const char *text) {
+    if (text == nullptr || _chunks.empty()) {
+        return;
+    }
+    const size_t size = strlen(text) + 1;
+    Chunk &chunk = _chunks[_current];
+    if (text + size == chunk.data.get() + chunk.used) {
+        // the most recent string, e.g. a query that is withdrawn
+        chunk.used -= size;
+    } else {
+        _wastedBytes += size;
+    }
+}
+
+size_t
+MessageArena::usedBytes() const {
+    size_t used = 0;
+    for (const Chunk &chunk: _chunks) {
+        used += chunk.used;
+    }
+    return used;
+}
+
+void
+MessageArena::clear() {
+    for (Chunk &chunk: _chunks) {
+        chunk.used = 0;
+    }
+    _current = 0;
+    _wastedBytes = 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * @class MessageArena
+ * @brief 聊天消息文本的分块线性分配器，取代每条消息的 strdup/free。
+ *
+ * 字符串依次复制到固定大小的块中，块在 clear 之后复用，因此对话进行时不再为每条消息调用 malloc。
+ * 释放最后分配的字符串（例如撤销本轮查询）会直接回退分配位置；释放其他字符串只记为浪费的字节，
+ * 由调用方在浪费过多时把存活的字符串复制到新的分配器中整理。
+ */
+class MessageArena {
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+        size_t used;
+    };
+
+    /// 已分配的块，`_current` 之后的块在 clear 之后等待复用
+    std::vector<Chunk> _chunks;
+    /// 当前写入的块
+    size_t _current = 0;
+    /// 新块的默认大小
+    size_t _chunkSize;
+    /// 已释放但未回收的字节数
+    size_t _wastedBytes = 0;
+
+public:
+    explicit MessageArena(size_t chunkSize = 16 * 1024);
+
+    MessageArena(MessageArena &&) = default;
+    MessageArena &operator=(MessageArena &&) = default;
+
+    /**
+     * @brief 复制一个以 '\0' 结尾的字符串。
+     *
+     * @return const char* 复制后的字符串，在 release、clear 或整理之前保持有效。
+     */
+    const char *copy(const char *text);
+
+    /**
+     * @brief 复制 `length` 个字节并追加 '\0'。
+     */
+    const char *copy(const char *text, size_t length);
+
+    /**
+     * @brief 释放由 copy 返回的字符串。
+     */
+    void release(const char *text);
+
+    /**
+     * @brief 已释放但未回收的字节数。
+     */
+    size_t wastedBytes() const { return _wastedBytes; }
+
+    /**
+     * @brief 已分配的字节数（包括浪费的字节）。
+     */
+    size_t usedBytes() const;
+
+    /**
+     * @brief 释放所有字符串，保留已分配的块供之后复用。
+     */
+    void clear();
+};
@@ -0,0 +1,56 @@
+#include "ModelPrefetch.h"
+#include "LLMLog.h"
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+size_t
+prefetchMappedFile(const char *path) {
+    // /proc/self/maps lists the canonical path of every mapped file
+    char realPath[PATH_MAX];
+    if (realpath(path, realPath) == nullptr) {
+        LOGe("prefetch: failed to resolve %s", path);
+        return 0;
+    }
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (!maps) {
+        LOGe("prefetch: failed to open /proc/self/maps");
+        return 0;
+    }
+
+    const auto pageSize = (uintptr_t) sysconf(_SC_PAGESIZE);
+    size_t prefetched = 0;
+    char line[PATH_MAX + 128];
+    while (fgets(line, sizeof(line), maps)) {
+        // address           perms offset  dev   inode      pathname
+        // 7f2c4a000-7f2c4b000 r--p 00000000 fd:01 1234567    /data/.../model.gguf
+        unsigned long start = 0;
+        unsigned long end = 0;
+        char perms[5] = {};
+        int pathStart = 0;
+        if (sscanf(line, "%lx-%lx %4s %*x %*x:%*x %*u %n", &start, &end, perms, &pathStart) < 3 ||
+            pathStart == 0 || perms[0] != 'r') {
+            continue;
+        }
+        char *mappedPath = line + pathStart;
+        mappedPath[strcspn(mappedPath, "\n")] = '\0';
+        if (strcmp(mappedPath, realPath) != 0) {
+            continue;
+        }
+
+        madvise(reinterpret_cast<void *>(start), end - start, MADV_WILLNEED);
+        // touch every page in order, the readahead started by madvise keeps ahead of the loop
+        volatile uint8_t sink = 0;
+        for (uintptr_t page = start; page < end; page += pageSize) {
+            sink = sink + *reinterpret_cast<const volatile uint8_t *>(page);
+        }
+        (void) sink;
+        prefetched += end - start;
+    }
+    fclose(maps);
+    return prefetched;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+
+/**
+ * @brief 预读进程中以 mmap 方式映射的模型文件，使第一次推理不再因为缺页而等待磁盘 I/O。
+ *
+ * 在 /proc/self/maps 中查找 `path` 的所有映射区间，先对每个区间调用 madvise(MADV_WILLNEED) 发起异步预读，
+ * 再按顺序读取每一页的一个字节，把文件内容载入页缓存并建立页表映射。
+ * 模型未使用 mmap 加载（权重已读入内存）时没有可预读的映射。
+ *
+ * @param path 模型文件的路径。
+ * @return size_t 预读的字节数，找不到映射时返回 0。
+ */
+size_t prefetchMappedFile(const char *path);
@@ -0,0 +1,36 @@
+#include "SamplerChain.h"
+
+llama_sampler *
+createSamplerChain(const SamplerParams &params) {
+    llama_sampler_chain_params sampler_params = llama_sampler_chain_default_params();
+    sampler_params.no_perf = true; // disable performance metrics
+    llama_sampler *sampler = llama_sampler_chain_init(sampler_params);
+
+    // penalties only touch the logits of the last `penaltyLastN` tokens
+    if (params.penaltyLastN != 0 &&
+        (params.repeatPenalty != 1.0f || params.frequencyPenalty != 0.0f || params.presencePenalty != 0.0f)) {
+        llama_sampler_chain_add(sampler,
+                                llama_sampler_init_penalties(params.penaltyLastN, params.repeatPenalty,
+                                                             params.frequencyPenalty, params.presencePenalty));
+    }
+    if (params.greedy) {
+        // argmax over the logits, no softmax
+        llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+        return sampler;
+    }
+
+    // truncate first: top-k partially sorts the vocabulary once and min-p compares raw logits against the
+    // maximum, so the steps below only sort and softmax the handful of candidates that are left
+    if (params.topK > 0) {
+        llama_sampler_chain_add(sampler, llama_sampler_init_top_k(params.topK));
+    }
+    if (params.minP > 0.0f) {
+        llama_sampler_chain_add(sampler, llama_sampler_init_min_p(params.minP, 1));
+    }
+    if (params.topP < 1.0f) {
+        llama_sampler_chain_add(sampler, llama_sampler_init_top_p(params.topP, 1));
+    }
+    llama_sampler_chain_add(sampler, llama_sampler_init_temp(params.temperature));
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(params.seed));
+    return sampler;
+}
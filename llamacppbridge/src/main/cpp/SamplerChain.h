@@ -0,0 +1,40 @@
+#pragma once
+#include "llama.h"
+#include <cstdint>
+
+/**
+ * @struct SamplerParams
+ * @brief 采样器链的参数，取值为 0（或 1.0）的步骤不会加入链中。
+ */
+struct SamplerParams {
+    /// 采样温度
+    float temperature = 1.0f;
+    /// min-p 阈值，概率低于最大概率乘以该值的 token 被丢弃，0 表示关闭
+    float minP = 0.01f;
+    /// 只保留概率最高的 k 个 token，0 表示关闭
+    int topK = 40;
+    /// 保留累计概率达到 p 的最小 token 集合，1.0 表示关闭
+    float topP = 1.0f;
+    /// 重复惩罚系数，1.0 表示关闭
+    float repeatPenalty = 1.0f;
+    /// 频率惩罚系数，0 表示关闭
+    float frequencyPenalty = 0.0f;
+    /// 存在惩罚系数，0 表示关闭
+    float presencePenalty = 0.0f;
+    /// 惩罚考虑的最近 token 数量
+    int penaltyLastN = 64;
+    /// 是否总是选择概率最高的 token（忽略温度和截断参数）
+    bool greedy = false;
+    /// 随机数种子
+    uint32_t seed = LLAMA_DEFAULT_SEED;
+};
+
+/**
+ * @brief 按 `params` 创建采样器链。
+ *
+ * 惩罚只修改出现过的 token，其后先做 top-k 和 min-p 截断（两者都不需要对整个词表做 softmax 或排序），
+ * 再对剩下的少量候选执行需要排序的 top-p、温度和随机采样；贪心模式只做惩罚和取最大值。
+ *
+ * @return llama_sampler* 采样器链，由调用方通过 llama_sampler_free 释放。
+ */
+llama_sampler *createSamplerChain(const SamplerParams &params);
@@ -0,0 +1,259 @@
+#include "ThreadPlacement.h"
+#include "ggml-backend.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+
+long
+readSysfsLong(const char *format, int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path), format, cpu);
+    FILE *file = fopen(path, "r");
+    if (file == nullptr) {
+        return -1;
+    }
+    long value = -1;
+    if (fscanf(file, "%ld", &value) != 1) {
+        value = -1;
+    }
+    fclose(file);
+    return value;
+}
+
+// the cpus this process may run on, e.g. restricted by the cpuset of a background app
+std::vector<int>
+allowedCpus() {
+    const int nCpus = (int) sysconf(_SC_NPROCESSORS_CONF);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    const bool known = sched_getaffinity(0, sizeof(set), &set) == 0;
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < nCpus && cpu < CPU_SETSIZE; cpu++) {
+        if (!known || CPU_ISSET(cpu, &set)) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::string
+formatCpuList(const std::vector<int> &cpus) {
+    std::string result;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        if (!result.empty()) {
+            result += ",";
+        }
+        result += std::to_string(cpus[i]);
+        if (j > i) {
+            result += "-" + std::to_string(cpus[j]);
+        }
+        i = j + 1;
+    }
+    return result;
+}
+
+} // namespace
+
+std::vector<int>
+detectPerformanceCpus() {
+    const std::vector<int> cpus = allowedCpus();
+    // cpu_capacity is the scheduler's normalized performance (1024 = fastest core); older kernels
+    // do not expose it, the maximum frequency is the next best proxy within one SoC
+    std::vector<long> capacity;
+    for (const char *format: {"/sys/devices/system/cpu/cpu%d/cpu_capacity",
+                              "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq"}) {
+        capacity.clear();
+        for (int cpu: cpus) {
+            const long value = readSysfsLong(format, cpu);
+            if (value <= 0) {
+                break;
+            }
+            capacity.push_back(value);
+        }
+        if (capacity.size() == cpus.size()) {
+            break;
+        }
+    }
+    if (capacity.size() != cpus.size() || cpus.empty()) {
+        return cpus;
+    }
+
+    // drop the slowest cluster: the little cores of big.LITTLE, or the A5xx cores of prime/big/little SoCs
+    const long slowest = *std::min_element(capacity.begin(), capacity.end());
+    std::vector<int> performanceCpus;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        if (capacity[i] > slowest) {
+            performanceCpus.push_back(cpus[i]);
+        }
+    }
+    return performanceCpus.empty() ? cpus : performanceCpus;
+}
+
+std::vector<int>
+parseCpuMask(const std::string &mask) {
+    std::vector<int> cpus;
+    if (mask.size() > 2 && mask[0] == '0' && (mask[1] == 'x' || mask[1] == 'X')) {
+        // the lowest bit is the last hex digit
+        int cpu = 0;
+        for (size_t i = mask.size(); i > 2; i--) {
+            const char c = mask[i - 1];
+            int digit;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                digit = c - 'A' + 10;
+            } else {
+                throw std::runtime_error("invalid CPU mask: " + mask);
+            }
+            for (int bit = 0; bit < 4; bit++, cpu++) {
+                if (digit & (1 << bit)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+    } else {
+        size_t pos = 0;
+        while (pos < mask.size()) {
+            size_t end = mask.find(',', pos);
+            if (end == std::string::npos) {
+                end = mask.size();
+            }
+            const std::string range = mask.substr(pos, end - pos);
+            int first = -1;
+            int last = -1;
+            char extra;
+            const int parsed = sscanf(range.c_str(), "%d-%d%c", &first, &last, &extra);
+            if (parsed == 1) {
+                last = first;
+            }
+            if ((parsed != 1 && parsed != 2) || first < 0 || last < first) {
+                throw std::runtime_error("invalid CPU list: " + mask);
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+            pos = end + 1;
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    if (cpus.empty() || cpus.back() >= GGML_MAX_N_THREADS) {
+        throw std::runtime_error("invalid CPU mask: " + mask);
+    }
+    return cpus;
+}
+
+void
+ThreadPlacement::configure(const ThreadParams &params) {
+    release();
+    std::vector<int> cpus;
+    switch (params.placement) {
+        case CPU_PLACEMENT_NONE:
+            break;
+        case CPU_PLACEMENT_PERFORMANCE:
+            cpus = detectPerformanceCpus();
+            break;
+        case CPU_PLACEMENT_MASK:
+            cpus = parseCpuMask(params.cpuMask);
+            break;
+        default:
+            throw std::runtime_error("unknown CPU placement");
+    }
+    if (params.poll < 0 || params.poll > 100) {
+        throw std::runtime_error("poll must be between 0 and 100");
+    }
+    _nThreads = params.nThreads;
+    if (_nThreads <= 0) {
+        _nThreads = (int) (cpus.empty() ? detectPerformanceCpus() : cpus).size();
+    }
+    _nThreads = std::max(_nThreads, 1);
+    _nThreadsBatch = params.nThreadsBatch > 0 ? params.nThreadsBatch : _nThreads;
+    _cpus = std::move(cpus);
+    _strictPinning = params.strictPinning;
+    _poll = params.poll;
+}
+
+void
+ThreadPlacement::attach(llama_context *ctx) {
+    if (_cpus.empty()) {
+        return;
+    }
+    if (_threadpool == nullptr) {
+        ggml_backend_reg_t cpuReg = ggml_backend_reg_by_name("CPU");
+        if (cpuReg == nullptr) {
+            throw std::runtime_error("the CPU backend is not loaded");
+        }
+        auto threadpoolNew = (ggml_threadpool_t (*)(ggml_threadpool_params *)) ggml_backend_reg_get_proc_address(
+                cpuReg, "ggml_threadpool_new");
+        _threadpoolFree = (void (*)(ggml_threadpool_t)) ggml_backend_reg_get_proc_address(
+                cpuReg, "ggml_threadpool_free");
+        if (threadpoolNew == nullptr || _threadpoolFree == nullptr) {
+            throw std::runtime_error("the CPU backend does not support threadpools");
+        }
+
+        ggml_threadpool_params params = ggml_threadpool_params_default(_nThreads);
+        for (int cpu: _cpus) {
+            params.cpumask[cpu] = true;
+        }
+        params.strict_cpu = _strictPinning;
+        params.poll = (uint32_t) _poll;
+        // with a separate batch pool the two would spin against each other on the same cores, so the decode
+        // pool starts paused like in llama.cpp's main, ggml resumes it when the first graph is computed on it
+        params.paused = _nThreadsBatch != _nThreads;
+        _threadpool = threadpoolNew(&params);
+        if (_threadpool == nullptr) {
+            throw std::runtime_error("ggml_threadpool_new() failed");
+        }
+        if (_nThreadsBatch != _nThreads) {
+            params.n_threads = _nThreadsBatch;
+            params.paused = false;
+            _threadpoolBatch = threadpoolNew(&params);
+            if (_threadpoolBatch == nullptr) {
+                release();
+                throw std::runtime_error("ggml_threadpool_new() failed");
+            }
+        }
+    }
+    // a null batch threadpool makes llama.cpp use `_threadpool` for prompt processing as well
+    llama_attach_threadpool(ctx, _threadpool, _threadpoolBatch);
+}
+
+void
+ThreadPlacement::release() {
+    if (_threadpoolBatch != nullptr) {
+        _threadpoolFree(_threadpoolBatch);
+        _threadpoolBatch = nullptr;
+    }
+    if (_threadpool != nullptr) {
+        _threadpoolFree(_threadpool);
+        _threadpool = nullptr;
+    }
+}
+
+std::string
+ThreadPlacement::describe() const {
+    std::string description = std::to_string(_nThreads) + "/" + std::to_string(_nThreadsBatch) + " threads";
+    if (_cpus.empty()) {
+        return description;
+    }
+    description += " on cpus " + formatCpuList(_cpus);
+    if (_strictPinning) {
+        description += " (strict)";
+    }
+    return description;
+}
+
+ThreadPlacement::~ThreadPlacement() {
+    release();
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "ggml.h"
+#include "llama.h"
+#include <string>
+#include <vector>
+
+/**
+ * @brief ggml 工作线程在 CPU 上的放置策略。
+ */
+enum CpuPlacement {
+    /// 不创建线程池，由系统调度 ggml 的线程（默认）
+    CPU_PLACEMENT_NONE = 0,
+    /// 只使用性能核：根据 cpu_capacity（或最高频率）去掉最慢的一组核心
+    CPU_PLACEMENT_PERFORMANCE = 1,
+    /// 只使用 `ThreadParams::cpuMask` 中列出的核心
+    CPU_PLACEMENT_MASK = 2,
+};
+
+/**
+ * @struct ThreadParams
+ * @brief 推理线程数量和 CPU 亲和性的参数。
+ */
+struct ThreadParams {
+    /// 解码（每次一个 token）使用的线程数，小于等于 0 时使用放置策略允许的核心数（CPU_PLACEMENT_NONE 时为性能核数）
+    int nThreads = 4;
+    /// 预填充（批量处理提示词）使用的线程数，小于等于 0 时与 `nThreads` 相同
+    int nThreadsBatch = 0;
+    /// 放置策略，取值见 CpuPlacement
+    int placement = CPU_PLACEMENT_NONE;
+    /// CPU_PLACEMENT_MASK 使用的核心，可以是十六进制掩码（"0xf0"）或列表（"4-7" / "0,2,4-7"）
+    std::string cpuMask;
+    /// 是否把每个线程固定在一个核心上，否则线程可以在允许的核心之间迁移
+    bool strictPinning = false;
+    /// 线程等待新任务时的自旋程度（0～100），0 表示立即休眠
+    int poll = 50;
+};
+
+/**
+ * @brief 找出性能核：读取每个核心的 /sys/devices/system/cpu/cpuN/cpu_capacity（没有时使用 cpufreq/cpuinfo_max_freq），
+ * 去掉数值最低的一组核心；所有核心相同时返回全部核心。只返回当前进程允许运行的核心。
+ */
+std::vector<int> detectPerformanceCpus();
+
+/**
+ * @brief 解析十六进制掩码（"0xf0"）或核心列表（"4-7" / "0,2,4-7"）。
+ *
+ * @throws std::runtime_error 格式无效时抛出。
+ */
+std::vector<int> parseCpuMask(const std::string &mask);
+
+/**
+ * @class ThreadPlacement
+ * @brief 按 ThreadParams 确定线程数，并在需要时创建固定在指定核心上的 ggml 线程池挂到上下文上。
+ *
+ * 线程池由 CPU 后端创建（arm64 上 CPU 后端是动态加载的模块，函数通过 ggml_backend_reg_get_proc_address 获取）。
+ * 预填充和解码的线程数不同时分别使用两个线程池。
+ */
+class ThreadPlacement {
+    int _nThreads = 4;
+    int _nThreadsBatch = 4;
+    /// 允许使用的核心，为空表示不创建线程池
+    std::vector<int> _cpus;
+    bool _strictPinning = false;
+    int _poll = 50;
+
+    ggml_threadpool_t _threadpool = nullptr;
+    ggml_threadpool_t _threadpoolBatch = nullptr;
+    void (*_threadpoolFree)(ggml_threadpool_t) = nullptr;
+
+public:
+    ThreadPlacement() = default;
+    ThreadPlacement(const ThreadPlacement &) = delete;
+    ThreadPlacement &operator=(const ThreadPlacement &) = delete;
+
+    /**
+     * @brief 解析参数，确定线程数和核心集合，释放之前创建的线程池。
+     *
+     * @throws std::runtime_error 放置策略或掩码无效时抛出。
+     */
+    void configure(const ThreadParams &params);
+
+    /// 解码线程数
+    int nThreads() const { return _nThreads; }
+
+    /// 预填充线程数
+    int nThreadsBatch() const { return _nThreadsBatch; }
+
+    /**
+     * @brief 第一次调用时创建线程池，并把线程池挂到 `ctx` 上；不需要线程池时什么也不做。
+     * 可以对多个上下文调用（例如投机解码的草稿上下文）。解码与批处理线程数相同时只创建一个线程池；
+     * 不同时另建批处理线程池，解码线程池以暂停状态创建，到第一次解码时才启动。
+     *
+     * @throws std::runtime_error CPU 后端不提供线程池接口或创建失败时抛出。
+     */
+    void attach(llama_context *ctx);
+
+    /**
+     * @brief 释放线程池，调用前必须已释放所有挂载了线程池的上下文。
+     */
+    void release();
+
+    /**
+     * @brief 便于日志输出的描述，例如 "4/8 threads on cpus 4-7 (strict)"。
+     */
+    std::string describe() const;
+
+    ~ThreadPlacement();
+};
@@ -0,0 +1,108 @@
+#include "TokenStreamBuffer.h"
+#include <algorithm>
+#include <stdexcept>
+
+TokenStreamBuffer::TokenStreamBuffer(size_t byteCapacity, size_t pieceCapacity)
+    : _bytes(byteCapacity), _pieceEnds(pieceCapacity) {}
+
+void
+TokenStreamBuffer::reset() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _writePos  = 0;
+    _readPos   = 0;
+    _pieceHead = 0;
+    _pieceTail = 0;
+    _finished  = false;
+    _error.clear();
+}
+
+bool
+TokenStreamBuffer::push(const char* data, size_t size) {
+    if (size > _bytes.size()) {
+        throw std::runtime_error("token piece larger than the stream buffer");
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _writable.wait(lock, [&] {
+        return _finished || (_writePos + size - _readPos <= _bytes.size() && _pieceTail - _pieceHead < _pieceEnds.size());
+    });
+    if (_finished) {
+        return false;
+    }
+    // 环形写入，必要时分两段拷贝
+    size_t offset = _writePos % _bytes.size();
+    size_t first  = std::min(size, _bytes.size() - offset);
+    std::copy(data, data + first, _bytes.begin() + offset);
+    std::copy(data + first, data + size, _bytes.begin());
+    _writePos += size;
+    _pieceEnds[_pieceTail % _pieceEnds.size()] = _writePos;
+    _pieceTail += 1;
+    lock.unlock();
+    _readable.notify_one();
+    return true;
+}
+
+bool
+TokenStreamBuffer::canPush(size_t size) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _finished ||
+           (_writePos + size - _readPos <= _bytes.size() && _pieceTail - _pieceHead < _pieceEnds.size());
+}
+
+void
+TokenStreamBuffer::finish(const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_finished) {
+            _finished = true;
+            _error    = error;
+        }
+    }
+    _readable.notify_all();
+    _writable.notify_all();
+}
+
+long
+TokenStreamBuffer::drain(char* dst, size_t capacity, int maxPieces) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _readable.wait(lock, [&] { return _finished || _writePos > _readPos; });
+    if (_writePos == _readPos) {
+        if (!_error.empty()) {
+            throw std::runtime_error(_error);
+        }
+        return -1;
+    }
+
+    uint64_t end = std::min<uint64_t>(_writePos, _readPos + capacity);
+    if (maxPieces > 0 && _pieceTail - _pieceHead > (uint64_t) maxPieces) {
+        end = std::min(end, _pieceEnds[(_pieceHead + maxPieces - 1) % _pieceEnds.size()]);
+    }
+    // 截断到最后一个完整词块的边界
+    uint64_t piece = _pieceHead;
+    uint64_t bound = _readPos;
+    while (piece < _pieceTail && _pieceEnds[piece % _pieceEnds.size()] <= end) {
+        bound = _pieceEnds[piece % _pieceEnds.size()];
+        piece++;
+    }
+    if (bound > _readPos) {
+        end = bound;
+    } else {
+        // 首个词块比 `capacity` 还大，退而在 UTF-8 码点边界处截断
+        while (end > _readPos && (_bytes[end % _bytes.size()] & 0xC0) == 0x80) {
+            end--;
+        }
+        if (end == _readPos) {
+            throw std::runtime_error("stream buffer capacity too small for a single codepoint");
+        }
+    }
+
+    size_t n      = end - _readPos;
+    size_t offset = _readPos % _bytes.size();
+    size_t first  = std::min(n, _bytes.size() - offset);
+    std::copy(_bytes.begin() + offset, _bytes.begin() + offset + first, dst);
+    std::copy(_bytes.begin(), _bytes.begin() + (n - first), dst + first);
+    _readPos   = end;
+    _pieceHead = piece;
+    lock.unlock();
+    _writable.notify_one();
+    return (long) n;
+}
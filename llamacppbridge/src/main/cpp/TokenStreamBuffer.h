@@ -0,0 +1,80 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @class TokenStreamBuffer
+ * @brief 生成线程与读取线程之间的定长字节环形缓冲区。
+ *
+ * 生成线程以“词块”（一次 completionLoop 产出的有效 UTF-8 片段）为单位写入，读取方一次取出最多 N 个词块
+ * 或当前全部可用字节，从而避免每个 token 都跨越一次 JNI 并创建一个 jstring。
+ * 缓冲区写满时生成线程阻塞，形成背压。
+ */
+class TokenStreamBuffer {
+    /// 字节环形缓冲区
+    std::vector<char> _bytes;
+    /// 每个词块结束位置（单调递增的逻辑偏移）组成的环形队列
+    std::vector<uint64_t> _pieceEnds;
+    /// 已写入的逻辑字节偏移
+    uint64_t _writePos = 0;
+    /// 已读取的逻辑字节偏移
+    uint64_t _readPos = 0;
+    /// `_pieceEnds` 中第一个未被完全读取的词块下标（逻辑计数）
+    uint64_t _pieceHead = 0;
+    /// `_pieceEnds` 中已写入的词块数量（逻辑计数）
+    uint64_t _pieceTail = 0;
+    /// 生成是否已结束（正常结束、被停止或出错）
+    bool _finished = false;
+    /// 生成线程抛出的错误信息，为空表示没有错误
+    std::string _error;
+
+    std::mutex              _mutex;
+    std::condition_variable _readable;
+    std::condition_variable _writable;
+
+public:
+    /**
+     * @param byteCapacity 字节缓冲区容量。
+     * @param pieceCapacity 可同时缓存的最大词块数量。
+     */
+    explicit TokenStreamBuffer(size_t byteCapacity = 64 * 1024, size_t pieceCapacity = 4096);
+
+    /**
+     * @brief 重置缓冲区状态，开始新一轮生成前调用。
+     */
+    void reset();
+
+    /**
+     * @brief 写入一个词块，缓冲区空间不足时阻塞，直到读取方腾出空间或缓冲区被关闭。
+     *
+     * @return bool 若缓冲区已被关闭（读取方停止了生成）返回 false。
+     */
+    bool push(const char* data, size_t size);
+
+    /**
+     * @brief 检查当前能否不阻塞地写入一个 `size` 字节的词块，供不能被单个读取方拖住的调度线程使用。
+     */
+    bool canPush(size_t size);
+
+    /**
+     * @brief 标记生成结束，唤醒所有等待中的读取方。
+     *
+     * @param error 错误信息，为空表示正常结束。
+     */
+    void finish(const std::string& error = "");
+
+    /**
+     * @brief 取出至多 `maxPieces` 个词块（`maxPieces <= 0` 表示取出全部可用数据），写入 `dst`。
+     *
+     * 没有可读数据时阻塞，直到有新的词块写入或生成结束。只在词块边界（或至少 UTF-8 码点边界）处截断，
+     * 因此每次返回的字节都是完整的 UTF-8 序列。
+     *
+     * @return long 写入 `dst` 的字节数；生成结束且数据已读完时返回 -1。
+     * @throws std::runtime_error 生成线程出错且数据已读完时抛出。
+     */
+    long drain(char* dst, size_t capacity, int maxPieces);
+};
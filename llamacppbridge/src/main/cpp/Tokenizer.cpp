@@ -0,0 +1,163 @@
+#include "Tokenizer.h"
+#include "Fnv1a.h"
+#include "LLMLog.h"
+#include "LlamaLog.h"
+#include <algorithm>
+#include <climits>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+uint64_t
+cacheKey(std::string_view text, bool addSpecial, bool parseSpecial) {
+    // the flags change the token count, so they are part of the key
+    const uint8_t flags = (uint8_t) ((addSpecial ? 1 : 0) | (parseSpecial ? 2 : 0));
+    return fnv1a(fnv1a(FNV1A_OFFSET_BASIS, &flags, 1), text.data(), text.size());
+}
+
+} // namespace
+
+Tokenizer::Tokenizer(llama_model *ownedModel, const llama_vocab *vocab, size_t cacheCapacity)
+    : _ownedModel(ownedModel), _vocab(vocab), _cacheCapacity(cacheCapacity) {
+    _cacheIndex.reserve(cacheCapacity);
+}
+
+Tokenizer::Tokenizer(const llama_model *model, size_t cacheCapacity)
+    : Tokenizer(nullptr, llama_model_get_vocab(model), cacheCapacity) {}
+
+std::unique_ptr<Tokenizer>
+Tokenizer::loadVocab(const char *modelPath, size_t cacheCapacity) {
+    installLlamaLogHook();
+    llama_model_params params = llama_model_default_params();
+    // only the tokenizer metadata is read, no backend is needed and no tensor is mapped
+    params.vocab_only = true;
+    params.use_mmap = false;
+    llama_model *model = llama_model_load_from_file(modelPath, params);
+    if (!model) {
+        LOGe("failed to load the vocabulary from %s", modelPath);
+        throw std::runtime_error("loadVocab() failed");
+    }
+    return std::unique_ptr<Tokenizer>(new Tokenizer(model, llama_model_get_vocab(model), cacheCapacity));
+}
+
+Tokenizer::~Tokenizer() {
+    if (_ownedModel) {
+        llama_model_free(_ownedModel);
+    }
+}
+
+void
+Tokenizer::tokenize(std::string_view text, bool addSpecial, bool parseSpecial, std::vector<llama_token> &tokens) {
+    // one token per byte plus BOS / EOS covers every vocabulary except byte-fallback corner cases
+    tokens.resize(text.size() + 2);
+    int32_t nTokens = llama_tokenize(_vocab, text.data(), (int32_t) text.size(), tokens.data(), (int32_t) tokens.size(),
+                                     addSpecial, parseSpecial);
+    if (nTokens == INT32_MIN) {
+        throw std::runtime_error("tokenize(): the text is too long");
+    }
+    if (nTokens < 0) {
+        tokens.resize(-nTokens);
+        nTokens = llama_tokenize(_vocab, text.data(), (int32_t) text.size(), tokens.data(), (int32_t) tokens.size(),
+                                 addSpecial, parseSpecial);
+    }
+    tokens.resize(nTokens);
+
+    const uint64_t key = cacheKey(text, addSpecial, parseSpecial);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_cacheIndex.find(key) == _cacheIndex.end()) {
+        _insert(key, nTokens);
+    }
+}
+
+std::string
+Tokenizer::detokenize(const llama_token *tokens, size_t nTokens, bool removeSpecial, bool unparseSpecial) {
+    std::string text(nTokens * 4 + 16, '\0');
+    int32_t nBytes = llama_detokenize(_vocab, tokens, (int32_t) nTokens, text.data(), (int32_t) text.size(),
+                                      removeSpecial, unparseSpecial);
+    if (nBytes < 0) {
+        text.resize(-nBytes);
+        nBytes = llama_detokenize(_vocab, tokens, (int32_t) nTokens, text.data(), (int32_t) text.size(), removeSpecial,
+                                  unparseSpecial);
+    }
+    text.resize(std::max(nBytes, 0));
+    return text;
+}
+
+int32_t
+Tokenizer::countTokens(std::string_view text, bool addSpecial, bool parseSpecial) {
+    const uint64_t key = cacheKey(text, addSpecial, parseSpecial);
+    int32_t count;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_lookup(key, count)) {
+            return count;
+        }
+    }
+    // tokenized without the lock, concurrent misses for the same text both insert the same count
+    // with no output buffer llama_tokenize only reports the count (negated)
+    const int32_t result =
+            llama_tokenize(_vocab, text.data(), (int32_t) text.size(), nullptr, 0, addSpecial, parseSpecial);
+    if (result == INT32_MIN) {
+        throw std::runtime_error("countTokens(): the text is too long");
+    }
+    count = -result;
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_cacheIndex.find(key) == _cacheIndex.end()) {
+        _insert(key, count);
+    }
+    return count;
+}
+
+void
+Tokenizer::countTokens(const std::vector<std::string> &texts, bool addSpecial, bool parseSpecial, int32_t *counts) {
+    for (size_t i = 0; i < texts.size(); i++) {
+        counts[i] = countTokens(texts[i], addSpecial, parseSpecial);
+    }
+}
+
+int32_t
+Tokenizer::vocabSize() const {
+    return llama_vocab_n_tokens(_vocab);
+}
+
+uint64_t
+Tokenizer::cacheHits() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _cacheHits;
+}
+
+uint64_t
+Tokenizer::cacheMisses() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _cacheMisses;
+}
+
+bool
+Tokenizer::_lookup(uint64_t key, int32_t &count) {
+    auto it = _cacheIndex.find(key);
+    if (it == _cacheIndex.end()) {
+        _cacheMisses++;
+        return false;
+    }
+    _cacheHits++;
+    _lru.splice(_lru.begin(), _lru, it->second);
+    count = it->second->count;
+    return true;
+}
+
+void
+Tokenizer::_insert(uint64_t key, int32_t count) {
+    if (_cacheCapacity == 0) {
+        return;
+    }
+    if (_lru.size() == _cacheCapacity) {
+        // reuse the node of the least recently used entry
+        _cacheIndex.erase(_lru.back().key);
+        _lru.splice(_lru.begin(), _lru, std::prev(_lru.end()));
+        _lru.front() = {key, count};
+    } else {
+        _lru.push_front({key, count});
+    }
+    _cacheIndex[key] = _lru.begin();
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "llama.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @class Tokenizer
+ * @brief 独立于推理上下文的分词器，用于在生成之前估算上下文预算（截断文档、统计历史消息长度等）。
+ *
+ * 既可以使用已加载模型的词表，也可以通过 loadVocab 以 `vocab_only` 方式只加载 GGUF 文件中的词表，
+ * 不映射权重，因此无需加载完整模型即可分词。countTokens 的结果按文本哈希缓存在 LRU 中，
+ * 反复统计同一段聊天历史时只需计算哈希。所有方法都是线程安全的。
+ */
+class Tokenizer {
+    /// loadVocab 加载的只包含词表的模型，使用已加载模型的词表时为 nullptr
+    llama_model *_ownedModel = nullptr;
+    const llama_vocab *_vocab;
+
+    struct CacheEntry {
+        uint64_t key;
+        int32_t count;
+    };
+    /// 缓存的 token 数量，最近使用的排在前面
+    std::list<CacheEntry> _lru;
+    std::unordered_map<uint64_t, std::list<CacheEntry>::iterator> _cacheIndex;
+    size_t _cacheCapacity;
+    uint64_t _cacheHits = 0;
+    uint64_t _cacheMisses = 0;
+    std::mutex _mutex;
+
+    Tokenizer(llama_model *ownedModel, const llama_vocab *vocab, size_t cacheCapacity);
+
+    /**
+     * @brief 查找缓存，命中时把缓存项移到最前面。
+     */
+    bool _lookup(uint64_t key, int32_t &count);
+
+    void _insert(uint64_t key, int32_t count);
+
+public:
+    /**
+     * @brief 使用已加载模型的词表，模型必须比分词器存活得更久。
+     *
+     * @param cacheCapacity countTokens 最多缓存的文本数量。
+     */
+    explicit Tokenizer(const llama_model *model, size_t cacheCapacity = 4096);
+
+    /**
+     * @brief 只加载 GGUF 文件中的词表（`vocab_only = true`），不读取张量数据。
+     *
+     * @throws std::runtime_error 文件无法加载时抛出。
+     */
+    static std::unique_ptr<Tokenizer> loadVocab(const char *modelPath, size_t cacheCapacity = 4096);
+
+    Tokenizer(const Tokenizer &) = delete;
+    Tokenizer &operator=(const Tokenizer &) = delete;
+
+    ~Tokenizer();
+
+    /**
+     * @brief 把文本转换为 token。
+     *
+     * @param addSpecial 是否按词表的设置添加 BOS / EOS。
+     * @param parseSpecial 是否把文本中的特殊 token（如 `<|im_start|>`）解析为对应的 token，与聊天模板渲染后的提示词分词方式一致。
+     * @param tokens 输出的 token，原有内容被替换。
+     */
+    void tokenize(std::string_view text, bool addSpecial, bool parseSpecial, std::vector<llama_token> &tokens);
+
+    /**
+     * @brief 把 token 转换回文本。
+     *
+     * @param removeSpecial 是否去掉词表自动添加的 BOS / EOS。
+     * @param unparseSpecial 是否输出特殊 token 的文本，否则跳过特殊 token。
+     */
+    std::string detokenize(const llama_token *tokens, size_t nTokens, bool removeSpecial, bool unparseSpecial);
+
+    /**
+     * @brief 统计文本的 token 数量，结果按文本哈希缓存。
+     *
+     * 缓存只保存 64 位哈希而不保存文本，哈希冲突（概率可以忽略）只会使估算的 token 数量不准确。
+     */
+    int32_t countTokens(std::string_view text, bool addSpecial, bool parseSpecial);
+
+    /**
+     * @brief 批量统计 token 数量，`counts` 至少有 `texts.size()` 个元素。
+     */
+    void countTokens(const std::vector<std::string> &texts, bool addSpecial, bool parseSpecial, int32_t *counts);
+
+    /**
+     * @brief 词表大小。
+     */
+    int32_t vocabSize() const;
+
+    /// countTokens 命中缓存的次数
+    uint64_t cacheHits();
+
+    /// countTokens 未命中缓存（实际分词）的次数
+    uint64_t cacheMisses();
+};
@@ -0,0 +1,125 @@
+#include "Utf8Stream.h"
+#include <cstring>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// length of the leading run of ASCII bytes, 16 bytes per step with SIMD, then 8 bytes per step
+size_t
+asciiPrefixLength(const uint8_t *data, size_t size) {
+    size_t i = 0;
+#if defined(__aarch64__)
+    for (; i + 16 <= size; i += 16) {
+        if (vmaxvq_u8(vld1q_u8(data + i)) >= 0x80) {
+            break;
+        }
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        const int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word & 0x8080808080808080ULL) {
+            break;
+        }
+    }
+    while (i < size && data[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+} // namespace
+
+size_t
+Utf8Stream::_writeReplacement(char *out) {
+    out[0] = (char) 0xEF;
+    out[1] = (char) 0xBF;
+    out[2] = (char) 0xBD;
+    return 3;
+}
+
+size_t
+Utf8Stream::append(const char *data, size_t size, char *out) {
+    size_t written = 0;
+    size_t i = 0;
+    while (i < size) {
+        if (_pendingNeed == 0) {
+            // between characters, a run of ASCII is copied as one block
+            const size_t run = asciiPrefixLength(reinterpret_cast<const uint8_t *>(data) + i, size - i);
+            memcpy(out + written, data + i, run);
+            written += run;
+            i += run;
+            if (i == size) {
+                break;
+            }
+        }
+        const auto byte = (uint8_t) data[i++];
+        if (_pendingNeed > 0) {
+            const bool second = _pendingSize == 1;
+            const uint8_t min = second ? _secondMin : 0x80;
+            const uint8_t max = second ? _secondMax : 0xBF;
+            if (byte >= min && byte <= max) {
+                _pending[_pendingSize++] = (char) byte;
+                if (--_pendingNeed == 0) {
+                    memcpy(out + written, _pending, _pendingSize);
+                    written += _pendingSize;
+                    _pendingSize = 0;
+                }
+                continue;
+            }
+            // the sequence is cut short, replace it and read this byte as the start of a new one
+            written += _writeReplacement(out + written);
+            _pendingSize = 0;
+            _pendingNeed = 0;
+        }
+
+        if (byte < 0x80) {
+            out[written++] = (char) byte;
+            continue;
+        }
+        _secondMin = 0x80;
+        _secondMax = 0xBF;
+        if (byte >= 0xC2 && byte <= 0xDF) {
+            _pendingNeed = 1;
+        } else if (byte >= 0xE0 && byte <= 0xEF) {
+            _pendingNeed = 2;
+            if (byte == 0xE0) {
+                _secondMin = 0xA0; // overlong
+            } else if (byte == 0xED) {
+                _secondMax = 0x9F; // UTF-16 surrogates
+            }
+        } else if (byte >= 0xF0 && byte <= 0xF4) {
+            _pendingNeed = 3;
+            if (byte == 0xF0) {
+                _secondMin = 0x90; // overlong
+            } else if (byte == 0xF4) {
+                _secondMax = 0x8F; // above U+10FFFF
+            }
+        } else {
+            // a stray continuation byte or a byte that never appears in UTF-8
+            written += _writeReplacement(out + written);
+            continue;
+        }
+        _pending[0] = (char) byte;
+        _pendingSize = 1;
+    }
+    return written;
+}
+
+void
+Utf8Stream::reset() {
+    _pendingSize = 0;
+    _pendingNeed = 0;
+}
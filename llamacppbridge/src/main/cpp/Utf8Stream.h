@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @class Utf8Stream
+ * @brief 把逐 token 解码得到的字节流增量地切分为完整的 UTF-8 字符。
+ *
+ * 一个多字节字符可能被拆分到多个 token 中。每次追加时只检查新写入的字节，
+ * 完整的字符立即输出，末尾未完成的字符（最多 3 个字节）留到下一次追加，
+ * 不需要从头重新扫描累积的字节。字符之间的 ASCII 连续段用 NEON / SSE2 每次检查 16 个字节并整段复制。
+ * 非法的字节序列输出为 U+FFFD。
+ */
+class Utf8Stream {
+    /// 未完成字符已收到的字节
+    char _pending[4] = {};
+    /// `_pending` 中的字节数
+    int _pendingSize = 0;
+    /// 未完成字符还需要的续字节数
+    int _pendingNeed = 0;
+    /// 第二个字节的合法范围（排除过长编码、代理项和超出 U+10FFFF 的编码）
+    uint8_t _secondMin = 0x80;
+    uint8_t _secondMax = 0xBF;
+
+    /// 输出 U+FFFD，返回写入的字节数
+    static size_t _writeReplacement(char *out);
+
+public:
+    /**
+     * @brief 追加 `size` 个字节后最多输出的字节数，调用方据此准备输出缓冲区。
+     */
+    static constexpr size_t maxOutputSize(size_t size) { return 3 * (size + 1); }
+
+    /**
+     * @brief 追加字节，把构成完整字符的部分写入 `out`。
+     *
+     * @param out 输出缓冲区，至少 maxOutputSize(size) 字节。
+     * @return size_t 写入 `out` 的字节数。
+     */
+    size_t append(const char *data, size_t size, char *out);
+
+    /**
+     * @brief 丢弃未完成的字符，开始新一轮生成前调用。
+     */
+    void reset();
+};
@@ -0,0 +1,233 @@
+#include "VectorKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VECTOR_KERNELS_NEON 1
+#elif defined(__x86_64__) && defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+#include <immintrin.h>
+#define VECTOR_KERNELS_AVX2 1
+#endif
+
+namespace {
+
+#if !VECTOR_KERNELS_AVX2
+uint16_t
+fp32ToFp16Scalar(float value) {
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t exp32 = (x >> 23) & 0xff;
+    uint32_t mant = x & 0x7fffff;
+    if (exp32 == 0xff) {
+        // inf stays inf, NaN stays a (quiet) NaN
+        return (uint16_t) (sign | 0x7c00 | (mant ? 0x200 : 0));
+    }
+    const int32_t exp = (int32_t) exp32 - 127 + 15;
+    if (exp >= 31) {
+        return (uint16_t) (sign | 0x7c00);
+    }
+    if (exp <= 0) {
+        // subnormal half (or zero)
+        if (exp < -10) {
+            return (uint16_t) sign;
+        }
+        mant |= 0x800000;
+        const uint32_t shift = (uint32_t) (14 - exp);
+        uint32_t half = mant >> shift;
+        const uint32_t rem = mant & ((1u << shift) - 1);
+        const uint32_t mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1))) {
+            half++;
+        }
+        return (uint16_t) (sign | half);
+    }
+    uint32_t half = sign | ((uint32_t) exp << 10) | (mant >> 13);
+    const uint32_t rem = mant & 0x1fff;
+    // round to nearest even, a carry into the exponent gives the next power of two (or inf)
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return (uint16_t) half;
+}
+
+float
+fp16ToFp32Scalar(uint16_t value) {
+    const uint32_t sign = (uint32_t) (value & 0x8000) << 16;
+    const uint32_t exp = (value >> 10) & 0x1f;
+    const uint32_t mant = value & 0x3ff;
+    uint32_t bits;
+    if (exp == 0) {
+        const float magnitude = std::ldexp((float) mant, -24);
+        return sign ? -magnitude : magnitude;
+    } else if (exp == 31) {
+        bits = sign | 0x7f800000 | (mant << 13);
+    } else {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+#endif
+
+#if VECTOR_KERNELS_AVX2
+float
+hsum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+int32_t
+hsum(__m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+} // namespace
+
+float
+dotF32(const float *a, const float *b, size_t n) {
+    size_t i = 0;
+    float sum = 0.0f;
+#if VECTOR_KERNELS_NEON
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+#elif VECTOR_KERNELS_AVX2
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    sum = hsum(_mm256_add_ps(acc0, acc1));
+#endif
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+float
+dotF16F32(const uint16_t *a, const float *b, size_t n) {
+    size_t i = 0;
+    float sum = 0.0f;
+#if VECTOR_KERNELS_NEON
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (; i + 8 <= n; i += 8) {
+        const float16x8_t half = vreinterpretq_f16_u16(vld1q_u16(a + i));
+        acc0 = vfmaq_f32(acc0, vcvt_f32_f16(vget_low_f16(half)), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vcvt_high_f32_f16(half), vld1q_f32(b + i + 4));
+    }
+    sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+#elif VECTOR_KERNELS_AVX2
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        const __m256 a0 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+        const __m256 a1 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i + 8)));
+        acc0 = _mm256_fmadd_ps(a0, _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(a1, _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    sum = hsum(_mm256_add_ps(acc0, acc1));
+#endif
+    for (; i < n; i++) {
+        sum += fp16ToFp32(a[i]) * b[i];
+    }
+    return sum;
+}
+
+int32_t
+dotI8(const int8_t *a, const int8_t *b, size_t n) {
+    size_t i = 0;
+    int32_t sum = 0;
+#if VECTOR_KERNELS_NEON
+    int32x4_t acc = vdupq_n_s32(0);
+    for (; i + 16 <= n; i += 16) {
+        const int8x16_t va = vld1q_s8(a + i);
+        const int8x16_t vb = vld1q_s8(b + i);
+#if defined(__ARM_FEATURE_DOTPROD)
+        acc = vdotq_s32(acc, va, vb);
+#else
+        // |a * b| <= 128 * 128 fits the int16 lanes, pairs are widened into the int32 accumulator
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc = vpadalq_s16(acc, vmull_high_s8(va, vb));
+#endif
+    }
+    sum = vaddvq_s32(acc);
+#elif VECTOR_KERNELS_AVX2
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 16 <= n; i += 16) {
+        const __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+        const __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    sum = hsum(acc);
+#endif
+    for (; i < n; i++) {
+        sum += (int32_t) a[i] * (int32_t) b[i];
+    }
+    return sum;
+}
+
+uint16_t
+fp32ToFp16(float value) {
+#if VECTOR_KERNELS_AVX2
+    return (uint16_t) _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+    return fp32ToFp16Scalar(value);
+#endif
+}
+
+float
+fp16ToFp32(uint16_t value) {
+#if VECTOR_KERNELS_AVX2
+    return _cvtsh_ss(value);
+#else
+    return fp16ToFp32Scalar(value);
+#endif
+}
+
+float
+quantizeI8(const float *x, int8_t *q, size_t n) {
+    float maxAbs = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        maxAbs = std::max(maxAbs, std::fabs(x[i]));
+    }
+    if (maxAbs == 0.0f) {
+        std::fill(q, q + n, (int8_t) 0);
+        return 0.0f;
+    }
+    const float scale = maxAbs / 127.0f;
+    const float inverse = 1.0f / scale;
+    for (size_t i = 0; i < n; i++) {
+        q[i] = (int8_t) std::clamp(std::lrintf(x[i] * inverse), -127L, 127L);
+    }
+    return scale;
+}
+
+const char *
+vectorKernelIsa() {
+#if VECTOR_KERNELS_NEON && defined(__ARM_FEATURE_DOTPROD)
+    return "neon-dotprod";
+#elif VECTOR_KERNELS_NEON
+    return "neon";
+#elif VECTOR_KERNELS_AVX2
+    return "avx2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief 向量库使用的点积内核。
+ *
+ * 按编译目标选择实现：aarch64 使用 NEON（编译时启用 dotprod 扩展则使用 SDOT），
+ * x86-64 在启用 AVX2 / FMA / F16C 时使用 AVX2，其余情况使用标量实现。
+ * 余弦相似度由调用方对归一化后的向量求点积得到。
+ */
+
+/**
+ * @brief 两个 f32 向量的点积。
+ */
+float dotF32(const float *a, const float *b, size_t n);
+
+/**
+ * @brief f16 向量（IEEE 半精度的位模式）与 f32 向量的点积，f16 在寄存器中转换为 f32 后累加。
+ */
+float dotF16F32(const uint16_t *a, const float *b, size_t n);
+
+/**
+ * @brief 两个 int8 向量的点积（int32 累加，n 不超过 2^16 时不会溢出）。
+ */
+int32_t dotI8(const int8_t *a, const int8_t *b, size_t n);
+
+/**
+ * @brief f32 转换为 IEEE 半精度（就近舍入），超出范围时为无穷大。
+ */
+uint16_t fp32ToFp16(float value);
+
+/**
+ * @brief IEEE 半精度转换为 f32。
+ */
+float fp16ToFp32(uint16_t value);
+
+/**
+ * @brief 对称量化为 int8：scale = max|x| / 127，q = round(x / scale)。
+ *
+ * @return float 反量化系数 scale，全零向量返回 0。
+ */
+float quantizeI8(const float *x, int8_t *q, size_t n);
+
+/**
+ * @brief 编译进来的内核实现，例如 "neon-dotprod"、"neon"、"avx2" 或 "scalar"，便于基准测试报告。
+ */
+const char *vectorKernelIsa();
@@ -0,0 +1,577 @@
+#include "VectorStore.h"
+#include "VectorKernels.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+constexpr char STORE_MAGIC[4] = {'S', 'V', 'E', 'C'};
+constexpr char IVF_MAGIC[4] = {'S', 'I', 'V', 'F'};
+constexpr uint32_t STORE_VERSION = 1;
+constexpr uint32_t IVF_VERSION = 1;
+// dotI8 accumulates in int32, 127 * 127 * 65536 still fits
+constexpr uint32_t MAX_DIM = 65536;
+// k-means trains on at most this many sampled vectors per list
+constexpr uint64_t TRAIN_SAMPLES_PER_LIST = 64;
+// the mapping doubles up to this step, then grows linearly, armeabi-v7a only has ~3 GB of address space
+constexpr size_t MAX_MAP_GROWTH = sizeof(void *) == 4 ? (size_t) 64 << 20 : (size_t) 1 << 30;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t type;
+    uint32_t metric;
+    uint32_t recordSize;
+    uint64_t count;
+    uint8_t reserved[32];
+};
+static_assert(sizeof(FileHeader) == 64, "the file header is 64 bytes");
+
+struct RecordPrefix {
+    int64_t id;
+    // int8 dequantization scale, unused for f16
+    float scale;
+    uint32_t reserved;
+};
+static_assert(sizeof(RecordPrefix) == 16, "the record prefix keeps the payload 16-byte aligned");
+
+struct IvfHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t nLists;
+    // number of vectors with a stored assignment
+    uint64_t count;
+    uint8_t reserved[8];
+};
+static_assert(sizeof(IvfHeader) == 32, "the IVF header is 32 bytes");
+
+size_t
+recordSize(uint32_t dim, VectorType type) {
+    const size_t payload = type == VECTOR_F16 ? dim * sizeof(uint16_t) : dim;
+    return (sizeof(RecordPrefix) + payload + 15) & ~(size_t) 15;
+}
+
+void
+preadAll(int fd, void *data, size_t size, off_t offset, const std::string &path) {
+    auto *bytes = static_cast<uint8_t *>(data);
+    while (size > 0) {
+        const ssize_t n = pread(fd, bytes, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::system_error(errno, std::generic_category(), "failed to read " + path);
+        }
+        if (n == 0) {
+            throw std::runtime_error("unexpected end of file: " + path);
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+void
+pwriteAll(int fd, const void *data, size_t size, off_t offset, const std::string &path) {
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        const ssize_t n = pwrite(fd, bytes, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::system_error(errno, std::generic_category(), "failed to write " + path);
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+/**
+ * @brief L2 归一化，零向量保持为零。
+ */
+void
+normalize(const float *in, float *out, size_t n) {
+    const float norm = std::sqrt(dotF32(in, in, n));
+    const float inverse = norm > 0.0f ? 1.0f / norm : 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = in[i] * inverse;
+    }
+}
+
+} // namespace
+
+std::unique_ptr<VectorStore>
+VectorStore::open(const std::string &path, uint32_t dim, VectorType type, VectorMetric metric) {
+    if (dim == 0 || dim > MAX_DIM) {
+        throw std::invalid_argument("VectorStore: dim must be in [1, " + std::to_string(MAX_DIM) + "]");
+    }
+    if (type != VECTOR_F16 && type != VECTOR_I8) {
+        throw std::invalid_argument("VectorStore: unknown vector type " + std::to_string(type));
+    }
+    if (metric != METRIC_DOT && metric != METRIC_COSINE) {
+        throw std::invalid_argument("VectorStore: unknown metric " + std::to_string(metric));
+    }
+    std::unique_ptr<VectorStore> store(new VectorStore());
+    store->_path = path;
+    store->_dim = dim;
+    store->_type = type;
+    store->_metric = metric;
+    store->_recordSize = recordSize(dim, type);
+    store->_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (store->_fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "failed to open " + path);
+    }
+    struct stat st{};
+    if (fstat(store->_fd, &st) != 0) {
+        throw std::system_error(errno, std::generic_category(), "failed to stat " + path);
+    }
+
+    FileHeader header{};
+    if (st.st_size == 0) {
+        memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+        header.version = STORE_VERSION;
+        header.dim = dim;
+        header.type = type;
+        header.metric = metric;
+        header.recordSize = (uint32_t) store->_recordSize;
+        pwriteAll(store->_fd, &header, sizeof(header), 0, path);
+    } else {
+        if ((size_t) st.st_size < sizeof(header)) {
+            throw std::runtime_error("not a vector store: " + path);
+        }
+        preadAll(store->_fd, &header, sizeof(header), 0, path);
+        if (memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) != 0) {
+            throw std::runtime_error("not a vector store: " + path);
+        }
+        if (header.version != STORE_VERSION) {
+            throw std::runtime_error("unsupported vector store version " + std::to_string(header.version));
+        }
+        if (header.dim != dim || header.type != type || header.metric != metric) {
+            throw std::invalid_argument("VectorStore: " + path + " was created with dim " + std::to_string(header.dim) +
+                                        ", type " + std::to_string(header.type) + ", metric " +
+                                        std::to_string(header.metric));
+        }
+        if (header.recordSize != store->_recordSize ||
+            (uint64_t) st.st_size < sizeof(header) + header.count * store->_recordSize) {
+            throw std::runtime_error("truncated or corrupted vector store: " + path);
+        }
+    }
+    store->_count = header.count;
+    store->_map(store->_count);
+    store->_loadIvf();
+    return store;
+}
+
+VectorStore::~VectorStore() {
+    if (_mapped) {
+        munmap(const_cast<uint8_t *>(_mapped), _mappedSize);
+    }
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+const uint8_t *
+VectorStore::_record(uint64_t row) const {
+    return _mapped + sizeof(FileHeader) + row * _recordSize;
+}
+
+void
+VectorStore::_map(uint64_t count) {
+    const size_t needed = sizeof(FileHeader) + count * _recordSize;
+    if (needed <= _mappedSize) {
+        return;
+    }
+    // pages past the end of the file are never touched, they become valid as records are appended
+    const size_t size = std::max(needed, _mappedSize + std::min(_mappedSize, MAX_MAP_GROWTH));
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, _fd, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "failed to map " + _path);
+    }
+    if (_mapped) {
+        munmap(const_cast<uint8_t *>(_mapped), _mappedSize);
+    }
+    _mapped = static_cast<const uint8_t *>(mapped);
+    _mappedSize = size;
+}
+
+void
+VectorStore::_decode(uint64_t row, float *out) const {
+    const uint8_t *record = _record(row);
+    const uint8_t *payload = record + sizeof(RecordPrefix);
+    if (_type == VECTOR_F16) {
+        const auto *values = reinterpret_cast<const uint16_t *>(payload);
+        for (uint32_t i = 0; i < _dim; i++) {
+            out[i] = fp16ToFp32(values[i]);
+        }
+    } else {
+        RecordPrefix prefix;
+        memcpy(&prefix, record, sizeof(prefix));
+        const auto *values = reinterpret_cast<const int8_t *>(payload);
+        for (uint32_t i = 0; i < _dim; i++) {
+            out[i] = (float) values[i] * prefix.scale;
+        }
+    }
+}
+
+float
+VectorStore::_centroidScore(const float *vector, uint32_t list) const {
+    return dotF32(vector, _centroids.data() + (size_t) list * _dim, _dim) - _centroidBias[list];
+}
+
+uint32_t
+VectorStore::_assign(const float *vector) const {
+    uint32_t best = 0;
+    float bestScore = -INFINITY;
+    for (uint32_t c = 0; c < _nLists; c++) {
+        const float score = _centroidScore(vector, c);
+        if (score > bestScore) {
+            bestScore = score;
+            best = c;
+        }
+    }
+    return best;
+}
+
+uint64_t
+VectorStore::size() const {
+    std::shared_lock<std::shared_mutex> lock(_mutex);
+    return _count;
+}
+
+uint32_t
+VectorStore::ivfLists() const {
+    std::shared_lock<std::shared_mutex> lock(_mutex);
+    return _nLists;
+}
+
+void
+VectorStore::add(const int64_t *ids, const float *vectors, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    if (_nLists > 0 && _count + n > UINT32_MAX) {
+        throw std::runtime_error("VectorStore: the IVF index holds at most 2^32 vectors");
+    }
+    std::vector<uint8_t> records(n * _recordSize, 0);
+    std::vector<float> normalized(_metric == METRIC_COSINE ? _dim : 0);
+    std::vector<uint32_t> assignments(_nLists > 0 ? n : 0);
+    for (size_t i = 0; i < n; i++) {
+        const float *vector = vectors + i * _dim;
+        if (_metric == METRIC_COSINE) {
+            normalize(vector, normalized.data(), _dim);
+            vector = normalized.data();
+        }
+        uint8_t *record = records.data() + i * _recordSize;
+        uint8_t *payload = record + sizeof(RecordPrefix);
+        RecordPrefix prefix{ids[i], 1.0f, 0};
+        if (_type == VECTOR_F16) {
+            auto *values = reinterpret_cast<uint16_t *>(payload);
+            for (uint32_t d = 0; d < _dim; d++) {
+                values[d] = fp32ToFp16(vector[d]);
+            }
+        } else {
+            prefix.scale = quantizeI8(vector, reinterpret_cast<int8_t *>(payload), _dim);
+        }
+        memcpy(record, &prefix, sizeof(prefix));
+        if (_nLists > 0) {
+            assignments[i] = _assign(vector);
+        }
+    }
+    // records first, then the mapping, the count in the header commits them once nothing else can fail
+    pwriteAll(_fd, records.data(), records.size(), (off_t) (sizeof(FileHeader) + _count * _recordSize), _path);
+    const uint64_t count = _count + n;
+    _map(count);
+    pwriteAll(_fd, &count, sizeof(count), offsetof(FileHeader, count), _path);
+    for (size_t i = 0; i < assignments.size(); i++) {
+        _assignments.push_back(assignments[i]);
+        _lists[assignments[i]].push_back((uint32_t) (_count + i));
+    }
+    _ivfDirty = _ivfDirty || !assignments.empty();
+    _count = count;
+}
+
+void
+VectorStore::buildIvf(uint32_t nLists, uint32_t nIter) {
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    if (nLists == 0 || nLists > _count) {
+        throw std::invalid_argument("VectorStore: nLists must be in [1, " + std::to_string(_count) + "]");
+    }
+    if (_count > UINT32_MAX) {
+        throw std::runtime_error("VectorStore: the IVF index holds at most 2^32 vectors");
+    }
+    const auto count = (uint32_t) _count;
+    const size_t dim = _dim;
+    std::mt19937 rng(count);
+
+    // a random sample, the first nLists rows of which seed the centroids
+    std::vector<uint32_t> rows(count);
+    std::iota(rows.begin(), rows.end(), 0);
+    const uint32_t nSample = (uint32_t) std::min<uint64_t>(count, nLists * TRAIN_SAMPLES_PER_LIST);
+    for (uint32_t i = 0; i < nSample; i++) {
+        std::swap(rows[i], rows[i + rng() % (count - i)]);
+    }
+    std::vector<float> sample(nSample * dim);
+    for (uint32_t i = 0; i < nSample; i++) {
+        _decode(rows[i], sample.data() + i * dim);
+    }
+    rows = std::vector<uint32_t>();
+
+    _nLists = nLists;
+    _centroids.assign(sample.begin(), sample.begin() + nLists * dim);
+    _centroidBias.assign(nLists, 0.0f);
+    std::vector<uint32_t> sampleLists(nSample);
+    std::vector<float> sums(nLists * dim);
+    std::vector<uint32_t> sizes(nLists);
+    for (uint32_t iter = 0; iter < nIter; iter++) {
+        if (_metric == METRIC_DOT) {
+            for (uint32_t c = 0; c < nLists; c++) {
+                const float *centroid = _centroids.data() + c * dim;
+                _centroidBias[c] = 0.5f * dotF32(centroid, centroid, dim);
+            }
+        }
+        std::fill(sums.begin(), sums.end(), 0.0f);
+        std::fill(sizes.begin(), sizes.end(), 0);
+        for (uint32_t i = 0; i < nSample; i++) {
+            const float *vector = sample.data() + i * dim;
+            const uint32_t c = _assign(vector);
+            sampleLists[i] = c;
+            sizes[c]++;
+            float *sum = sums.data() + c * dim;
+            for (size_t d = 0; d < dim; d++) {
+                sum[d] += vector[d];
+            }
+        }
+        for (uint32_t c = 0; c < nLists; c++) {
+            float *centroid = _centroids.data() + c * dim;
+            if (sizes[c] == 0) {
+                // reseed an empty list with a random sample
+                const float *vector = sample.data() + (rng() % nSample) * dim;
+                std::copy(vector, vector + dim, centroid);
+                continue;
+            }
+            const float inverse = 1.0f / (float) sizes[c];
+            for (size_t d = 0; d < dim; d++) {
+                centroid[d] = sums[c * dim + d] * inverse;
+            }
+            if (_metric == METRIC_COSINE) {
+                // spherical k-means
+                normalize(centroid, centroid, dim);
+            }
+        }
+    }
+    if (_metric == METRIC_DOT) {
+        for (uint32_t c = 0; c < nLists; c++) {
+            const float *centroid = _centroids.data() + c * dim;
+            _centroidBias[c] = 0.5f * dotF32(centroid, centroid, dim);
+        }
+    }
+
+    _assignments.resize(count);
+    _lists.assign(nLists, {});
+    std::vector<float> vector(dim);
+    for (uint32_t row = 0; row < count; row++) {
+        _decode(row, vector.data());
+        _assignments[row] = _assign(vector.data());
+        _lists[_assignments[row]].push_back(row);
+    }
+    _ivfDirty = true;
+    _saveIvf();
+}
+
+void
+VectorStore::setProbes(uint32_t nProbe) {
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    _nProbe = std::max<uint32_t>(nProbe, 1);
+}
+
+size_t
+VectorStore::search(const float *query, size_t k, VectorSearchResult *out) const {
+    std::shared_lock<std::shared_mutex> lock(_mutex);
+    if (k == 0 || _count == 0) {
+        return 0;
+    }
+    std::vector<float> q(query, query + _dim);
+    if (_metric == METRIC_COSINE) {
+        normalize(q.data(), q.data(), _dim);
+    }
+    std::vector<int8_t> qI8;
+    float qScale = 0.0f;
+    if (_type == VECTOR_I8) {
+        qI8.resize(_dim);
+        qScale = quantizeI8(q.data(), qI8.data(), _dim);
+    }
+
+    // min-heap of the k best results so far, the worst one at the front
+    const auto better = [](const VectorSearchResult &a, const VectorSearchResult &b) { return a.score > b.score; };
+    std::vector<VectorSearchResult> heap;
+    heap.reserve(k);
+    const auto scan = [&](uint64_t row) {
+        const uint8_t *record = _record(row);
+        const uint8_t *payload = record + sizeof(RecordPrefix);
+        RecordPrefix prefix;
+        float score;
+        if (_type == VECTOR_F16) {
+            score = dotF16F32(reinterpret_cast<const uint16_t *>(payload), q.data(), _dim);
+        } else {
+            memcpy(&prefix.scale, record + offsetof(RecordPrefix, scale), sizeof(prefix.scale));
+            score = (float) dotI8(reinterpret_cast<const int8_t *>(payload), qI8.data(), _dim) * qScale * prefix.scale;
+        }
+        if (heap.size() == k && score <= heap.front().score) {
+            return;
+        }
+        memcpy(&prefix.id, record, sizeof(prefix.id));
+        if (heap.size() == k) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = {prefix.id, score};
+        } else {
+            heap.push_back({prefix.id, score});
+        }
+        std::push_heap(heap.begin(), heap.end(), better);
+    };
+
+    const uint32_t nProbe = std::min(_nProbe, _nLists);
+    if (_nLists == 0 || nProbe == _nLists) {
+        for (uint64_t row = 0; row < _count; row++) {
+            scan(row);
+        }
+    } else {
+        std::vector<std::pair<float, uint32_t>> lists(_nLists);
+        for (uint32_t c = 0; c < _nLists; c++) {
+            // the lists closest to the query are the ones its neighbours were assigned to
+            lists[c] = {_centroidScore(q.data(), c), c};
+        }
+        std::partial_sort(lists.begin(), lists.begin() + nProbe, lists.end(),
+                          [](const auto &a, const auto &b) { return a.first > b.first; });
+        for (uint32_t p = 0; p < nProbe; p++) {
+            for (const uint32_t row: _lists[lists[p].second]) {
+                scan(row);
+            }
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+    std::copy(heap.begin(), heap.end(), out);
+    return heap.size();
+}
+
+void
+VectorStore::sync() {
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    if (fdatasync(_fd) != 0) {
+        throw std::system_error(errno, std::generic_category(), "failed to sync " + _path);
+    }
+    if (_ivfDirty) {
+        _saveIvf();
+    }
+}
+
+void
+VectorStore::_loadIvf() {
+    const std::string ivfPath = _path + ".ivf";
+    const int fd = ::open(ivfPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    IvfHeader header{};
+    struct stat st{};
+    bool valid = fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(header);
+    std::vector<float> centroids;
+    std::vector<uint32_t> assignments;
+    try {
+        if (valid) {
+            preadAll(fd, &header, sizeof(header), 0, ivfPath);
+            const uint64_t expectedSize = sizeof(header) + (uint64_t) header.nLists * _dim * sizeof(float) +
+                                          header.count * sizeof(uint32_t);
+            valid = memcmp(header.magic, IVF_MAGIC, sizeof(header.magic)) == 0 && header.version == IVF_VERSION &&
+                    header.dim == _dim && header.nLists > 0 && header.count <= _count &&
+                    (uint64_t) st.st_size == expectedSize;
+        }
+        if (valid) {
+            centroids.resize((size_t) header.nLists * _dim);
+            assignments.resize(header.count);
+            preadAll(fd, centroids.data(), centroids.size() * sizeof(float), sizeof(header), ivfPath);
+            preadAll(fd, assignments.data(), assignments.size() * sizeof(uint32_t),
+                     (off_t) (sizeof(header) + centroids.size() * sizeof(float)), ivfPath);
+            valid = std::all_of(assignments.begin(), assignments.end(),
+                                [&](uint32_t c) { return c < header.nLists; });
+        }
+    } catch (const std::exception &) {
+        valid = false;
+    }
+    ::close(fd);
+    if (!valid) {
+        // a stale or foreign index is ignored, buildIvf() replaces it
+        return;
+    }
+
+    _nLists = header.nLists;
+    _centroids = std::move(centroids);
+    _centroidBias.assign(_nLists, 0.0f);
+    if (_metric == METRIC_DOT) {
+        for (uint32_t c = 0; c < _nLists; c++) {
+            const float *centroid = _centroids.data() + (size_t) c * _dim;
+            _centroidBias[c] = 0.5f * dotF32(centroid, centroid, _dim);
+        }
+    }
+    _assignments = std::move(assignments);
+    _lists.assign(_nLists, {});
+    for (uint32_t row = 0; row < _assignments.size(); row++) {
+        _lists[_assignments[row]].push_back(row);
+    }
+    // vectors appended after the index was last written
+    std::vector<float> vector(_dim);
+    for (uint64_t row = _assignments.size(); row < _count; row++) {
+        _decode(row, vector.data());
+        _assignments.push_back(_assign(vector.data()));
+        _lists[_assignments.back()].push_back((uint32_t) row);
+        _ivfDirty = true;
+    }
+}
+
+void
+VectorStore::_saveIvf() {
+    const std::string ivfPath = _path + ".ivf";
+    const std::string tmpPath = ivfPath + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "we");
+    if (file == nullptr) {
+        throw std::system_error(errno, std::generic_category(), "failed to create " + tmpPath);
+    }
+    IvfHeader header{};
+    memcpy(header.magic, IVF_MAGIC, sizeof(header.magic));
+    header.version = IVF_VERSION;
+    header.dim = _dim;
+    header.nLists = _nLists;
+    header.count = _assignments.size();
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(_centroids.data(), sizeof(float), _centroids.size(), file);
+    fwrite(_assignments.data(), sizeof(uint32_t), _assignments.size(), file);
+    const bool failed = ferror(file) != 0;
+    if (fclose(file) != 0 || failed) {
+        const int error = errno;
+        unlink(tmpPath.c_str());
+        throw std::system_error(error, std::generic_category(), "failed to write " + tmpPath);
+    }
+    if (rename(tmpPath.c_str(), ivfPath.c_str()) != 0) {
+        const int error = errno;
+        unlink(tmpPath.c_str());
+        throw std::system_error(error, std::generic_category(), "failed to replace " + ivfPath);
+    }
+    _ivfDirty = false;
+}
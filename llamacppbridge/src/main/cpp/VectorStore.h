@@ -0,0 +1,185 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+/// 向量在文件中的存储格式
+enum VectorType : uint32_t {
+    /// IEEE 半精度，每维 2 字节
+    VECTOR_F16 = 0,
+    /// 每个向量一个 f32 缩放系数的对称 int8 量化，每维 1 字节
+    VECTOR_I8 = 1,
+};
+
+/// 相似度度量
+enum VectorMetric : uint32_t {
+    /// 内积
+    METRIC_DOT = 0,
+    /// 余弦相似度：向量在写入时、查询在搜索时做 L2 归一化，然后求内积
+    METRIC_COSINE = 1,
+};
+
+/**
+ * @struct VectorSearchResult
+ * @brief 一条搜索结果。
+ */
+struct VectorSearchResult {
+    /// 写入时指定的向量 ID
+    int64_t id;
+    /// 相似度，越大越相似
+    float score;
+};
+
+/**
+ * @class VectorStore
+ * @brief 只追加的磁盘向量库，支持暴力搜索和 IVF（倒排文件）近似搜索。
+ *
+ * 文件由 64 字节的文件头和定长记录组成，每条记录是 16 字节的前缀（ID 和 int8 缩放系数）加上向量数据，
+ * 按 16 字节对齐。整个文件以 mmap 方式只读映射，打开时只读取文件头，因此大索引也能立即加载；
+ * 追加时先写记录再更新文件头中的数量，写入中断时多出的半条记录会被忽略并在下次追加时覆盖。
+ *
+ * IVF 索引（k-means 聚类中心和每个向量所属的列表）保存在 `<path>.ivf` 中，搜索时只扫描与查询最相似的
+ * nProbe 个列表。建立索引后追加的向量会立即分配到最近的列表。
+ *
+ * 搜索可以在多个线程中并发进行，追加、建立索引和 sync 会等待正在进行的搜索结束。
+ */
+class VectorStore {
+    std::string _path;
+    int _fd = -1;
+    uint32_t _dim = 0;
+    VectorType _type = VECTOR_F16;
+    VectorMetric _metric = METRIC_DOT;
+    /// 单条记录的字节数（含前缀和对齐）
+    size_t _recordSize = 0;
+    /// 文件头中已提交的向量数量
+    uint64_t _count = 0;
+    const uint8_t *_mapped = nullptr;
+    /// 映射的字节数，按倍数增长（单次增长有上限）以减少重新映射，可以超过文件大小（只访问已提交的记录）
+    size_t _mappedSize = 0;
+
+    /// IVF 列表数量，0 表示未建立索引
+    uint32_t _nLists = 0;
+    uint32_t _nProbe = 8;
+    /// nLists * dim 个聚类中心
+    std::vector<float> _centroids;
+    /// 每个聚类中心的分配偏置，METRIC_DOT 时为 |c|^2 / 2，使按内积分配等价于按欧氏距离分配
+    std::vector<float> _centroidBias;
+    /// 每个向量所属的列表
+    std::vector<uint32_t> _assignments;
+    /// 每个列表中的向量下标
+    std::vector<std::vector<uint32_t>> _lists;
+    /// IVF 索引是否有尚未写入 `<path>.ivf` 的修改
+    bool _ivfDirty = false;
+
+    mutable std::shared_mutex _mutex;
+
+    VectorStore() = default;
+
+    const uint8_t *_record(uint64_t row) const;
+
+    /**
+     * @brief 确保映射覆盖前 `count` 条记录。
+     */
+    void _map(uint64_t count);
+
+    /**
+     * @brief 把第 `row` 条记录解码为 f32。
+     */
+    void _decode(uint64_t row, float *out) const;
+
+    /**
+     * @brief `vector` 与第 `list` 个聚类中心的接近程度，越大越近；分配向量和选择探测列表使用同一个分数。
+     */
+    float _centroidScore(const float *vector, uint32_t list) const;
+
+    /**
+     * @brief 返回与 `vector` 最接近的 IVF 列表。
+     */
+    uint32_t _assign(const float *vector) const;
+
+    void _loadIvf();
+
+    void _saveIvf();
+
+public:
+    /**
+     * @brief 打开向量库文件，文件不存在时创建。
+     *
+     * @param dim 向量维度，打开已有文件时必须与文件一致。
+     * @param type 存储格式，打开已有文件时必须与文件一致。
+     * @param metric 相似度度量，打开已有文件时必须与文件一致。
+     * @throws std::invalid_argument 参数无效或与已有文件不一致时抛出。
+     * @throws std::system_error 文件无法打开、读取或映射时抛出。
+     * @throws std::runtime_error 文件不是有效的向量库时抛出。
+     */
+    static std::unique_ptr<VectorStore>
+    open(const std::string &path, uint32_t dim, VectorType type, VectorMetric metric);
+
+    ~VectorStore();
+
+    VectorStore(const VectorStore &) = delete;
+    VectorStore &operator=(const VectorStore &) = delete;
+
+    uint32_t dim() const { return _dim; }
+
+    VectorType type() const { return _type; }
+
+    VectorMetric metric() const { return _metric; }
+
+    /**
+     * @brief 向量数量。
+     */
+    uint64_t size() const;
+
+    /**
+     * @brief IVF 列表数量，未建立索引时为 0。
+     */
+    uint32_t ivfLists() const;
+
+    /**
+     * @brief 追加 `n` 个向量。
+     *
+     * @param ids 每个向量的 ID，不检查重复。
+     * @param vectors n * dim() 个 f32，按行存放。
+     * @throws std::system_error 写入失败时抛出。
+     */
+    void add(const int64_t *ids, const float *vectors, size_t n);
+
+    /**
+     * @brief 用 k-means 建立（或重建）IVF 索引并写入 `<path>.ivf`。
+     *
+     * 聚类只使用最多 nLists * 64 个随机抽样的向量，然后把所有向量分配到最近的聚类中心。
+     *
+     * @param nLists 列表数量，通常取 sqrt(size()) 到 4 * sqrt(size())。
+     * @param nIter k-means 迭代次数。
+     * @throws std::invalid_argument nLists 为 0 或大于向量数量时抛出。
+     * @throws std::system_error 写入失败时抛出。
+     */
+    void buildIvf(uint32_t nLists, uint32_t nIter = 10);
+
+    /**
+     * @brief 设置搜索时扫描的 IVF 列表数量，越大召回率越高、速度越慢，不小于列表数量时等价于暴力搜索。默认为 8。
+     */
+    void setProbes(uint32_t nProbe);
+
+    /**
+     * @brief 搜索与 `query` 最相似的 k 个向量。
+     *
+     * 用大小为 k 的最小堆维护候选，已建立 IVF 索引时只扫描 nProbe 个列表，否则扫描全部向量。
+     *
+     * @param query dim() 个 f32。
+     * @param out 至少 k 个元素，按相似度从大到小写入。
+     * @return size_t 写入的结果数量，即 min(k, 扫描的向量数)。
+     */
+    size_t search(const float *query, size_t k, VectorSearchResult *out) const;
+
+    /**
+     * @brief 把追加的记录刷到磁盘，并写入有修改的 IVF 索引。
+     *
+     * @throws std::system_error 写入失败时抛出。
+     */
+    void sync();
+};
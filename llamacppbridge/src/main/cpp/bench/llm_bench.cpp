@@ -0,0 +1,755 @@
+#include "LLMInference.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+/**
+ * @brief llm_bench：在宿主机上驱动 LLMInference 的独立基准测试程序。
+ *
+ * 依次执行 loadModel → startCompletion → completionLoop → stopCompletion，统计模型加载时间、
+ * 首 token 时间（TTFT）、预填充速度、解码速度以及进程峰值 RSS，并可输出 JSON 报告用于跨提交追踪性能回归。
+ * 替换全局 operator new 统计解码阶段每个 token 的堆分配次数，用于确认解码热路径不分配内存。
+ */
+
+// 进程内所有 operator new 的调用次数（包括 libllama 中的分配）
+static std::atomic<long> gAllocCount{0};
+
+void*
+operator new(size_t size) {
+    gAllocCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void
+operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void
+operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+namespace {
+
+struct BenchOptions {
+    std::string modelPath;
+    std::string prompt       = "Write a short story about a robot that learns to paint.";
+    std::string systemPrompt;
+    std::string chatTemplate;
+    std::string jsonPath;
+    std::string label;
+    std::string draftModelPath;
+    // 加载后应用的 LoRA 适配器及其缩放系数
+    std::vector<std::pair<std::string, float>> loraAdapters;
+    std::string grammarPath;
+    // 每行一条文本，非空时在生成之后测量批量嵌入的速度
+    std::string embedPath;
+    // 每行一条消息，非空时测量只加载词表的时间和统计 token 数量的耗时
+    std::string budgetPath;
+    // 大于 0 时在生成之后为同一提示词一次生成多条候选
+    int         nCandidates  = 0;
+    bool        beamSearch   = false;
+    int         embedPooling = LLAMA_POOLING_TYPE_UNSPECIFIED;
+    bool        jsonSchema   = false;
+    int         nPredict     = 128;
+    int         nRepeat      = 1;
+    long        timeoutMs    = 0;
+    int         overflow     = CONTEXT_OVERFLOW_FAIL;
+    int         nKeep        = -1;
+    int         speculative  = SPECULATIVE_NONE;
+    int         nDraft       = 6;
+    ThreadParams threads;
+    long        contextSize  = 2048;
+    int         nBatch       = 512;
+    int         nUbatch      = 512;
+    int         typeK        = GGML_TYPE_F16;
+    int         typeV        = GGML_TYPE_F16;
+    int         flashAttn    = LLAMA_FLASH_ATTN_TYPE_AUTO;
+    float       minP         = 0.05f;
+    float       temperature  = 1.0f;
+    int         topK         = 40;
+    float       topP         = 1.0f;
+    float       repeatPenalty = 1.0f;
+    bool        greedy       = false;
+    bool        useMmap      = true;
+    bool        warmup       = true;
+    bool        prefetch     = true;
+    bool        useMlock     = false;
+};
+
+struct BenchResult {
+    double loadMs       = 0.0;
+    double warmupMs     = 0.0;
+    // 加载并应用全部 LoRA 适配器的时间
+    double loraMs       = 0.0;
+    // 批量嵌入的文本数和耗时（不含创建嵌入上下文）
+    int    embedTexts   = 0;
+    double embedMs      = 0.0;
+    // 只加载词表的时间，以及首次（未命中缓存）和再次（命中缓存）统计全部消息 token 数量的耗时
+    double vocabLoadMs  = 0.0;
+    int    budgetTexts  = 0;
+    int    budgetTokens = 0;
+    double budgetColdUs = 0.0;
+    double budgetWarmUs = 0.0;
+    // 一次生成全部候选的耗时（包括预填充）以及生成的 token 总数
+    double candidatesMs = 0.0;
+    int    candidateTokens = 0;
+    // 每一轮的首 token 时间，第二轮起会复用 KV 缓存中与上一轮相同的提示词前缀
+    std::vector<double> ttftRunsMs;
+    double ttftMs       = 0.0;
+    double prefillMs    = 0.0;
+    double decodeMs     = 0.0;
+    int    promptTokens = 0;
+    int    decodeTokens = 0;
+    // 解码阶段（首 token 之后）的堆分配次数
+    long   decodeAllocs = 0;
+    long   peakRssKb    = 0;
+    bool   hitEog       = false;
+    // 最后一轮的结束原因（StopReason），因达到 -n 而停止时为 STOP_NONE
+    int    stopReason   = STOP_NONE;
+    float  draftAcceptanceRate = 0.0f;
+    // LLMInference 记录的最后一轮分阶段指标
+    InferenceMetrics metrics;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double
+elapsedMs(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+long
+peakRssKb() {
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    // Linux 上 ru_maxrss 的单位为 KB
+    return usage.ru_maxrss;
+}
+
+std::string
+readFile(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error("failed to open " + path);
+    }
+    std::string content;
+    char        buffer[4096];
+    size_t      n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        content.append(buffer, n);
+    }
+    fclose(file);
+    return content;
+}
+
+int
+parseKvCacheType(const std::string& name) {
+    for (ggml_type type: {GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0}) {
+        if (name == ggml_type_name(type)) {
+            return type;
+        }
+    }
+    return -1;
+}
+
+void
+printUsage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s -m <model.gguf> [options]\n"
+            "  -m, --model <path>        GGUF 模型文件路径（必填）\n"
+            "  -p, --prompt <text>       用户提示词\n"
+            "  -s, --system <text>       系统提示词\n"
+            "  -n, --n-predict <n>       最多生成的 token 数（默认 128）\n"
+            "  -r, --repeat <n>          重复执行同一查询的轮数，报告最后一轮的指标（默认 1）\n"
+            "      --timeout <ms>        每轮生成（包括预填充）的时间上限，超时后通过 abort 回调中止（默认不限制）\n"
+            "  -t, --threads <n>         解码线程数，0 表示按放置策略自动选择（默认 4）\n"
+            "  -tb, --threads-batch <n>  预填充线程数（默认与 -t 相同）\n"
+            "      --perf-cores          只在性能核上运行（按 cpu_capacity 或最高频率排除最慢的一组核心）\n"
+            "  -C, --cpu-mask <mask>     只在指定核心上运行：十六进制掩码（0xf0）或核心列表（4-7）\n"
+            "      --cpu-strict          把每个线程固定在一个核心上\n"
+            "      --poll <0..100>       线程等待任务时的自旋程度（默认 50）\n"
+            "  -c, --ctx-size <n>        上下文大小（默认 2048）\n"
+            "  -b, --batch-size <n>      预填充逻辑批大小 n_batch（默认 512）\n"
+            "  -ub, --ubatch-size <n>    预填充物理批大小 n_ubatch（默认 512）\n"
+            "      --chat-template <s>   聊天模板（默认使用模型内置模板）\n"
+            "  -ctk, --cache-type-k <t>  KV 缓存中 K 的类型：f16、q8_0、q4_0（默认 f16）\n"
+            "  -ctv, --cache-type-v <t>  KV 缓存中 V 的类型：f16、q8_0、q4_0（默认 f16，量化类型需要 flash attention）\n"
+            "  -fa, --flash-attn <mode>  flash attention：auto、on、off（默认 auto）\n"
+            "      --overflow <policy>   上下文写满时的策略：fail、shift、restart（默认 fail）\n"
+            "      --keep <n>            shift 策略保留的前缀 token 数（默认保留系统提示词）\n"
+            "      --spec <mode>         投机解码的草稿来源：none、ngram、draft（默认 none）\n"
+            "      --draft-model <path>  草稿模型（--spec draft 时使用）\n"
+            "      --lora <path>         加载并应用 LoRA 适配器（缩放系数 1，可重复）\n"
+            "      --lora-scaled <path> <s>  加载并以缩放系数 s 应用 LoRA 适配器（可重复）\n"
+            "      --n-draft <n>         每次验证的最大草稿 token 数（默认 6）\n"
+            "      --grammar <path>      用 GBNF 语法文件约束输出\n"
+            "      --embed <path>        生成之后批量计算文件中每一行的嵌入，报告每秒处理的文本数\n"
+            "      --candidates <n>      生成之后为同一提示词一次生成 n 条候选（共享一次预填充，批量解码）\n"
+            "      --beam                候选使用集束搜索而不是独立采样\n"
+            "      --budget <path>       只加载词表，统计文件中每一行的 token 数量，报告首次与命中缓存时的耗时\n"
+            "      --pooling <mode>      嵌入的池化方式：mean | cls | last（默认使用模型的设置）\n"
+            "      --json-schema <path>  用 JSON schema 文件约束输出\n"
+            "      --temp <f>            采样温度（默认 1.0）\n"
+            "      --min-p <f>           min-p 阈值（默认 0.05）\n"
+            "      --top-k <n>           top-k 候选数量，0 表示关闭（默认 40）\n"
+            "      --top-p <f>           top-p 阈值，1.0 表示关闭（默认 1.0）\n"
+            "      --repeat-penalty <f>  重复惩罚系数，1.0 表示关闭（默认 1.0）\n"
+            "      --greedy              贪心采样\n"
+            "      --no-mmap             不使用内存映射加载模型\n"
+            "      --mlock               锁定模型内存\n"
+            "      --no-warmup           加载后不预热（不预读模型文件、不执行空解码）\n"
+            "      --no-prefetch         预热时不预读模型文件\n"
+            "      --json <path>         将 JSON 报告写入文件（'-' 表示 stdout，生成的文本改写到 stderr）\n"
+            "      --label <s>           写入 JSON 报告的标签（例如提交哈希）\n",
+            argv0);
+}
+
+bool
+parseArgs(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto        next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "missing value for %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if (arg == "-m" || arg == "--model") {
+            options.modelPath = next();
+        } else if (arg == "-p" || arg == "--prompt") {
+            options.prompt = next();
+        } else if (arg == "-s" || arg == "--system") {
+            options.systemPrompt = next();
+        } else if (arg == "-r" || arg == "--repeat") {
+            options.nRepeat = std::max(1, atoi(next()));
+        } else if (arg == "-n" || arg == "--n-predict") {
+            options.nPredict = atoi(next());
+        } else if (arg == "--timeout") {
+            options.timeoutMs = atol(next());
+        } else if (arg == "-t" || arg == "--threads") {
+            options.threads.nThreads = atoi(next());
+        } else if (arg == "-tb" || arg == "--threads-batch") {
+            options.threads.nThreadsBatch = atoi(next());
+        } else if (arg == "--perf-cores") {
+            options.threads.placement = CPU_PLACEMENT_PERFORMANCE;
+        } else if (arg == "-C" || arg == "--cpu-mask") {
+            options.threads.placement = CPU_PLACEMENT_MASK;
+            options.threads.cpuMask   = next();
+        } else if (arg == "--cpu-strict") {
+            options.threads.strictPinning = true;
+        } else if (arg == "--poll") {
+            options.threads.poll = atoi(next());
+        } else if (arg == "-c" || arg == "--ctx-size") {
+            options.contextSize = atol(next());
+        } else if (arg == "-b" || arg == "--batch-size") {
+            options.nBatch = atoi(next());
+        } else if (arg == "-ub" || arg == "--ubatch-size") {
+            options.nUbatch = atoi(next());
+        } else if (arg == "-ctk" || arg == "--cache-type-k" || arg == "-ctv" || arg == "--cache-type-v") {
+            std::string name = next();
+            int         type = parseKvCacheType(name);
+            if (type < 0) {
+                fprintf(stderr, "unsupported KV cache type: %s\n", name.c_str());
+                return false;
+            }
+            if (arg == "-ctk" || arg == "--cache-type-k") {
+                options.typeK = type;
+            } else {
+                options.typeV = type;
+            }
+        } else if (arg == "-fa" || arg == "--flash-attn") {
+            std::string mode = next();
+            if (mode == "auto") {
+                options.flashAttn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+            } else if (mode == "on") {
+                options.flashAttn = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+            } else if (mode == "off") {
+                options.flashAttn = LLAMA_FLASH_ATTN_TYPE_DISABLED;
+            } else {
+                fprintf(stderr, "unknown flash attention mode: %s\n", mode.c_str());
+                return false;
+            }
+        } else if (arg == "--overflow") {
+            std::string policy = next();
+            if (policy == "fail") {
+                options.overflow = CONTEXT_OVERFLOW_FAIL;
+            } else if (policy == "shift") {
+                options.overflow = CONTEXT_OVERFLOW_SHIFT;
+            } else if (policy == "restart") {
+                options.overflow = CONTEXT_OVERFLOW_RESTART;
+            } else {
+                fprintf(stderr, "unknown overflow policy: %s\n", policy.c_str());
+                return false;
+            }
+        } else if (arg == "--keep") {
+            options.nKeep = atoi(next());
+        } else if (arg == "--spec") {
+            std::string mode = next();
+            if (mode == "none") {
+                options.speculative = SPECULATIVE_NONE;
+            } else if (mode == "ngram") {
+                options.speculative = SPECULATIVE_NGRAM;
+            } else if (mode == "draft") {
+                options.speculative = SPECULATIVE_DRAFT_MODEL;
+            } else {
+                fprintf(stderr, "unknown speculative decoding mode: %s\n", mode.c_str());
+                return false;
+            }
+        } else if (arg == "--draft-model") {
+            options.draftModelPath = next();
+        } else if (arg == "--lora") {
+            options.loraAdapters.emplace_back(next(), 1.0f);
+        } else if (arg == "--lora-scaled") {
+            std::string path = next();
+            options.loraAdapters.emplace_back(path, (float) atof(next()));
+        } else if (arg == "--n-draft") {
+            options.nDraft = atoi(next());
+        } else if (arg == "--embed") {
+            options.embedPath = next();
+        } else if (arg == "--candidates") {
+            options.nCandidates = atoi(next());
+        } else if (arg == "--beam") {
+            options.beamSearch = true;
+        } else if (arg == "--budget") {
+            options.budgetPath = next();
+        } else if (arg == "--pooling") {
+            std::string mode = next();
+            if (mode == "mean") {
+                options.embedPooling = LLAMA_POOLING_TYPE_MEAN;
+            } else if (mode == "cls") {
+                options.embedPooling = LLAMA_POOLING_TYPE_CLS;
+            } else if (mode == "last") {
+                options.embedPooling = LLAMA_POOLING_TYPE_LAST;
+            } else {
+                fprintf(stderr, "unknown pooling type: %s\n", mode.c_str());
+                return false;
+            }
+        } else if (arg == "--grammar") {
+            options.grammarPath = next();
+            options.jsonSchema  = false;
+        } else if (arg == "--json-schema") {
+            options.grammarPath = next();
+            options.jsonSchema  = true;
+        } else if (arg == "--chat-template") {
+            options.chatTemplate = next();
+        } else if (arg == "--temp") {
+            options.temperature = (float) atof(next());
+        } else if (arg == "--min-p") {
+            options.minP = (float) atof(next());
+        } else if (arg == "--top-k") {
+            options.topK = atoi(next());
+        } else if (arg == "--top-p") {
+            options.topP = (float) atof(next());
+        } else if (arg == "--repeat-penalty") {
+            options.repeatPenalty = (float) atof(next());
+        } else if (arg == "--greedy") {
+            options.greedy = true;
+        } else if (arg == "--no-mmap") {
+            options.useMmap = false;
+        } else if (arg == "--mlock") {
+            options.useMlock = true;
+        } else if (arg == "--no-warmup") {
+            options.warmup = false;
+        } else if (arg == "--no-prefetch") {
+            options.prefetch = false;
+        } else if (arg == "--json") {
+            options.jsonPath = next();
+        } else if (arg == "--label") {
+            options.label = next();
+        } else if (arg == "-h" || arg == "--help") {
+            return false;
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    if (options.speculative == SPECULATIVE_DRAFT_MODEL && options.draftModelPath.empty()) {
+        fprintf(stderr, "--spec draft requires --draft-model\n");
+        return false;
+    }
+    return !options.modelPath.empty();
+}
+
+std::string
+jsonEscape(const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        switch (c) {
+        case '"':
+            escaped += "\\\"";
+            break;
+        case '\\':
+            escaped += "\\\\";
+            break;
+        case '\n':
+            escaped += "\\n";
+            break;
+        case '\t':
+            escaped += "\\t";
+            break;
+        default:
+            if ((unsigned char) c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                escaped += buf;
+            } else {
+                escaped += c;
+            }
+        }
+    }
+    return escaped;
+}
+
+double
+tokensPerSecond(int nTokens, double ms) {
+    return ms > 0.0 ? nTokens / (ms / 1000.0) : 0.0;
+}
+
+const char*
+stopReasonName(int stopReason) {
+    switch (stopReason) {
+        case STOP_EOG: return "eog";
+        case STOP_CANCELLED: return "cancelled";
+        case STOP_MAX_TOKENS: return "max_tokens";
+        case STOP_DEADLINE: return "deadline";
+        default: return "n_predict";
+    }
+}
+
+// 最后一轮解码阶段平均每个 token 的堆分配次数
+double
+allocsPerToken(const BenchResult& result) {
+    return result.decodeTokens > 0 ? (double) result.decodeAllocs / result.decodeTokens : 0.0;
+}
+
+// 以 "%10.2f MB" 的格式输出大小，llama.cpp 没有报告时输出 unknown
+std::string
+formatMb(const std::optional<size_t>& bytes) {
+    char text[32];
+    if (bytes) {
+        snprintf(text, sizeof(text), "%10.2f MB", *bytes / (1024.0 * 1024.0));
+    } else {
+        snprintf(text, sizeof(text), "%10s", "unknown");
+    }
+    return text;
+}
+
+void
+writeJsonReport(FILE* out, const BenchOptions& options, const BenchResult& result) {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"label\": \"%s\",\n", jsonEscape(options.label).c_str());
+    fprintf(out, "  \"model\": \"%s\",\n", jsonEscape(options.modelPath).c_str());
+    fprintf(out, "  \"n_threads\": %d,\n", options.threads.nThreads);
+    fprintf(out, "  \"n_threads_batch\": %d,\n",
+            options.threads.nThreadsBatch > 0 ? options.threads.nThreadsBatch : options.threads.nThreads);
+    fprintf(out, "  \"cpu_placement\": \"%s\",\n",
+            options.threads.placement == CPU_PLACEMENT_PERFORMANCE ? "perf"
+            : options.threads.placement == CPU_PLACEMENT_MASK      ? options.threads.cpuMask.c_str()
+                                                                   : "none");
+    fprintf(out, "  \"cpu_strict\": %s,\n", options.threads.strictPinning ? "true" : "false");
+    fprintf(out, "  \"n_ctx\": %ld,\n", options.contextSize);
+    fprintf(out, "  \"n_batch\": %d,\n", options.nBatch);
+    fprintf(out, "  \"n_ubatch\": %d,\n", options.nUbatch);
+    fprintf(out, "  \"cache_type_k\": \"%s\",\n", ggml_type_name((ggml_type) options.typeK));
+    fprintf(out, "  \"cache_type_v\": \"%s\",\n", ggml_type_name((ggml_type) options.typeV));
+    fprintf(out, "  \"flash_attn\": \"%s\",\n",
+            options.flashAttn == LLAMA_FLASH_ATTN_TYPE_ENABLED    ? "on"
+            : options.flashAttn == LLAMA_FLASH_ATTN_TYPE_DISABLED ? "off"
+                                                                  : "auto");
+    fprintf(out, "  \"n_predict\": %d,\n", options.nPredict);
+    fprintf(out, "  \"n_repeat\": %d,\n", options.nRepeat);
+    fprintf(out, "  \"speculative\": \"%s\",\n",
+            options.speculative == SPECULATIVE_NGRAM         ? "ngram"
+            : options.speculative == SPECULATIVE_DRAFT_MODEL ? "draft"
+                                                             : "none");
+    fprintf(out, "  \"n_draft\": %d,\n", options.speculative == SPECULATIVE_NONE ? 0 : options.nDraft);
+    fprintf(out, "  \"load_ms\": %.3f,\n", result.loadMs);
+    fprintf(out, "  \"warmup_ms\": %.3f,\n", result.warmupMs);
+    fprintf(out, "  \"lora_adapters\": %zu,\n", options.loraAdapters.size());
+    fprintf(out, "  \"lora_ms\": %.3f,\n", result.loraMs);
+    fprintf(out, "  \"embed_texts\": %d,\n", result.embedTexts);
+    fprintf(out, "  \"embed_ms\": %.3f,\n", result.embedMs);
+    fprintf(out, "  \"embed_texts_s\": %.3f,\n", tokensPerSecond(result.embedTexts, result.embedMs));
+    fprintf(out, "  \"n_candidates\": %d,\n", options.nCandidates);
+    fprintf(out, "  \"beam_search\": %s,\n", options.beamSearch ? "true" : "false");
+    fprintf(out, "  \"candidates_ms\": %.3f,\n", result.candidatesMs);
+    fprintf(out, "  \"candidate_tokens\": %d,\n", result.candidateTokens);
+    fprintf(out, "  \"vocab_load_ms\": %.3f,\n", result.vocabLoadMs);
+    fprintf(out, "  \"budget_texts\": %d,\n", result.budgetTexts);
+    fprintf(out, "  \"budget_tokens\": %d,\n", result.budgetTokens);
+    fprintf(out, "  \"budget_cold_us\": %.3f,\n", result.budgetColdUs);
+    fprintf(out, "  \"budget_warm_us\": %.3f,\n", result.budgetWarmUs);
+    fprintf(out, "  \"ttft_ms\": %.3f,\n", result.ttftMs);
+    fprintf(out, "  \"ttft_ms_runs\": [");
+    for (size_t i = 0; i < result.ttftRunsMs.size(); i++) {
+        fprintf(out, "%s%.3f", i == 0 ? "" : ", ", result.ttftRunsMs[i]);
+    }
+    fprintf(out, "],\n");
+    fprintf(out, "  \"prompt_tokens\": %d,\n", result.promptTokens);
+    fprintf(out, "  \"prefill_ms\": %.3f,\n", result.prefillMs);
+    fprintf(out, "  \"prefill_tok_s\": %.3f,\n", tokensPerSecond(result.promptTokens, result.prefillMs));
+    fprintf(out, "  \"decode_tokens\": %d,\n", result.decodeTokens);
+    fprintf(out, "  \"decode_ms\": %.3f,\n", result.decodeMs);
+    fprintf(out, "  \"decode_tok_s\": %.3f,\n", tokensPerSecond(result.decodeTokens, result.decodeMs));
+    fprintf(out, "  \"allocs_per_token\": %.3f,\n", allocsPerToken(result));
+    fprintf(out, "  \"draft_acceptance_rate\": %.3f,\n", result.draftAcceptanceRate);
+    fprintf(out, "  \"hit_eog\": %s,\n", result.hitEog ? "true" : "false");
+    fprintf(out, "  \"stop_reason\": \"%s\",\n", stopReasonName(result.stopReason));
+    fprintf(out, "  \"metrics\": %s,\n", result.metrics.toJson().c_str());
+    fprintf(out, "  \"peak_rss_kb\": %ld\n", result.peakRssKb);
+    fprintf(out, "}\n");
+}
+
+// 生成的文本写入 stdout；--json - 时 stdout 只留给 JSON 报告，文本改写到 stderr
+FILE*
+textOutput(const BenchOptions& options) {
+    return options.jsonPath == "-" ? stderr : stdout;
+}
+
+// 执行一轮 startCompletion → completionStep → stopCompletion，结果写入 result
+void
+runCompletion(LLMInference& llmInference, const BenchOptions& options, BenchResult& result) {
+    result.decodeTokens = 0;
+    result.decodeAllocs = 0;
+    FILE* out           = textOutput(options);
+
+    // 首 token 时间包含聊天模板渲染、分词、预填充以及第一次采样
+    auto start = Clock::now();
+    GenerationLimits limits;
+    limits.timeoutMs = options.timeoutMs;
+    llmInference.startCompletion(options.prompt.c_str(), limits);
+    result.promptTokens = llmInference.getPromptTokenCount();
+
+    std::string_view piece;
+    auto             prefillStart = Clock::now();
+    result.hitEog                 = !llmInference.completionStep(piece);
+    auto             firstToken   = Clock::now();
+    result.prefillMs              = elapsedMs(prefillStart, firstToken);
+    result.ttftMs                 = elapsedMs(start, firstToken);
+    result.ttftRunsMs.push_back(result.ttftMs);
+    if (!result.hitEog) {
+        fwrite(piece.data(), 1, piece.size(), out);
+    }
+
+    // 第一个 token 由预填充产生，之后每次 completionStep 返回一个 token（投机解码时一次验证可产生多个）
+    auto decodeStart = Clock::now();
+    long allocStart  = gAllocCount.load(std::memory_order_relaxed);
+    while (!result.hitEog && result.decodeTokens + 1 < options.nPredict) {
+        if (!llmInference.completionStep(piece)) {
+            result.hitEog = true;
+            break;
+        }
+        result.decodeTokens++;
+        fwrite(piece.data(), 1, piece.size(), out);
+        fflush(out);
+    }
+    result.decodeAllocs = gAllocCount.load(std::memory_order_relaxed) - allocStart;
+    result.decodeMs     = elapsedMs(decodeStart, Clock::now());
+    result.stopReason   = llmInference.getStopReason();
+    result.hitEog       = result.stopReason == STOP_EOG;
+    llmInference.stopCompletion();
+    fputc('\n', out);
+}
+
+// 读取文件中的非空行
+std::vector<std::string>
+readLines(const std::string& path) {
+    std::vector<std::string> lines;
+    std::string              content = readFile(path);
+    size_t                   start   = 0;
+    while (start < content.size()) {
+        size_t end = content.find('\n', start);
+        if (end == std::string::npos) {
+            end = content.size();
+        }
+        if (end > start) {
+            lines.emplace_back(content, start, end - start);
+        }
+        start = end + 1;
+    }
+    return lines;
+}
+
+// 读取 --embed 文件的每一行，一次调用计算全部嵌入
+void
+runEmbedding(LLMInference& llmInference, const BenchOptions& options, BenchResult& result) {
+    std::vector<std::string> texts = readLines(options.embedPath);
+    EmbeddingParams params;
+    params.poolingType = options.embedPooling;
+    llmInference.initEmbeddings(params);
+    std::vector<float> embeddings(texts.size() * llmInference.getEmbeddingSize());
+    auto embedStart   = Clock::now();
+    llmInference.embed(texts, true, embeddings.data());
+    result.embedMs    = elapsedMs(embedStart, Clock::now());
+    result.embedTexts = (int) texts.size();
+}
+
+// 为 -p 的提示词一次生成 --candidates 条候选，每条最多 -n 个 token
+void
+runCandidates(LLMInference& llmInference, const BenchOptions& options, BenchResult& result) {
+    GenerationLimits limits;
+    limits.maxTokens = options.nPredict;
+    limits.timeoutMs = options.timeoutMs;
+    auto start = Clock::now();
+    std::vector<GenerationCandidate> candidates =
+            llmInference.generateCandidates(options.prompt.c_str(), options.nCandidates, options.beamSearch, limits);
+    result.candidatesMs = elapsedMs(start, Clock::now());
+    for (const GenerationCandidate& candidate: candidates) {
+        result.candidateTokens += candidate.nTokens;
+        fprintf(textOutput(options), "[candidate %.3f] %s\n", candidate.logProb / std::max(candidate.nTokens, 1), candidate.text.c_str());
+    }
+}
+
+// 以 vocab_only 方式加载词表，统计 --budget 文件中每一行的 token 数量两次（第二次全部命中缓存）
+void
+runBudget(const BenchOptions& options, BenchResult& result) {
+    std::vector<std::string> texts = readLines(options.budgetPath);
+    std::vector<int32_t>     counts(texts.size());
+    auto loadStart     = Clock::now();
+    auto tokenizer     = Tokenizer::loadVocab(options.modelPath.c_str());
+    result.vocabLoadMs = elapsedMs(loadStart, Clock::now());
+    auto coldStart      = Clock::now();
+    tokenizer->countTokens(texts, false, true, counts.data());
+    result.budgetColdUs = elapsedMs(coldStart, Clock::now()) * 1000.0;
+    auto warmStart      = Clock::now();
+    tokenizer->countTokens(texts, false, true, counts.data());
+    result.budgetWarmUs = elapsedMs(warmStart, Clock::now()) * 1000.0;
+    result.budgetTexts  = (int) texts.size();
+    for (int32_t count: counts) {
+        result.budgetTokens += count;
+    }
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseArgs(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    BenchResult  result;
+    LLMInference llmInference;
+    try {
+        auto loadStart = Clock::now();
+        llmInference.loadModel(options.modelPath.c_str(), options.minP, options.temperature, false,
+                               options.contextSize,
+                               options.chatTemplate.empty() ? nullptr : options.chatTemplate.c_str(),
+                               options.threads, options.useMmap, options.useMlock, options.nBatch, options.nUbatch,
+                               options.typeK, options.typeV, options.flashAttn, options.nCandidates);
+        result.loadMs = elapsedMs(loadStart, Clock::now());
+        if (options.warmup) {
+            auto warmupStart = Clock::now();
+            llmInference.warmup(options.prefetch);
+            result.warmupMs = elapsedMs(warmupStart, Clock::now());
+        }
+        SamplerParams samplerParams;
+        samplerParams.temperature   = options.temperature;
+        samplerParams.minP          = options.minP;
+        samplerParams.topK          = options.topK;
+        samplerParams.topP          = options.topP;
+        samplerParams.repeatPenalty = options.repeatPenalty;
+        samplerParams.greedy        = options.greedy;
+        llmInference.setSamplerParams(samplerParams);
+        llmInference.setContextOverflowPolicy(options.overflow, options.nKeep);
+        if (options.speculative == SPECULATIVE_DRAFT_MODEL) {
+            llmInference.loadDraftModel(options.draftModelPath.c_str());
+        }
+        llmInference.setSpeculativeDecoding(options.speculative, options.nDraft);
+        if (!options.loraAdapters.empty()) {
+            auto loraStart = Clock::now();
+            for (const auto& [path, scale]: options.loraAdapters) {
+                llmInference.setLoraAdapter(llmInference.loadLoraAdapter(path.c_str()), scale);
+            }
+            result.loraMs = elapsedMs(loraStart, Clock::now());
+        }
+        if (!options.grammarPath.empty()) {
+            std::string grammar = readFile(options.grammarPath);
+            llmInference.setGrammar(grammar.c_str(), options.jsonSchema);
+        }
+        if (!options.systemPrompt.empty()) {
+            llmInference.addChatMessage(options.systemPrompt.c_str(), "system");
+        }
+
+        // storeChats = false：每一轮都是独立的查询
+        for (int i = 0; i < options.nRepeat; i++) {
+            runCompletion(llmInference, options, result);
+        }
+        if (options.nCandidates > 0) {
+            runCandidates(llmInference, options, result);
+        }
+        if (!options.embedPath.empty()) {
+            runEmbedding(llmInference, options, result);
+        }
+        if (!options.budgetPath.empty()) {
+            runBudget(options, result);
+        }
+    } catch (std::runtime_error& error) {
+        fprintf(stderr, "llm_bench failed: %s\n", error.what());
+        return 1;
+    }
+    result.peakRssKb = peakRssKb();
+    result.draftAcceptanceRate = llmInference.getDraftAcceptanceRate();
+    result.metrics = llmInference.getMetrics();
+
+    fprintf(stderr,
+            "\nload        : %10.2f ms\n"
+            "warm-up     : %10.2f ms\n"
+            "lora        : %10.2f ms\n"
+            "ttft        : %10.2f ms\n"
+            "prefill     : %10.2f tok/s (%d tokens in %.2f ms)\n"
+            "decode      : %10.2f tok/s (%d tokens in %.2f ms)\n"
+            "decode p50  : %10.2f ms (p95 %.2f ms, p99 %.2f ms)\n"
+            "allocations : %10.2f per token\n"
+            "sample      : %10.2f ms\n"
+            "detokenize  : %10.2f ms\n"
+            "kv cache    : %s\n"
+            "compute buf : %s\n"
+            "draft accept: %10.2f %%\n"
+            "embed       : %10.2f texts/s (%d texts in %.2f ms)\n"
+            "candidates  : %10.2f tok/s (%d tokens in %.2f ms)\n"
+            "vocab load  : %10.2f ms\n"
+            "budget      : %10.2f us cold, %.2f us cached (%d texts, %d tokens)\n"
+            "peak rss    : %10.2f MB\n",
+            result.loadMs, result.warmupMs, result.loraMs, result.ttftMs, tokensPerSecond(result.promptTokens, result.prefillMs),
+            result.promptTokens, result.prefillMs, tokensPerSecond(result.decodeTokens, result.decodeMs),
+            result.decodeTokens, result.decodeMs, result.metrics.decodeP50Ms, result.metrics.decodeP95Ms,
+            result.metrics.decodeP99Ms, allocsPerToken(result), result.metrics.sampleMs, result.metrics.detokenizeMs,
+            formatMb(result.metrics.kvCacheBytes).c_str(), formatMb(result.metrics.computeBufferBytes).c_str(),
+            result.draftAcceptanceRate * 100.0f,
+            tokensPerSecond(result.embedTexts, result.embedMs), result.embedTexts, result.embedMs,
+            tokensPerSecond(result.candidateTokens, result.candidatesMs), result.candidateTokens, result.candidatesMs,
+            result.vocabLoadMs, result.budgetColdUs, result.budgetWarmUs, result.budgetTexts, result.budgetTokens,
+            result.peakRssKb / 1024.0);
+
+    if (!options.jsonPath.empty()) {
+        if (options.jsonPath == "-") {
+            writeJsonReport(stdout, options, result);
+        } else {
+            FILE* out = fopen(options.jsonPath.c_str(), "w");
+            if (!out) {
+                fprintf(stderr, "failed to open %s for writing\n", options.jsonPath.c_str());
+                return 1;
+            }
+            writeJsonReport(out, options, result);
+            fclose(out);
+        }
+    }
+    return 0;
+}
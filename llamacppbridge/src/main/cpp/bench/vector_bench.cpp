@@ -0,0 +1,348 @@
+#include "VectorKernels.h"
+#include "VectorStore.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief vector_bench：在宿主机上测量 VectorStore 的写入、打开和搜索速度。
+ *
+ * 对每种规模和存储格式生成主题相互重叠、各向异性的合成向量（模拟文本嵌入），写入新的向量库文件后重新打开，
+ * 分别测量暴力搜索和 IVF 搜索的单线程 QPS，并以暴力搜索的结果为基准计算 IVF 的 recall@k。
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::vector<size_t>     sizes    = {10000, 100000, 1000000};
+    std::vector<VectorType> types    = {VECTOR_F16, VECTOR_I8};
+    std::string             dir      = "/tmp";
+    std::string             jsonPath;
+    std::string             label;
+    uint32_t                dim      = 384;
+    int                     nQueries = 200;
+    int                     k        = 10;
+    // 0 表示取 sqrt(n)
+    uint32_t                nLists   = 0;
+    uint32_t                nProbe   = 8;
+    uint32_t                nIter    = 10;
+    bool                    keep     = false;
+};
+
+struct BenchResult {
+    VectorType type;
+    size_t     size;
+    double     fileMb;
+    double     addMs;
+    double     openMs;
+    double     flatQps;
+    uint32_t   nLists;
+    double     ivfBuildMs;
+    double     ivfQps;
+    double     recall;
+};
+
+double
+elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+const char*
+typeName(VectorType type) {
+    return type == VECTOR_F16 ? "f16" : "i8";
+}
+
+void
+printUsage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "      --sizes <n,n,...>     向量数量（默认 10000,100000,1000000）\n"
+            "      --type <t>            存储格式：f16、i8、all（默认 all）\n"
+            "  -d, --dim <n>             向量维度（默认 384）\n"
+            "  -q, --queries <n>         每种配置的查询次数（默认 200）\n"
+            "  -k <n>                    每次查询返回的结果数（默认 10）\n"
+            "      --lists <n>           IVF 列表数量，0 表示 sqrt(n)（默认 0）\n"
+            "      --probes <n>          IVF 搜索扫描的列表数量（默认 8）\n"
+            "      --iter <n>            k-means 迭代次数（默认 10）\n"
+            "      --dir <path>          向量库文件所在目录（默认 /tmp）\n"
+            "      --keep                保留生成的向量库文件\n"
+            "      --json <path>         将 JSON 报告写入文件（'-' 表示 stdout）\n"
+            "      --label <s>           写入 JSON 报告的标签（例如提交哈希）\n",
+            argv0);
+}
+
+bool
+parseArgs(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto        next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "missing value for %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if (arg == "--sizes") {
+            options.sizes.clear();
+            std::string sizes = next();
+            for (size_t start = 0; start < sizes.size();) {
+                size_t end = sizes.find(',', start);
+                if (end == std::string::npos) {
+                    end = sizes.size();
+                }
+                options.sizes.push_back(strtoull(sizes.substr(start, end - start).c_str(), nullptr, 10));
+                start = end + 1;
+            }
+        } else if (arg == "--type") {
+            std::string type = next();
+            if (type == "f16") {
+                options.types = {VECTOR_F16};
+            } else if (type == "i8") {
+                options.types = {VECTOR_I8};
+            } else if (type != "all") {
+                fprintf(stderr, "unknown vector type: %s\n", type.c_str());
+                return false;
+            }
+        } else if (arg == "-d" || arg == "--dim") {
+            options.dim = (uint32_t) atoi(next());
+        } else if (arg == "-q" || arg == "--queries") {
+            options.nQueries = std::max(1, atoi(next()));
+        } else if (arg == "-k") {
+            options.k = std::max(1, atoi(next()));
+        } else if (arg == "--lists") {
+            options.nLists = (uint32_t) atoi(next());
+        } else if (arg == "--probes") {
+            options.nProbe = (uint32_t) std::max(1, atoi(next()));
+        } else if (arg == "--iter") {
+            options.nIter = (uint32_t) std::max(1, atoi(next()));
+        } else if (arg == "--dir") {
+            options.dir = next();
+        } else if (arg == "--keep") {
+            options.keep = true;
+        } else if (arg == "--json") {
+            options.jsonPath = next();
+        } else if (arg == "--label") {
+            options.label = next();
+        } else if (arg == "-h" || arg == "--help") {
+            return false;
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return options.dim > 0 && !options.sizes.empty();
+}
+
+// 相互重叠的主题混合：每个向量是公共均值、若干随机主题方向的加权和与噪声之和，各维方差按幂律衰减。
+// 主题之间没有清晰的边界，近邻常常落在相邻的 IVF 列表中，与真实文本嵌入的各向异性和主题重叠相近
+class VectorGenerator {
+    // 每个向量混合的主题数
+    static constexpr int TOPICS_PER_VECTOR = 3;
+
+    std::mt19937                          _rng;
+    std::normal_distribution<float>       _normal;
+    std::uniform_real_distribution<float> _uniform{0.0f, 1.0f};
+    std::vector<float>                    _mean;
+    std::vector<float>                    _topics;
+    // 每一维的标准差
+    std::vector<float>                    _scale;
+    uint32_t                              _dim;
+    uint32_t                              _nTopics;
+
+public:
+    VectorGenerator(uint32_t dim, uint32_t nTopics, uint32_t seed)
+        : _rng(seed), _dim(dim), _nTopics(nTopics) {
+        _scale.resize(dim);
+        _mean.resize(dim);
+        for (uint32_t d = 0; d < dim; d++) {
+            _scale[d] = 1.0f / std::sqrt(1.0f + (float) d / 16.0f);
+            _mean[d]  = 0.5f * _scale[d] * _normal(_rng);
+        }
+        _topics.resize((size_t) nTopics * dim);
+        for (size_t i = 0; i < _topics.size(); i++) {
+            _topics[i] = _scale[i % dim] * _normal(_rng);
+        }
+    }
+
+    void next(float* out) {
+        for (uint32_t d = 0; d < _dim; d++) {
+            out[d] = _mean[d] + _scale[d] * _normal(_rng);
+        }
+        for (int t = 0; t < TOPICS_PER_VECTOR; t++) {
+            const float* topic  = _topics.data() + (size_t) (_rng() % _nTopics) * _dim;
+            const float  weight = _uniform(_rng);
+            for (uint32_t d = 0; d < _dim; d++) {
+                out[d] += weight * topic[d];
+            }
+        }
+    }
+};
+
+double
+fileSizeMb(const std::string& path) {
+    struct stat st {};
+    return stat(path.c_str(), &st) == 0 ? st.st_size / (1024.0 * 1024.0) : 0.0;
+}
+
+// 返回查询的 QPS，每次查询的结果写入 results
+double
+runQueries(const VectorStore& store, const std::vector<float>& queries, const BenchOptions& options,
+           std::vector<VectorSearchResult>& results) {
+    results.resize((size_t) options.nQueries * options.k);
+    auto start = Clock::now();
+    for (int q = 0; q < options.nQueries; q++) {
+        store.search(queries.data() + (size_t) q * options.dim, options.k, results.data() + (size_t) q * options.k);
+    }
+    return options.nQueries / (elapsedMs(start) / 1000.0);
+}
+
+BenchResult
+runBenchmark(const BenchOptions& options, VectorType type, size_t size) {
+    BenchResult result{};
+    result.type = type;
+    result.size = size;
+    const std::string path = options.dir + "/vector_bench_" + typeName(type) + "_" + std::to_string(size) + ".svec";
+    unlink(path.c_str());
+    unlink((path + ".ivf").c_str());
+
+    VectorGenerator generator(options.dim, 1024, 42);
+    {
+        auto store = VectorStore::open(path, options.dim, type, METRIC_COSINE);
+        // 分块写入，避免为 1M 个向量一次性生成 f32 数据
+        const size_t         chunk = 4096;
+        std::vector<float>   vectors(chunk * options.dim);
+        std::vector<int64_t> ids(chunk);
+        auto                 start = Clock::now();
+        for (size_t added = 0; added < size; added += chunk) {
+            const size_t n = std::min(chunk, size - added);
+            for (size_t i = 0; i < n; i++) {
+                generator.next(vectors.data() + i * options.dim);
+                ids[i] = (int64_t) (added + i);
+            }
+            store->add(ids.data(), vectors.data(), n);
+        }
+        store->sync();
+        result.addMs = elapsedMs(start);
+    }
+    result.fileMb = fileSizeMb(path);
+
+    auto start = Clock::now();
+    auto store = VectorStore::open(path, options.dim, type, METRIC_COSINE);
+    result.openMs = elapsedMs(start);
+
+    std::vector<float> queries((size_t) options.nQueries * options.dim);
+    for (int q = 0; q < options.nQueries; q++) {
+        generator.next(queries.data() + (size_t) q * options.dim);
+    }
+    std::vector<VectorSearchResult> flatResults;
+    std::vector<VectorSearchResult> ivfResults;
+    result.flatQps = runQueries(*store, queries, options, flatResults);
+
+    result.nLists = options.nLists > 0 ? options.nLists : (uint32_t) std::max(1.0, std::sqrt((double) size));
+    result.nLists = (uint32_t) std::min<size_t>(result.nLists, size);
+    start = Clock::now();
+    store->buildIvf(result.nLists, options.nIter);
+    result.ivfBuildMs = elapsedMs(start);
+    store->setProbes(options.nProbe);
+    result.ivfQps = runQueries(*store, queries, options, ivfResults);
+
+    size_t hits = 0;
+    for (int q = 0; q < options.nQueries; q++) {
+        std::unordered_set<int64_t> expected;
+        for (int i = 0; i < options.k; i++) {
+            expected.insert(flatResults[(size_t) q * options.k + i].id);
+        }
+        for (int i = 0; i < options.k; i++) {
+            hits += expected.count(ivfResults[(size_t) q * options.k + i].id);
+        }
+    }
+    result.recall = (double) hits / ((double) options.nQueries * options.k);
+
+    store.reset();
+    if (!options.keep) {
+        unlink(path.c_str());
+        unlink((path + ".ivf").c_str());
+    }
+    return result;
+}
+
+void
+writeJsonReport(FILE* out, const BenchOptions& options, const std::vector<BenchResult>& results) {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"label\": \"%s\",\n", options.label.c_str());
+    fprintf(out, "  \"isa\": \"%s\",\n", vectorKernelIsa());
+    fprintf(out, "  \"dim\": %u,\n", options.dim);
+    fprintf(out, "  \"k\": %d,\n", options.k);
+    fprintf(out, "  \"n_queries\": %d,\n", options.nQueries);
+    fprintf(out, "  \"n_probe\": %u,\n", options.nProbe);
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& result = results[i];
+        fprintf(out,
+                "    {\"type\": \"%s\", \"n\": %zu, \"file_mb\": %.3f, \"add_ms\": %.3f, \"open_ms\": %.3f, "
+                "\"flat_qps\": %.3f, \"n_lists\": %u, \"ivf_build_ms\": %.3f, \"ivf_qps\": %.3f, \"recall\": %.4f}%s\n",
+                typeName(result.type), result.size, result.fileMb, result.addMs, result.openMs, result.flatQps,
+                result.nLists, result.ivfBuildMs, result.ivfQps, result.recall, i + 1 == results.size() ? "" : ",");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseArgs(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    fprintf(stderr, "kernels: %s, dim %u, k %d, %d queries, %u probes\n", vectorKernelIsa(), options.dim, options.k,
+            options.nQueries, options.nProbe);
+    fprintf(stderr, "%-4s %9s %9s %10s %8s %10s %6s %10s %10s %7s\n", "type", "n", "file MB", "add ms", "open ms",
+            "flat qps", "lists", "build ms", "ivf qps", "recall");
+    std::vector<BenchResult> results;
+    for (size_t size : options.sizes) {
+        for (VectorType type : options.types) {
+            if (size == 0) {
+                continue;
+            }
+            try {
+                results.push_back(runBenchmark(options, type, size));
+            } catch (const std::exception& e) {
+                fprintf(stderr, "%s: %s\n", typeName(type), e.what());
+                return 1;
+            }
+            const BenchResult& result = results.back();
+            fprintf(stderr, "%-4s %9zu %9.1f %10.1f %8.3f %10.1f %6u %10.1f %10.1f %7.4f\n", typeName(type),
+                    result.size, result.fileMb, result.addMs, result.openMs, result.flatQps, result.nLists,
+                    result.ivfBuildMs, result.ivfQps, result.recall);
+        }
+    }
+
+    if (!options.jsonPath.empty()) {
+        if (options.jsonPath == "-") {
+            writeJsonReport(stdout, options, results);
+        } else {
+            FILE* out = fopen(options.jsonPath.c_str(), "w");
+            if (!out) {
+                fprintf(stderr, "failed to open %s for writing\n", options.jsonPath.c_str());
+                return 1;
+            }
+            writeJsonReport(out, options, results);
+            fclose(out);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,212 @@
+# Host (x86-64 / aarch64 Linux) build of the inference engine, used to profile
+# LLMInference off-device. Produces a static library without the JNI bridge
+# and the `llm_bench` benchmark executable, plus the vector store and its
+# `vector_bench` benchmark.
+#
+#   cmake -S llamacppbridge/src/main/cpp -B build-host -DCMAKE_BUILD_TYPE=Release
+#   cmake --build build-host -j
+#   ./build-host/llm_bench -m model.gguf -n 128 --json report.json
+#   ctest --test-dir build-host --output-on-failure
+
+option(SMOLLM_HOST_NATIVE "Compile the host library with -march=native" ON)
+option(SMOLLM_HOST_TESTS "Build the host tests run by ctest" ON)
+
+find_package(Threads REQUIRED)
+
+# the libraries and the ggml-cpu test modules also compile llama.cpp / ggml
+# sources, only the bench and test executables treat warnings as errors
+set(HOST_WARNING_FLAGS -Wall -Wextra)
+set(HOST_WERROR_FLAGS ${HOST_WARNING_FLAGS} -Werror)
+
+if (CMAKE_SYSTEM_PROCESSOR MATCHES "^(aarch64|arm64)")
+    set(GGML_CPU_ARCH_SOURCES ${GGML_DIR}/src/ggml-cpu/arch/arm/quants.c)
+    set(GGML_CPU_ARCH_DEFINITIONS GGML_USE_CPU GGML_USE_CPU_AARCH64)
+elseif (CMAKE_SYSTEM_PROCESSOR MATCHES "^(x86_64|AMD64|amd64)")
+    set(GGML_CPU_ARCH_SOURCES ${GGML_DIR}/src/ggml-cpu/arch/x86/quants.c)
+    set(GGML_CPU_ARCH_DEFINITIONS GGML_USE_CPU)
+else()
+    message(FATAL_ERROR "unsupported host processor: ${CMAKE_SYSTEM_PROCESSOR}")
+endif()
+
+# common.cpp references the build-info symbols that llama.cpp's CMake script
+# normally generates from git (see GGML_COMMIT / GGML_VERSION above)
+set(HOST_BUILD_INFO_SOURCE ${CMAKE_CURRENT_BINARY_DIR}/build-info.cpp)
+file(WRITE ${HOST_BUILD_INFO_SOURCE}
+        "int LLAMA_BUILD_NUMBER = 0;\n"
+        "char const *LLAMA_COMMIT = \"\";\n"
+        "char const *LLAMA_COMPILER = \"\";\n"
+        "char const *LLAMA_BUILD_TARGET = \"\";\n"
+)
+
+set(TARGET_NAME_HOST smollm_host)
+add_library(
+        ${TARGET_NAME_HOST}
+        STATIC
+        ${LLAMA_SOURCES}
+        ${GGML_CPU_SOURCES}
+        ${GGML_CPU_ARCH_SOURCES}
+        ${HOST_BUILD_INFO_SOURCE}
+        ${INFERENCE_SOURCES}
+)
+target_include_directories(
+        ${TARGET_NAME_HOST}
+        PUBLIC
+        ${CMAKE_CURRENT_SOURCE_DIR}
+        ${COMMON_DIR}
+        ${GGML_DIR}/include
+        ${GGML_DIR}/src
+        ${GGML_DIR}/src/ggml-cpu
+        ${LLAMA_DIR}/include
+        ${VENDOR_DIR}
+)
+target_compile_definitions(
+        ${TARGET_NAME_HOST}
+        PRIVATE
+        GGML_COMMIT=""
+        GGML_VERSION=""
+        PUBLIC
+        ${GGML_CPU_ARCH_DEFINITIONS}
+)
+target_compile_features(${TARGET_NAME_HOST} PUBLIC cxx_std_17)
+target_compile_options(
+        ${TARGET_NAME_HOST}
+        PRIVATE
+        -O3 -ffunction-sections -fdata-sections ${HOST_WARNING_FLAGS}
+)
+if (SMOLLM_HOST_NATIVE)
+    target_compile_options(${TARGET_NAME_HOST} PRIVATE -march=native)
+endif()
+target_link_libraries(
+        ${TARGET_NAME_HOST}
+        PUBLIC
+        Threads::Threads ${CMAKE_DL_LIBS} m
+)
+
+add_executable(llm_bench bench/llm_bench.cpp)
+target_link_libraries(llm_bench PRIVATE ${TARGET_NAME_HOST})
+target_compile_options(llm_bench PRIVATE ${HOST_WERROR_FLAGS})
+target_link_options(llm_bench PRIVATE -Wl,--gc-sections)
+
+# the vector store without its JNI bindings, -march=native selects the AVX2 kernels on x86-64
+add_library(vectorstore_host STATIC VectorKernels.cpp VectorStore.cpp)
+target_include_directories(vectorstore_host PUBLIC ${CMAKE_CURRENT_SOURCE_DIR})
+target_compile_features(vectorstore_host PUBLIC cxx_std_17)
+target_compile_options(vectorstore_host PRIVATE -O3 ${HOST_WARNING_FLAGS})
+if (SMOLLM_HOST_NATIVE)
+    target_compile_options(vectorstore_host PRIVATE -march=native)
+endif()
+target_link_libraries(vectorstore_host PUBLIC Threads::Threads)
+
+add_executable(vector_bench bench/vector_bench.cpp)
+target_compile_options(vector_bench PRIVATE ${HOST_WERROR_FLAGS})
+target_link_libraries(vector_bench PRIVATE vectorstore_host)
+
+if (NOT SMOLLM_HOST_TESTS)
+    return()
+endif()
+
+enable_testing()
+
+# dispatch_test: the ggml-cpu kernels are compiled once per ISA level, like the
+# arm64 libggml-cpu-<variant>.so, and every level the host CPU supports must
+# produce the same results as the first (baseline) level on fixed inputs
+if (CMAKE_SYSTEM_PROCESSOR MATCHES "^(aarch64|arm64)")
+    set(HOST_CPU_VARIANTS
+            "v8|-march=armv8-a"
+            "v8_2_fp16|-march=armv8.2-a+fp16"
+            "v8_2_fp16_dotprod|-march=armv8.2-a+fp16+dotprod"
+            "v8_4_fp16_dotprod|-march=armv8.4-a+fp16+dotprod"
+            "v8_4_fp16_dotprod_sve|-march=armv8.4-a+fp16+dotprod+sve"
+            "v8_4_fp16_dotprod_i8mm|-march=armv8.4-a+fp16+dotprod+i8mm"
+            "v8_4_fp16_dotprod_i8mm_sve|-march=armv8.4-a+fp16+dotprod+i8mm+sve"
+    )
+else()
+    set(HOST_CPU_VARIANTS
+            "x86_64|-march=x86-64"
+            "x86_64_v3|-march=x86-64-v3"
+            "x86_64_v4|-march=x86-64-v4"
+    )
+endif()
+
+set(GGML_BASE_SOURCES ${LLAMA_SOURCES})
+list(FILTER GGML_BASE_SOURCES INCLUDE REGEX "/ggml/src/")
+
+set(DISPATCH_TEST_ARGS)
+set(DISPATCH_TEST_MODULES)
+foreach (variant ${HOST_CPU_VARIANTS})
+    string(REPLACE "|" ";" variant ${variant})
+    list(GET variant 0 variant_name)
+    list(GET variant 1 variant_flags)
+    set(target_name dispatch_kernels_${variant_name})
+    add_library(
+            ${target_name}
+            MODULE
+            ${GGML_BASE_SOURCES}
+            ${GGML_CPU_SOURCES}
+            ${GGML_CPU_ARCH_SOURCES}
+            test/dispatch_kernels.cpp
+    )
+    target_include_directories(
+            ${target_name}
+            PRIVATE
+            ${CMAKE_CURRENT_SOURCE_DIR}/test
+            ${GGML_DIR}/include
+            ${GGML_DIR}/src
+            ${GGML_DIR}/src/ggml-cpu
+    )
+    target_compile_definitions(
+            ${target_name}
+            PRIVATE
+            GGML_COMMIT=""
+            GGML_VERSION=""
+            ${GGML_CPU_ARCH_DEFINITIONS}
+    )
+    target_compile_features(${target_name} PRIVATE cxx_std_17)
+    # hidden: every module keeps its own copy of ggml, only the test entry points are exported
+    target_compile_options(${target_name} PRIVATE ${variant_flags} -O3 -fvisibility=hidden ${HOST_WARNING_FLAGS})
+    target_link_libraries(${target_name} PRIVATE Threads::Threads m)
+    list(APPEND DISPATCH_TEST_ARGS ${variant_name}=$<TARGET_FILE:${target_name}>)
+    list(APPEND DISPATCH_TEST_MODULES ${target_name})
+endforeach()
+
+add_executable(dispatch_test test/dispatch_test.cpp)
+target_include_directories(dispatch_test PRIVATE test)
+target_compile_options(dispatch_test PRIVATE ${HOST_WERROR_FLAGS})
+target_link_libraries(dispatch_test PRIVATE ${TARGET_NAME_HOST} ${CMAKE_DL_LIBS})
+add_dependencies(dispatch_test ${DISPATCH_TEST_MODULES})
+add_test(NAME dispatch_test COMMAND dispatch_test ${DISPATCH_TEST_ARGS})
+
+# utf8_stream_test_<variant>: Utf8Stream.cpp compiled at each ISA level, so the
+# SIMD / SWAR / byte-at-a-time boundaries of its ASCII scan are all covered;
+# variants the host CPU lacks exit with 77 and are reported as skipped
+foreach (variant ${HOST_CPU_VARIANTS})
+    string(REPLACE "|" ";" variant ${variant})
+    list(GET variant 0 variant_name)
+    list(GET variant 1 variant_flags)
+    set(target_name utf8_stream_${variant_name})
+    add_library(${target_name} OBJECT Utf8Stream.cpp)
+    target_include_directories(${target_name} PRIVATE ${CMAKE_CURRENT_SOURCE_DIR})
+    target_compile_features(${target_name} PRIVATE cxx_std_17)
+    target_compile_options(${target_name} PRIVATE ${variant_flags} -O3 ${HOST_WERROR_FLAGS})
+    # the test itself stays at the baseline level so it can run the CPU check first
+    add_executable(utf8_stream_test_${variant_name} test/utf8_stream_test.cpp $<TARGET_OBJECTS:${target_name}>)
+    target_include_directories(utf8_stream_test_${variant_name} PRIVATE test)
+    target_compile_options(utf8_stream_test_${variant_name} PRIVATE ${HOST_WERROR_FLAGS})
+    target_link_libraries(utf8_stream_test_${variant_name} PRIVATE ${TARGET_NAME_HOST})
+    add_test(NAME utf8_stream_test_${variant_name} COMMAND utf8_stream_test_${variant_name} ${variant_name})
+    set_tests_properties(utf8_stream_test_${variant_name} PROPERTIES SKIP_RETURN_CODE 77)
+endforeach()
+
+# load_cancel_test: drives the loadModel JNI entry point through a fake JNIEnv,
+# so it only needs the JDK's jni.h, not a JVM
+find_package(JNI QUIET)
+if (JAVA_INCLUDE_PATH AND JAVA_INCLUDE_PATH2)
+    add_executable(load_cancel_test test/load_cancel_test.cpp llamacppbridge.cpp)
+    target_include_directories(load_cancel_test PRIVATE ${JAVA_INCLUDE_PATH} ${JAVA_INCLUDE_PATH2})
+    # the JNI entry points keep the JNI signature, most of them ignore `thiz`
+    target_compile_options(load_cancel_test PRIVATE ${HOST_WERROR_FLAGS} -Wno-unused-parameter)
+    target_link_libraries(load_cancel_test PRIVATE ${TARGET_NAME_HOST})
+    add_test(NAME load_cancel_test COMMAND load_cancel_test ${CMAKE_CURRENT_BINARY_DIR}/load_cancel_test.gguf)
+else()
+    message(STATUS "jni.h not found, load_cancel_test is not built")
+endif()
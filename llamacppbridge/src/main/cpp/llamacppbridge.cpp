@@ -1,6 +1,26 @@
+#include "JniUtf8.h"
 #include "LLMInference.h"
 #include <jni.h>
 
+namespace {
+
+// 把 llama 的模型加载进度转发给 Java 层的 LoadProgressListener
+struct LoadProgressContext {
+    JNIEnv*   env;
+    jobject   listener;
+    jmethodID onProgress;
+};
+
+bool
+onLoadProgress(float progress, void* userData) {
+    auto*    context     = static_cast<LoadProgressContext*>(userData);
+    jboolean keepLoading = context->env->CallBooleanMethod(context->listener, context->onProgress, progress);
+    // an exception thrown by the listener aborts the load and is rethrown in Java
+    return !context->env->ExceptionCheck() && keepLoading;
+}
+
+} // namespace
+
 /**
  * @brief 加载 LLM 模型。
  *
@@ -14,15 +34,31 @@
  * @param storeChats 是否存储聊天记录。
  * @param contextSize 模型的上下文大小。
  * @param chatTemplate 包含聊天模板的 Java 字符串对象。
- * @param nThreads 用于推理的线程数。
+ * @param nThreads 解码使用的线程数，小于等于 0 时自动选择。
+ * @param nThreadsBatch 预填充使用的线程数，小于等于 0 时与 `nThreads` 相同。
+ * @param cpuPlacement CPU 放置策略（0 由系统调度，1 只用性能核，2 只用 `cpuMask` 中的核心）。
+ * @param cpuMask 策略为 2 时使用的核心，十六进制掩码或核心列表，可以为 null。
+ * @param strictCpuPinning 是否把每个线程固定在一个核心上。
  * @param useMmap 是否使用内存映射加载模型。
  * @param useMlock 是否锁定模型内存。
- * @return 指向 LLMInference 实例的 jlong 类型指针，若加载失败可能抛出 Java 异常。
+ * @param nBatch 预填充时每次提交给 llama_decode 的最大 token 数（逻辑批大小）。
+ * @param nUbatch 计算图一次处理的最大 token 数（物理批大小）。
+ * @param typeK KV 缓存中 K 的数据类型（ggml_type）。
+ * @param typeV KV 缓存中 V 的数据类型（ggml_type）。
+ * @param flashAttn flash attention 开关（-1 自动，0 关闭，1 开启）。
+ * @param maxCandidates generateCandidates 最多生成的候选数量，0 表示不使用。
+ * @param progressListener 加载进度监听器（LoadProgressListener），返回 false 时中止加载，可以为 null。
+ * @return 指向 LLMInference 实例的 jlong 类型指针；加载失败或被中止时抛出 Java 异常并返回 0。
  */
 extern "C" JNIEXPORT jlong JNICALL
 Java_com_stephen_llamacppbridge_LlamaCppBridge_loadModel(JNIEnv* env, jobject thiz, jstring modelPath, jfloat minP,
                                                          jfloat temperature, jboolean storeChats, jlong contextSize,
-                                                         jstring chatTemplate, jint nThreads, jboolean useMmap, jboolean useMlock) {
+                                                         jstring chatTemplate, jint nThreads, jint nThreadsBatch,
+                                                         jint cpuPlacement, jstring cpuMask, jboolean strictCpuPinning,
+                                                         jboolean useMmap, jboolean useMlock,
+                                                         jint nBatch, jint nUbatch, jint typeK, jint typeV,
+                                                         jint flashAttn, jint maxCandidates,
+                                                         jobject progressListener) {
     // 标识是否复制字符串内容的标志
     jboolean    isCopy           = true;
     // 将 Java 字符串转换为 C 风格的 UTF-8 字符串，获取模型路径
@@ -32,13 +68,38 @@ Java_com_stephen_llamacppbridge_LlamaCppBridge_loadModel(JNIEnv* env, jobject th
     // 将 Java 字符串转换为 C 风格的 UTF-8 字符串，获取聊天模板
     const char* chatTemplateCstr = env->GetStringUTFChars(chatTemplate, &isCopy);
 
+    ThreadParams threadParams;
+    threadParams.nThreads      = nThreads;
+    threadParams.nThreadsBatch = nThreadsBatch;
+    threadParams.placement     = cpuPlacement;
+    threadParams.strictPinning = strictCpuPinning;
+    if (cpuMask != nullptr) {
+        const char* cpuMaskCstr = env->GetStringUTFChars(cpuMask, &isCopy);
+        threadParams.cpuMask    = cpuMaskCstr;
+        env->ReleaseStringUTFChars(cpuMask, cpuMaskCstr);
+    }
+
+    // 加载进度在当前线程上回调，JNIEnv 在回调期间保持有效
+    LoadProgressContext progressContext{env, progressListener, nullptr};
+    if (progressListener != nullptr) {
+        progressContext.onProgress =
+                env->GetMethodID(env->GetObjectClass(progressListener), "onProgress", "(F)Z");
+    }
+
     try {
         // 调用 LLMInference 实例的 loadModel 方法加载模型
-        llmInference->loadModel(modelPathCstr, minP, temperature, storeChats, contextSize, chatTemplateCstr, nThreads,
-                                useMmap, useMlock);
+        llmInference->loadModel(modelPathCstr, minP, temperature, storeChats, contextSize, chatTemplateCstr,
+                                threadParams, useMmap, useMlock, nBatch, nUbatch, typeK, typeV, flashAttn,
+                                maxCandidates, progressListener != nullptr ? onLoadProgress : nullptr,
+                                &progressContext);
     } catch (std::runtime_error& error) {
-        // 若加载过程中抛出异常，在 Java 层抛出 IllegalStateException 异常
-        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        // 若加载过程中抛出异常，在 Java 层抛出 IllegalStateException 异常（监听器抛出的异常优先）
+        if (!env->ExceptionCheck()) {
+            env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        }
+        // 释放加载失败（或被监听器中止）的实例，Java 层不会拿到它的指针
+        delete llmInference;
+        llmInference = nullptr;
     }
 
     // 释放之前获取的 C 风格的模型路径字符串
@@ -49,6 +110,27 @@ Java_com_stephen_llamacppbridge_LlamaCppBridge_loadModel(JNIEnv* env, jobject th
     return reinterpret_cast<jlong>(llmInference);
 }
 
+/**
+ * @brief 预热刚加载的模型。
+ *
+ * 该函数通过 JNI 从 Java 层调用，预读 mmap 映射的模型文件并执行一次空解码，
+ * 使第一个用户 token 不再承担冷启动的 I/O 和计算缓冲区分配开销。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param prefetch 是否预读模型文件。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_warmup(JNIEnv* env, jobject thiz, jlong modelPtr, jboolean prefetch) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    try {
+        llmInference->warmup(prefetch);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
 /**
  * @brief 向聊天记录中添加消息。
  *
@@ -63,20 +145,331 @@ Java_com_stephen_llamacppbridge_LlamaCppBridge_loadModel(JNIEnv* env, jobject th
 extern "C" JNIEXPORT void JNICALL
 Java_com_stephen_llamacppbridge_LlamaCppBridge_addChatMessage(JNIEnv* env, jobject thiz, jlong modelPtr, jstring message,
                                                               jstring role) {
-    // 标识是否复制字符串内容的标志
-    jboolean    isCopy       = true;
-    // 将 Java 字符串转换为 C 风格的 UTF-8 字符串，获取消息内容
-    const char* messageCstr  = env->GetStringUTFChars(message, &isCopy);
-    // 将 Java 字符串转换为 C 风格的 UTF-8 字符串，获取消息角色
-    const char* roleCstr     = env->GetStringUTFChars(role, &isCopy);
+    // 将 Java 字符串转换为标准 UTF-8，与 LlamaTokenizer 统计 token 时的字节相同
+    const std::string messageUtf8  = toUtf8(env, message);
+    const std::string roleUtf8     = toUtf8(env, role);
     // 将 jlong 类型的指针转换为 LLMInference 实例指针
-    auto*       llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    auto*             llmInference = reinterpret_cast<LLMInference*>(modelPtr);
     // 调用 LLMInference 实例的 addChatMessage 方法添加消息
-    llmInference->addChatMessage(messageCstr, roleCstr);
-    // 释放之前获取的 C 风格的消息内容字符串
-    env->ReleaseStringUTFChars(message, messageCstr);
-    // 释放之前获取的 C 风格的消息角色字符串
-    env->ReleaseStringUTFChars(role, roleCstr);
+    llmInference->addChatMessage(messageUtf8.c_str(), roleUtf8.c_str());
+}
+
+/**
+ * @brief 替换采样器链。
+ *
+ * 该函数通过 JNI 从 Java 层调用，截断步骤（top-k、min-p）排在需要对候选排序的步骤之前，
+ * 取值为 0（或 1.0）的步骤不会加入采样器链。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param temperature 采样温度。
+ * @param minP min-p 阈值。
+ * @param topK top-k 候选数量。
+ * @param topP top-p 累计概率阈值。
+ * @param repeatPenalty 重复惩罚系数。
+ * @param frequencyPenalty 频率惩罚系数。
+ * @param presencePenalty 存在惩罚系数。
+ * @param penaltyLastN 惩罚考虑的最近 token 数量。
+ * @param greedy 是否使用贪心采样。
+ * @param seed 随机数种子。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_setSamplerParams(JNIEnv* env, jobject thiz, jlong modelPtr,
+                                                                jfloat temperature, jfloat minP, jint topK, jfloat topP,
+                                                                jfloat repeatPenalty, jfloat frequencyPenalty,
+                                                                jfloat presencePenalty, jint penaltyLastN,
+                                                                jboolean greedy, jint seed) {
+    auto*         llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    SamplerParams params;
+    params.temperature      = temperature;
+    params.minP             = minP;
+    params.topK             = topK;
+    params.topP             = topP;
+    params.repeatPenalty    = repeatPenalty;
+    params.frequencyPenalty = frequencyPenalty;
+    params.presencePenalty  = presencePenalty;
+    params.penaltyLastN     = penaltyLastN;
+    params.greedy           = greedy;
+    params.seed             = (uint32_t) seed;
+    llmInference->setSamplerParams(params);
+}
+
+/**
+ * @brief 设置约束之后每次生成的语法。
+ *
+ * 该函数通过 JNI 从 Java 层调用，编译后的语法按内容缓存，重复使用相同的语法或 JSON schema 不会重新解析。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param grammar GBNF 语法或 JSON schema，为 null 时取消约束。
+ * @param isJsonSchema `grammar` 是否为 JSON schema。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_setGrammar(JNIEnv* env, jobject thiz, jlong modelPtr, jstring grammar,
+                                                          jboolean isJsonSchema) {
+    auto*       llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    const char* grammarCstr  = grammar != nullptr ? env->GetStringUTFChars(grammar, nullptr) : nullptr;
+    try {
+        llmInference->setGrammar(grammarCstr, isJsonSchema);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+    }
+    if (grammarCstr != nullptr) {
+        env->ReleaseStringUTFChars(grammar, grammarCstr);
+    }
+}
+
+/**
+ * @brief 设置上下文窗口写满时的处理策略。
+ *
+ * 该函数通过 JNI 从 Java 层调用，可选择抛出异常、平移 KV 缓存丢弃最旧的内容，或丢弃最早的对话轮次后重新预填充。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param policy 处理策略，取值见 ContextOverflowPolicy。
+ * @param nKeep 平移策略下始终保留的前缀 token 数，小于 0 表示保留系统提示词。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_setContextOverflowPolicy(JNIEnv* env, jobject thiz, jlong modelPtr,
+                                                                        jint policy, jint nKeep) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    try {
+        llmInference->setContextOverflowPolicy(policy, nKeep);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+    }
+}
+
+/**
+ * @brief 加载用于投机解码的草稿模型。
+ *
+ * 该函数通过 JNI 从 Java 层调用，草稿模型必须与已加载的模型共享词表。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param modelPath 包含草稿模型文件路径的 Java 字符串对象。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_loadDraftModel(JNIEnv* env, jobject thiz, jlong modelPtr,
+                                                              jstring modelPath) {
+    jboolean    isCopy        = true;
+    const char* modelPathCstr = env->GetStringUTFChars(modelPath, &isCopy);
+    auto*       llmInference  = reinterpret_cast<LLMInference*>(modelPtr);
+    try {
+        llmInference->loadDraftModel(modelPathCstr);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+    env->ReleaseStringUTFChars(modelPath, modelPathCstr);
+}
+
+/**
+ * @brief 设置投机解码模式。
+ *
+ * 该函数通过 JNI 从 Java 层调用，可选择草稿模型或 n-gram 查找作为草稿来源。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param mode 草稿来源，取值见 SpeculativeMode。
+ * @param nDraft 每次验证时最多提交的草稿 token 数。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_setSpeculativeDecoding(JNIEnv* env, jobject thiz, jlong modelPtr,
+                                                                      jint mode, jint nDraft) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    try {
+        llmInference->setSpeculativeDecoding(mode, nDraft);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+    }
+}
+
+/**
+ * @brief 获取投机解码中草稿 token 的接受率。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @return 被接受的草稿 token 比例，范围为 [0, 1]。
+ */
+extern "C" JNIEXPORT jfloat JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_getDraftAcceptanceRate(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    return llmInference->getDraftAcceptanceRate();
+}
+
+/**
+ * @brief 加载 LoRA 适配器。
+ *
+ * 该函数通过 JNI 从 Java 层调用，适配器加载后不会立即应用，同一路径重复加载时返回已有的 id。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param path 包含适配器文件路径的 Java 字符串对象。
+ * @return 适配器 id，若出现异常则返回 -1。
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_loadLoraAdapter(JNIEnv* env, jobject thiz, jlong modelPtr,
+                                                               jstring path) {
+    jboolean    isCopy       = true;
+    const char* pathCstr     = env->GetStringUTFChars(path, &isCopy);
+    auto*       llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    jint        id           = -1;
+    try {
+        id = llmInference->loadLoraAdapter(pathCstr);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+    env->ReleaseStringUTFChars(path, pathCstr);
+    return id;
+}
+
+/**
+ * @brief 设置 LoRA 适配器的缩放系数，为 0 时卸下适配器。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param id loadLoraAdapter 返回的适配器 id。
+ * @param scale 缩放系数。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_setLoraAdapter(JNIEnv* env, jobject thiz, jlong modelPtr, jint id,
+                                                              jfloat scale) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    try {
+        llmInference->setLoraAdapter(id, scale);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+    }
+}
+
+/**
+ * @brief 卸下所有 LoRA 适配器，回到基础模型。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_clearLoraAdapters(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    llmInference->clearLoraAdapters();
+}
+
+/**
+ * @brief 在已加载的模型上创建嵌入上下文。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param poolingType 池化方式，取值见 llama_pooling_type（-1 表示使用模型的设置）。
+ * @param nBatch 一次解码处理的最大 token 数，也是单条文本的最大长度。
+ * @param nSeqMax 一次解码打包的最大文本数。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_initEmbeddings(JNIEnv* env, jobject thiz, jlong modelPtr,
+                                                              jint poolingType, jint nBatch, jint nSeqMax) {
+    auto*           llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    EmbeddingParams params;
+    params.poolingType = poolingType;
+    params.nBatch      = nBatch;
+    params.nSeqMax     = nSeqMax;
+    try {
+        llmInference->initEmbeddings(params);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+    }
+}
+
+/**
+ * @brief 获取嵌入向量的维度。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @return 嵌入向量的维度。
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_getEmbeddingSize(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    return llmInference->getEmbeddingSize();
+}
+
+/**
+ * @brief 批量计算文本嵌入，结果按文本顺序写入 Java 层提供的 direct ByteBuffer。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param texts 输入文本数组。
+ * @param normalize 是否对每个向量做 L2 归一化。
+ * @param buffer 接收 float 的 direct ByteBuffer（本机字节序），容量至少为文本数 × 维度 × 4 字节。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_embed(JNIEnv* env, jobject thiz, jlong modelPtr, jobjectArray texts,
+                                                     jboolean normalize, jobject buffer) {
+    auto*       llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    const jsize nTexts       = env->GetArrayLength(texts);
+    auto*       dst          = static_cast<float*>(env->GetDirectBufferAddress(buffer));
+    jlong       capacity     = env->GetDirectBufferCapacity(buffer);
+    if (dst == nullptr || capacity < (jlong) nTexts * llmInference->getEmbeddingSize() * (jlong) sizeof(float)) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"),
+                      "buffer must be a direct ByteBuffer large enough for all embeddings");
+        return;
+    }
+    // the texts are copied so that the local references can be dropped one by one
+    std::vector<std::string> textsVec;
+    textsVec.reserve(nTexts);
+    for (jsize i = 0; i < nTexts; i++) {
+        auto text = (jstring) env->GetObjectArrayElement(texts, i);
+        textsVec.push_back(toUtf8(env, text));
+        env->DeleteLocalRef(text);
+    }
+    try {
+        llmInference->embed(textsVec, normalize, dst);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
+/**
+ * @brief 获取使用已加载模型词表的分词器，分词器由 LLMInference 持有。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @return 指向 Tokenizer 实例的 jlong 类型指针，在模型关闭后失效。
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_getTokenizer(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    try {
+        return reinterpret_cast<jlong>(&llmInference->getTokenizer());
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        return 0;
+    }
+}
+
+/**
+ * @brief 获取模型加载和最近一次生成的分阶段性能指标。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @return JSON 格式的指标（字段见 InferenceMetrics::toJson）。
+ */
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_getMetrics(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    return env->NewStringUTF(llmInference->getMetrics().toJson().c_str());
 }
 
 /**
@@ -115,6 +508,65 @@ Java_com_stephen_llamacppbridge_LlamaCppBridge_getContextSizeUsed(JNIEnv* env, j
     return llmInference->getContextSizeUsed();
 }
 
+/**
+ * @brief 获取当前预填充的进度。
+ *
+ * 该函数通过 JNI 从 Java 层调用，可在生成进行时从其他线程轮询。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @return 已处理的提示词 token 比例，范围为 [0, 1]。
+ */
+extern "C" JNIEXPORT jfloat JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_getPrefillProgress(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    return llmInference->getPrefillProgress();
+}
+
+/**
+ * @brief 获取最近一次预填充的速度。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @return 预填充速度，单位为 token/秒。
+ */
+extern "C" JNIEXPORT jfloat JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_getPrefillSpeed(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    return llmInference->getPrefillSpeed();
+}
+
+/**
+ * @brief 请求取消本轮生成。
+ *
+ * 该函数通过 JNI 从 Java 层调用，可从其他线程调用，正在执行的 llama_decode（包括预填充的分块）会在计算图中途返回。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_cancel(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    llmInference->cancel();
+}
+
+/**
+ * @brief 获取最近一次生成结束的原因。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @return StopReason 的取值。
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_getStopReason(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    return llmInference->getStopReason();
+}
+
 /**
  * @brief 关闭 LLM 模型并释放资源。
  *
@@ -144,16 +596,12 @@ Java_com_stephen_llamacppbridge_LlamaCppBridge_close(JNIEnv* env, jobject thiz,
  */
 extern "C" JNIEXPORT void JNICALL
 Java_com_stephen_llamacppbridge_LlamaCppBridge_startCompletion(JNIEnv* env, jobject thiz, jlong modelPtr, jstring prompt) {
-    // 标识是否复制字符串内容的标志
-    jboolean    isCopy       = true;
-    // 将 Java 字符串转换为 C 风格的 UTF-8 字符串，获取提示内容
-    const char* promptCstr   = env->GetStringUTFChars(prompt, &isCopy);
+    // 将 Java 字符串转换为标准 UTF-8，获取提示内容
+    const std::string promptUtf8   = toUtf8(env, prompt);
     // 将 jlong 类型的指针转换为 LLMInference 实例指针
-    auto*       llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    auto*             llmInference = reinterpret_cast<LLMInference*>(modelPtr);
     // 调用 LLMInference 实例的 startCompletion 方法启动响应生成过程
-    llmInference->startCompletion(promptCstr);
-    // 释放之前获取的 C 风格的提示内容字符串
-    env->ReleaseStringUTFChars(prompt, promptCstr);
+    llmInference->startCompletion(promptUtf8.c_str());
 }
 
 /**
@@ -171,10 +619,12 @@ Java_com_stephen_llamacppbridge_LlamaCppBridge_completionLoop(JNIEnv* env, jobje
     // 将 jlong 类型的指针转换为 LLMInference 实例指针
     auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
     try {
-        // 调用 LLMInference 实例的 completionLoop 方法获取响应片段
-        std::string response = llmInference->completionLoop();
-        // 将 C++ 字符串转换为 Java 字符串并返回
-        return env->NewStringUTF(response.c_str());
+        // 响应片段指向 LLMInference 内部以 '\0' 结尾的缓冲区，直接转换为 Java 字符串，不经过 std::string
+        std::string_view piece;
+        if (!llmInference->completionStep(piece)) {
+            return env->NewStringUTF("[EOG]");
+        }
+        return env->NewStringUTF(piece.data());
     } catch (std::runtime_error& error) {
         // 若生成过程中抛出异常，在 Java 层抛出 IllegalStateException 异常
         env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
@@ -197,4 +647,171 @@ Java_com_stephen_llamacppbridge_LlamaCppBridge_stopCompletion(JNIEnv* env, jobje
     auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
     // 调用 LLMInference 实例的 stopCompletion 方法停止响应生成过程
     llmInference->stopCompletion();
-}
\ No newline at end of file
+}
+/**
+ * @brief 以流式模式启动响应生成过程。
+ *
+ * 该函数通过 JNI 从 Java 层调用，生成在原生线程上进行，生成的词块写入原生环形缓冲区，
+ * Java 层通过 drainStream 批量读取，避免每个 token 都跨越一次 JNI。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param prompt 包含生成响应所需提示的 Java 字符串对象。
+ * @param maxTokens 最多生成的 token 数，小于等于 0 表示不限制。
+ * @param timeoutMs 从调用开始计时的生成时间上限（毫秒），包括预填充，小于等于 0 表示不限制。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_startStream(JNIEnv* env, jobject thiz, jlong modelPtr, jstring prompt,
+                                                           jint maxTokens, jlong timeoutMs) {
+    const std::string promptUtf8   = toUtf8(env, prompt);
+    auto*             llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    GenerationLimits limits;
+    limits.maxTokens = maxTokens;
+    limits.timeoutMs = (long) timeoutMs;
+    try {
+        llmInference->startStream(promptUtf8.c_str(), limits);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
+/**
+ * @brief 批量读取流式生成的响应片段。
+ *
+ * 该函数通过 JNI 从 Java 层调用，将至多 maxTokens 个词块（或全部可用数据）写入 Java 层提供的
+ * direct ByteBuffer，没有可读数据时阻塞。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param buffer 用于接收 UTF-8 字节的 direct ByteBuffer。
+ * @param maxTokens 最多读取的词块数量，小于等于 0 表示读取全部可用数据。
+ * @return 写入 buffer 的字节数，生成结束时返回 -1，若出现异常则抛出 Java 异常。
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_drainStream(JNIEnv* env, jobject thiz, jlong modelPtr, jobject buffer,
+                                                           jint maxTokens) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    auto* dst          = static_cast<char*>(env->GetDirectBufferAddress(buffer));
+    jlong capacity     = env->GetDirectBufferCapacity(buffer);
+    if (dst == nullptr || capacity <= 0) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), "buffer must be a direct ByteBuffer");
+        return -1;
+    }
+    try {
+        return (jint) llmInference->drainStream(dst, (size_t) capacity, maxTokens);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        return -1;
+    }
+}
+
+/**
+ * @brief 为同一个查询一次生成多条候选续写，提示词只预填充一次，所有候选在同一个批次中解码。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param query 用户查询。
+ * @param nCandidates 候选数量。
+ * @param beamSearch 是否使用集束搜索。
+ * @param maxTokens 每个候选最多生成的 token 数，小于等于 0 表示只受上下文大小限制。
+ * @param timeoutMs 整次调用的时间上限（毫秒），小于等于 0 表示不限制。
+ * @return GenerationCandidate 数组，按平均对数概率从高到低排序，若出现异常则抛出 Java 异常。
+ */
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_generateCandidates(JNIEnv* env, jobject thiz, jlong modelPtr,
+                                                                  jstring query, jint nCandidates,
+                                                                  jboolean beamSearch, jint maxTokens,
+                                                                  jlong timeoutMs) {
+    const std::string queryUtf8    = toUtf8(env, query);
+    auto*            llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    GenerationLimits limits;
+    limits.maxTokens = maxTokens;
+    limits.timeoutMs = (long) timeoutMs;
+    std::vector<GenerationCandidate> candidates;
+    try {
+        candidates = llmInference->generateCandidates(queryUtf8.c_str(), nCandidates, beamSearch, limits);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        return nullptr;
+    }
+
+    jclass       candidateClass = env->FindClass("com/stephen/llamacppbridge/GenerationCandidate");
+    jmethodID    constructor    = env->GetMethodID(candidateClass, "<init>", "(Ljava/lang/String;FIZ)V");
+    jobjectArray array          = env->NewObjectArray((jsize) candidates.size(), candidateClass, nullptr);
+    for (size_t i = 0; i < candidates.size(); i++) {
+        jstring text      = env->NewStringUTF(candidates[i].text.c_str());
+        jobject candidate = env->NewObject(candidateClass, constructor, text, (jfloat) candidates[i].logProb,
+                                           (jint) candidates[i].nTokens, (jboolean) candidates[i].finished);
+        env->SetObjectArrayElement(array, (jsize) i, candidate);
+        env->DeleteLocalRef(candidate);
+        env->DeleteLocalRef(text);
+    }
+    return array;
+}
+
+/**
+ * @brief 停止流式响应生成过程。
+ *
+ * 该函数通过 JNI 从 Java 层调用，请求生成线程停止并等待其退出，然后完成与 stopCompletion 相同的收尾工作。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_stopStream(JNIEnv* env, jobject thiz, jlong modelPtr) {
+    auto* llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    try {
+        llmInference->stopStream();
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
+/**
+ * @brief 将当前会话保存为快照文件。
+ *
+ * 该函数通过 JNI 从 Java 层调用，保存 KV 缓存、聊天消息和 token 历史，之后可通过 loadSession 快速恢复对话，
+ * 无需重新预填充全部历史。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param path 包含快照文件路径的 Java 字符串对象。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_saveSession(JNIEnv* env, jobject thiz, jlong modelPtr, jstring path) {
+    jboolean    isCopy       = true;
+    const char* pathCstr     = env->GetStringUTFChars(path, &isCopy);
+    auto*       llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    try {
+        llmInference->saveSession(pathCstr);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+    env->ReleaseStringUTFChars(path, pathCstr);
+}
+
+/**
+ * @brief 从快照文件恢复会话。
+ *
+ * 该函数通过 JNI 从 Java 层调用，快照必须由同一模型、相同上下文大小保存。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPtr 指向 LLMInference 实例的 jlong 类型指针。
+ * @param path 包含快照文件路径的 Java 字符串对象。
+ * @return 恢复成功返回 true，快照不存在、无效或不匹配时返回 false。
+ */
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppBridge_loadSession(JNIEnv* env, jobject thiz, jlong modelPtr, jstring path) {
+    jboolean    isCopy       = true;
+    const char* pathCstr     = env->GetStringUTFChars(path, &isCopy);
+    auto*       llmInference = reinterpret_cast<LLMInference*>(modelPtr);
+    bool        loaded       = llmInference->loadSession(pathCstr);
+    env->ReleaseStringUTFChars(path, pathCstr);
+    return loaded;
+}
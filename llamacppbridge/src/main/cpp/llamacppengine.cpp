@@ -0,0 +1,258 @@
+#include "JniUtf8.h"
+#include "LLMEngine.h"
+#include <jni.h>
+
+/**
+ * @brief 加载模型并创建多会话推理引擎。
+ *
+ * 该函数通过 JNI 从 Java 层调用，引擎持有一份模型和一个上下文，所有会话共享，
+ * 由原生调度线程把各会话的预填充和解码合并为批次执行。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param modelPath 包含模型文件路径的 Java 字符串对象。
+ * @param contextSize 上下文大小，由所有会话平分。
+ * @param nThreads 用于推理的线程数。
+ * @param useMmap 是否使用内存映射加载模型。
+ * @param useMlock 是否锁定模型内存。
+ * @param nSeqMax 最多同时存在的会话数量，大于 nBatch 时取 nBatch。
+ * @param nBatch 每一步提交给 llama_decode 的最大 token 数。
+ * @param nUbatch 计算图一次处理的最大 token 数。
+ * @return 指向 LLMEngine 实例的 jlong 类型指针，加载失败时抛出 Java 异常并返回 0。
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_loadEngine(JNIEnv* env, jobject thiz, jstring modelPath,
+                                                          jlong contextSize, jint nThreads, jboolean useMmap,
+                                                          jboolean useMlock, jint nSeqMax, jint nBatch, jint nUbatch) {
+    jboolean    isCopy        = true;
+    const char* modelPathCstr = env->GetStringUTFChars(modelPath, &isCopy);
+    auto*       llmEngine     = new LLMEngine();
+    try {
+        llmEngine->loadModel(modelPathCstr, contextSize, nThreads, useMmap, useMlock, nSeqMax, nBatch, nUbatch);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        delete llmEngine;
+        llmEngine = nullptr;
+    }
+    env->ReleaseStringUTFChars(modelPath, modelPathCstr);
+    return reinterpret_cast<jlong>(llmEngine);
+}
+
+/**
+ * @brief 在引擎上创建一个会话。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param enginePtr 指向 LLMEngine 实例的 jlong 类型指针。
+ * @param temperature 采样温度。
+ * @param minP min-p 阈值。
+ * @param topK top-k 候选数量。
+ * @param topP top-p 累计概率阈值。
+ * @param repeatPenalty 重复惩罚系数。
+ * @param frequencyPenalty 频率惩罚系数。
+ * @param presencePenalty 存在惩罚系数。
+ * @param penaltyLastN 惩罚考虑的最近 token 数量。
+ * @param greedy 是否使用贪心采样。
+ * @param seed 随机数种子。
+ * @param chatTemplate 包含聊天模板的 Java 字符串对象。
+ * @return 会话句柄，会话数量已达上限时抛出 Java 异常。
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_createSession(JNIEnv* env, jobject thiz, jlong enginePtr,
+                                                             jfloat temperature, jfloat minP, jint topK, jfloat topP,
+                                                             jfloat repeatPenalty, jfloat frequencyPenalty,
+                                                             jfloat presencePenalty, jint penaltyLastN,
+                                                             jboolean greedy, jint seed, jstring chatTemplate) {
+    SamplerParams params;
+    params.temperature      = temperature;
+    params.minP             = minP;
+    params.topK             = topK;
+    params.topP             = topP;
+    params.repeatPenalty    = repeatPenalty;
+    params.frequencyPenalty = frequencyPenalty;
+    params.presencePenalty  = presencePenalty;
+    params.penaltyLastN     = penaltyLastN;
+    params.greedy           = greedy;
+    params.seed             = (uint32_t) seed;
+
+    jboolean    isCopy           = true;
+    const char* chatTemplateCstr = env->GetStringUTFChars(chatTemplate, &isCopy);
+    auto*       llmEngine        = reinterpret_cast<LLMEngine*>(enginePtr);
+    jint        sessionId        = -1;
+    try {
+        sessionId = llmEngine->createSession(params, chatTemplateCstr);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+    env->ReleaseStringUTFChars(chatTemplate, chatTemplateCstr);
+    return sessionId;
+}
+
+/**
+ * @brief 关闭会话并释放其在 KV 缓存中的内容。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param enginePtr 指向 LLMEngine 实例的 jlong 类型指针。
+ * @param sessionId 会话句柄。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_destroySession(JNIEnv* env, jobject thiz, jlong enginePtr,
+                                                              jint sessionId) {
+    auto* llmEngine = reinterpret_cast<LLMEngine*>(enginePtr);
+    try {
+        llmEngine->destroySession(sessionId);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
+/**
+ * @brief 向会话的聊天记录中添加消息。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param enginePtr 指向 LLMEngine 实例的 jlong 类型指针。
+ * @param sessionId 会话句柄。
+ * @param message 包含要添加消息内容的 Java 字符串对象。
+ * @param role 包含消息角色（如 "user", "system" 等）的 Java 字符串对象。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_addChatMessage(JNIEnv* env, jobject thiz, jlong enginePtr,
+                                                              jint sessionId, jstring message, jstring role) {
+    const std::string messageUtf8 = toUtf8(env, message);
+    const std::string roleUtf8    = toUtf8(env, role);
+    auto*             llmEngine   = reinterpret_cast<LLMEngine*>(enginePtr);
+    try {
+        llmEngine->addChatMessage(sessionId, messageUtf8.c_str(), roleUtf8.c_str());
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
+/**
+ * @brief 向会话添加用户查询并开始生成。
+ *
+ * 该函数通过 JNI 从 Java 层调用，立即返回；生成由调度线程与其他会话合批完成，
+ * 生成的词块通过 drain 批量读取。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param enginePtr 指向 LLMEngine 实例的 jlong 类型指针。
+ * @param sessionId 会话句柄。
+ * @param prompt 包含用户查询的 Java 字符串对象。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_startCompletion(JNIEnv* env, jobject thiz, jlong enginePtr,
+                                                               jint sessionId, jstring prompt) {
+    const std::string promptUtf8 = toUtf8(env, prompt);
+    auto*             llmEngine  = reinterpret_cast<LLMEngine*>(enginePtr);
+    try {
+        llmEngine->startCompletion(sessionId, promptUtf8.c_str());
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
+/**
+ * @brief 批量读取会话已生成的响应片段。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param enginePtr 指向 LLMEngine 实例的 jlong 类型指针。
+ * @param sessionId 会话句柄。
+ * @param buffer 用于接收 UTF-8 字节的 direct ByteBuffer。
+ * @param maxTokens 最多读取的词块数量，小于等于 0 表示读取全部可用数据。
+ * @return 写入 buffer 的字节数，生成结束时返回 -1，若出现异常则抛出 Java 异常。
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_drain(JNIEnv* env, jobject thiz, jlong enginePtr, jint sessionId,
+                                                     jobject buffer, jint maxTokens) {
+    auto* llmEngine = reinterpret_cast<LLMEngine*>(enginePtr);
+    auto* dst       = static_cast<char*>(env->GetDirectBufferAddress(buffer));
+    jlong capacity  = env->GetDirectBufferCapacity(buffer);
+    if (dst == nullptr || capacity <= 0) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), "buffer must be a direct ByteBuffer");
+        return -1;
+    }
+    try {
+        return (jint) llmEngine->drain(sessionId, dst, (size_t) capacity, maxTokens);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        return -1;
+    }
+}
+
+/**
+ * @brief 停止会话的本轮生成，保存已生成的响应。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param enginePtr 指向 LLMEngine 实例的 jlong 类型指针。
+ * @param sessionId 会话句柄。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_stopCompletion(JNIEnv* env, jobject thiz, jlong enginePtr,
+                                                              jint sessionId) {
+    auto* llmEngine = reinterpret_cast<LLMEngine*>(enginePtr);
+    try {
+        llmEngine->stopCompletion(sessionId);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+}
+
+/**
+ * @brief 获取会话最近一次响应的生成速度。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param enginePtr 指向 LLMEngine 实例的 jlong 类型指针。
+ * @param sessionId 会话句柄。
+ * @return 响应生成速度，单位为 token/秒。
+ */
+extern "C" JNIEXPORT jfloat JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_getResponseGenerationSpeed(JNIEnv* env, jobject thiz, jlong enginePtr,
+                                                                          jint sessionId) {
+    auto* llmEngine = reinterpret_cast<LLMEngine*>(enginePtr);
+    try {
+        return llmEngine->getResponseGenerationSpeed(sessionId);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        return 0.0f;
+    }
+}
+
+/**
+ * @brief 获取会话已使用的上下文大小。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param enginePtr 指向 LLMEngine 实例的 jlong 类型指针。
+ * @param sessionId 会话句柄。
+ * @return 会话已使用的上下文大小。
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_getContextSizeUsed(JNIEnv* env, jobject thiz, jlong enginePtr,
+                                                                  jint sessionId) {
+    auto* llmEngine = reinterpret_cast<LLMEngine*>(enginePtr);
+    try {
+        return llmEngine->getContextSizeUsed(sessionId);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+        return 0;
+    }
+}
+
+/**
+ * @brief 关闭引擎，停止调度线程并释放所有会话、上下文和模型。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param thiz 调用该本地方法的 Java 对象引用。
+ * @param enginePtr 指向 LLMEngine 实例的 jlong 类型指针。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaCppEngine_close(JNIEnv* env, jobject thiz, jlong enginePtr) {
+    auto* llmEngine = reinterpret_cast<LLMEngine*>(enginePtr);
+    delete llmEngine;
+}
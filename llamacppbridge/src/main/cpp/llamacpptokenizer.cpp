@@ -0,0 +1,183 @@
+#include "Tokenizer.h"
+#include <jni.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief 把 Java 字节数组（UTF-8 文本）复制到 `out`，复用其容量。
+ *
+ * 文本以标准 UTF-8 字节而不是 GetStringUTFChars 的 Modified UTF-8 传入；生成路径的消息与提示词由 toUtf8（JniUtf8.h）
+ * 转换为相同的字节，emoji 等补充平面字符的 token 数量与生成时一致。
+ */
+void
+copyBytes(JNIEnv* env, jbyteArray bytes, std::string& out) {
+    out.resize(env->GetArrayLength(bytes));
+    env->GetByteArrayRegion(bytes, 0, (jsize) out.size(), reinterpret_cast<jbyte*>(out.data()));
+}
+
+jintArray
+toIntArray(JNIEnv* env, const std::vector<llama_token>& tokens) {
+    jintArray result = env->NewIntArray((jsize) tokens.size());
+    env->SetIntArrayRegion(result, 0, (jsize) tokens.size(), tokens.data());
+    return result;
+}
+
+} // namespace
+
+/**
+ * @brief 只加载 GGUF 文件中的词表，创建独立的分词器。
+ *
+ * @param env JNI 环境指针，用于与 Java 虚拟机交互。
+ * @param clazz LlamaTokenizer 类。
+ * @param modelPath 包含模型文件路径的 Java 字符串对象。
+ * @return 指向 Tokenizer 实例的 jlong 类型指针，需要通过 `close` 释放；加载失败时抛出 IllegalStateException 并返回 0。
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_stephen_llamacppbridge_LlamaTokenizer_loadVocab(JNIEnv* env, jclass clazz, jstring modelPath) {
+    const char* modelPathCstr = env->GetStringUTFChars(modelPath, nullptr);
+    Tokenizer*  tokenizer     = nullptr;
+    try {
+        tokenizer = Tokenizer::loadVocab(modelPathCstr).release();
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalStateException"), error.what());
+    }
+    env->ReleaseStringUTFChars(modelPath, modelPathCstr);
+    return reinterpret_cast<jlong>(tokenizer);
+}
+
+/**
+ * @brief 把 UTF-8 文本转换为 token。
+ *
+ * @param tokenizerPtr 指向 Tokenizer 实例的 jlong 类型指针。
+ * @param text UTF-8 编码的文本。
+ * @param addSpecial 是否按词表的设置添加 BOS / EOS。
+ * @param parseSpecial 是否解析文本中的特殊 token。
+ * @return token 数组。
+ */
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_stephen_llamacppbridge_LlamaTokenizer_tokenize(JNIEnv* env, jobject thiz, jlong tokenizerPtr,
+                                                        jbyteArray text, jboolean addSpecial, jboolean parseSpecial) {
+    auto*                    tokenizer = reinterpret_cast<Tokenizer*>(tokenizerPtr);
+    std::string              textBytes;
+    std::vector<llama_token> tokens;
+    copyBytes(env, text, textBytes);
+    try {
+        tokenizer->tokenize(textBytes, addSpecial, parseSpecial, tokens);
+    } catch (std::runtime_error& error) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+        return nullptr;
+    }
+    return toIntArray(env, tokens);
+}
+
+/**
+ * @brief 批量把 UTF-8 文本转换为 token。
+ *
+ * @param tokenizerPtr 指向 Tokenizer 实例的 jlong 类型指针。
+ * @param texts UTF-8 编码的文本数组（byte[][]）。
+ * @param addSpecial 是否按词表的设置添加 BOS / EOS。
+ * @param parseSpecial 是否解析文本中的特殊 token。
+ * @return 与输入顺序一致的 token 数组（int[][]）。
+ */
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_stephen_llamacppbridge_LlamaTokenizer_tokenizeBatch(JNIEnv* env, jobject thiz, jlong tokenizerPtr,
+                                                             jobjectArray texts, jboolean addSpecial,
+                                                             jboolean parseSpecial) {
+    auto*                    tokenizer = reinterpret_cast<Tokenizer*>(tokenizerPtr);
+    const jsize              nTexts    = env->GetArrayLength(texts);
+    jobjectArray             result    = env->NewObjectArray(nTexts, env->FindClass("[I"), nullptr);
+    std::string              textBytes;
+    std::vector<llama_token> tokens;
+    for (jsize i = 0; i < nTexts; i++) {
+        auto text = (jbyteArray) env->GetObjectArrayElement(texts, i);
+        copyBytes(env, text, textBytes);
+        env->DeleteLocalRef(text);
+        try {
+            tokenizer->tokenize(textBytes, addSpecial, parseSpecial, tokens);
+        } catch (std::runtime_error& error) {
+            env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+            return nullptr;
+        }
+        jintArray array = toIntArray(env, tokens);
+        env->SetObjectArrayElement(result, i, array);
+        env->DeleteLocalRef(array);
+    }
+    return result;
+}
+
+/**
+ * @brief 把 token 转换回 UTF-8 文本。
+ *
+ * @param tokenizerPtr 指向 Tokenizer 实例的 jlong 类型指针。
+ * @param tokens token 数组。
+ * @param removeSpecial 是否去掉词表自动添加的 BOS / EOS。
+ * @param unparseSpecial 是否输出特殊 token 的文本。
+ * @return UTF-8 编码的文本，由 Java 层解码（截断的多字节字符会被替换为 U+FFFD）。
+ */
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_stephen_llamacppbridge_LlamaTokenizer_detokenize(JNIEnv* env, jobject thiz, jlong tokenizerPtr,
+                                                          jintArray tokens, jboolean removeSpecial,
+                                                          jboolean unparseSpecial) {
+    auto*                    tokenizer = reinterpret_cast<Tokenizer*>(tokenizerPtr);
+    std::vector<llama_token> tokensVec(env->GetArrayLength(tokens));
+    env->GetIntArrayRegion(tokens, 0, (jsize) tokensVec.size(), tokensVec.data());
+    const std::string text = tokenizer->detokenize(tokensVec.data(), tokensVec.size(), removeSpecial, unparseSpecial);
+    jbyteArray        result = env->NewByteArray((jsize) text.size());
+    env->SetByteArrayRegion(result, 0, (jsize) text.size(), reinterpret_cast<const jbyte*>(text.data()));
+    return result;
+}
+
+/**
+ * @brief 批量统计 token 数量，结果按文本哈希缓存，重复统计同一段聊天历史时不会重新分词。
+ *
+ * @param tokenizerPtr 指向 Tokenizer 实例的 jlong 类型指针。
+ * @param texts UTF-8 编码的文本数组（byte[][]）。
+ * @param addSpecial 是否按词表的设置添加 BOS / EOS。
+ * @param parseSpecial 是否解析文本中的特殊 token。
+ * @return 每条文本的 token 数量。
+ */
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_stephen_llamacppbridge_LlamaTokenizer_countTokens(JNIEnv* env, jobject thiz, jlong tokenizerPtr,
+                                                           jobjectArray texts, jboolean addSpecial,
+                                                           jboolean parseSpecial) {
+    auto*                tokenizer = reinterpret_cast<Tokenizer*>(tokenizerPtr);
+    const jsize          nTexts    = env->GetArrayLength(texts);
+    std::vector<int32_t> counts(nTexts);
+    std::string          textBytes;
+    for (jsize i = 0; i < nTexts; i++) {
+        auto text = (jbyteArray) env->GetObjectArrayElement(texts, i);
+        copyBytes(env, text, textBytes);
+        env->DeleteLocalRef(text);
+        try {
+            counts[i] = tokenizer->countTokens(textBytes, addSpecial, parseSpecial);
+        } catch (std::runtime_error& error) {
+            env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), error.what());
+            return nullptr;
+        }
+    }
+    jintArray result = env->NewIntArray(nTexts);
+    env->SetIntArrayRegion(result, 0, nTexts, counts.data());
+    return result;
+}
+
+/**
+ * @brief 获取词表大小。
+ *
+ * @param tokenizerPtr 指向 Tokenizer 实例的 jlong 类型指针。
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_stephen_llamacppbridge_LlamaTokenizer_getVocabSize(JNIEnv* env, jobject thiz, jlong tokenizerPtr) {
+    return reinterpret_cast<Tokenizer*>(tokenizerPtr)->vocabSize();
+}
+
+/**
+ * @brief 释放 loadVocab 创建的分词器。
+ *
+ * @param tokenizerPtr 指向 Tokenizer 实例的 jlong 类型指针。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_LlamaTokenizer_close(JNIEnv* env, jobject thiz, jlong tokenizerPtr) {
+    delete reinterpret_cast<Tokenizer*>(tokenizerPtr);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * dispatch_kernels 模块的入口：每个 CPU 后端变体编译一份模块（ggml 与 ggml-cpu 内核按该变体的 -march 编译），
+ * dispatch_test 通过 dlopen / dlsym 调用这些函数，在相同的固定输入上比较各变体的输出。
+ */
+
+#define DISPATCH_KERNELS_API __attribute__((visibility("default")))
+
+extern "C" {
+
+struct DispatchKernelCase {
+    const char* name;
+    // 与基准变体输出之间允许的归一化均方误差，SIMD 路径的累加顺序和舍入与标量路径不同
+    double      maxNmse;
+    // 输出的 float 个数
+    size_t      outputSize;
+};
+
+/**
+ * @brief 用例数量。
+ */
+DISPATCH_KERNELS_API int dispatchKernelCaseCount();
+
+/**
+ * @brief 第 `index` 个用例的描述。
+ */
+DISPATCH_KERNELS_API DispatchKernelCase dispatchKernelCase(int index);
+
+/**
+ * @brief 在固定输入上运行第 `index` 个用例，把结果写入 `output`（outputSize 个 float）。
+ *
+ * @return 计算失败时返回 false。
+ */
+DISPATCH_KERNELS_API bool runDispatchKernelCase(int index, float* output);
+
+}
+
+typedef int (*DispatchKernelCaseCountFn)();
+typedef DispatchKernelCase (*DispatchKernelCaseFn)(int index);
+typedef bool (*RunDispatchKernelCaseFn)(int index, float* output);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "CpuDispatch.h"
+#include <string>
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+/**
+ * @brief 判断当前 CPU 能否运行 host.cmake 中 HOST_CPU_VARIANTS 的变体 `variant`。
+ *
+ * aarch64 上用 CpuDispatch 选择 libggml-cpu-<variant>.so 时的同一张 HWCAP 表判断；
+ * 调用方本身必须按基准 -march 编译，只在判断通过后才调用按该变体编译的代码。
+ */
+inline bool
+isHostCpuVariantSupported(const std::string& variant) {
+#if defined(__aarch64__) && defined(__linux__)
+    return isCpuVariantSupported(variant.c_str(), getauxval(AT_HWCAP), getauxval(AT_HWCAP2));
+#elif defined(__x86_64__)
+    __builtin_cpu_init();
+    const bool v3 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+                    __builtin_cpu_supports("f16c") && __builtin_cpu_supports("bmi2");
+    const bool v4 = v3 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+                    __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+    if (variant == "x86_64_v4") {
+        return v4;
+    }
+    if (variant == "x86_64_v3") {
+        return v3;
+    }
+    return variant == "x86_64";
+#else
+    (void) variant;
+    return false;
+#endif
+}
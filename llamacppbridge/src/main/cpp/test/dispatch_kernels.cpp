@@ -0,0 +1,127 @@
+#include "DispatchKernels.h"
+#include "ggml-cpu.h"
+#include "ggml.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief dispatch_test 的内核模块：按当前变体的 -march 运行 ggml-cpu 中随指令集变化的内核。
+ *
+ * 覆盖各权重类型的 mul_mat（vec_dot / gemv 与多列的 gemm 路径），以及 vec.cpp 中的 softmax、rms_norm、silu。
+ * 输入由固定种子的 LCG 生成，各变体的输入完全相同。
+ */
+
+namespace {
+
+enum KernelOp {
+    MUL_MAT,
+    SOFT_MAX,
+    RMS_NORM,
+    SILU,
+};
+
+struct KernelCase {
+    const char* name;
+    double      maxNmse;
+    KernelOp    op;
+    ggml_type   type;
+    int64_t     nCols;
+};
+
+// QK_K = 256 的倍数，k-quant 的超级块才能完整覆盖一行
+constexpr int64_t N_EMBD = 256;
+constexpr int64_t N_ROWS = 64;
+
+// mul_mat 的阈值与 llama.cpp 的 test-backend-ops 一致，逐元素算子只允许舍入误差
+constexpr KernelCase CASES[] = {
+        {"mul_mat f32 x1",   5e-4, MUL_MAT,  GGML_TYPE_F32,  1},
+        {"mul_mat f32 x7",   5e-4, MUL_MAT,  GGML_TYPE_F32,  7},
+        {"mul_mat f16 x1",   5e-4, MUL_MAT,  GGML_TYPE_F16,  1},
+        {"mul_mat f16 x7",   5e-4, MUL_MAT,  GGML_TYPE_F16,  7},
+        {"mul_mat q8_0 x1",  5e-4, MUL_MAT,  GGML_TYPE_Q8_0, 1},
+        {"mul_mat q8_0 x7",  5e-4, MUL_MAT,  GGML_TYPE_Q8_0, 7},
+        {"mul_mat q4_0 x1",  5e-4, MUL_MAT,  GGML_TYPE_Q4_0, 1},
+        {"mul_mat q4_0 x7",  5e-4, MUL_MAT,  GGML_TYPE_Q4_0, 7},
+        {"mul_mat q4_K x1",  5e-4, MUL_MAT,  GGML_TYPE_Q4_K, 1},
+        {"mul_mat q4_K x7",  5e-4, MUL_MAT,  GGML_TYPE_Q4_K, 7},
+        {"mul_mat q6_K x1",  5e-4, MUL_MAT,  GGML_TYPE_Q6_K, 1},
+        {"mul_mat q6_K x7",  5e-4, MUL_MAT,  GGML_TYPE_Q6_K, 7},
+        {"soft_max",         1e-7, SOFT_MAX, GGML_TYPE_F32,  7},
+        {"rms_norm",         1e-7, RMS_NORM, GGML_TYPE_F32,  7},
+        {"silu",             1e-7, SILU,     GGML_TYPE_F32,  7},
+};
+
+constexpr int N_CASES = sizeof(CASES) / sizeof(CASES[0]);
+
+size_t
+outputSize(const KernelCase& kernelCase) {
+    return (kernelCase.op == MUL_MAT ? N_ROWS : N_EMBD) * kernelCase.nCols;
+}
+
+// [-1, 1) 内的确定性输入，只用整数运算生成，与编译选项无关
+void
+fillInputs(float* data, size_t n, uint32_t seed) {
+    uint32_t state = seed * 2654435761u + 1;
+    for (size_t i = 0; i < n; i++) {
+        state   = state * 1664525u + 1013904223u;
+        data[i] = (float) (int32_t) (state >> 8) / (float) (1 << 23) - 1.0f;
+    }
+}
+
+} // namespace
+
+int
+dispatchKernelCaseCount() {
+    return N_CASES;
+}
+
+DispatchKernelCase
+dispatchKernelCase(int index) {
+    return {CASES[index].name, CASES[index].maxNmse, outputSize(CASES[index])};
+}
+
+bool
+runDispatchKernelCase(int index, float* output) {
+    const KernelCase& kernelCase = CASES[index];
+    ggml_cpu_init();
+
+    // tensors, the graph and the compute work buffer are all allocated in the context
+    ggml_init_params params = {64 * 1024 * 1024, nullptr, false};
+    ggml_context*    ctx    = ggml_init(params);
+    if (ctx == nullptr) {
+        return false;
+    }
+    ggml_tensor* x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, N_EMBD, kernelCase.nCols);
+    fillInputs(static_cast<float*>(x->data), N_EMBD * kernelCase.nCols, 1);
+
+    ggml_tensor* result = nullptr;
+    switch (kernelCase.op) {
+        case MUL_MAT: {
+            std::vector<float> weights(N_EMBD * N_ROWS);
+            fillInputs(weights.data(), weights.size(), 2);
+            ggml_tensor* w = ggml_new_tensor_2d(ctx, kernelCase.type, N_EMBD, N_ROWS);
+            ggml_quantize_chunk(kernelCase.type, weights.data(), w->data, 0, N_ROWS, N_EMBD, nullptr);
+            result = ggml_mul_mat(ctx, w, x);
+            break;
+        }
+        case SOFT_MAX:
+            result = ggml_soft_max(ctx, x);
+            break;
+        case RMS_NORM:
+            result = ggml_rms_norm(ctx, x, 1e-6f);
+            break;
+        case SILU:
+            result = ggml_silu(ctx, x);
+            break;
+    }
+
+    ggml_cgraph* graph = ggml_new_graph(ctx);
+    ggml_build_forward_expand(graph, result);
+    const bool ok = ggml_graph_compute_with_ctx(ctx, graph, 1) == GGML_STATUS_SUCCESS;
+    if (ok) {
+        memcpy(output, result->data, outputSize(kernelCase) * sizeof(float));
+    }
+    ggml_free(ctx);
+    return ok;
+}
@@ -0,0 +1,123 @@
+#include "DispatchKernels.h"
+#include "HostCpuSupport.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <dlfcn.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief dispatch_test：检查每个 CPU 后端变体在固定输入上与基准变体（第一个参数）的输出一致。
+ *
+ *   dispatch_test <variant>=<module.so> ...
+ *
+ * 模块由 host.cmake 按 CPU 后端变体的 -march 编译；当前 CPU 不支持的变体会被跳过。aarch64 上用
+ * CpuDispatch 选择 libggml-cpu-<variant>.so 时的同一张 HWCAP 表判断，这样选择逻辑本身也被覆盖。
+ */
+
+namespace {
+
+struct Variant {
+    std::string                     name;
+    std::string                     path;
+    // the modules are never unloaded, the case names stay valid
+    std::vector<DispatchKernelCase> cases;
+    std::vector<std::vector<float>> outputs;
+};
+
+// 运行模块中的所有用例，失败时返回 false
+bool
+runVariant(Variant& variant) {
+    void* module = dlopen(variant.path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (module == nullptr) {
+        fprintf(stderr, "%s: %s\n", variant.name.c_str(), dlerror());
+        return false;
+    }
+    auto caseCount  = reinterpret_cast<DispatchKernelCaseCountFn>(dlsym(module, "dispatchKernelCaseCount"));
+    auto kernelCase = reinterpret_cast<DispatchKernelCaseFn>(dlsym(module, "dispatchKernelCase"));
+    auto runCase    = reinterpret_cast<RunDispatchKernelCaseFn>(dlsym(module, "runDispatchKernelCase"));
+    if (caseCount == nullptr || kernelCase == nullptr || runCase == nullptr) {
+        fprintf(stderr, "%s: missing dispatch kernel entry points\n", variant.name.c_str());
+        return false;
+    }
+    for (int i = 0; i < caseCount(); i++) {
+        std::vector<float> output(kernelCase(i).outputSize);
+        if (!runCase(i, output.data())) {
+            fprintf(stderr, "%s: %s failed to compute\n", variant.name.c_str(), kernelCase(i).name);
+            return false;
+        }
+        variant.cases.push_back(kernelCase(i));
+        variant.outputs.push_back(std::move(output));
+    }
+    return true;
+}
+
+// 归一化均方误差，与 test-backend-ops 的定义相同
+double
+nmse(const std::vector<float>& output, const std::vector<float>& expected) {
+    double error = 0.0;
+    double norm  = 0.0;
+    for (size_t i = 0; i < output.size(); i++) {
+        if (!std::isfinite(output[i])) {
+            return INFINITY;
+        }
+        const double diff = (double) output[i] - expected[i];
+        error += diff * diff;
+        norm += (double) expected[i] * expected[i];
+    }
+    return norm > 0.0 ? error / norm : error;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <variant>=<module.so> ...\n", argv[0]);
+        return 2;
+    }
+    std::vector<Variant> variants;
+    for (int i = 1; i < argc; i++) {
+        const char* separator = strchr(argv[i], '=');
+        if (separator == nullptr) {
+            fprintf(stderr, "invalid argument: %s\n", argv[i]);
+            return 2;
+        }
+        variants.push_back({std::string(argv[i], separator - argv[i]), separator + 1, {}, {}});
+    }
+
+    Variant& baseline = variants[0];
+    if (!isHostCpuVariantSupported(baseline.name) || !runVariant(baseline)) {
+        fprintf(stderr, "baseline variant %s cannot run on this CPU\n", baseline.name.c_str());
+        return 1;
+    }
+
+    int failures = 0;
+    for (size_t v = 1; v < variants.size(); v++) {
+        Variant& variant = variants[v];
+        if (!isHostCpuVariantSupported(variant.name)) {
+            printf("%-28s skipped, not supported by this CPU\n", variant.name.c_str());
+            continue;
+        }
+        if (!runVariant(variant) || variant.outputs.size() != baseline.outputs.size()) {
+            failures++;
+            continue;
+        }
+        for (size_t i = 0; i < baseline.outputs.size(); i++) {
+            const DispatchKernelCase& description = baseline.cases[i];
+            const double              error       = nmse(variant.outputs[i], baseline.outputs[i]);
+            const bool                ok          = error <= description.maxNmse;
+            printf("%-28s %-18s nmse = %.3e %s\n", variant.name.c_str(), description.name, error,
+                   ok ? "ok" : "FAIL");
+            if (!ok) {
+                failures++;
+            }
+        }
+    }
+    if (failures > 0) {
+        fprintf(stderr, "%d dispatch kernel case(s) differ from %s\n", failures, baseline.name.c_str());
+        return 1;
+    }
+    return 0;
+}
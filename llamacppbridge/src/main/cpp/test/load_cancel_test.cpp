@@ -0,0 +1,216 @@
+#include "ggml.h"
+#include "gguf.h"
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <jni.h>
+#include <string>
+#include <type_traits>
+
+/**
+ * @brief load_cancel_test：检查 loadModel 的 JNI 入口在加载失败或被进度监听器中止时抛出异常并返回 0。
+ *
+ *   load_cancel_test <model.gguf>
+ *
+ * 在给定路径写入一个只有一层的微型 llama 模型，然后通过一个只实现了 loadModel 用到的函数的 JNIEnv
+ * 直接调用 Java_com_stephen_llamacppbridge_LlamaCppBridge_loadModel，不需要 JVM。
+ */
+
+extern "C" jlong
+Java_com_stephen_llamacppbridge_LlamaCppBridge_loadModel(JNIEnv* env, jobject thiz, jstring modelPath, jfloat minP,
+                                                         jfloat temperature, jboolean storeChats, jlong contextSize,
+                                                         jstring chatTemplate, jint nThreads, jint nThreadsBatch,
+                                                         jint cpuPlacement, jstring cpuMask, jboolean strictCpuPinning,
+                                                         jboolean useMmap, jboolean useMlock, jint nBatch, jint nUbatch,
+                                                         jint typeK, jint typeV, jint flashAttn, jint maxCandidates,
+                                                         jobject progressListener);
+
+namespace {
+
+constexpr uint32_t N_EMBD  = 8;
+constexpr uint32_t N_HEAD  = 2;
+constexpr uint32_t N_FF    = 16;
+constexpr uint32_t N_LAYER = 1;
+
+/**
+ * @brief 写入一个微型 llama 模型：SPM 词表只有 6 个 token，权重全部为 F32。
+ */
+bool
+writeTinyModel(const char* path) {
+    gguf_context* gguf = gguf_init_empty();
+    gguf_set_val_str(gguf, "general.architecture", "llama");
+    gguf_set_val_u32(gguf, "llama.context_length", 256);
+    gguf_set_val_u32(gguf, "llama.embedding_length", N_EMBD);
+    gguf_set_val_u32(gguf, "llama.block_count", N_LAYER);
+    gguf_set_val_u32(gguf, "llama.feed_forward_length", N_FF);
+    gguf_set_val_u32(gguf, "llama.attention.head_count", N_HEAD);
+    gguf_set_val_f32(gguf, "llama.attention.layer_norm_rms_epsilon", 1e-5f);
+
+    const char*   tokens[]     = {"<unk>", "<s>", "</s>", "<0x0A>", "a", "b"};
+    const float   scores[]     = {0.0f, 0.0f, 0.0f, 0.0f, -1.0f, -2.0f};
+    // UNKNOWN, CONTROL, CONTROL, BYTE, NORMAL, NORMAL
+    const int32_t tokenTypes[] = {2, 3, 3, 6, 1, 1};
+    const size_t  nVocab       = sizeof(tokens) / sizeof(tokens[0]);
+    gguf_set_val_str(gguf, "tokenizer.ggml.model", "llama");
+    gguf_set_arr_str(gguf, "tokenizer.ggml.tokens", tokens, nVocab);
+    gguf_set_arr_data(gguf, "tokenizer.ggml.scores", GGUF_TYPE_FLOAT32, scores, nVocab);
+    gguf_set_arr_data(gguf, "tokenizer.ggml.token_type", GGUF_TYPE_INT32, tokenTypes, nVocab);
+
+    ggml_init_params params = {1024 * 1024, nullptr, false};
+    ggml_context*    ctx    = ggml_init(params);
+    auto addTensor = [&](const std::string& name, int64_t ne0, int64_t ne1) {
+        ggml_tensor* tensor = ne1 > 0 ? ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1)
+                                      : ggml_new_tensor_1d(ctx, GGML_TYPE_F32, ne0);
+        ggml_set_name(tensor, name.c_str());
+        auto* data = static_cast<float*>(tensor->data);
+        for (int64_t i = 0; i < ggml_nelements(tensor); i++) {
+            data[i] = 0.01f * (float) (i % 7);
+        }
+        gguf_add_tensor(gguf, tensor);
+    };
+    addTensor("token_embd.weight", N_EMBD, (int64_t) nVocab);
+    addTensor("output_norm.weight", N_EMBD, 0);
+    addTensor("output.weight", N_EMBD, (int64_t) nVocab);
+    for (uint32_t layer = 0; layer < N_LAYER; layer++) {
+        const std::string prefix = "blk." + std::to_string(layer) + ".";
+        addTensor(prefix + "attn_norm.weight", N_EMBD, 0);
+        addTensor(prefix + "attn_q.weight", N_EMBD, N_EMBD);
+        addTensor(prefix + "attn_k.weight", N_EMBD, N_EMBD);
+        addTensor(prefix + "attn_v.weight", N_EMBD, N_EMBD);
+        addTensor(prefix + "attn_output.weight", N_EMBD, N_EMBD);
+        addTensor(prefix + "ffn_norm.weight", N_EMBD, 0);
+        addTensor(prefix + "ffn_gate.weight", N_EMBD, N_FF);
+        addTensor(prefix + "ffn_down.weight", N_FF, N_EMBD);
+        addTensor(prefix + "ffn_up.weight", N_EMBD, N_FF);
+    }
+    const bool written = gguf_write_to_file(gguf, path, false);
+    ggml_free(ctx);
+    gguf_free(gguf);
+    return written;
+}
+
+// the JDK and the NDK name the function table struct differently
+using JniFunctions = std::remove_const_t<std::remove_pointer_t<decltype(JNIEnv::functions)>>;
+
+struct FakeJni;
+
+// the JNIEnv handed to the bridge, the fake functions find their state through `owner`
+struct FakeEnv : JNIEnv {
+    FakeJni* owner = nullptr;
+};
+
+/**
+ * @brief 只实现 loadModel 用到的 JNI 函数：字符串直接指向 std::string，ThrowNew 只记录异常。
+ */
+struct FakeJni {
+    JniFunctions functions{};
+    FakeEnv      env;
+    // how often the listener's onProgress() was called, it always asks to stop loading
+    int          progressCalls = 0;
+    std::string  thrownClass;
+    std::string  thrownMessage;
+    // a non-null placeholder for the jclass / jmethodID / listener handles
+    char         placeholder   = 0;
+
+    static FakeJni& from(JNIEnv* env) { return *static_cast<FakeEnv*>(env)->owner; }
+
+    FakeJni() {
+        functions.GetStringUTFChars = [](JNIEnv*, jstring string, jboolean*) {
+            return reinterpret_cast<const std::string*>(string)->c_str();
+        };
+        functions.ReleaseStringUTFChars = [](JNIEnv*, jstring, const char*) {};
+        functions.GetObjectClass        = [](JNIEnv* env, jobject) {
+            return reinterpret_cast<jclass>(&from(env).placeholder);
+        };
+        functions.GetMethodID = [](JNIEnv* env, jclass, const char*, const char*) {
+            return reinterpret_cast<jmethodID>(&from(env).placeholder);
+        };
+        functions.CallBooleanMethodV = [](JNIEnv* env, jobject, jmethodID, va_list) -> jboolean {
+            from(env).progressCalls++;
+            return JNI_FALSE;
+        };
+        functions.ExceptionCheck = [](JNIEnv* env) -> jboolean {
+            return from(env).thrownClass.empty() ? JNI_FALSE : JNI_TRUE;
+        };
+        // the class name doubles as the jclass handle
+        functions.FindClass = [](JNIEnv*, const char* name) {
+            return reinterpret_cast<jclass>(const_cast<char*>(name));
+        };
+        functions.ThrowNew = [](JNIEnv* env, jclass clazz, const char* message) -> jint {
+            FakeJni& jni      = from(env);
+            jni.thrownClass   = reinterpret_cast<const char*>(clazz);
+            jni.thrownMessage = message;
+            return 0;
+        };
+        env.functions = &functions;
+        env.owner     = this;
+    }
+
+    FakeJni(const FakeJni&) = delete;
+
+    jobject listener() { return reinterpret_cast<jobject>(&placeholder); }
+};
+
+jstring
+toJString(const std::string& string) {
+    return reinterpret_cast<jstring>(const_cast<std::string*>(&string));
+}
+
+jlong
+loadModel(FakeJni& jni, const std::string& modelPath, int maxCandidates, jobject listener) {
+    const std::string chatTemplate = "{% for message in messages %}{{ message['content'] }}{% endfor %}";
+    return Java_com_stephen_llamacppbridge_LlamaCppBridge_loadModel(
+            &jni.env, nullptr, toJString(modelPath), 0.01f, 0.8f, JNI_TRUE, 256, toJString(chatTemplate), 1, 1, 0,
+            nullptr, JNI_FALSE, JNI_TRUE, JNI_FALSE, 32, 32, GGML_TYPE_F16, GGML_TYPE_F16, -1, maxCandidates,
+            listener);
+}
+
+int failures = 0;
+
+void
+expect(bool condition, const char* description) {
+    printf("%-60s %s\n", description, condition ? "ok" : "FAIL");
+    if (!condition) {
+        failures++;
+    }
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <model.gguf>\n", argv[0]);
+        return 2;
+    }
+    const std::string modelPath = argv[1];
+    if (!writeTinyModel(modelPath.c_str())) {
+        fprintf(stderr, "failed to write %s\n", modelPath.c_str());
+        return 1;
+    }
+
+    {
+        // the listener cancels the load on its first call
+        FakeJni jni;
+        jlong   handle = loadModel(jni, modelPath, 0, jni.listener());
+        expect(jni.progressCalls > 0, "cancelled load: the listener was called");
+        expect(handle == 0, "cancelled load: returns a 0 handle");
+        expect(jni.thrownClass == "java/lang/IllegalStateException", "cancelled load: throws");
+    }
+    {
+        // rejected by the parameter validation before the model is opened
+        FakeJni jni;
+        jlong   handle = loadModel(jni, modelPath, -1, nullptr);
+        expect(handle == 0, "invalid maxCandidates: returns a 0 handle");
+        expect(jni.thrownClass == "java/lang/IllegalStateException", "invalid maxCandidates: throws");
+    }
+    {
+        FakeJni jni;
+        jlong   handle = loadModel(jni, modelPath + ".missing", 0, nullptr);
+        expect(handle == 0, "missing model file: returns a 0 handle");
+        expect(!jni.thrownClass.empty(), "missing model file: throws");
+    }
+
+    remove(modelPath.c_str());
+    return failures == 0 ? 0 : 1;
+}
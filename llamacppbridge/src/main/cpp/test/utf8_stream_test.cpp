@@ -0,0 +1,209 @@
+#include "HostCpuSupport.h"
+#include "Utf8Stream.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * @brief utf8_stream_test：检查 Utf8Stream 在任意切分下的输出与一次性标量解码一致。
+ *
+ *   utf8_stream_test <variant>
+ *
+ * host.cmake 按每个 CPU 后端变体的 -march 编译一份 Utf8Stream.cpp，覆盖 NEON / SSE2 的 16 字节快速路径、
+ * 8 字节 SWAR 路径和逐字节尾部之间的边界。输入混合了长短不一的 ASCII 段、多字节字符和各类非法序列，
+ * 在每个字节偏移处切成两段、逐字节以及按伪随机长度分段送入，拼接的输出必须与参考解码逐字节相同。
+ * 当前 CPU 不支持的变体返回 77（ctest 记为跳过）。
+ */
+
+namespace {
+
+constexpr int SKIPPED = 77;
+
+const std::string REPLACEMENT = "\xEF\xBF\xBD";
+
+/**
+ * @brief 参考解码：一次处理全部输入，非法序列的最大子部分替换为一个 U+FFFD（Unicode 第 3 章的推荐做法），
+ * 末尾未完成的字符不输出，与 Utf8Stream 留到下一次追加的行为一致。
+ */
+std::string
+referenceDecode(const std::string& input) {
+    std::string out;
+    size_t      i = 0;
+    while (i < input.size()) {
+        const auto lead = (uint8_t) input[i];
+        if (lead < 0x80) {
+            out.push_back((char) lead);
+            i++;
+            continue;
+        }
+        int     need = 0;
+        uint8_t lo   = 0x80;
+        uint8_t hi   = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            need = 1;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            need = 2;
+            lo   = lead == 0xE0 ? 0xA0 : 0x80;
+            hi   = lead == 0xED ? 0x9F : 0xBF;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            need = 3;
+            lo   = lead == 0xF0 ? 0x90 : 0x80;
+            hi   = lead == 0xF4 ? 0x8F : 0xBF;
+        } else {
+            out += REPLACEMENT;
+            i++;
+            continue;
+        }
+        int n = 1;
+        for (; n <= need; n++) {
+            if (i + n == input.size()) {
+                return out;
+            }
+            const auto    byte = (uint8_t) input[i + n];
+            const uint8_t min  = n == 1 ? lo : 0x80;
+            const uint8_t max  = n == 1 ? hi : 0xBF;
+            if (byte < min || byte > max) {
+                break;
+            }
+        }
+        if (n > need) {
+            out.append(input, i, need + 1);
+            i += need + 1;
+        } else {
+            // the byte that broke the sequence starts the next one
+            out += REPLACEMENT;
+            i += n;
+        }
+    }
+    return out;
+}
+
+// 依次追加 `input` 中长度为 `pieces` 的各段，返回拼接的输出
+std::string
+streamDecode(const std::string& input, const std::vector<size_t>& pieces) {
+    Utf8Stream  stream;
+    std::string out;
+    size_t      offset = 0;
+    for (size_t size: pieces) {
+        // each piece is copied so that it starts at a fresh allocation, like a detokenized token
+        std::vector<char> piece(input.begin() + offset, input.begin() + offset + size);
+        std::vector<char> text(Utf8Stream::maxOutputSize(size));
+        out.append(text.data(), stream.append(piece.data(), size, text.data()));
+        offset += size;
+    }
+    return out;
+}
+
+// 固定的片段：各种长度的 ASCII 段（跨越 16 / 8 字节边界）、合法的多字节字符和非法序列
+std::vector<std::string>
+fragments() {
+    std::vector<std::string> result = {
+            "\xC3\xA9",             // é
+            "\xE4\xB8\xAD",         // 中
+            "\xF0\x9F\x98\x80",     // U+1F600
+            "\xF4\x8F\xBF\xBF",     // U+10FFFF
+            "\xEE\x80\x80",         // U+E000, right after the surrogates
+            "\x80",                 // stray continuation byte
+            "\xC0\xAF",             // overlong lead byte
+            "\xFF",                 // never valid
+            "\xE0\x80\xAF",         // overlong three-byte form
+            "\xED\xA0\x80",         // UTF-16 surrogate
+            "\xF4\x90\x80\x80",     // above U+10FFFF
+            "\xF0\x80\x80\x80",     // overlong four-byte form
+            "\xE4\xB8",             // truncated, followed by whatever comes next
+            "\xF0\x9F\x98",         // truncated
+            std::string(1, '\0'),
+    };
+    for (size_t length: {1, 7, 8, 9, 15, 16, 17, 31, 33, 64}) {
+        std::string ascii;
+        for (size_t i = 0; i < length; i++) {
+            ascii.push_back((char) ('a' + i % 26));
+        }
+        result.push_back(ascii);
+    }
+    return result;
+}
+
+// 固定种子的 LCG，结果与编译选项无关
+struct Lcg {
+    uint32_t state;
+
+    uint32_t next() {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    }
+};
+
+int failures = 0;
+
+void
+expectDecoded(const std::string& input, const std::vector<size_t>& pieces, const std::string& expected,
+              const char* description) {
+    const std::string output = streamDecode(input, pieces);
+    if (output != expected) {
+        if (failures < 10) {
+            printf("%s: %zu input bytes in %zu pieces, output differs from the reference\n", description,
+                   input.size(), pieces.size());
+        }
+        failures++;
+    }
+}
+
+void
+checkInput(const std::string& input, Lcg& rng) {
+    const std::string expected = referenceDecode(input);
+    expectDecoded(input, {input.size()}, expected, "one piece");
+    for (size_t split = 0; split <= input.size(); split++) {
+        expectDecoded(input, {split, input.size() - split}, expected, "two pieces");
+    }
+    expectDecoded(input, std::vector<size_t>(input.size(), 1), expected, "single bytes");
+    for (int round = 0; round < 16; round++) {
+        std::vector<size_t> pieces;
+        for (size_t left = input.size(); left > 0;) {
+            const size_t size = std::min<size_t>(left, rng.next() % 40);
+            pieces.push_back(size);
+            left -= size;
+        }
+        expectDecoded(input, pieces, expected, "random pieces");
+    }
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <variant>\n", argv[0]);
+        return 2;
+    }
+    if (!isHostCpuVariantSupported(argv[1])) {
+        printf("%s skipped, not supported by this CPU\n", argv[1]);
+        return SKIPPED;
+    }
+
+    const std::vector<std::string> parts = fragments();
+    Lcg                            rng{42};
+    int                            inputs = 0;
+    // every fragment next to every other one, so each invalid sequence is followed by each kind of byte
+    for (const std::string& first: parts) {
+        for (const std::string& second: parts) {
+            checkInput(first + second + first, rng);
+            inputs++;
+        }
+    }
+    // longer mixed inputs, ending in the middle of a character about half of the time
+    for (int i = 0; i < 64; i++) {
+        std::string input;
+        const int   nParts = 4 + (int) (rng.next() % 24);
+        for (int p = 0; p < nParts; p++) {
+            input += parts[rng.next() % parts.size()];
+        }
+        checkInput(input, rng);
+        inputs++;
+    }
+
+    printf("%s: %d inputs, %s\n", argv[1], inputs, failures == 0 ? "ok" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
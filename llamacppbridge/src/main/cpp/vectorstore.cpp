@@ -0,0 +1,240 @@
+#include "VectorStore.h"
+#include <algorithm>
+#include <jni.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief 把 C++ 异常转换为 Java 异常：参数错误时抛出 IllegalArgumentException，其余情况抛出 IOException。
+ */
+void
+throwException(JNIEnv *env, const std::exception &e) {
+    if (dynamic_cast<const std::invalid_argument *>(&e) != nullptr) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), e.what());
+    } else {
+        env->ThrowNew(env->FindClass("java/io/IOException"), e.what());
+    }
+}
+
+/**
+ * @brief 把 Java 字符串复制为 std::string。
+ */
+std::string
+toString(JNIEnv *env, jstring value) {
+    const char *chars = env->GetStringUTFChars(value, nullptr);
+    std::string result(chars);
+    env->ReleaseStringUTFChars(value, chars);
+    return result;
+}
+
+/**
+ * @brief 检查 `nVectors` 个向量需要的 float 数量不超过 `available`，否则抛出 IllegalArgumentException。
+ */
+bool
+checkVectors(JNIEnv *env, const VectorStore *store, jsize nVectors, jlong available) {
+    if ((jlong) nVectors * store->dim() > available) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"),
+                      ("expected " + std::to_string((jlong) nVectors * store->dim()) + " floats for " +
+                       std::to_string(nVectors) + " vectors, got " + std::to_string(available))
+                              .c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+/**
+ * @brief 打开（或创建）向量库文件，返回其本地句柄。句柄需要通过 `close` 释放。
+ *
+ * @param path 向量库文件的路径，IVF 索引保存在 `<path>.ivf`。
+ * @param dim 向量维度。
+ * @param type 存储格式，取值见 VectorType。
+ * @param metric 相似度度量，取值见 VectorMetric。
+ * @return 指向 VectorStore 的 jlong 类型句柄；参数与已有文件不一致时抛出 IllegalArgumentException，
+ *         文件无法读写或不是向量库时抛出 IOException 并返回 0。
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_open(JNIEnv *env, jobject thiz, jstring path, jint dim, jint type,
+                                                 jint metric) {
+    try {
+        return reinterpret_cast<jlong>(
+                VectorStore::open(toString(env, path), (uint32_t) dim, (VectorType) type, (VectorMetric) metric)
+                        .release());
+    } catch (const std::exception &e) {
+        throwException(env, e);
+        return 0;
+    }
+}
+
+/**
+ * @brief 追加 Java 数组中的向量。
+ *
+ * @param nativeHandle 指向 VectorStore 的本地句柄。
+ * @param ids 每个向量的 ID。
+ * @param vectors ids.size * dim 个 float，按行存放。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_add(JNIEnv *env, jobject thiz, jlong nativeHandle, jlongArray ids,
+                                                jfloatArray vectors) {
+    auto *store = reinterpret_cast<VectorStore *>(nativeHandle);
+    const jsize nVectors = env->GetArrayLength(ids);
+    if (!checkVectors(env, store, nVectors, env->GetArrayLength(vectors))) {
+        return;
+    }
+    std::vector<int64_t> idValues(nVectors);
+    env->GetLongArrayRegion(ids, 0, nVectors, reinterpret_cast<jlong *>(idValues.data()));
+    jfloat *values = env->GetFloatArrayElements(vectors, nullptr);
+    try {
+        store->add(idValues.data(), values, nVectors);
+    } catch (const std::exception &e) {
+        throwException(env, e);
+    }
+    env->ReleaseFloatArrayElements(vectors, values, JNI_ABORT);
+}
+
+/**
+ * @brief 追加直接缓冲区中的向量，例如 `LlamaCppBridge.embed` 返回的缓冲区，不复制向量数据。
+ *
+ * @param nativeHandle 指向 VectorStore 的本地句柄。
+ * @param ids 每个向量的 ID。
+ * @param buffer 直接分配的 FloatBuffer，从位置 0 开始存放 ids.size * dim 个 float。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_addBuffer(JNIEnv *env, jobject thiz, jlong nativeHandle,
+                                                      jlongArray ids, jobject buffer) {
+    auto *store = reinterpret_cast<VectorStore *>(nativeHandle);
+    const auto *values = static_cast<const float *>(env->GetDirectBufferAddress(buffer));
+    if (values == nullptr) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), "the buffer must be a direct buffer");
+        return;
+    }
+    const jsize nVectors = env->GetArrayLength(ids);
+    if (!checkVectors(env, store, nVectors, env->GetDirectBufferCapacity(buffer))) {
+        return;
+    }
+    std::vector<int64_t> idValues(nVectors);
+    env->GetLongArrayRegion(ids, 0, nVectors, reinterpret_cast<jlong *>(idValues.data()));
+    try {
+        store->add(idValues.data(), values, nVectors);
+    } catch (const std::exception &e) {
+        throwException(env, e);
+    }
+}
+
+/**
+ * @brief 搜索与查询最相似的 k 个向量。
+ *
+ * @param nativeHandle 指向 VectorStore 的本地句柄。
+ * @param query dim 个 float。
+ * @param k 返回的最大结果数量。
+ * @return VectorSearchResult 数组，按相似度从大到小排序。
+ */
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_search(JNIEnv *env, jobject thiz, jlong nativeHandle,
+                                                   jfloatArray query, jint k) {
+    auto *store = reinterpret_cast<VectorStore *>(nativeHandle);
+    if (!checkVectors(env, store, 1, env->GetArrayLength(query))) {
+        return nullptr;
+    }
+    std::vector<float> queryValues(store->dim());
+    env->GetFloatArrayRegion(query, 0, (jsize) queryValues.size(), queryValues.data());
+    std::vector<VectorSearchResult> results;
+    size_t nResults;
+    try {
+        // there are never more results than vectors, a huge k must not size the buffer
+        results.resize((size_t) std::min<uint64_t>((uint64_t) std::max(k, 0), store->size()));
+        nResults = store->search(queryValues.data(), results.size(), results.data());
+    } catch (const std::exception &e) {
+        throwException(env, e);
+        return nullptr;
+    }
+
+    jclass resultClass = env->FindClass("com/stephen/llamacppbridge/VectorSearchResult");
+    jmethodID constructor = env->GetMethodID(resultClass, "<init>", "(JF)V");
+    jobjectArray array = env->NewObjectArray((jsize) nResults, resultClass, nullptr);
+    for (size_t i = 0; i < nResults; i++) {
+        jobject result = env->NewObject(resultClass, constructor, (jlong) results[i].id, (jfloat) results[i].score);
+        env->SetObjectArrayElement(array, (jsize) i, result);
+        env->DeleteLocalRef(result);
+    }
+    return array;
+}
+
+/**
+ * @brief 用 k-means 建立（或重建）IVF 索引并写入磁盘。
+ *
+ * @param nativeHandle 指向 VectorStore 的本地句柄。
+ * @param nLists 列表数量。
+ * @param nIter k-means 迭代次数。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_buildIvf(JNIEnv *env, jobject thiz, jlong nativeHandle, jint nLists,
+                                                     jint nIter) {
+    if (nLists <= 0 || nIter <= 0) {
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), "nLists and nIter must be positive");
+        return;
+    }
+    try {
+        reinterpret_cast<VectorStore *>(nativeHandle)->buildIvf((uint32_t) nLists, (uint32_t) nIter);
+    } catch (const std::exception &e) {
+        throwException(env, e);
+    }
+}
+
+/**
+ * @brief 设置搜索时扫描的 IVF 列表数量。
+ *
+ * @param nativeHandle 指向 VectorStore 的本地句柄。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_setProbes(JNIEnv *env, jobject thiz, jlong nativeHandle, jint nProbe) {
+    reinterpret_cast<VectorStore *>(nativeHandle)->setProbes((uint32_t) std::max(nProbe, 1));
+}
+
+/**
+ * @brief 获取向量数量。
+ *
+ * @param nativeHandle 指向 VectorStore 的本地句柄。
+ */
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_getSize(JNIEnv *env, jobject thiz, jlong nativeHandle) {
+    return (jlong) reinterpret_cast<VectorStore *>(nativeHandle)->size();
+}
+
+/**
+ * @brief 获取 IVF 列表数量，未建立索引时为 0。
+ *
+ * @param nativeHandle 指向 VectorStore 的本地句柄。
+ */
+extern "C" JNIEXPORT jint JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_getIvfLists(JNIEnv *env, jobject thiz, jlong nativeHandle) {
+    return (jint) reinterpret_cast<VectorStore *>(nativeHandle)->ivfLists();
+}
+
+/**
+ * @brief 把追加的向量和 IVF 索引写到磁盘。
+ *
+ * @param nativeHandle 指向 VectorStore 的本地句柄。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_sync(JNIEnv *env, jobject thiz, jlong nativeHandle) {
+    try {
+        reinterpret_cast<VectorStore *>(nativeHandle)->sync();
+    } catch (const std::exception &e) {
+        throwException(env, e);
+    }
+}
+
+/**
+ * @brief 释放向量库，解除文件映射并关闭文件（不会写回 IVF 索引，需要先调用 `sync`）。
+ *
+ * @param nativeHandle 指向 VectorStore 的本地句柄。
+ */
+extern "C" JNIEXPORT void JNICALL
+Java_com_stephen_llamacppbridge_VectorStore_close(JNIEnv *env, jobject thiz, jlong nativeHandle) {
+    delete reinterpret_cast<VectorStore *>(nativeHandle);
+}
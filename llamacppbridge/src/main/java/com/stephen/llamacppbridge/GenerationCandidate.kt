@@ -0,0 +1,16 @@
+package com.stephen.llamacppbridge
+
+/**
+ * [LlamaCppBridge.generateCandidates] 生成的一条候选续写。
+ *
+ * @param text 候选文本，末尾不完整的 UTF-8 字符被丢弃。
+ * @param logProb 候选中每个令牌在模型原始分布下的对数概率之和，除以 [tokenCount] 可以比较不同长度的候选。
+ * @param tokenCount 候选的令牌数（不含结束令牌）。
+ * @param finished 是否以结束令牌结束，否则因达到 maxTokens、上下文写满或取消而截断。
+ */
+data class GenerationCandidate(
+    val text: String,
+    val logProb: Float,
+    val tokenCount: Int,
+    val finished: Boolean,
+)
@@ -2,27 +2,37 @@ package com.stephen.llamacppbridge
 
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
+import java.io.Closeable
 
-class GgufFileReader {
+/**
+ * GGUF 文件元数据读取器。
+ *
+ * 只映射并解析文件头，不会读取张量数据；键值对在第一次查询时才被解析。
+ * 读取器持有文件描述符和内存映射，使用完毕后需要调用 [close]（或使用 `use {}`）。
+ * 同一个读取器不能在多个线程中同时使用。
+ */
+class GgufFileReader : Closeable {
     companion object {
         init {
             System.loadLibrary("ggufreader")
         }
     }
 
-    // 存储本地 GGUF 上下文的句柄，初始值为 0L
+    // 存储本地 GGUF 元数据读取器的句柄，初始值为 0L
     private var nativeHandle: Long = 0L
 
     /**
      * 异步加载 GGUF 模型文件。
-     * 该方法会在 IO 线程中调用本地方法获取 GGUF 上下文的本地句柄。
+     * 该方法会在 IO 线程中打开文件并校验文件头，之前加载的文件会被关闭。
      *
      * @param modelPath GGUF 模型文件的路径。
+     * @throws java.io.FileNotFoundException 如果在给定路径下找不到模型文件。
+     * @throws java.io.IOException 如果文件不是有效的 GGUF 文件。
      */
     suspend fun load(modelPath: String) =
         withContext(Dispatchers.IO) {
-            // 调用本地方法获取 GGUF 上下文的本地句柄
-            nativeHandle = getGGUFContextNativeHandle(modelPath)
+            close()
+            nativeHandle = open(modelPath)
         }
 
     /**
@@ -62,17 +72,78 @@ class GgufFileReader {
     }
 
     /**
-     * 返回本地句柄（指向在本地创建的 gguf_context 的指针）。
+     * 读取字符串类型的元数据。
+     *
+     * @param key 元数据的键，例如 `general.name`。
+     * @return 对应的字符串，若键不存在或不是字符串则返回 null。
+     * @throws AssertionError 如果未调用 [load] 方法初始化读取器。
+     */
+    fun getString(key: String): String? {
+        assert(nativeHandle != 0L) { "Use GGUFReader.load() to initialize the reader" }
+        return getString(nativeHandle, key)
+    }
+
+    /**
+     * 读取整数类型的元数据，接受以任意整数类型（u8～i64）或布尔值存储的值。
+     *
+     * @param key 元数据的键，例如 `llama.block_count`。
+     * @return 对应的整数，若键不存在或不是整数则返回 null。
+     * @throws AssertionError 如果未调用 [load] 方法初始化读取器。
+     */
+    fun getLong(key: String): Long? {
+        assert(nativeHandle != 0L) { "Use GGUFReader.load() to initialize the reader" }
+        return getLong(nativeHandle, key)
+    }
+
+    /**
+     * 读取模型的参数量（所有张量的元素个数之和）。
+     *
+     * @throws AssertionError 如果未调用 [load] 方法初始化读取器。
+     */
+    fun getParameterCount(): Long {
+        assert(nativeHandle != 0L) { "Use GGUFReader.load() to initialize the reader" }
+        return getParameterCount(nativeHandle)
+    }
+
+    /**
+     * 读取模型的量化类型，例如 `Q4_K_M`；无法识别时返回 null。
+     *
+     * @throws AssertionError 如果未调用 [load] 方法初始化读取器。
+     */
+    fun getQuantType(): String? {
+        assert(nativeHandle != 0L) { "Use GGUFReader.load() to initialize the reader" }
+        return getQuantType(nativeHandle).ifEmpty { null }
+    }
+
+    /**
+     * 关闭已加载的文件，释放本地资源。可以重复调用。
+     */
+    override fun close() {
+        if (nativeHandle != 0L) {
+            close(nativeHandle)
+            nativeHandle = 0L
+        }
+    }
+
+    /**
+     * 打开 GGUF 文件并返回本地句柄（指向在本地创建的 GGUFMetadata 的指针）。
      *
      * @param modelPath GGUF 模型文件的路径。
-     * @return 指向 gguf_context 的本地句柄。
+     * @return 指向 GGUFMetadata 的本地句柄。
+     */
+    private external fun open(modelPath: String): Long
+
+    /**
+     * 释放本地句柄。
+     *
+     * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
      */
-    private external fun getGGUFContextNativeHandle(modelPath: String): Long
+    private external fun close(nativeHandle: Long)
 
     /**
      * 根据本地句柄从 GGUF 文件中读取上下文大小（以令牌数量为单位）。
      *
-     * @param nativeHandle 指向 gguf_context 的本地句柄。
+     * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
      * @return 上下文大小，若未读取到则返回 -1L。
      */
     private external fun getContextSize(nativeHandle: Long): Long
@@ -80,8 +151,28 @@ class GgufFileReader {
     /**
      * 根据本地句柄从 GGUF 文件中读取聊天模板。
      *
-     * @param nativeHandle 指向 gguf_context 的本地句柄。
+     * @param nativeHandle 指向 GGUFMetadata 的本地句柄。
      * @return 聊天模板字符串，若未读取到则返回空字符串。
      */
     private external fun getChatTemplate(nativeHandle: Long): String
-}
\ No newline at end of file
+
+    /**
+     * 根据本地句柄读取字符串类型的元数据，若未读取到则返回 null。
+     */
+    private external fun getString(nativeHandle: Long, key: String): String?
+
+    /**
+     * 根据本地句柄读取整数类型的元数据，若未读取到则返回 null。
+     */
+    private external fun getLong(nativeHandle: Long, key: String): Long?
+
+    /**
+     * 根据本地句柄读取模型的参数量。
+     */
+    private external fun getParameterCount(nativeHandle: Long): Long
+
+    /**
+     * 根据本地句柄读取模型的量化类型，若无法识别则返回空字符串。
+     */
+    private external fun getQuantType(nativeHandle: Long): String
+}
@@ -0,0 +1,137 @@
+package com.stephen.llamacppbridge
+
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+import java.io.Closeable
+import java.io.IOException
+
+/**
+ * 模型索引中一个 GGUF 文件的摘要。
+ *
+ * @property path 模型文件的路径。
+ * @property lastModifiedNs 文件的修改时间（纳秒）。
+ * @property fileSize 文件大小（字节）。
+ * @property architecture 模型架构，例如 `llama`、`qwen2`。
+ * @property contextLength 训练时的上下文长度，未知时为 null。
+ * @property quantType 量化类型，例如 `Q4_K_M`，无法识别时为空字符串。
+ * @property parameterCount 参数量。
+ * @property chatTemplateHash 聊天模板的 64 位 FNV-1a 哈希，没有聊天模板时为 0。
+ */
+data class GgufModelInfo(
+    val path: String,
+    val lastModifiedNs: Long,
+    val fileSize: Long,
+    val architecture: String,
+    val contextLength: Long?,
+    val quantType: String,
+    val parameterCount: Long,
+    val chatTemplateHash: Long,
+)
+
+/**
+ * 持久化在磁盘上的 GGUF 模型索引。
+ *
+ * 查询模型文件时只检查文件的修改时间和大小，未变化时直接返回索引中的摘要，
+ * 因此模型列表只需在模型文件第一次出现或被替换时解析一次文件头。
+ * [close] 会把修改写回索引文件并释放本地资源。
+ *
+ * @param indexPath 索引文件的路径，例如 `File(context.filesDir, "models.idx").absolutePath`。
+ */
+class GgufModelIndex(indexPath: String) : Closeable {
+    companion object {
+        init {
+            System.loadLibrary("ggufreader")
+        }
+    }
+
+    // 存储本地 GGUFIndex 的句柄
+    private var nativeHandle: Long = open(indexPath)
+
+    /**
+     * 获取模型文件的摘要，索引过期或没有记录时在 IO 线程中解析文件头。
+     *
+     * @param modelPaths 模型文件的路径。
+     * @return 可读取的模型的摘要，不存在或不是有效 GGUF 文件的路径会被跳过（并从索引中移除）。
+     */
+    suspend fun scan(modelPaths: List<String>): List<GgufModelInfo> =
+        withContext(Dispatchers.IO) {
+            checkOpen()
+            val models =
+                modelPaths.mapNotNull { path ->
+                    try {
+                        lookup(nativeHandle, path)
+                    } catch (e: IOException) {
+                        null
+                    }
+                }
+            save(nativeHandle)
+            models
+        }
+
+    /**
+     * 返回索引中记录的所有摘要（按路径排序），不访问任何模型文件。
+     */
+    fun getCachedModels(): List<GgufModelInfo> {
+        checkOpen()
+        return getEntries(nativeHandle).toList()
+    }
+
+    /**
+     * 从索引中移除一个模型文件，例如在删除模型文件之后。
+     */
+    fun remove(modelPath: String) {
+        checkOpen()
+        remove(nativeHandle, modelPath)
+    }
+
+    /**
+     * 把修改写回索引文件并释放本地资源。可以重复调用。
+     *
+     * @throws IOException 如果索引文件写入失败。
+     */
+    override fun close() {
+        if (nativeHandle != 0L) {
+            try {
+                save(nativeHandle)
+            } finally {
+                close(nativeHandle)
+                nativeHandle = 0L
+            }
+        }
+    }
+
+    private fun checkOpen() = check(nativeHandle != 0L) { "The index is closed" }
+
+    /**
+     * 读取（或新建）索引文件，返回本地句柄（指向在本地创建的 GGUFIndex 的指针）。
+     */
+    private external fun open(indexPath: String): Long
+
+    /**
+     * 获取模型文件的摘要。
+     *
+     * @throws java.io.FileNotFoundException 如果模型文件不存在。
+     * @throws IOException 如果文件不是有效的 GGUF 文件。
+     */
+    private external fun lookup(nativeHandle: Long, modelPath: String): GgufModelInfo
+
+    /**
+     * 返回索引中记录的所有摘要。
+     */
+    private external fun getEntries(nativeHandle: Long): Array<GgufModelInfo>
+
+    /**
+     * 从索引中移除一个模型文件。
+     */
+    private external fun remove(nativeHandle: Long, modelPath: String)
+
+    /**
+     * 把修改写回索引文件。
+     */
+    private external fun save(nativeHandle: Long)
+
+    /**
+     * 释放本地句柄。
+     */
+    private external fun close(nativeHandle: Long)
+}
@@ -0,0 +1,20 @@
+package com.stephen.llamacppbridge
+
+/**
+ * 约束一次响应输出格式的语法。编译后的语法在原生层按内容缓存，重复使用相同的语法不会重新解析。
+ */
+sealed class Grammar {
+    /**
+     * GBNF 格式的语法，根规则必须命名为 `root`。
+     *
+     * @param gbnf 语法文本。
+     */
+    data class Gbnf(val gbnf: String) : Grammar()
+
+    /**
+     * JSON schema，响应将是符合该 schema 的 JSON。
+     *
+     * @param schema JSON schema 文本。
+     */
+    data class JsonSchema(val schema: String) : Grammar()
+}
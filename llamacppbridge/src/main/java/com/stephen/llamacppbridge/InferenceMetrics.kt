@@ -0,0 +1,80 @@
+package com.stephen.llamacppbridge
+
+import org.json.JSONObject
+
+/**
+ * 模型加载和最近一次响应的分阶段性能指标，时间单位均为毫秒。
+ *
+ * @param loadMs 模型加载（包括创建上下文）耗时。
+ * @param warmupMs 预热耗时，未预热时为 0。
+ * @param tokenizeMs 渲染聊天模板与分词耗时。
+ * @param prefillTokens 预填充的令牌数（不包括复用 KV 缓存的前缀）。
+ * @param prefillMs 预填充耗时。
+ * @param ttftMs 首令牌时间：从开始生成到采样得到第一个令牌。
+ * @param decodeTokens 生成的令牌数。
+ * @param decodeSteps 解码步数（投机解码时一步可以生成多个令牌）。
+ * @param decodeMs 所有解码步的总耗时。
+ * @param decodeP50Ms 单步解码延迟的 50 百分位。
+ * @param decodeP95Ms 单步解码延迟的 95 百分位。
+ * @param decodeP99Ms 单步解码延迟的 99 百分位。
+ * @param sampleMs 采样（包括语法约束）耗时。
+ * @param detokenizeMs 令牌转换为文本以及 UTF-8 校验耗时。
+ * @param kvCacheUsed KV 缓存中已使用的令牌数。
+ * @param kvCacheSize KV 缓存容量（上下文大小）。
+ * @param kvCacheBytes KV 缓存占用的内存（字节），llama.cpp 没有报告时为 `null`。
+ * @param computeBufferBytes 上下文的计算缓冲区大小（字节），即推理期间计算缓冲区的峰值，llama.cpp 没有报告时为 `null`。
+ */
+data class InferenceMetrics(
+    val loadMs: Double,
+    val warmupMs: Double,
+    val tokenizeMs: Double,
+    val prefillTokens: Int,
+    val prefillMs: Double,
+    val ttftMs: Double,
+    val decodeTokens: Int,
+    val decodeSteps: Int,
+    val decodeMs: Double,
+    val decodeP50Ms: Double,
+    val decodeP95Ms: Double,
+    val decodeP99Ms: Double,
+    val sampleMs: Double,
+    val detokenizeMs: Double,
+    val kvCacheUsed: Int,
+    val kvCacheSize: Int,
+    val kvCacheBytes: Long?,
+    val computeBufferBytes: Long?,
+) {
+    internal companion object {
+        /**
+         * 解析本地层 InferenceMetrics::toJson 输出的 JSON。
+         */
+        fun fromJson(json: String): InferenceMetrics {
+            val obj = JSONObject(json)
+            return InferenceMetrics(
+                loadMs = obj.getDouble("load_ms"),
+                warmupMs = obj.getDouble("warmup_ms"),
+                tokenizeMs = obj.getDouble("tokenize_ms"),
+                prefillTokens = obj.getInt("prefill_tokens"),
+                prefillMs = obj.getDouble("prefill_ms"),
+                ttftMs = obj.getDouble("ttft_ms"),
+                decodeTokens = obj.getInt("decode_tokens"),
+                decodeSteps = obj.getInt("decode_steps"),
+                decodeMs = obj.getDouble("decode_ms"),
+                decodeP50Ms = obj.getDouble("decode_p50_ms"),
+                decodeP95Ms = obj.getDouble("decode_p95_ms"),
+                decodeP99Ms = obj.getDouble("decode_p99_ms"),
+                sampleMs = obj.getDouble("sample_ms"),
+                detokenizeMs = obj.getDouble("detokenize_ms"),
+                kvCacheUsed = obj.getInt("kv_cache_used"),
+                kvCacheSize = obj.getInt("kv_cache_size"),
+                kvCacheBytes = optSize(obj, "kv_cache_bytes"),
+                computeBufferBytes = optSize(obj, "compute_buffer_bytes"),
+            )
+        }
+
+        /**
+         * 读取大小字段，本地层以 `null` 表示未知。
+         */
+        private fun optSize(obj: JSONObject, name: String): Long? = if (obj.isNull(name)) null else obj.getLong(name)
+    }
+}
@@ -5,13 +5,16 @@ import android.util.Log
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.flow
+import kotlinx.coroutines.isActive
 import kotlinx.coroutines.withContext
-import java.io.File
 import java.io.FileNotFoundException
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.nio.FloatBuffer
 
 /**
  * LlamaCppBridge 类用于与 Llama C++ 库进行交互，实现大语言模型（LLM）的加载、推理等功能。
- * 该类会根据设备的 CPU 特性加载不同的本地库，支持加载 GGUF 格式的模型文件，
+ * 本地库会根据设备的 CPU 特性加载对应指令集级别的计算内核，支持加载 GGUF 格式的模型文件，
  * 并提供了添加对话消息、获取模型响应等功能。
  */
 class LlamaCppBridge {
@@ -19,98 +22,34 @@ class LlamaCppBridge {
         init {
             val logTag = LlamaCppBridge::class.java.simpleName
 
-            // 检查以下 CPU 特性是否可用，并据此加载本地库
-            val cpuFeatures = getCPUFeatures()
-            val hasFp16 = cpuFeatures.contains("fp16") || cpuFeatures.contains("fphp")
-            val hasDotProd = cpuFeatures.contains("dotprod") || cpuFeatures.contains("asimddp")
-            val hasSve = cpuFeatures.contains("sve")
-            val hasI8mm = cpuFeatures.contains("i8mm")
-            val isAtLeastArmV82 =
-                cpuFeatures.contains("asimd") &&
-                        cpuFeatures.contains("crc32") &&
-                        cpuFeatures.contains(
-                            "aes",
-                        )
-            val isAtLeastArmV84 = cpuFeatures.contains("dcpop") && cpuFeatures.contains("uscat")
-
-            Log.d(logTag, "CPU features: $cpuFeatures")
-            Log.d(logTag, "- hasFp16: $hasFp16")
-            Log.d(logTag, "- hasDotProd: $hasDotProd")
-            Log.d(logTag, "- hasSve: $hasSve")
-            Log.d(logTag, "- hasI8mm: $hasI8mm")
-            Log.d(logTag, "- isAtLeastArmV82: $isAtLeastArmV82")
-            Log.d(logTag, "- isAtLeastArmV84: $isAtLeastArmV84")
-
-            // 检查应用是否在模拟器设备上运行
-            // 注意，这不是官方检查模拟器的方法
-            val isEmulated =
-                (Build.HARDWARE.contains("goldfish") || Build.HARDWARE.contains("ranchu"))
-            Log.d(logTag, "isEmulated: $isEmulated")
-
-            if (!isEmulated) {
-                if (supportsArm64V8a()) {
-                    if (isAtLeastArmV84 && hasSve && hasI8mm && hasFp16 && hasDotProd) {
-                        Log.d(logTag, "Loading libsmollm_v8_4_fp16_dotprod_i8mm_sve.so")
-                        System.loadLibrary("smollm_v8_4_fp16_dotprod_i8mm_sve")
-                    } else if (isAtLeastArmV84 && hasSve && hasFp16 && hasDotProd) {
-                        Log.d(logTag, "Loading libsmollm_v8_4_fp16_dotprod_sve.so")
-                        System.loadLibrary("smollm_v8_4_fp16_dotprod_sve")
-                    } else if (isAtLeastArmV84 && hasI8mm && hasFp16 && hasDotProd) {
-                        Log.d(logTag, "Loading libsmollm_v8_4_fp16_dotprod_i8mm.so")
-                        System.loadLibrary("smollm_v8_4_fp16_dotprod_i8mm")
-                    } else if (isAtLeastArmV84 && hasFp16 && hasDotProd) {
-                        Log.d(logTag, "Loading libsmollm_v8_4_fp16_dotprod.so")
-                        System.loadLibrary("smollm_v8_4_fp16_dotprod")
-                    } else if (isAtLeastArmV82 && hasFp16 && hasDotProd) {
-                        Log.d(logTag, "Loading libsmollm_v8_2_fp16_dotprod.so")
-                        System.loadLibrary("smollm_v8_2_fp16_dotprod")
-                    } else if (isAtLeastArmV82 && hasFp16) {
-                        Log.d(logTag, "Loading libsmollm_v8_2_fp16.so")
-                        System.loadLibrary("smollm_v8_2_fp16")
-                    } else {
-                        Log.d(logTag, "Loading libsmollm_v8.so")
-                        System.loadLibrary("smollm_v8")
-                    }
-                } else if (Build.SUPPORTED_32_BIT_ABIS[0]?.equals("armeabi-v7a") == true) {
-                    // armv7a (32位) 设备
-                    Log.d(logTag, "Loading libsmollm_v7a.so")
-                    System.loadLibrary("smollm_v7a")
-                } else {
-                    Log.d(logTag, "Loading default libsmollm.so")
-                    System.loadLibrary("smollm")
-                }
+            // arm64 设备只有一个 libsmollm.so：ggml-cpu 的内核按指令集级别编译为多个 libggml-cpu-*.so，
+            // 由本地库在加载第一个模型时通过 getauxval(AT_HWCAP / AT_HWCAP2) 选择设备支持的最高级别变体
+            if (!supportsArm64V8a() && Build.SUPPORTED_32_BIT_ABIS.firstOrNull() == "armeabi-v7a") {
+                // armv7a (32位) 设备
+                Log.d(logTag, "Loading libsmollm_v7a.so")
+                System.loadLibrary("smollm_v7a")
             } else {
-                // 加载不包含 ARM 特定指令的默认本地库
-                Log.d(logTag, "Loading default libsmollm.so")
+                Log.d(logTag, "Loading libsmollm.so")
                 System.loadLibrary("smollm")
             }
         }
 
-        /**
-         * 读取 /proc/cpuinfo 文件，返回以 'Features :' 开头的包含可用 CPU 特性的行。
-         * @return 包含 CPU 特性的字符串，如果文件不存在则返回空字符串。
-         */
-        private fun getCPUFeatures(): String {
-            val cpuInfo =
-                try {
-                    File("/proc/cpuinfo").readText()
-                } catch (e: FileNotFoundException) {
-                    ""
-                }
-            val cpuFeatures =
-                cpuInfo
-                    .substringAfter("Features")
-                    .substringAfter(":")
-                    .substringBefore("\n")
-                    .trim()
-            return cpuFeatures
-        }
-
         /**
          * 检查设备是否支持 arm64-v8a 架构。
          * @return 如果支持则返回 true，否则返回 false。
          */
         private fun supportsArm64V8a(): Boolean = Build.SUPPORTED_ABIS[0].equals("arm64-v8a")
+
+        /**
+         * 确保本地库已按 CPU 特性加载，供同一本地库中的其他类（如 [LlamaCppEngine]）在调用本地方法前使用。
+         * 调用本函数会触发伴生对象的初始化。
+         */
+        internal fun ensureNativeLibraryLoaded() = Unit
+
+        /**
+         * 流式读取响应时使用的 direct ByteBuffer 大小（字节）。
+         */
+        internal const val STREAM_READ_BUFFER_SIZE = 16 * 1024
     }
 
     private var nativePtr = 0L
@@ -125,19 +64,167 @@ class LlamaCppBridge {
             "{% for message in messages %}{% if loop.first and messages[0]['role'] != 'system' %}{{ '<|im_start|>system You are a helpful AI assistant named SmolLM, trained by Hugging Face<|im_end|> ' }}{% endif %}{{'<|im_start|>' + message['role'] + ' ' + message['content'] + '<|im_end|>' + ' '}}{% endfor %}{% if add_generation_prompt %}{{ '<|im_start|>assistant ' }}{% endif %}"
     }
 
+    /**
+     * 上下文窗口写满时的处理策略，顺序与本地层的 ContextOverflowPolicy 一致。
+     */
+    enum class ContextOverflowPolicy {
+        /** 抛出 IllegalStateException("context size reached")。 */
+        FAIL,
+
+        /** 保留前 numKeep 个令牌（默认为系统提示词），丢弃其余部分中最旧的一半并平移 KV 缓存，同时移除被丢弃的历史消息。 */
+        SHIFT,
+
+        /** 丢弃最早的对话轮次，直到剩余历史不超过上下文的一半，然后重新预填充。 */
+        RESTART,
+    }
+
+    /**
+     * 投机解码的草稿来源，顺序与本地层的 SpeculativeMode 一致。
+     */
+    enum class SpeculativeMode {
+        /** 不使用投机解码。 */
+        NONE,
+
+        /** 由 [InferenceParams.draftModelPath] 指定的小型草稿模型生成草稿，该模型必须与主模型共享词表。 */
+        DRAFT_MODEL,
+
+        /** 在提示词和已生成内容中查找 n-gram 续写作为草稿，不需要额外的模型，适合代码和结构化输出。 */
+        NGRAM,
+    }
+
+    /**
+     * 最近一次生成结束的原因，顺序与本地层的 StopReason 一致。
+     */
+    enum class StopReason {
+        /** 生成尚未结束，或还没有开始过生成。 */
+        NONE,
+
+        /** 模型生成了结束令牌。 */
+        EOG,
+
+        /** 被 [cancel] 取消，或响应 Flow 被取消。 */
+        CANCELLED,
+
+        /** 达到了 maxTokens 上限。 */
+        MAX_TOKENS,
+
+        /** 超过了 timeoutMs 时间上限。 */
+        DEADLINE,
+    }
+
+    /**
+     * 嵌入的池化方式，取值与 llama_pooling_type 一致。
+     *
+     * @param value 对应的 llama_pooling_type 取值。
+     */
+    enum class PoolingType(
+        val value: Int,
+    ) {
+        /** 使用模型元数据中的池化方式。 */
+        MODEL_DEFAULT(-1),
+
+        /** 对所有令牌的隐藏状态取平均。 */
+        MEAN(1),
+
+        /** 使用第一个（CLS）令牌的隐藏状态。 */
+        CLS(2),
+
+        /** 使用最后一个令牌的隐藏状态，适用于基于解码器的嵌入模型。 */
+        LAST(3),
+    }
+
+    /**
+     * KV 缓存的数据类型。量化类型按 ggml 的块格式存储，q8_0 约为 f16 的一半，q4_0 约为四分之一。
+     *
+     * @param ggmlType 对应的 ggml_type 取值。
+     */
+    enum class KvCacheType(
+        val ggmlType: Int,
+    ) {
+        F16(1),
+        Q8_0(8),
+        Q4_0(2),
+    }
+
+    /**
+     * flash attention 开关，取值与 llama_flash_attn_type 一致。
+     *
+     * @param value 对应的 llama_flash_attn_type 取值。
+     */
+    enum class FlashAttention(
+        val value: Int,
+    ) {
+        /** 由 llama.cpp 根据模型和后端自动决定。 */
+        AUTO(-1),
+        DISABLED(0),
+        ENABLED(1),
+    }
+
+    /**
+     * 推理线程在 CPU 上的放置策略，取值与本地的 CpuPlacement 一致。
+     *
+     * @param value 对应的 CpuPlacement 取值。
+     */
+    enum class CpuPlacement(
+        val value: Int,
+    ) {
+        /** 由系统调度推理线程。 */
+        NONE(0),
+
+        /** 只在性能核上运行：根据 cpu_capacity（或最高频率）排除最慢的一组核心。 */
+        PERFORMANCE(1),
+
+        /** 只在 [InferenceParams.cpuMask] 列出的核心上运行。 */
+        MASK(2),
+    }
+
     /**
      * 数据类，用于保存 LLM 的推理参数。
      *
      * @param minP 令牌被考虑的最小概率，也称为核采样（top-P sampling）。（默认值：0.01f）
      * @param temperature 采样温度，值越高输出越随机。（默认值：1.0f）
      * @param storeChats 是否在内存中存储聊天历史。如果为 true，LLM 将记住当前会话中的先前交互。（默认值：true）
+     *                   如果为 false，每次查询只包含系统提示词和本次查询，与上一次查询相同的提示词前缀（如系统提示词）
+     *                   会直接复用 KV 缓存，不再重复预填充。
      * @param contextSize LLM 的上下文大小（以令牌为单位），决定了 LLM 能“记住”多少之前的对话。
      *                    如果为 null，将使用 GGUF 模型文件中的值，若模型文件中也没有，则使用默认值。（默认值：null）
      * @param chatTemplate 用于格式化对话的聊天模板，是一个 Jinja2 模板字符串。
      *                     如果为 null，将使用 GGUF 模型文件中的值，若模型文件中也没有，则使用默认值。（默认值：null）
-     * @param numThreads 用于推理的线程数。（默认值：4）
+     * @param numThreads 解码（逐个生成令牌）使用的线程数，小于等于 0 时使用放置策略允许的核心数
+     *                   （[CpuPlacement.NONE] 时为性能核数）。（默认值：4）
+     * @param numThreadsBatch 预填充提示词使用的线程数，小于等于 0 时与 `numThreads` 相同。
+     *                        预填充是计算密集型的，可以比解码使用更多核心。（默认值：0）
+     * @param cpuPlacement 推理线程的放置策略。异构（big.LITTLE）SoC 上解码速度受最慢的线程限制，
+     *                     [CpuPlacement.PERFORMANCE] 可以避免线程被调度到能效核上。（默认值：[CpuPlacement.NONE]）
+     * @param cpuMask [CpuPlacement.MASK] 策略使用的核心，十六进制掩码（如 "0xf0"）或核心列表（如 "4-7"）。（默认值：null）
+     * @param strictCpuPinning 是否把每个线程固定在一个核心上，否则线程可以在允许的核心之间迁移。（默认值：false）
      * @param useMmap 是否使用内存映射文件 I/O 来加载模型，这可以提高加载速度并减少内存使用。（默认值：true）
      * @param useMlock 是否将模型锁定在内存中，这可以防止模型被交换到磁盘，可能提高性能。（默认值：false）
+     * @param numBatch 预填充时每次提交给模型的最大令牌数（逻辑批大小），提示词会按此大小分块预填充，
+     *                 每个分块之后更新进度并可被取消。（默认值：512）
+     * @param numUbatch 计算图一次处理的最大令牌数（物理批大小），决定计算缓冲区的大小，越小峰值内存越低。（默认值：512）
+     * @param contextOverflowPolicy 上下文窗口写满时的处理策略。（默认值：[ContextOverflowPolicy.FAIL]）
+     * @param numKeep [ContextOverflowPolicy.SHIFT] 策略下始终保留的前缀令牌数，小于 0 表示保留系统提示词。（默认值：-1）
+     * @param speculativeMode 投机解码的草稿来源。草稿令牌在一次前向计算中与当前令牌一起验证，
+     *                        输出分布不变，只影响生成速度。（默认值：[SpeculativeMode.NONE]）
+     * @param draftModelPath [SpeculativeMode.DRAFT_MODEL] 模式下草稿模型（GGUF）的路径。（默认值：null）
+     * @param numDraft 每次验证时最多提交的草稿令牌数，CPU 上建议 4～8。（默认值：6）
+     * @param topK 只保留概率最高的 k 个令牌，0 表示关闭。（默认值：40）
+     * @param topP 保留累计概率达到 p 的最小令牌集合，1.0 表示关闭。（默认值：1.0f）
+     * @param repeatPenalty 重复惩罚系数，1.0 表示关闭。（默认值：1.0f）
+     * @param frequencyPenalty 频率惩罚系数，0 表示关闭。（默认值：0.0f）
+     * @param presencePenalty 存在惩罚系数，0 表示关闭。（默认值：0.0f）
+     * @param penaltyLastN 惩罚考虑的最近令牌数量。（默认值：64）
+     * @param greedy 是否总是选择概率最高的令牌，开启后忽略温度和截断参数。（默认值：false）
+     * @param kvCacheTypeK KV 缓存中 K 的数据类型。长上下文时 KV 缓存是除权重之外最大的内存开销，
+     *                     量化类型可以把这部分内存减半甚至降到四分之一。（默认值：[KvCacheType.F16]）
+     * @param kvCacheTypeV KV 缓存中 V 的数据类型，量化类型需要 flash attention（不能为 [FlashAttention.DISABLED]）。
+     *                     （默认值：[KvCacheType.F16]）
+     * @param flashAttention flash attention 开关。（默认值：[FlashAttention.AUTO]）
+     * @param warmup 加载后是否预热模型：预读模型文件并执行一次空解码，
+     *               把冷启动的 I/O 和计算缓冲区分配从第一个用户令牌提前到加载阶段。（默认值：true）
+     * @param maxCandidates [generateCandidates] 最多生成的候选数量，0 表示不使用。大于 0 时每个候选占用上下文中的一个序列，
+     *                      所有序列共享同一个 KV 缓存，候选生成的令牌与聊天历史一起计入 [contextSize]。（默认值：0）
      */
     data class InferenceParams(
         val minP: Float = 0.01f,
@@ -146,10 +233,44 @@ class LlamaCppBridge {
         val contextSize: Long? = null,
         val chatTemplate: String? = null,
         val numThreads: Int = 4,
+        val numThreadsBatch: Int = 0,
+        val cpuPlacement: CpuPlacement = CpuPlacement.NONE,
+        val cpuMask: String? = null,
+        val strictCpuPinning: Boolean = false,
         val useMmap: Boolean = true,
         val useMlock: Boolean = false,
+        val numBatch: Int = 512,
+        val numUbatch: Int = 512,
+        val contextOverflowPolicy: ContextOverflowPolicy = ContextOverflowPolicy.FAIL,
+        val numKeep: Int = -1,
+        val speculativeMode: SpeculativeMode = SpeculativeMode.NONE,
+        val draftModelPath: String? = null,
+        val numDraft: Int = 6,
+        val topK: Int = 40,
+        val topP: Float = 1.0f,
+        val repeatPenalty: Float = 1.0f,
+        val frequencyPenalty: Float = 0.0f,
+        val presencePenalty: Float = 0.0f,
+        val penaltyLastN: Int = 64,
+        val greedy: Boolean = false,
+        val kvCacheTypeK: KvCacheType = KvCacheType.F16,
+        val kvCacheTypeV: KvCacheType = KvCacheType.F16,
+        val flashAttention: FlashAttention = FlashAttention.AUTO,
+        val warmup: Boolean = true,
+        val maxCandidates: Int = 0,
     )
 
+    /**
+     * 模型加载进度的本地回调。
+     */
+    private fun interface LoadProgressListener {
+        /**
+         * @param progress 加载进度（0～1）。
+         * @return 返回 false 时中止加载。
+         */
+        fun onProgress(progress: Float): Boolean
+    }
+
     /**
      * 从给定路径加载 GGUF 模型。
      * 该函数将读取 GGUF 模型文件中的元数据，如上下文大小和聊天模板，如果 `params` 中未明确提供这些参数，将使用模型文件中的值。
@@ -158,18 +279,27 @@ class LlamaCppBridge {
      * @param params 要使用的推理参数。如果未提供，将使用默认值。
      *               如果 `params` 中未提供 `contextSize` 或 `chatTemplate`，将使用 GGUF 模型文件中的值，
      *               如果模型文件中也没有，则使用 [DefaultInferenceParams] 中的默认值。
+     * @param onProgress 模型加载进度（0～1）的回调，在加载线程上调用。取消调用方的协程会中止加载。（默认值：null）
      * @return 如果模型加载成功返回 `true`，否则返回 `false`。
      * @throws FileNotFoundException 如果在给定路径下找不到模型文件。
+     * @throws java.io.IOException 如果模型文件不是有效的 GGUF 文件。
+     * @throws IllegalArgumentException 如果 [InferenceParams.maxCandidates] 小于 0。
+     * @throws IllegalStateException 如果模型加载失败或被中止。
      */
     suspend fun load(
         modelPath: String,
         params: InferenceParams = InferenceParams(),
+        onProgress: ((Float) -> Unit)? = null,
     ) = withContext(Dispatchers.IO) {
-        val ggufFileReader = GgufFileReader()
-        ggufFileReader.load(modelPath)
-        val modelContextSize = ggufFileReader.getContextSize() ?: DefaultInferenceParams.contextSize
-        val modelChatTemplate =
-            ggufFileReader.getChatTemplate() ?: DefaultInferenceParams.chatTemplate
+        require(params.maxCandidates >= 0) { "maxCandidates must not be negative" }
+        val (modelContextSize, modelChatTemplate) =
+            GgufFileReader().use { ggufFileReader ->
+                ggufFileReader.load(modelPath)
+                Pair(
+                    ggufFileReader.getContextSize() ?: DefaultInferenceParams.contextSize,
+                    ggufFileReader.getChatTemplate() ?: DefaultInferenceParams.chatTemplate,
+                )
+            }
         nativePtr =
             loadModel(
                 modelPath,
@@ -179,9 +309,46 @@ class LlamaCppBridge {
                 params.contextSize ?: modelContextSize,
                 params.chatTemplate ?: modelChatTemplate,
                 params.numThreads,
+                params.numThreadsBatch,
+                params.cpuPlacement.value,
+                params.cpuMask,
+                params.strictCpuPinning,
                 params.useMmap,
                 params.useMlock,
+                params.numBatch,
+                params.numUbatch,
+                params.kvCacheTypeK.ggmlType,
+                params.kvCacheTypeV.ggmlType,
+                params.flashAttention.value,
+                params.maxCandidates,
+                LoadProgressListener { progress ->
+                    onProgress?.invoke(progress)
+                    isActive
+                },
             )
+        if (params.warmup) {
+            warmup(nativePtr, true)
+        }
+        setSamplerParams(
+            SamplerParams(
+                temperature = params.temperature,
+                minP = params.minP,
+                topK = params.topK,
+                topP = params.topP,
+                repeatPenalty = params.repeatPenalty,
+                frequencyPenalty = params.frequencyPenalty,
+                presencePenalty = params.presencePenalty,
+                penaltyLastN = params.penaltyLastN,
+                greedy = params.greedy,
+            ),
+        )
+        setContextOverflowPolicy(nativePtr, params.contextOverflowPolicy.ordinal, params.numKeep)
+        if (params.speculativeMode == SpeculativeMode.DRAFT_MODEL) {
+            val draftModelPath =
+                requireNotNull(params.draftModelPath) { "draftModelPath is required for SpeculativeMode.DRAFT_MODEL" }
+            loadDraftModel(nativePtr, draftModelPath)
+        }
+        setSpeculativeDecoding(nativePtr, params.speculativeMode.ordinal, params.numDraft)
     }
 
     /**
@@ -219,6 +386,29 @@ class LlamaCppBridge {
         addChatMessage(nativePtr, message, "assistant")
     }
 
+    /**
+     * 替换采样器链，例如在同一个模型上切换创意写作和确定性的结构化输出。不能在生成响应的过程中调用。
+     *
+     * @param params 采样参数。
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun setSamplerParams(params: SamplerParams) {
+        verifyHandle()
+        setSamplerParams(
+            nativePtr,
+            params.temperature,
+            params.minP,
+            params.topK,
+            params.topP,
+            params.repeatPenalty,
+            params.frequencyPenalty,
+            params.presencePenalty,
+            params.penaltyLastN,
+            params.greedy,
+            params.seed,
+        )
+    }
+
     /**
      * 返回 LLM 通过 `getResponse()` 生成上一个响应的速度（令牌/秒）。
      *
@@ -242,18 +432,262 @@ class LlamaCppBridge {
         return getContextSizeUsed(nativePtr)
     }
 
+    /**
+     * 返回当前（或最近一次）提示词预填充的进度，可在生成进行时从其他线程轮询。
+     *
+     * @return 已处理的提示词令牌比例，范围为 [0, 1]。
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun getPrefillProgress(): Float {
+        verifyHandle()
+        return getPrefillProgress(nativePtr)
+    }
+
+    /**
+     * 返回最近一次提示词预填充的速度（令牌/秒）。
+     *
+     * @return 预填充速度。
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun getPrefillSpeed(): Float {
+        verifyHandle()
+        return getPrefillSpeed(nativePtr)
+    }
+
+    /**
+     * 返回投机解码中草稿令牌的累计接受率，可用于判断当前草稿来源是否值得开启。
+     *
+     * @return 被接受的草稿令牌比例，范围为 [0, 1]；未开启投机解码时为 0。
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun getDraftAcceptanceRate(): Float {
+        verifyHandle()
+        return getDraftAcceptanceRate(nativePtr)
+    }
+
+    /**
+     * 加载基于当前模型训练的 LoRA 适配器，加载后不会立即应用。
+     * 不同任务只需各加载一次适配器，之后通过 [setLoraAdapter] 切换，无需重新加载整个模型，
+     * 内存中也只保留一份基础模型权重。同一路径重复加载时返回已有的 id。
+     *
+     * @param path 适配器 GGUF 文件路径。
+     * @return 适配器 id。
+     * @throws IllegalStateException 如果模型未加载，或适配器无效、与模型不兼容。
+     */
+    suspend fun loadLoraAdapter(path: String): Int =
+        withContext(Dispatchers.IO) {
+            verifyHandle()
+            loadLoraAdapter(nativePtr, path)
+        }
+
+    /**
+     * 设置适配器在之后的响应中使用的缩放系数，`scale` 为 0 时卸下该适配器。不能在生成响应的过程中调用。
+     * 应用的适配器发生变化时 KV 缓存会被清空，下一次响应需要重新预填充全部聊天历史。
+     *
+     * @param id [loadLoraAdapter] 返回的适配器 id。
+     * @param scale 缩放系数。（默认值：1.0）
+     * @throws IllegalStateException 如果模型未加载。
+     * @throws IllegalArgumentException 如果 id 无效。
+     */
+    fun setLoraAdapter(
+        id: Int,
+        scale: Float = 1.0f,
+    ) {
+        verifyHandle()
+        setLoraAdapter(nativePtr, id, scale)
+    }
+
+    /**
+     * 卸下所有适配器，回到基础模型。已加载的适配器保留，可以再次通过 [setLoraAdapter] 应用。
+     *
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun clearLoraAdapters() {
+        verifyHandle()
+        clearLoraAdapters(nativePtr)
+    }
+
+    /**
+     * 在已加载的模型上创建嵌入上下文，之后可通过 [embed] 计算文本嵌入（例如用于本地检索）。
+     * 嵌入上下文与生成共享模型权重，不需要额外的运行时，也不会影响对话的 KV 缓存。
+     *
+     * @param poolingType 池化方式。（默认值：[PoolingType.MODEL_DEFAULT]）
+     * @param batchSize 一次解码处理的最大令牌数，也是单条文本的最大长度，更长的文本被截断。（默认值：2048）
+     * @param maxSequences 一次解码打包的最大文本数。（默认值：64）
+     * @throws IllegalStateException 如果模型未加载。
+     * @throws IllegalArgumentException 如果参数无效，或模型未定义池化方式而 [poolingType] 为 [PoolingType.MODEL_DEFAULT]。
+     */
+    suspend fun initEmbeddings(
+        poolingType: PoolingType = PoolingType.MODEL_DEFAULT,
+        batchSize: Int = 2048,
+        maxSequences: Int = 64,
+    ) = withContext(Dispatchers.IO) {
+        verifyHandle()
+        initEmbeddings(nativePtr, poolingType.value, batchSize, maxSequences)
+    }
+
+    /**
+     * 返回嵌入向量的维度。
+     *
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun getEmbeddingSize(): Int {
+        verifyHandle()
+        return getEmbeddingSize(nativePtr)
+    }
+
+    /**
+     * 批量计算文本嵌入。多条短文本会被打包进同一次解码，索引大量笔记时应尽量一次传入多条文本。
+     * 不能与响应生成同时进行。
+     *
+     * @param texts 输入文本。
+     * @param normalize 是否对每个向量做 L2 归一化，归一化后的点积即余弦相似度。（默认值：true）
+     * @return 连续存放的向量，第 i 个向量位于 [i * getEmbeddingSize(), (i + 1) * getEmbeddingSize())，
+     *         底层是 direct buffer，可直接传给其他本地代码。
+     * @throws IllegalStateException 如果模型未加载、未调用 [initEmbeddings] 或编码失败。
+     */
+    suspend fun embed(
+        texts: List<String>,
+        normalize: Boolean = true,
+    ): FloatBuffer =
+        withContext(Dispatchers.IO) {
+            verifyHandle()
+            val buffer =
+                ByteBuffer
+                    .allocateDirect(texts.size * getEmbeddingSize(nativePtr) * Float.SIZE_BYTES)
+                    .order(ByteOrder.nativeOrder())
+            embed(nativePtr, texts.toTypedArray(), normalize, buffer)
+            buffer.asFloatBuffer()
+        }
+
+    /**
+     * 返回使用已加载模型词表的分词器，用于在生成之前统计聊天历史或文档的 token 数量。
+     * 分词器由本对象持有，对其调用 [LlamaTokenizer.close] 不会释放任何资源；[close] 之后不能再使用。
+     * 只需要分词而不需要推理时，使用 [LlamaTokenizer.load] 只加载词表。
+     *
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun getTokenizer(): LlamaTokenizer {
+        verifyHandle()
+        return LlamaTokenizer(getTokenizer(nativePtr), ownsNative = false)
+    }
+
+    /**
+     * 返回模型加载和最近一次响应的分阶段性能指标，用于定位端侧延迟的来源。应在响应结束之后调用。
+     *
+     * @return 分阶段性能指标。
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun getMetrics(): InferenceMetrics {
+        verifyHandle()
+        return InferenceMetrics.fromJson(getMetrics(nativePtr))
+    }
+
+    /**
+     * 取消当前的生成，可从任意线程调用。正在执行的预填充分块或解码会在计算中途停止，
+     * 用户修改并重新发送查询时可以立即把 CPU 让给下一次请求。
+     * 在预填充阶段被取消时本轮的用户查询不会被记入聊天历史；在解码阶段被取消时已生成的部分响应照常保存。
+     *
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun cancel() {
+        verifyHandle()
+        cancel(nativePtr)
+    }
+
+    /**
+     * 取消当前的提示词预填充，等同于 [cancel]。
+     *
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun cancelPrefill() = cancel()
+
+    /**
+     * 返回最近一次生成结束的原因，例如用于区分模型自然结束和达到 maxTokens / timeoutMs 上限。
+     *
+     * @return 结束原因，生成进行中返回 [StopReason.NONE]。
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    fun getStopReason(): StopReason {
+        verifyHandle()
+        return StopReason.entries[getStopReason(nativePtr)]
+    }
+
+    /**
+     * 将当前会话（KV 缓存、聊天历史和令牌历史）保存为快照文件。
+     * 重新打开对话时可通过 [loadSession] 直接恢复，无需重新预填充全部历史消息。
+     * 不能在生成响应的过程中调用。
+     *
+     * @param path 快照文件路径。
+     * @throws IllegalStateException 如果模型未加载或写入失败。
+     */
+    suspend fun saveSession(path: String) =
+        withContext(Dispatchers.IO) {
+            verifyHandle()
+            saveSession(nativePtr, path)
+        }
+
+    /**
+     * 从快照文件恢复会话，替换当前的聊天历史。
+     * 快照必须由同一模型、相同的上下文大小保存；若返回 `false`，调用方应退回到通过
+     * [addUserMessage] / [addAssistantMessage] 重放历史消息的方式。快照校验通过但 KV 缓存载入失败时，
+     * 当前对话会被清空，因此重放时需要包含全部历史消息。
+     *
+     * @param path 快照文件路径。
+     * @return 恢复成功返回 `true`，快照不存在、无效或与当前模型不匹配时返回 `false`。
+     * @throws IllegalStateException 如果模型未加载。
+     */
+    suspend fun loadSession(path: String): Boolean =
+        withContext(Dispatchers.IO) {
+            verifyHandle()
+            loadSession(nativePtr, path)
+        }
+
+    /**
+     * 在 IO 线程中为同一个查询一次生成多条候选续写，例如输入联想的多个建议。
+     * 提示词只预填充一次，之后所有候选在同一个批次中逐步解码，耗时约为一次预填充加上一次批量生成，
+     * 而不是把整个生成流程重复 [count] 次。查询和候选都不会写入聊天历史，不应用语法约束和投机解码。
+     * 可以通过 [cancel] 取消，此时返回已生成的部分。
+     *
+     * @param query 向 LLM 提出的查询。
+     * @param count 候选数量，不能超过 [InferenceParams.maxCandidates]。（默认值：3）
+     * @param maxTokens 每个候选最多生成的令牌数，小于等于 0 表示只受上下文大小限制。（默认值：32）
+     * @param beamSearch 是否使用集束搜索（按累计概率保留最好的 [count] 条路径），否则每个候选使用当前采样参数独立采样。
+     *                   贪心采样时独立采样的候选都相同，应使用集束搜索。（默认值：false）
+     * @param timeoutMs 整次调用（包括预填充）的时间上限（毫秒），小于等于 0 表示不限制。（默认值：0）
+     * @return 按平均每个令牌的对数概率从高到低排序的候选。
+     * @throws IllegalStateException 如果模型未加载、[count] 无效、上下文写满或解码失败。
+     */
+    suspend fun generateCandidates(
+        query: String,
+        count: Int = 3,
+        maxTokens: Int = 32,
+        beamSearch: Boolean = false,
+        timeoutMs: Long = 0,
+    ): List<GenerationCandidate> =
+        withContext(Dispatchers.IO) {
+            verifyHandle()
+            generateCandidates(nativePtr, query, count, beamSearch, maxTokens, timeoutMs).toList()
+        }
+
     /**
      * 以异步 Flow 的形式返回 LLM 对给定查询的响应。
      * 这对于流式传输 LLM 生成的响应很有用。
      *
      * @param query 向 LLM 提出的查询。
+     * @param grammar 约束响应格式的语法，为 null 时不加约束。（默认值：null）
      * @return 一个字符串 Flow，每个字符串是响应的一部分。
      *         当 LLM 完成响应生成时，Flow 结束。特殊令牌 "[EOG]"（生成结束）表示响应结束。
      * @throws IllegalStateException 如果模型未加载。
+     * @throws IllegalArgumentException 如果语法无效。
      */
-    fun getResponseAsFlow(query: String): Flow<String> =
+    fun getResponseAsFlow(
+        query: String,
+        grammar: Grammar? = null,
+    ): Flow<String> =
         flow {
             verifyHandle()
+            setGrammar(grammar)
             startCompletion(nativePtr, query)
             var piece = completionLoop(nativePtr)
             while (piece != "[EOG]") {
@@ -263,16 +697,62 @@ class LlamaCppBridge {
             stopCompletion(nativePtr)
         }
 
+    /**
+     * 以异步 Flow 的形式返回 LLM 对给定查询的响应，生成在原生线程上进行。
+     * 与 [getResponseAsFlow] 不同，每次跨越 JNI 会批量读取多个词块，减少 JNI 往返次数和 String 分配。
+     *
+     * @param query 向 LLM 提出的查询。
+     * @param maxTokensPerRead 每次最多读取的词块数量，小于等于 0 表示读取当前全部可用的数据。（默认值：0）
+     * @param grammar 约束响应格式的语法，为 null 时不加约束。（默认值：null）
+     * @param maxTokens 最多生成的令牌数，小于等于 0 表示不限制。（默认值：0）
+     * @param timeoutMs 生成（包括预填充）的时间上限（毫秒），小于等于 0 表示不限制。（默认值：0）
+     * @return 一个字符串 Flow，每个字符串包含一个或多个词块。当 LLM 完成响应生成、达到上限或 Flow 被取消时，
+     *         生成线程停止，结束原因可通过 [getStopReason] 查询。Flow 被取消时正在执行的解码会立即中止。
+     * @throws IllegalStateException 如果模型未加载。
+     * @throws IllegalArgumentException 如果语法无效。
+     */
+    fun getResponseAsBatchedFlow(
+        query: String,
+        maxTokensPerRead: Int = 0,
+        grammar: Grammar? = null,
+        maxTokens: Int = 0,
+        timeoutMs: Long = 0,
+    ): Flow<String> =
+        flow {
+            verifyHandle()
+            setGrammar(grammar)
+            val buffer = ByteBuffer.allocateDirect(STREAM_READ_BUFFER_SIZE)
+            startStream(nativePtr, query, maxTokens, timeoutMs)
+            try {
+                var numBytes = drainStream(nativePtr, buffer, maxTokensPerRead)
+                while (numBytes >= 0) {
+                    buffer.position(0)
+                    buffer.limit(numBytes)
+                    emit(Charsets.UTF_8.decode(buffer).toString())
+                    buffer.clear()
+                    numBytes = drainStream(nativePtr, buffer, maxTokensPerRead)
+                }
+            } finally {
+                stopStream(nativePtr)
+            }
+        }
+
     /**
      * 以字符串形式返回 LLM 对给定查询的响应。
      * 该函数是阻塞的，将返回完整的响应。
      *
      * @param query 用户向 LLM 提出的查询/提示。
+     * @param grammar 约束响应格式的语法，为 null 时不加约束。（默认值：null）
      * @return LLM 的完整响应。
      * @throws IllegalStateException 如果模型未加载。
+     * @throws IllegalArgumentException 如果语法无效。
      */
-    fun getResponse(query: String): String {
+    fun getResponse(
+        query: String,
+        grammar: Grammar? = null,
+    ): String {
         verifyHandle()
+        setGrammar(grammar)
         startCompletion(nativePtr, query)
         var piece = completionLoop(nativePtr)
         var response = ""
@@ -295,6 +775,17 @@ class LlamaCppBridge {
         }
     }
 
+    /**
+     * 设置下一次响应使用的语法，为 null 时取消约束。
+     */
+    private fun setGrammar(grammar: Grammar?) {
+        when (grammar) {
+            null -> setGrammar(nativePtr, null, false)
+            is Grammar.Gbnf -> setGrammar(nativePtr, grammar.gbnf, false)
+            is Grammar.JsonSchema -> setGrammar(nativePtr, grammar.schema, true)
+        }
+    }
+
     /**
      * 验证模型是否已加载。
      * @throws IllegalStateException 如果模型未加载。
@@ -311,9 +802,19 @@ class LlamaCppBridge {
      * @param storeChats 是否存储聊天记录。
      * @param contextSize 上下文大小。
      * @param chatTemplate 聊天模板。
-     * @param nThreads 线程数。
+     * @param nThreads 解码线程数。
+     * @param nThreadsBatch 预填充线程数。
+     * @param cpuPlacement CPU 放置策略（CpuPlacement）。
+     * @param cpuMask 放置策略为 MASK 时使用的核心，可以为 null。
+     * @param strictCpuPinning 是否把每个线程固定在一个核心上。
      * @param useMmap 是否使用内存映射。
      * @param useMlock 是否锁定内存。
+     * @param nBatch 逻辑批大小。
+     * @param nUbatch 物理批大小。
+     * @param typeK KV 缓存中 K 的数据类型（ggml_type）。
+     * @param typeV KV 缓存中 V 的数据类型（ggml_type）。
+     * @param flashAttn flash attention 开关（llama_flash_attn_type）。
+     * @param progressListener 加载进度监听器，可以为 null。
      * @return 模型指针。
      */
     private external fun loadModel(
@@ -324,10 +825,199 @@ class LlamaCppBridge {
         contextSize: Long,
         chatTemplate: String,
         nThreads: Int,
+        nThreadsBatch: Int,
+        cpuPlacement: Int,
+        cpuMask: String?,
+        strictCpuPinning: Boolean,
         useMmap: Boolean,
         useMlock: Boolean,
+        nBatch: Int,
+        nUbatch: Int,
+        typeK: Int,
+        typeV: Int,
+        flashAttn: Int,
+        maxCandidates: Int,
+        progressListener: LoadProgressListener?,
     ): Long
 
+    /**
+     * 预热模型的本地方法。
+     * @param modelPtr 模型指针。
+     * @param prefetch 是否预读模型文件。
+     */
+    private external fun warmup(
+        modelPtr: Long,
+        prefetch: Boolean,
+    )
+
+    /**
+     * 替换采样器链的本地方法。
+     * @param modelPtr 模型指针。
+     */
+    private external fun setSamplerParams(
+        modelPtr: Long,
+        temperature: Float,
+        minP: Float,
+        topK: Int,
+        topP: Float,
+        repeatPenalty: Float,
+        frequencyPenalty: Float,
+        presencePenalty: Float,
+        penaltyLastN: Int,
+        greedy: Boolean,
+        seed: Int,
+    )
+
+    /**
+     * 设置语法约束的本地方法。
+     * @param modelPtr 模型指针。
+     * @param grammar GBNF 语法或 JSON schema，为 null 时取消约束。
+     * @param isJsonSchema [grammar] 是否为 JSON schema。
+     */
+    private external fun setGrammar(
+        modelPtr: Long,
+        grammar: String?,
+        isJsonSchema: Boolean,
+    )
+
+    /**
+     * 设置上下文溢出处理策略的本地方法。
+     * @param modelPtr 模型指针。
+     * @param policy 处理策略（[ContextOverflowPolicy] 的序号）。
+     * @param nKeep 平移策略下保留的前缀令牌数。
+     */
+    private external fun setContextOverflowPolicy(
+        modelPtr: Long,
+        policy: Int,
+        nKeep: Int,
+    )
+
+    /**
+     * 加载草稿模型的本地方法。
+     * @param modelPtr 模型指针。
+     * @param modelPath 草稿模型文件路径。
+     */
+    private external fun loadDraftModel(
+        modelPtr: Long,
+        modelPath: String,
+    )
+
+    /**
+     * 设置投机解码模式的本地方法。
+     * @param modelPtr 模型指针。
+     * @param mode 草稿来源（[SpeculativeMode] 的序号）。
+     * @param nDraft 每次验证时最多提交的草稿令牌数。
+     */
+    private external fun setSpeculativeDecoding(
+        modelPtr: Long,
+        mode: Int,
+        nDraft: Int,
+    )
+
+    /**
+     * 获取草稿令牌接受率的本地方法。
+     * @param modelPtr 模型指针。
+     * @return 草稿令牌接受率。
+     */
+    private external fun getDraftAcceptanceRate(modelPtr: Long): Float
+
+    /**
+     * 加载 LoRA 适配器的本地方法。
+     * @param modelPtr 模型指针。
+     * @param path 适配器文件路径。
+     * @return 适配器 id。
+     */
+    private external fun loadLoraAdapter(
+        modelPtr: Long,
+        path: String,
+    ): Int
+
+    /**
+     * 设置 LoRA 适配器缩放系数的本地方法。
+     * @param modelPtr 模型指针。
+     * @param id 适配器 id。
+     * @param scale 缩放系数，0 表示卸下。
+     */
+    private external fun setLoraAdapter(
+        modelPtr: Long,
+        id: Int,
+        scale: Float,
+    )
+
+    /**
+     * 卸下所有 LoRA 适配器的本地方法。
+     * @param modelPtr 模型指针。
+     */
+    private external fun clearLoraAdapters(modelPtr: Long)
+
+    /**
+     * 创建嵌入上下文的本地方法。
+     * @param modelPtr 模型指针。
+     * @param poolingType llama_pooling_type 取值。
+     * @param nBatch 一次解码的最大令牌数。
+     * @param nSeqMax 一次解码的最大文本数。
+     */
+    private external fun initEmbeddings(
+        modelPtr: Long,
+        poolingType: Int,
+        nBatch: Int,
+        nSeqMax: Int,
+    )
+
+    /**
+     * 获取嵌入维度的本地方法。
+     * @param modelPtr 模型指针。
+     * @return 嵌入维度。
+     */
+    private external fun getEmbeddingSize(modelPtr: Long): Int
+
+    /**
+     * 批量计算文本嵌入的本地方法。
+     * @param modelPtr 模型指针。
+     * @param texts 输入文本。
+     * @param normalize 是否做 L2 归一化。
+     * @param buffer 接收向量的 direct ByteBuffer（本机字节序）。
+     */
+    private external fun embed(
+        modelPtr: Long,
+        texts: Array<String>,
+        normalize: Boolean,
+        buffer: ByteBuffer,
+    )
+
+    /**
+     * 一次生成多条候选续写的本地方法。
+     * @param modelPtr 模型指针。
+     * @param query 用户查询。
+     * @param nCandidates 候选数量。
+     * @param beamSearch 是否使用集束搜索。
+     * @param maxTokens 每个候选最多生成的令牌数。
+     * @param timeoutMs 时间上限（毫秒）。
+     * @return 候选数组。
+     */
+    private external fun generateCandidates(
+        modelPtr: Long,
+        query: String,
+        nCandidates: Int,
+        beamSearch: Boolean,
+        maxTokens: Int,
+        timeoutMs: Long,
+    ): Array<GenerationCandidate>
+
+    /**
+     * 获取模型分词器的本地方法。
+     * @param modelPtr 模型指针。
+     * @return 分词器指针。
+     */
+    private external fun getTokenizer(modelPtr: Long): Long
+
+    /**
+     * 获取分阶段性能指标的本地方法。
+     * @param modelPtr 模型指针。
+     * @return JSON 格式的指标。
+     */
+    private external fun getMetrics(modelPtr: Long): String
+
     /**
      * 添加聊天消息的本地方法。
      * @param modelPtr 模型指针。
@@ -354,6 +1044,33 @@ class LlamaCppBridge {
      */
     private external fun getContextSizeUsed(modelPtr: Long): Int
 
+    /**
+     * 获取预填充进度的本地方法。
+     * @param modelPtr 模型指针。
+     * @return 预填充进度。
+     */
+    private external fun getPrefillProgress(modelPtr: Long): Float
+
+    /**
+     * 获取预填充速度的本地方法。
+     * @param modelPtr 模型指针。
+     * @return 预填充速度。
+     */
+    private external fun getPrefillSpeed(modelPtr: Long): Float
+
+    /**
+     * 取消本轮生成的本地方法。
+     * @param modelPtr 模型指针。
+     */
+    private external fun cancel(modelPtr: Long)
+
+    /**
+     * 获取最近一次生成结束原因的本地方法。
+     * @param modelPtr 模型指针。
+     * @return StopReason 的序号。
+     */
+    private external fun getStopReason(modelPtr: Long): Int
+
     /**
      * 关闭模型的本地方法。
      * @param modelPtr 模型指针。
@@ -382,4 +1099,58 @@ class LlamaCppBridge {
      * @param modelPtr 模型指针。
      */
     private external fun stopCompletion(modelPtr: Long)
+
+    /**
+     * 保存会话快照的本地方法。
+     * @param modelPtr 模型指针。
+     * @param path 快照文件路径。
+     */
+    private external fun saveSession(
+        modelPtr: Long,
+        path: String,
+    )
+
+    /**
+     * 恢复会话快照的本地方法。
+     * @param modelPtr 模型指针。
+     * @param path 快照文件路径。
+     * @return 是否恢复成功。
+     */
+    private external fun loadSession(
+        modelPtr: Long,
+        path: String,
+    ): Boolean
+
+    /**
+     * 以流式模式开始生成的本地方法。
+     * @param modelPtr 模型指针。
+     * @param prompt 提示内容。
+     * @param maxTokens 最多生成的令牌数，小于等于 0 表示不限制。
+     * @param timeoutMs 生成的时间上限（毫秒），小于等于 0 表示不限制。
+     */
+    private external fun startStream(
+        modelPtr: Long,
+        prompt: String,
+        maxTokens: Int,
+        timeoutMs: Long,
+    )
+
+    /**
+     * 批量读取流式生成片段的本地方法。
+     * @param modelPtr 模型指针。
+     * @param buffer 用于接收 UTF-8 字节的 direct ByteBuffer。
+     * @param maxTokens 最多读取的词块数量，小于等于 0 表示读取全部可用数据。
+     * @return 写入的字节数，生成结束时返回 -1。
+     */
+    private external fun drainStream(
+        modelPtr: Long,
+        buffer: ByteBuffer,
+        maxTokens: Int,
+    ): Int
+
+    /**
+     * 停止流式生成的本地方法。
+     * @param modelPtr 模型指针。
+     */
+    private external fun stopStream(modelPtr: Long)
 }
\ No newline at end of file
@@ -0,0 +1,349 @@
+package com.stephen.llamacppbridge
+
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.flow
+import kotlinx.coroutines.withContext
+import java.nio.ByteBuffer
+
+/**
+ * LlamaCppEngine 在一份模型权重和一个上下文上承载多个并发会话。
+ * 每个会话占用上下文中的一个序列，原生调度线程在每一步把所有会话的预填充分块和待解码令牌合并为一个批次执行，
+ * 因此同时运行多个对话（例如多个智能体）时内存占用不会成倍增加。
+ */
+class LlamaCppEngine {
+    companion object {
+        init {
+            LlamaCppBridge.ensureNativeLibraryLoaded()
+        }
+
+        /**
+         * 未指定 [EngineParams.contextSize] 时，所有会话共享的上下文大小上限（以令牌为单位）。
+         * KV 缓存的内存与上下文大小成正比，因此默认值不随 [EngineParams.maxSessions] 增长。
+         */
+        const val DEFAULT_CONTEXT_BUDGET = 8192L
+    }
+
+    private var nativePtr = 0L
+    private var modelChatTemplate = LlamaCppBridge.DefaultInferenceParams.chatTemplate
+
+    /**
+     * 数据类，用于保存引擎的参数。
+     *
+     * @param contextSize 上下文大小（以令牌为单位），由所有会话平分。
+     *                    如果为 null，将使用 GGUF 模型文件中的值与 [DEFAULT_CONTEXT_BUDGET] 中的较小者，
+     *                    例如默认 4 个会话时每个会话最多 2048 个令牌。（默认值：null）
+     * @param maxSessions 最多同时存在的会话数量，大于 [numBatch] 时取 [numBatch]。（默认值：4）
+     * @param numThreads 用于推理的线程数。（默认值：4）
+     * @param useMmap 是否使用内存映射文件 I/O 来加载模型。（默认值：true）
+     * @param useMlock 是否将模型锁定在内存中。（默认值：false）
+     * @param numBatch 每一步提交给模型的最大令牌数，所有会话的解码令牌和预填充分块共享该预算。（默认值：512）
+     * @param numUbatch 计算图一次处理的最大令牌数。（默认值：512）
+     */
+    data class EngineParams(
+        val contextSize: Long? = null,
+        val maxSessions: Int = 4,
+        val numThreads: Int = 4,
+        val useMmap: Boolean = true,
+        val useMlock: Boolean = false,
+        val numBatch: Int = 512,
+        val numUbatch: Int = 512,
+    )
+
+    /**
+     * 引擎中的一个会话，拥有独立的聊天历史和采样器。
+     * 会话不是线程安全的：同一会话的调用应串行进行，不同会话可以在不同线程中并发使用。
+     */
+    inner class Session internal constructor(
+        private val sessionId: Int,
+    ) {
+        private var closed = false
+
+        /**
+         * 向会话的聊天历史中添加系统提示。
+         *
+         * @param prompt 系统提示内容。
+         * @throws IllegalStateException 如果会话已关闭或正在生成响应。
+         */
+        fun addSystemPrompt(prompt: String) {
+            checkOpen()
+            addChatMessage(nativePtr, sessionId, prompt, "system")
+        }
+
+        /**
+         * 向会话的聊天历史中添加用户消息。
+         *
+         * @param message 用户的消息。
+         * @throws IllegalStateException 如果会话已关闭或正在生成响应。
+         */
+        fun addUserMessage(message: String) {
+            checkOpen()
+            addChatMessage(nativePtr, sessionId, message, "user")
+        }
+
+        /**
+         * 向会话的聊天历史中添加助手消息。
+         *
+         * @param message 助手消息内容。
+         * @throws IllegalStateException 如果会话已关闭或正在生成响应。
+         */
+        fun addAssistantMessage(message: String) {
+            checkOpen()
+            addChatMessage(nativePtr, sessionId, message, "assistant")
+        }
+
+        /**
+         * 以异步 Flow 的形式返回对给定查询的响应，生成与其他会话合批进行。
+         *
+         * @param query 向 LLM 提出的查询。
+         * @param maxTokensPerRead 每次最多读取的词块数量，小于等于 0 表示读取当前全部可用的数据。（默认值：0）
+         * @return 一个字符串 Flow，每个字符串包含一个或多个词块。Flow 完成或被取消时本轮生成停止，
+         *         已生成的响应会被记入会话的聊天历史。
+         * @throws IllegalStateException 如果会话已关闭或正在生成响应。
+         */
+        fun getResponseAsFlow(
+            query: String,
+            maxTokensPerRead: Int = 0,
+        ): Flow<String> =
+            flow {
+                checkOpen()
+                val buffer = ByteBuffer.allocateDirect(LlamaCppBridge.STREAM_READ_BUFFER_SIZE)
+                startCompletion(nativePtr, sessionId, query)
+                try {
+                    var numBytes = drain(nativePtr, sessionId, buffer, maxTokensPerRead)
+                    while (numBytes >= 0) {
+                        buffer.position(0)
+                        buffer.limit(numBytes)
+                        emit(Charsets.UTF_8.decode(buffer).toString())
+                        buffer.clear()
+                        numBytes = drain(nativePtr, sessionId, buffer, maxTokensPerRead)
+                    }
+                } finally {
+                    stopCompletion(nativePtr, sessionId)
+                }
+            }
+
+        /**
+         * 返回会话上一个响应的生成速度（令牌/秒）。
+         *
+         * @throws IllegalStateException 如果会话已关闭。
+         */
+        fun getResponseGenerationSpeed(): Float {
+            checkOpen()
+            return getResponseGenerationSpeed(nativePtr, sessionId)
+        }
+
+        /**
+         * 返回会话已使用的上下文令牌数量。
+         *
+         * @throws IllegalStateException 如果会话已关闭。
+         */
+        fun getContextLengthUsed(): Int {
+            checkOpen()
+            return getContextSizeUsed(nativePtr, sessionId)
+        }
+
+        /**
+         * 关闭会话，释放其占用的序列，正在进行的生成会先被停止。可以重复调用，引擎关闭后调用不做任何事。
+         */
+        fun close() {
+            if (!closed) {
+                closed = true
+                if (nativePtr != 0L) {
+                    destroySession(nativePtr, sessionId)
+                }
+            }
+        }
+
+        /**
+         * 会话句柄在关闭后可能被新会话复用，因此在转发给本地方法之前检查会话和引擎是否仍然可用。
+         * @throws IllegalStateException 如果会话或引擎已关闭。
+         */
+        private fun checkOpen() {
+            check(!closed) { "The session is closed" }
+            verifyHandle()
+        }
+    }
+
+    /**
+     * 从给定路径加载 GGUF 模型并启动引擎。
+     *
+     * @param modelPath GGUF 模型文件的路径。
+     * @param params 引擎参数。
+     * @throws IllegalStateException 如果模型加载失败。
+     */
+    suspend fun load(
+        modelPath: String,
+        params: EngineParams = EngineParams(),
+    ) = withContext(Dispatchers.IO) {
+        val modelContextSize =
+            GgufFileReader().use { ggufFileReader ->
+                ggufFileReader.load(modelPath)
+                modelChatTemplate =
+                    ggufFileReader.getChatTemplate() ?: LlamaCppBridge.DefaultInferenceParams.chatTemplate
+                ggufFileReader.getContextSize() ?: LlamaCppBridge.DefaultInferenceParams.contextSize
+            }
+        nativePtr =
+            loadEngine(
+                modelPath,
+                params.contextSize ?: minOf(modelContextSize, DEFAULT_CONTEXT_BUDGET),
+                params.numThreads,
+                params.useMmap,
+                params.useMlock,
+                params.maxSessions,
+                params.numBatch,
+                params.numUbatch,
+            )
+    }
+
+    /**
+     * 创建一个会话。
+     *
+     * @param samplerParams 会话的采样参数。
+     * @param chatTemplate 聊天模板，为 null 时使用 GGUF 模型文件中的模板，
+     *                     若模型文件中也没有，则使用 [LlamaCppBridge.DefaultInferenceParams.chatTemplate]。
+     * @return 新的会话。
+     * @throws IllegalStateException 如果引擎未加载或会话数量已达上限。
+     */
+    fun createSession(
+        samplerParams: SamplerParams = SamplerParams(),
+        chatTemplate: String? = null,
+    ): Session {
+        verifyHandle()
+        val sessionId =
+            createSession(
+                nativePtr,
+                samplerParams.temperature,
+                samplerParams.minP,
+                samplerParams.topK,
+                samplerParams.topP,
+                samplerParams.repeatPenalty,
+                samplerParams.frequencyPenalty,
+                samplerParams.presencePenalty,
+                samplerParams.penaltyLastN,
+                samplerParams.greedy,
+                samplerParams.seed,
+                chatTemplate ?: modelChatTemplate,
+            )
+        return Session(sessionId)
+    }
+
+    /**
+     * 关闭引擎，释放所有会话、上下文和模型。
+     */
+    fun close() {
+        if (nativePtr != 0L) {
+            close(nativePtr)
+            nativePtr = 0L
+        }
+    }
+
+    /**
+     * 验证引擎是否已加载。
+     * @throws IllegalStateException 如果引擎未加载。
+     */
+    private fun verifyHandle() {
+        check(nativePtr != 0L) { "Engine is not loaded. Use LlamaCppEngine.load to load the model" }
+    }
+
+    /**
+     * 加载模型并创建引擎的本地方法。
+     * @return 引擎指针。
+     */
+    private external fun loadEngine(
+        modelPath: String,
+        contextSize: Long,
+        nThreads: Int,
+        useMmap: Boolean,
+        useMlock: Boolean,
+        nSeqMax: Int,
+        nBatch: Int,
+        nUbatch: Int,
+    ): Long
+
+    /**
+     * 创建会话的本地方法。
+     * @return 会话句柄。
+     */
+    private external fun createSession(
+        enginePtr: Long,
+        temperature: Float,
+        minP: Float,
+        topK: Int,
+        topP: Float,
+        repeatPenalty: Float,
+        frequencyPenalty: Float,
+        presencePenalty: Float,
+        penaltyLastN: Int,
+        greedy: Boolean,
+        seed: Int,
+        chatTemplate: String,
+    ): Int
+
+    /**
+     * 关闭会话的本地方法。
+     */
+    private external fun destroySession(
+        enginePtr: Long,
+        sessionId: Int,
+    )
+
+    /**
+     * 向会话添加聊天消息的本地方法。
+     */
+    private external fun addChatMessage(
+        enginePtr: Long,
+        sessionId: Int,
+        message: String,
+        role: String,
+    )
+
+    /**
+     * 开始会话本轮生成的本地方法。
+     */
+    private external fun startCompletion(
+        enginePtr: Long,
+        sessionId: Int,
+        prompt: String,
+    )
+
+    /**
+     * 批量读取会话响应片段的本地方法。
+     * @return 写入 buffer 的字节数，生成结束时为 -1。
+     */
+    private external fun drain(
+        enginePtr: Long,
+        sessionId: Int,
+        buffer: ByteBuffer,
+        maxTokens: Int,
+    ): Int
+
+    /**
+     * 停止会话本轮生成的本地方法。
+     */
+    private external fun stopCompletion(
+        enginePtr: Long,
+        sessionId: Int,
+    )
+
+    /**
+     * 获取会话响应生成速度的本地方法。
+     */
+    private external fun getResponseGenerationSpeed(
+        enginePtr: Long,
+        sessionId: Int,
+    ): Float
+
+    /**
+     * 获取会话上下文使用大小的本地方法。
+     */
+    private external fun getContextSizeUsed(
+        enginePtr: Long,
+        sessionId: Int,
+    ): Int
+
+    /**
+     * 关闭引擎的本地方法。
+     */
+    private external fun close(enginePtr: Long)
+}
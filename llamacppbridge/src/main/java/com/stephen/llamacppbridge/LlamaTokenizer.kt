@@ -0,0 +1,195 @@
+package com.stephen.llamacppbridge
+
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+import java.io.Closeable
+import java.io.File
+import java.io.FileNotFoundException
+
+/**
+ * 独立于推理的分词器，用于在生成之前估算上下文预算：截断检索到的文档、统计聊天历史的长度等。
+ *
+ * 通过 [LlamaCppBridge.getTokenizer] 获取已加载模型的分词器，或通过 [load] 只加载 GGUF 文件中的词表
+ * （不读取权重，通常在几十毫秒内完成）。[countTokens] 的结果按文本哈希缓存，反复统计同一段聊天历史时
+ * 不会重新分词。所有方法都可以在任意线程中调用。
+ *
+ * 文本以 UTF-8 字节传给本地层，emoji 等补充平面字符的分词结果与生成时一致。
+ */
+class LlamaTokenizer internal constructor(
+    private var nativePtr: Long,
+    private val ownsNative: Boolean,
+) : Closeable {
+    companion object {
+        init {
+            LlamaCppBridge.ensureNativeLibraryLoaded()
+        }
+
+        /**
+         * 在 IO 线程中只加载模型文件中的词表，创建独立的分词器。使用完毕后需要调用 [close]。
+         *
+         * @param modelPath GGUF 模型文件的路径。
+         * @throws FileNotFoundException 如果在给定路径下找不到模型文件。
+         * @throws IllegalStateException 如果词表无法加载。
+         */
+        suspend fun load(modelPath: String): LlamaTokenizer =
+            withContext(Dispatchers.IO) {
+                if (!File(modelPath).exists()) {
+                    throw FileNotFoundException("Model file not found at $modelPath")
+                }
+                LlamaTokenizer(loadVocab(modelPath), ownsNative = true)
+            }
+
+        /**
+         * 只加载词表的本地方法。
+         * @param modelPath 模型文件路径。
+         * @return 分词器指针。
+         */
+        @JvmStatic
+        private external fun loadVocab(modelPath: String): Long
+    }
+
+    /**
+     * 词表大小。
+     */
+    val vocabSize: Int
+        get() {
+            checkOpen()
+            return getVocabSize(nativePtr)
+        }
+
+    /**
+     * 把文本转换为 token。
+     *
+     * @param addSpecial 是否按词表的设置添加 BOS / EOS。（默认值：true）
+     * @param parseSpecial 是否把文本中的特殊 token（如 `<|im_start|>`）解析为对应的 token。（默认值：true）
+     */
+    fun tokenize(
+        text: String,
+        addSpecial: Boolean = true,
+        parseSpecial: Boolean = true,
+    ): IntArray {
+        checkOpen()
+        return tokenize(nativePtr, text.toByteArray(), addSpecial, parseSpecial)
+    }
+
+    /**
+     * 批量把文本转换为 token，只跨越一次 JNI 边界。
+     *
+     * @return 与 [texts] 顺序一致的 token 数组。
+     */
+    fun tokenize(
+        texts: List<String>,
+        addSpecial: Boolean = true,
+        parseSpecial: Boolean = true,
+    ): List<IntArray> {
+        checkOpen()
+        return tokenizeBatch(nativePtr, toByteArrays(texts), addSpecial, parseSpecial).toList()
+    }
+
+    /**
+     * 把 token 转换回文本。
+     *
+     * @param removeSpecial 是否去掉词表自动添加的 BOS / EOS。（默认值：false）
+     * @param unparseSpecial 是否输出特殊 token 的文本，否则跳过特殊 token。（默认值：false）
+     */
+    fun detokenize(
+        tokens: IntArray,
+        removeSpecial: Boolean = false,
+        unparseSpecial: Boolean = false,
+    ): String {
+        checkOpen()
+        return String(detokenize(nativePtr, tokens, removeSpecial, unparseSpecial), Charsets.UTF_8)
+    }
+
+    /**
+     * 统计文本的 token 数量，结果会被缓存。
+     *
+     * 默认不添加 BOS / EOS，逐条统计消息后求和时不会重复计入；默认解析特殊 token，与渲染聊天模板后的提示词一致。
+     */
+    fun countTokens(
+        text: String,
+        addSpecial: Boolean = false,
+        parseSpecial: Boolean = true,
+    ): Int = countTokens(listOf(text), addSpecial, parseSpecial)[0]
+
+    /**
+     * 批量统计 token 数量，只跨越一次 JNI 边界，已缓存的文本只需计算哈希。
+     *
+     * @return 与 [texts] 顺序一致的 token 数量。
+     */
+    fun countTokens(
+        texts: List<String>,
+        addSpecial: Boolean = false,
+        parseSpecial: Boolean = true,
+    ): IntArray {
+        checkOpen()
+        return countTokens(nativePtr, toByteArrays(texts), addSpecial, parseSpecial)
+    }
+
+    /**
+     * 释放 [load] 创建的分词器。[LlamaCppBridge.getTokenizer] 返回的分词器由模型持有，只会被标记为不可用。
+     * 可以重复调用。
+     */
+    override fun close() {
+        if (nativePtr != 0L) {
+            if (ownsNative) {
+                close(nativePtr)
+            }
+            nativePtr = 0L
+        }
+    }
+
+    private fun checkOpen() = check(nativePtr != 0L) { "The tokenizer is closed" }
+
+    private fun toByteArrays(texts: List<String>): Array<ByteArray> = Array(texts.size) { texts[it].toByteArray() }
+
+    /**
+     * 分词的本地方法。
+     */
+    private external fun tokenize(
+        tokenizerPtr: Long,
+        text: ByteArray,
+        addSpecial: Boolean,
+        parseSpecial: Boolean,
+    ): IntArray
+
+    /**
+     * 批量分词的本地方法。
+     */
+    private external fun tokenizeBatch(
+        tokenizerPtr: Long,
+        texts: Array<ByteArray>,
+        addSpecial: Boolean,
+        parseSpecial: Boolean,
+    ): Array<IntArray>
+
+    /**
+     * 把 token 转换为 UTF-8 字节的本地方法。
+     */
+    private external fun detokenize(
+        tokenizerPtr: Long,
+        tokens: IntArray,
+        removeSpecial: Boolean,
+        unparseSpecial: Boolean,
+    ): ByteArray
+
+    /**
+     * 批量统计 token 数量的本地方法。
+     */
+    private external fun countTokens(
+        tokenizerPtr: Long,
+        texts: Array<ByteArray>,
+        addSpecial: Boolean,
+        parseSpecial: Boolean,
+    ): IntArray
+
+    /**
+     * 获取词表大小的本地方法。
+     */
+    private external fun getVocabSize(tokenizerPtr: Long): Int
+
+    /**
+     * 释放分词器的本地方法。
+     */
+    private external fun close(tokenizerPtr: Long)
+}
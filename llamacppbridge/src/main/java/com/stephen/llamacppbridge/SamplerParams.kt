@@ -0,0 +1,29 @@
+package com.stephen.llamacppbridge
+
+/**
+ * 采样器链的参数。截断步骤（top-k、min-p）排在需要对候选排序的 top-p 和温度之前，
+ * 因此在 15 万词表的模型上采样也不会明显增加每个令牌的延迟。取值为 0（或 1.0）的步骤不会加入采样器链。
+ *
+ * @param temperature 采样温度，值越高输出越随机。（默认值：1.0f）
+ * @param minP 令牌被考虑的最小概率（相对于概率最高的令牌）。（默认值：0.01f）
+ * @param topK 只保留概率最高的 k 个令牌，0 表示关闭。（默认值：40）
+ * @param topP 保留累计概率达到 p 的最小令牌集合，1.0 表示关闭。（默认值：1.0f）
+ * @param repeatPenalty 重复惩罚系数，1.0 表示关闭。（默认值：1.0f）
+ * @param frequencyPenalty 频率惩罚系数，0 表示关闭。（默认值：0.0f）
+ * @param presencePenalty 存在惩罚系数，0 表示关闭。（默认值：0.0f）
+ * @param penaltyLastN 惩罚考虑的最近令牌数量。（默认值：64）
+ * @param greedy 是否总是选择概率最高的令牌，开启后忽略温度和截断参数。（默认值：false）
+ * @param seed 随机数种子，-1 表示每次使用随机种子。（默认值：-1）
+ */
+data class SamplerParams(
+    val temperature: Float = 1.0f,
+    val minP: Float = 0.01f,
+    val topK: Int = 40,
+    val topP: Float = 1.0f,
+    val repeatPenalty: Float = 1.0f,
+    val frequencyPenalty: Float = 0.0f,
+    val presencePenalty: Float = 0.0f,
+    val penaltyLastN: Int = 64,
+    val greedy: Boolean = false,
+    val seed: Int = -1,
+)
@@ -0,0 +1,253 @@
+package com.stephen.llamacppbridge
+
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+import java.io.Closeable
+import java.io.IOException
+import java.nio.FloatBuffer
+
+/**
+ * 一条向量搜索结果。
+ *
+ * @property id 写入时指定的向量 ID。
+ * @property score 相似度，越大越相似（余弦度量时在 [-1, 1] 之间）。
+ */
+data class VectorSearchResult(
+    val id: Long,
+    val score: Float,
+)
+
+/**
+ * 只追加的磁盘向量库，用于对 [LlamaCppBridge.embed] 得到的嵌入做最近邻搜索。
+ *
+ * 向量以 f16 或 int8 量化后写入文件，整个文件以内存映射方式读取，因此打开大索引不需要加载时间；
+ * 点积在本地用 NEON / AVX2 计算，top-k 用大小为 k 的堆维护。默认对全部向量做暴力搜索，
+ * 调用 [buildIvf] 建立 IVF 索引后只扫描与查询最相似的 [setProbes] 个列表。
+ * 搜索可以在多个线程中并发进行。使用完毕后需要调用 [close]（或使用 `use {}`）。
+ *
+ * @param path 向量库文件的路径，IVF 索引保存在 `<path>.ivf`。文件不存在时会被创建。
+ * @param dim 向量维度，例如 [LlamaCppBridge.getEmbeddingSize] 的返回值。
+ * @param type 存储格式。
+ * @param metric 相似度度量。
+ * @throws IllegalArgumentException 如果参数与已有文件不一致。
+ * @throws IOException 如果文件无法读写或不是向量库。
+ */
+class VectorStore(
+    path: String,
+    val dim: Int,
+    type: Type = Type.F16,
+    metric: Metric = Metric.COSINE,
+) : Closeable {
+    companion object {
+        init {
+            System.loadLibrary("vectorstore")
+        }
+    }
+
+    /**
+     * 向量的存储格式，顺序与本地层的 VectorType 一致。
+     */
+    enum class Type {
+        /** 半精度，每维 2 字节，几乎不损失精度。 */
+        F16,
+
+        /** 每个向量一个缩放系数的 int8 量化，每维 1 字节，搜索更快，分数有少量量化误差。 */
+        I8,
+    }
+
+    /**
+     * 相似度度量，顺序与本地层的 VectorMetric 一致。
+     */
+    enum class Metric {
+        /** 内积。 */
+        DOT,
+
+        /** 余弦相似度，向量和查询会被归一化。 */
+        COSINE,
+    }
+
+    // 存储本地 VectorStore 的句柄
+    private var nativeHandle: Long = open(path, dim, type.ordinal, metric.ordinal)
+
+    /**
+     * 向量数量。
+     */
+    val size: Long
+        get() {
+            checkOpen()
+            return getSize(nativeHandle)
+        }
+
+    /**
+     * IVF 列表数量，未建立索引时为 0。
+     */
+    val ivfLists: Int
+        get() {
+            checkOpen()
+            return getIvfLists(nativeHandle)
+        }
+
+    /**
+     * 在 IO 线程中追加向量。
+     *
+     * @param ids 每个向量的 ID，不检查重复。
+     * @param vectors `ids.size * dim` 个 float，按行存放。
+     */
+    suspend fun add(
+        ids: LongArray,
+        vectors: FloatArray,
+    ) = withContext(Dispatchers.IO) {
+        checkOpen()
+        add(nativeHandle, ids, vectors)
+    }
+
+    /**
+     * 在 IO 线程中追加直接缓冲区中的向量，例如 [LlamaCppBridge.embed] 的返回值，不会复制向量数据。
+     *
+     * @param ids 每个向量的 ID，不检查重复。
+     * @param vectors 直接分配的缓冲区，从位置 0 开始存放 `ids.size * dim` 个 float。
+     */
+    suspend fun add(
+        ids: LongArray,
+        vectors: FloatBuffer,
+    ) = withContext(Dispatchers.IO) {
+        checkOpen()
+        addBuffer(nativeHandle, ids, vectors)
+    }
+
+    /**
+     * 搜索与 [query] 最相似的 [k] 个向量。
+     *
+     * @return 按相似度从大到小排序的结果，向量少于 [k] 个时返回全部向量。
+     */
+    fun search(
+        query: FloatArray,
+        k: Int = 10,
+    ): List<VectorSearchResult> {
+        checkOpen()
+        return search(nativeHandle, query, k).toList()
+    }
+
+    /**
+     * 在默认调度器中用 k-means 建立（或重建）IVF 索引并写入磁盘，建立索引后追加的向量会自动加入索引。
+     *
+     * @param nLists 列表数量，通常取 `sqrt(size)` 到 `4 * sqrt(size)`，不能超过向量数量。
+     * @param nIter k-means 迭代次数。
+     */
+    suspend fun buildIvf(
+        nLists: Int,
+        nIter: Int = 10,
+    ) = withContext(Dispatchers.Default) {
+        checkOpen()
+        buildIvf(nativeHandle, nLists, nIter)
+    }
+
+    /**
+     * 设置搜索时扫描的 IVF 列表数量（默认为 8），越大召回率越高、速度越慢。
+     */
+    fun setProbes(nProbe: Int) {
+        checkOpen()
+        setProbes(nativeHandle, nProbe)
+    }
+
+    /**
+     * 在 IO 线程中把追加的向量和 IVF 索引写到磁盘。
+     */
+    suspend fun sync() =
+        withContext(Dispatchers.IO) {
+            checkOpen()
+            sync(nativeHandle)
+        }
+
+    /**
+     * 把修改写到磁盘并释放本地资源。可以重复调用。
+     *
+     * @throws IOException 如果写入失败。
+     */
+    override fun close() {
+        if (nativeHandle != 0L) {
+            try {
+                sync(nativeHandle)
+            } finally {
+                close(nativeHandle)
+                nativeHandle = 0L
+            }
+        }
+    }
+
+    private fun checkOpen() = check(nativeHandle != 0L) { "The vector store is closed" }
+
+    /**
+     * 打开（或创建）向量库文件，返回本地句柄（指向在本地创建的 VectorStore 的指针）。
+     */
+    private external fun open(
+        path: String,
+        dim: Int,
+        type: Int,
+        metric: Int,
+    ): Long
+
+    /**
+     * 追加数组中的向量。
+     */
+    private external fun add(
+        nativeHandle: Long,
+        ids: LongArray,
+        vectors: FloatArray,
+    )
+
+    /**
+     * 追加直接缓冲区中的向量。
+     */
+    private external fun addBuffer(
+        nativeHandle: Long,
+        ids: LongArray,
+        vectors: FloatBuffer,
+    )
+
+    /**
+     * 搜索最相似的 k 个向量。
+     */
+    private external fun search(
+        nativeHandle: Long,
+        query: FloatArray,
+        k: Int,
+    ): Array<VectorSearchResult>
+
+    /**
+     * 建立 IVF 索引。
+     */
+    private external fun buildIvf(
+        nativeHandle: Long,
+        nLists: Int,
+        nIter: Int,
+    )
+
+    /**
+     * 设置扫描的 IVF 列表数量。
+     */
+    private external fun setProbes(
+        nativeHandle: Long,
+        nProbe: Int,
+    )
+
+    /**
+     * 获取向量数量。
+     */
+    private external fun getSize(nativeHandle: Long): Long
+
+    /**
+     * 获取 IVF 列表数量。
+     */
+    private external fun getIvfLists(nativeHandle: Long): Int
+
+    /**
+     * 把修改写到磁盘。
+     */
+    private external fun sync(nativeHandle: Long)
+
+    /**
+     * 释放本地句柄。
+     */
+    private external fun close(nativeHandle: Long)
+}